@@ -0,0 +1,160 @@
+/*************************************************************************************
+ * 
+ * 
+ * Copyright (c) 2021, Zhengjun Liu <zjliu@casm.ac.cn>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ ************************************************************************************/
+
+// std
+#include <exception>
+#include <stdexcept>
+#include <iomanip>
+#include <iostream>
+#include <string>
+// boost
+#include <boost/program_options.hpp>
+
+#include "hsl.h"
+
+namespace po = boost::program_options;
+
+namespace
+{
+
+void printCounts(char const* title, std::vector<uint64_t> const& counts)
+{
+    std::cout << "\n" << title << "\n";
+    for (size_t k = 0; k < counts.size(); ++k)
+    {
+        if (counts[k] > 0)
+            std::cout << std::setw(8) << k << std::setw(16) << counts[k] << "\n";
+    }
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    std::string input;
+    size_t bins = 256;
+    size_t threads = 0;
+
+    po::options_description options("hslinfo options");
+    options.add_options()
+        ("help,h", "produce help message")
+        ("input,i", po::value<std::string>(&input), "input HSP file")
+        ("header-only,H", "summarize from the header and zone map without reading points")
+        ("histogram", "print the histogram of every field")
+        ("bins,b", po::value<size_t>(&bins)->default_value(256), "maximum number of histogram bins")
+        ("threads,j", po::value<size_t>(&threads)->default_value(0), "threads reading points, 0 for one per hardware thread")
+    ;
+
+    po::positional_options_description positional;
+    positional.add("input", 1);
+
+    try
+    {
+        po::variables_map vm;
+        po::store(po::command_line_parser(argc, argv).options(options).positional(positional).run(), vm);
+        po::notify(vm);
+
+        if (vm.count("help") || input.empty())
+        {
+            std::cout << "Prints summary statistics of the fields of an HSP file.\n"
+                      << "usage: hslinfo [options] input.hsp\n\n"
+                      << options << std::endl;
+            return vm.count("help") ? 0 : 1;
+        }
+
+        hsl::Reader reader(input);
+        if (!reader.open())
+        {
+            std::cerr << "Error: cannot open " << input << std::endl;
+            return 1;
+        }
+
+        hsl::Statistics stats;
+        stats.setBinCount(bins);
+        stats.setConcurrency(threads);
+        if (vm.count("header-only"))
+            stats.computeFromHeader(reader);
+        else
+            stats.compute(reader);
+
+        hsl::Header const& header = reader.getHeader();
+        std::cout << "File:   " << input << "\n"
+                  << "Points: " << stats.getPointCount()
+                  << (stats.isHeaderOnly() ? " (from the header)" : "") << "\n"
+                  << "Bands:  " << header.getSchema().getBandCount() << "\n\n";
+
+        std::cout << std::left << std::setw(24) << "field" << std::right
+                  << std::setw(14) << "count" << std::setw(18) << "minimum" << std::setw(18) << "maximum"
+                  << std::setw(18) << "mean" << std::setw(18) << "std dev" << "\n";
+        std::vector<hsl::FieldStatistics> const& fields = stats.getFieldStatistics();
+        for (size_t i = 0; i < fields.size(); ++i)
+        {
+            hsl::FieldStatistics const& f = fields[i];
+            std::cout << std::left << std::setw(24) << f.getName() << std::right
+                      << std::setw(14) << f.getCount() << std::setprecision(10)
+                      << std::setw(18) << f.getMinimum() << std::setw(18) << f.getMaximum();
+            if (stats.isHeaderOnly())
+                std::cout << std::setw(18) << "-" << std::setw(18) << "-";
+            else
+                std::cout << std::setw(18) << f.getMean() << std::setw(18) << f.getStandardDeviation();
+            std::cout << "\n";
+        }
+
+        printCounts("Points by return number", stats.getReturnCounts());
+        if (!stats.getClassificationCounts().empty())
+            printCounts("Points by classification", stats.getClassificationCounts());
+
+        if (vm.count("histogram") && !stats.isHeaderOnly())
+        {
+            for (size_t i = 0; i < fields.size(); ++i)
+            {
+                std::cout << "\nHistogram of " << fields[i].getName() << "\n";
+                std::vector<hsl::HistogramBin> const bins = fields[i].getBins();
+                for (size_t b = 0; b < bins.size(); ++b)
+                {
+                    std::cout << std::setprecision(10) << std::setw(18) << bins[b].lower
+                              << std::setw(18) << bins[b].upper << std::setw(16) << bins[b].count << "\n";
+                }
+            }
+        }
+        std::cout << std::flush;
+    }
+    catch (std::exception const& e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    catch (...)
+    {
+        std::cerr << "Unknown error\n";
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,137 @@
+/*************************************************************************************
+ * 
+ * 
+ * Copyright (c) 2021, Zhengjun Liu <zjliu@casm.ac.cn>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ ************************************************************************************/
+
+// std
+#include <exception>
+#include <stdexcept>
+#include <iostream>
+#include <string>
+// boost
+#include <boost/program_options.hpp>
+
+#include "hsl.h"
+
+namespace po = boost::program_options;
+
+int main(int argc, char* argv[])
+{
+    std::string input;
+    std::string output;
+    std::string curve;
+    std::string temp;
+    std::string octree;
+    size_t memory = 256;
+    uint32_t chunkSize = 65536;
+
+    po::options_description options("hslsort options");
+    options.add_options()
+        ("help,h", "produce help message")
+        ("input,i", po::value<std::string>(&input), "input HSP file")
+        ("output,o", po::value<std::string>(&output), "output HSP file")
+        ("curve,c", po::value<std::string>(&curve)->default_value("hilbert"), "space filling curve: hilbert or morton, not with --octree")
+        ("memory,m", po::value<size_t>(&memory)->default_value(256), "memory budget in MB")
+        ("chunk-size", po::value<uint32_t>(&chunkSize)->default_value(65536), "points per chunk table entry, 0 for none")
+        ("octree", po::value<std::string>(&octree), "write level of detail order instead and its octree to this .hso file")
+        ("temp,t", po::value<std::string>(&temp), "prefix of temporary files, defaults to the output file name")
+    ;
+
+    po::positional_options_description positional;
+    positional.add("input", 1);
+    positional.add("output", 1);
+
+    try
+    {
+        po::variables_map vm;
+        po::store(po::command_line_parser(argc, argv).options(options).positional(positional).run(), vm);
+        po::notify(vm);
+
+        if (vm.count("help") || input.empty() || output.empty())
+        {
+            std::cout << "Reorders the points of an HSP file along a space filling curve.\n"
+                      << "usage: hslsort [options] input.hsp output.hsp\n\n"
+                      << options << std::endl;
+            return vm.count("help") ? 0 : 1;
+        }
+
+        if (!octree.empty())
+        {
+            // level of detail order has its own curve
+            if (!vm["curve"].defaulted())
+                throw std::invalid_argument("--curve cannot be combined with --octree");
+
+            hsl::OctreeBuilder builder;
+            builder.setMaxMemoryUsage(memory * 1024 * 1024);
+            builder.setChunkSize(chunkSize);
+            if (!temp.empty())
+                builder.setTempFileName(temp);
+            if (!builder.build(input, output, octree))
+            {
+                std::cerr << "Error: cannot build the octree of " << input << std::endl;
+                return 1;
+            }
+
+            std::cout << "Wrote " << output << " in level of detail order, octree " << octree << std::endl;
+            return 0;
+        }
+
+        hsl::SpatialSorter sorter;
+        if (curve == "hilbert")
+            sorter.setCurve(hsl::SC_Hilbert);
+        else if (curve == "morton")
+            sorter.setCurve(hsl::SC_Morton);
+        else
+            throw std::invalid_argument("unknown curve " + curve);
+
+        sorter.setMaxMemoryUsage(memory * 1024 * 1024);
+        sorter.setChunkSize(chunkSize);
+        if (!temp.empty())
+            sorter.setTempFileName(temp);
+
+        if (!sorter.sort(input, output))
+        {
+            std::cerr << "Error: cannot sort " << input << " into " << output << std::endl;
+            return 1;
+        }
+
+        std::cout << "Sorted " << input << " into " << output << " using "
+                  << sorter.getRunCount() << " run(s)" << std::endl;
+    }
+    catch (std::exception const& e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    catch (...)
+    {
+        std::cerr << "Unknown error\n";
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,209 @@
+/*************************************************************************************
+ * 
+ * 
+ * Copyright (c) 2021, Zhengjun Liu <zjliu@casm.ac.cn>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ ************************************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <cstddef>
+#include <utility>
+#include <vector>
+#include "hslLIB.h"
+#include "FieldAccessor.h"
+#include "Header.h"
+#include "Pipeline.h"
+
+namespace hsl
+{
+
+class PointBlock;
+class Reader;
+class Writer;
+
+/// Running mean and covariance of the band values of points. Next to the
+/// covariance of the bands it keeps that of the differences between
+/// consecutive points of a block, neighbours along the scan, from which
+/// the noise covariance of MNF is estimated. Covariances of disjoint sets
+/// of points merge, so that threads can each summarize part of a file.
+class LIBHSL_API BandCovariance
+{
+public:
+    BandCovariance();
+
+    /// Threads reading points, one per hardware thread by default (0).
+    void setConcurrency(size_t threads) { m_concurrency = threads; }
+    /// Points per block handed to a thread, 4096 by default.
+    void setBlockSize(uint32_t size) { m_blockSize = size ? size : 1; }
+
+    /// Accumulates the band values of the points left in reader, after its
+    /// filters, in one pass and returns their number. Replaces any
+    /// covariance held.
+    uint64_t compute(Reader& reader);
+
+    /// Starts an empty covariance of the bands of header.
+    void reset(Header const& header);
+
+    /// Adds the points of block, whose schema must be that of reset().
+    void add(PointBlock const& block);
+
+    /// Adds the points summarized by other, a covariance of as many bands.
+    void merge(BandCovariance const& other);
+
+    size_t getBandCount() const { return m_bands.size(); }
+    uint64_t getCount() const { return m_signal.count; }
+    /// Number of pairs of consecutive points the noise is estimated from.
+    uint64_t getNoiseCount() const { return m_noise.count; }
+
+    /// Mean of each band.
+    std::vector<double> const& getMean() const { return m_signal.mean; }
+    /// Population covariance of the bands, row-major bands x bands.
+    std::vector<double> getCovariance() const { return m_signal.covariance(); }
+    /// Covariance of the noise, half that of the differences between
+    /// consecutive points, row-major bands x bands.
+    std::vector<double> getNoiseCovariance() const;
+
+private:
+    /// Count, mean and sum of the outer products of the deviations from
+    /// the mean (upper triangle) of a series of vectors.
+    struct Moments
+    {
+        uint64_t count;
+        std::vector<double> mean;
+        std::vector<double> comoment;
+
+        void reset(size_t size);
+        /// Adds n vectors held as columns: component b of vector p at
+        /// columns[b * stride + p].
+        void add(const double* columns, size_t stride, size_t n, std::vector<double>& centred);
+        void merge(Moments const& other);
+        std::vector<double> covariance() const;
+    };
+
+    size_t                      m_concurrency;
+    uint32_t                    m_blockSize;
+    Header const*               m_header;
+    std::vector<FieldAccessor>  m_bands;
+    Moments                     m_signal;
+    Moments                     m_noise;
+
+    // buffers of add()
+    std::vector<double>         m_columns;
+    std::vector<double>         m_centred;
+    std::vector<size_t>         m_pairs;
+};
+
+enum BandProjectionMethod
+{
+    BP_PCA,     ///< principal components, by decreasing variance
+    BP_MNF      ///< minimum noise fraction, by decreasing signal to noise
+};
+
+/// A linear projection of the band values of points onto a few components,
+/// computed from a BandCovariance by principal component analysis (PCA) or
+/// the minimum noise fraction transform (MNF). Component k of a point with
+/// band values x is getComponent(k) . (x - getMean()).
+///
+///     hsl::BandCovariance covariance;
+///     covariance.compute(reader);
+///     hsl::BandProjection projection(covariance, hsl::BP_MNF, 15);
+///     hsl::Header header = projection.createHeader(reader.getHeader());
+///     hsl::Writer writer("reduced.hsp", header);
+///     writer.open();
+///     reader.reset();
+///     hsl::reduceBands(reader, writer, projection);
+class LIBHSL_API BandProjection
+{
+public:
+    /// Throws libhsl_error if covariance has no points, or for MNF no pairs
+    /// of consecutive points, and std::invalid_argument if components is 0
+    /// or more than the bands.
+    BandProjection(BandCovariance const& covariance, BandProjectionMethod method, size_t components);
+
+    BandProjectionMethod getMethod() const { return m_method; }
+    size_t getBandCount() const { return m_mean.size(); }
+    size_t getComponentCount() const { return m_components.size() / m_mean.size(); }
+    std::vector<double> const& getMean() const { return m_mean; }
+
+    /// Eigenvalues of all components in decreasing order: the variance of
+    /// each principal component, or the signal to noise ratio plus one of
+    /// each noise fraction.
+    std::vector<double> const& getEigenvalues() const { return m_eigenvalues; }
+
+    /// Weights of the bands in component k.
+    const double* getComponent(size_t k) const { return &m_components[k * m_mean.size()]; }
+
+    /// Projects the band values of one point.
+    void project(const double* bands, double* components) const;
+
+    /// header with its bands replaced by one DT_FLOAT band per component,
+    /// and without waveform data.
+    Header createHeader(Header const& header) const;
+
+private:
+    BandProjectionMethod    m_method;
+    std::vector<double>     m_mean;
+    std::vector<double>     m_eigenvalues;
+    std::vector<double>     m_components;  // row-major components x bands
+};
+
+/// Replaces the records of source in each block by records of target whose
+/// bands hold the components of the source bands. The fields other than
+/// bands that target shares with source are copied.
+class LIBHSL_API BandProjectionStage: public SchemaStage
+{
+public:
+    /// Throws std::invalid_argument if source does not have the bands of
+    /// projection or target has fewer bands than components.
+    BandProjectionStage(BandProjection const& projection, Header const& source, Header const& target);
+
+    void prepare(size_t workers);
+
+protected:
+    void rewrite(PointBlock const& in, PointBlock& out, size_t worker);
+
+private:
+    struct Scratch
+    {
+        std::vector<double> bands;
+        std::vector<double> values;
+    };
+
+    BandProjection m_projection;
+    std::vector<FieldAccessor> m_bands;             // source bands
+    std::vector<FieldAccessor> m_components;        // target bands
+    std::vector<Scratch> m_scratch;
+};
+
+/// Writes the points left in reader to writer with their bands projected,
+/// on concurrency threads (one per hardware thread if 0), in file order.
+/// The writer's header is usually projection.createHeader() of the
+/// reader's. Returns the number of points written.
+LIBHSL_API uint64_t reduceBands(Reader& reader, Writer& writer, BandProjection const& projection,
+                                size_t concurrency = 0);
+
+}
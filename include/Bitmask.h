@@ -0,0 +1,125 @@
+/*************************************************************************************
+ * 
+ * 
+ * Copyright (c) 2021, Zhengjun Liu <zjliu@casm.ac.cn>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ ************************************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <cstddef>
+#include <vector>
+
+namespace hsl
+{
+
+/// Selection of the records of a PointBlock, one bit per record packed into
+/// 64-bit words. Bits past size() in the last word are kept clear.
+class Bitmask
+{
+public:
+    Bitmask() : _size(0) {}
+    explicit Bitmask(size_t size, bool value = true) : _size(0) { assign(size, value); }
+
+    inline size_t size() const { return _size; }
+    inline bool empty() const { return _size == 0; }
+
+    /// Resizes to size bits, all set to value.
+    void assign(size_t size, bool value = true)
+    {
+        _size = size;
+        _words.assign((size + 63) / 64, value ? ~0ULL : 0ULL);
+        trim();
+    }
+
+    inline bool test(size_t i) const { return (_words[i >> 6] >> (i & 63)) & 1; }
+    inline void set(size_t i) { _words[i >> 6] |= 1ULL << (i & 63); }
+    inline void reset(size_t i) { _words[i >> 6] &= ~(1ULL << (i & 63)); }
+
+    /// Number of set bits.
+    size_t count() const
+    {
+        size_t n = 0;
+        for (size_t w = 0; w < _words.size(); ++w)
+        {
+            uint64_t v = _words[w];
+            while (v)
+            {
+                v &= v - 1;
+                ++n;
+            }
+        }
+        return n;
+    }
+
+    bool any() const
+    {
+        for (size_t w = 0; w < _words.size(); ++w)
+            if (_words[w])
+                return true;
+        return false;
+    }
+
+    bool none() const { return !any(); }
+
+    /// Clears the bits that are clear in other, which must have the same size.
+    Bitmask& operator&=(Bitmask const& other)
+    {
+        for (size_t w = 0; w < _words.size() && w < other._words.size(); ++w)
+            _words[w] &= other._words[w];
+        return *this;
+    }
+
+    Bitmask& operator|=(Bitmask const& other)
+    {
+        for (size_t w = 0; w < _words.size() && w < other._words.size(); ++w)
+            _words[w] |= other._words[w];
+        return *this;
+    }
+
+    void flip()
+    {
+        for (size_t w = 0; w < _words.size(); ++w)
+            _words[w] = ~_words[w];
+        trim();
+    }
+
+    inline size_t wordCount() const { return _words.size(); }
+    inline uint64_t* words() { return _words.empty() ? 0 : &_words[0]; }
+    inline const uint64_t* words() const { return _words.empty() ? 0 : &_words[0]; }
+
+private:
+    void trim()
+    {
+        if (_size & 63)
+            _words.back() &= (1ULL << (_size & 63)) - 1;
+    }
+
+    size_t                  _size;
+    std::vector<uint64_t>   _words;
+};
+
+}
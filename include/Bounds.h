@@ -398,7 +398,7 @@ bool contains(Point const& point) const
         return false;
         
     // If our z bounds has no length, we'll say it's contained anyway.
-    if (!ranges[2].contains(point.getZ())) 
+    if (ranges.size() > 2 && !ranges[2].contains(point.getZ())) 
     {
         if (detail::compare_distance(ranges[2].length(), 0.0))
             return true;
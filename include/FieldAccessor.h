@@ -0,0 +1,157 @@
+/*************************************************************************************
+ * 
+ * 
+ * Copyright (c) 2021, Zhengjun Liu <zjliu@casm.ac.cn>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ ************************************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <cstring>
+#include <utility>
+#include <vector>
+#include "hslLIB.h"
+#include "hslDefinitions.h"
+#include "IdDefinitions.h"
+
+namespace hsl
+{
+
+class Schema;
+class PointBlock;
+
+/// Decodes one field of a schema straight from raw record bytes, without a
+/// Point or a Variant. Numeric fields of any DataType are supported, and bit
+/// fields of up to 8 bits that lie within one byte.
+class LIBHSL_API FieldAccessor
+{
+public:
+    FieldAccessor();
+
+    /// Binds to the n-th field with id of schema (n counts bands).
+    /// Returns false if there is no such field or it cannot be decoded raw.
+    bool bind(Schema const& schema, FieldId id, size_t n = 0);
+
+    bool isBound() const { return _type != DT_UNKNOWN; }
+    FieldId getId() const { return _id; }
+    DataType getDataType() const { return _type; }
+    size_t getByteOffset() const { return _byteOffset; }
+    bool isSigned() const { return _signed; }
+
+    /// Stored value of the field, before scale and offset.
+    double getRaw(const uint8_t* record) const;
+
+    /// Value of the field with scale and offset applied.
+    inline double getValue(const uint8_t* record) const
+    {
+        return getRaw(record) * _scale + _offset;
+    }
+
+    /// Stores raw as the value of the field, before scale and offset.
+    /// Integer fields round to nearest and saturate at the limits of the
+    /// type.
+    void setRaw(uint8_t* record, double raw) const;
+
+    /// Stores value, removing scale and offset, see setRaw.
+    inline void setValue(uint8_t* record, double value) const
+    {
+        setRaw(record, (value - _offset) / _scale);
+    }
+
+    /// Stores the n values of in, removing scale and offset, in n records
+    /// that are stride bytes apart, starting at records. See setRaw.
+    void scatter(uint8_t* records, size_t stride, size_t n, const double* in) const;
+
+    double getScale() const { return _scale; }
+    double getOffset() const { return _offset; }
+
+    /// Translates the scaled value range [low, high] to the stored integer
+    /// domain: on return a record matches iff its raw value lies in
+    /// [rawLow, rawHigh], with exactly the rounding of getValue. rawLow >
+    /// rawHigh if no stored value matches. Returns false for floating point
+    /// fields, which have no integer domain.
+    bool getRawRange(double low, double high, int64_t& rawLow, int64_t& rawHigh) const;
+
+    /// Whether every stored value fits an int32_t, so that
+    /// gatherRaw(block, std::vector<int32_t>&) is exact.
+    bool isInt32Raw() const;
+
+    /// Stores the scaled values of the field for all records of block in column.
+    void gather(PointBlock const& block, std::vector<double>& column) const;
+
+    /// Stores the scaled values of the field for n records that are stride
+    /// bytes apart, starting at records, in out.
+    void gather(const uint8_t* records, size_t stride, size_t n, double* out) const;
+
+    /// Stores the raw values of the field for n records that are stride
+    /// bytes apart, starting at records, in out.
+    void gatherRaw(const uint8_t* records, size_t stride, size_t n, double* out) const;
+
+    /// Stores the raw values of an integer field of at most 32 bits for all
+    /// records of block in column.
+    void gatherRaw(PointBlock const& block, std::vector<int32_t>& column) const;
+
+    /// Stores the raw values of an integer field of at most 8 bits for all
+    /// records of block in column.
+    void gatherRaw(PointBlock const& block, std::vector<uint8_t>& column) const;
+
+private:
+    FieldId     _id;
+    DataType    _type;
+    size_t      _byteOffset;
+    size_t      _bitSize;
+    unsigned    _shift;         // bit fields: position of the lowest bit
+    uint32_t    _mask;
+    bool        _signed;
+    double      _scale;
+    double      _offset;
+};
+
+/// Copies the fields that a target schema shares with a source schema, in
+/// scaled values. Fields are matched by id and by their order among the
+/// fields with that id, so the n-th band goes to the n-th band.
+class LIBHSL_API FieldCopier
+{
+public:
+    /// Binds every field of target that source also has, except those with
+    /// one of the ids in excluded.
+    void bind(Schema const& source, Schema const& target, std::vector<FieldId> const& excluded);
+
+    size_t size() const { return _fields.size(); }
+
+    /// Copies the shared fields of one source record to a target record.
+    void copy(const uint8_t* source, uint8_t* target) const;
+
+    /// Copies the shared fields of n records, sourceStride and targetStride
+    /// bytes apart, column by column through values.
+    void copy(const uint8_t* source, size_t sourceStride, uint8_t* target, size_t targetStride, size_t n,
+              std::vector<double>& values) const;
+
+private:
+    std::vector<std::pair<FieldAccessor, FieldAccessor> > _fields;     // source, target
+};
+
+}
@@ -34,6 +34,8 @@
 
 #pragma once
 
+#include <cmath>
+#include <limits>
 #include <memory>
 #include <vector>
 #include <functional>
@@ -47,6 +49,10 @@
 #include "Bounds.h"
 #include "Classification.h"
 #include "Color.h"
+#include "PointBlock.h"
+#include "Bitmask.h"
+#include "FieldAccessor.h"
+#include "ZoneMap.h"
 
 
 namespace hsl {
@@ -68,6 +74,23 @@ public:
     /// of filter to the point.  If the function returns true, the point 
     /// passes the filter and is kept.
     virtual bool filter(const Point& point) = 0;
+
+    /// Batch form of filter(const Point&) applied to every record of block.
+    /// Clears the bit of each record in mask that does not pass; mask has one
+    /// bit per record and bits that are already clear stay clear, so a chain
+    /// of filters can share one mask. The default implementation decodes the
+    /// records still selected and calls filter(const Point&) on each of them
+    /// in block order.
+    virtual void filter(const PointBlock& block, Bitmask& mask);
+
+    /// Whether the result for a point depends on that point alone. Filters
+    /// that count or remember the points they see return false, and are
+    /// never moved by a FilterChain that reorders its filters.
+    virtual bool isStateless() const { return true; }
+
+    /// Whether the statistics of zones show that no point of chunk can pass
+    /// the filter, so the chunk need not be read. The default cannot tell.
+    virtual bool canSkip(ZoneMap const& zones, size_t chunk) { return false; }
     
     /// Sets whether the filter is one that keeps data that matches 
     /// construction criteria or rejects them.
@@ -91,6 +114,31 @@ private:
 
 typedef std::shared_ptr<FilterInterface> FilterPtr;
 
+/// Comparison used by ContinuousValueFilter. CO_Custom means a user supplied
+/// compare_func that only the per point path can evaluate.
+enum ComparisonOperator
+{
+    CO_Custom,
+    CO_Less,
+    CO_LessEqual,
+    CO_Greater,
+    CO_GreaterEqual,
+    CO_Equal
+};
+
+namespace detail {
+
+// Selection kernels over column values. Each clears the bits in words of the
+// n values that do not match, or of those that match when invert is set.
+// SSE2 is used when the target supports it.
+LIBHSL_API void selectRange(const double* v, size_t n, double lo, double hi, bool invert, uint64_t* words);
+LIBHSL_API void selectRange(const int32_t* v, size_t n, int32_t lo, int32_t hi, bool invert, uint64_t* words);
+LIBHSL_API void selectMembers(const uint8_t* v, size_t n, std::vector<uint8_t> const& members, bool invert, uint64_t* words);
+LIBHSL_API void selectEqual(const uint8_t* a, const uint8_t* b, size_t n, bool invert, uint64_t* words);
+LIBHSL_API void selectCompare(const double* v, size_t n, ComparisonOperator op, double value, bool invert, uint64_t* words);
+
+}
+
 /// A filter for keeping or rejecting points that fall within a 
 /// specified bounds.
 class LIBHSL_API BoundsFilter: public FilterInterface
@@ -101,11 +149,24 @@ public:
     BoundsFilter(double minx, double miny, double minz, double maxx, double maxy, double maxz);
     BoundsFilter(Bounds<double> const& b);
     bool filter(const Point& point);
+    void filter(const PointBlock& block, Bitmask& mask);
+    bool canSkip(ZoneMap const& zones, size_t chunk);
 
 private:
     
     Bounds<double> bounds;
 
+    // the bounds translated to the stored coordinates of m_header
+    Header const* m_header;
+    bool m_raw;
+    size_t m_dimensions;
+    int32_t m_rawMin[3];
+    int32_t m_rawMax[3];
+    bool m_empty;
+    std::vector<int32_t> m_column;
+
+    void prepare(Header const* header);
+
     BoundsFilter(BoundsFilter const& other);
     BoundsFilter& operator=(BoundsFilter const& rhs);
 };
@@ -119,10 +180,14 @@ public:
 
     ClassificationFilter(class_list_type classes);
     bool filter(const Point& point);
+    void filter(const PointBlock& block, Bitmask& mask);
+    bool canSkip(ZoneMap const& zones, size_t chunk);
     
 private:
 
     class_list_type m_classes;
+    std::vector<uint8_t> m_codes;
+    std::vector<uint8_t> m_column;
 
     ClassificationFilter(ClassificationFilter const& other);
     ClassificationFilter& operator=(ClassificationFilter const& rhs);
@@ -136,6 +201,8 @@ public:
     /// Default constructor.  Keep every thin'th point.
     ThinFilter(uint32_t thin);
     bool filter(const hsl::Point& point);
+    using FilterInterface::filter;
+    bool isStateless() const { return false; }
 
 
 private:
@@ -157,11 +224,15 @@ public:
 
     ReturnFilter(return_list_type returns, bool last_only);
     bool filter(const Point& point);
+    void filter(const PointBlock& block, Bitmask& mask);
     
 private:
 
     return_list_type m_returns;
     bool last_only;
+    std::vector<uint8_t> m_codes;
+    std::vector<uint8_t> m_column;
+    std::vector<uint8_t> m_column2;
 
     ReturnFilter(ReturnFilter const& other);
     ReturnFilter& operator=(ReturnFilter const& rhs);
@@ -174,6 +245,7 @@ public:
 
     ValidationFilter();
     bool filter(const Point& point);
+    using FilterInterface::filter;
     
 private:
 
@@ -219,9 +291,37 @@ public:
     /// hsl::ContinuousValueFilter<uint16_t>* intensity_filter = new hsl::ContinuousValueFilter<uint16_t>(f, 100, c);
     /// intensity_filter->SetType(hsl::FilterInterface::eInclusion);
     ContinuousValueFilter(filter_func f, T value, compare_func c)
-        : hsl::FilterInterface(eInclusion), f(f), c(c),value(value)
+        : hsl::FilterInterface(eInclusion), f(f), c(c),value(value), m_op(CO_Custom),
+        m_fieldId(FI_UNKNOWN), m_fieldIndex(0), m_fieldHeader(0), m_rawDomain(false), m_rawLow(0), m_rawHigh(-1)
     {}
 
+    /// Construct the filter over a schema field instead of a Point function,
+    /// which lets the batch filter work on the raw record bytes. The value
+    /// is translated once into the stored integer domain of the field, so
+    /// points are compared without decoding them; floating point fields are
+    /// compared as scaled doubles.
+    /// \param id - The field to compare, scale and offset of the field are applied.
+    /// \param value - The value to use for one-way comparison
+    /// \param op - The comparison
+    /// \param n - Which field with this id to use, for band values the band index
+
+    /// hsl::ContinuousValueFilter<double> band_filter(hsl::FI_BandValue, 0.25, hsl::CO_Greater, 45);
+    ContinuousValueFilter(FieldId id, T value, ComparisonOperator op, size_t n = 0)
+        : hsl::FilterInterface(eInclusion), value(value), m_op(op),
+        m_fieldId(id), m_fieldIndex(n), m_fieldHeader(0), m_rawDomain(false), m_rawLow(0), m_rawHigh(-1)
+    {
+        c = makeCompare(op);
+    }
+
+    /// Construct the filter over a schema field with a simple expression,
+    /// see the filter_func form for the supported expressions.
+    ContinuousValueFilter(FieldId id, std::string const& filter_string, size_t n = 0)
+        : hsl::FilterInterface(eInclusion), m_fieldId(id), m_fieldIndex(n), m_fieldHeader(0),
+        m_rawDomain(false), m_rawLow(0), m_rawHigh(-1)
+    {
+        parse(filter_string);
+    }
+
         
     /// Construct the filter with a filter_func and a simple 
     /// expression.  
@@ -251,9 +351,203 @@ public:
     /// intensity_filter->SetType(hsl::FilterInterface::eInclusion);
     
     ContinuousValueFilter(filter_func f, std::string const& filter_string)
-        : hsl::FilterInterface(eInclusion), f(f)
+        : hsl::FilterInterface(eInclusion), f(f), m_fieldId(FI_UNKNOWN), m_fieldIndex(0), m_fieldHeader(0),
+        m_rawDomain(false), m_rawLow(0), m_rawHigh(-1)
+    {
+        parse(filter_string);
+    }
+            
+    bool filter(const hsl::Point& p)
+    {
+        bool output = false;
+
+        bool passed;
+        if (m_fieldId != FI_UNKNOWN && m_op != CO_Custom)
+        {
+            if (!bindField(p.getHeader()))
+                return false;
+            passed = compareField(&p.getData()[0]);
+        }
+        else
+        {
+            T v;
+            if (m_fieldId != FI_UNKNOWN)
+            {
+                if (!bindField(p.getHeader()))
+                    return false;
+                v = static_cast<T>(m_field.getValue(&p.getData()[0]));
+            }
+            else
+            {
+                v = f(&p);
+            }
+            // std::cout << std::endl<< "Checking c(v, value) v: " << v << " value: " << value;
+            passed = c(v, value);
+        }
+        if (passed){
+            // std::cout<< " ... succeeded "<<std::endl;
+            if (GetType() == eInclusion) {
+                output = true;
+            } else {
+                // std::cout << "Filter type is eExclusion and test passed" << std::endl;
+                output = false;
+            }    
+        } else {
+            // std::cout<<" ... failed" <<std::endl;
+            if (GetType() == eInclusion) {
+                output = false;
+            } else {
+                // std::cout << "Filter type is eExclusion and test failed" << std::endl;
+                output = true;
+            }    
+        }
+        // std::cout << " returning " << output << std::endl;
+        return output;
+    }
+
+    /// Filters on the raw record bytes when the filter was built over a field
+    /// with one of the standard comparisons, otherwise point by point.
+    void filter(const PointBlock& block, Bitmask& mask)
+    {
+        if (m_fieldId == FI_UNKNOWN || m_op == CO_Custom)
+        {
+            FilterInterface::filter(block, mask);
+            return;
+        }
+
+        if (!bindField(block.getHeader()))
+        {
+            mask.assign(mask.size(), false);
+            return;
+        }
+
+        bool exclude = GetType() == eExclusion;
+        if (m_rawDomain)
+        {
+            if (m_rawLow > m_rawHigh)
+            {
+                // no stored value passes
+                if (!exclude)
+                    mask.assign(mask.size(), false);
+                return;
+            }
+            if (m_field.isInt32Raw())
+            {
+                m_field.gatherRaw(block, m_rawColumn);
+                detail::selectRange(&m_rawColumn[0], m_rawColumn.size(), static_cast<int32_t>(m_rawLow),
+                    static_cast<int32_t>(m_rawHigh), exclude, mask.words());
+                return;
+            }
+        }
+
+        m_field.gather(block, m_column);
+        detail::selectCompare(&m_column[0], m_column.size(), m_op, static_cast<double>(value),
+            exclude, mask.words());
+    }
+
+    /// Skips chunks whose value range of the field cannot pass.
+    bool canSkip(ZoneMap const& zones, size_t chunk)
+    {
+        double low, high;
+        if (m_fieldId == FI_UNKNOWN || m_op == CO_Custom ||
+            !zones.getRange(chunk, m_fieldId, m_fieldIndex, low, high))
+            return false;
+
+        // whether any and whether all values of [low, high] compare true
+        double v = static_cast<double>(value);
+        bool any, all;
+        switch (m_op)
+        {
+        case CO_Less: any = low < v; all = high < v; break;
+        case CO_LessEqual: any = low <= v; all = high <= v; break;
+        case CO_Greater: any = high > v; all = low > v; break;
+        case CO_GreaterEqual: any = high >= v; all = low >= v; break;
+        default: any = low <= v && v <= high; all = detail::exactly_equal(low, v) && detail::exactly_equal(high, v); break;
+        }
+        return GetType() == eInclusion ? !any : all;
+    }
+    
+private:
+
+    ContinuousValueFilter(ContinuousValueFilter const& other);
+    ContinuousValueFilter& operator=(ContinuousValueFilter const& rhs);
+    filter_func f;
+    compare_func c;
+    T value;
+    ComparisonOperator m_op;
+    FieldId m_fieldId;
+    size_t m_fieldIndex;
+    Header const* m_fieldHeader;
+    FieldAccessor m_field;
+    bool m_rawDomain;
+    int64_t m_rawLow;
+    int64_t m_rawHigh;
+    std::vector<double> m_column;
+    std::vector<int32_t> m_rawColumn;
+
+    static compare_func makeCompare(ComparisonOperator op)
+    {
+        switch (op)
+        {
+        case CO_Less: return std::less<T>();
+        case CO_LessEqual: return std::less_equal<T>();
+        case CO_Greater: return std::greater<T>();
+        case CO_GreaterEqual: return std::greater_equal<T>();
+        case CO_Equal: return std::equal_to<T>();
+        default: return compare_func();
+        }
+    }
+
+    bool bindField(Header const* header)
+    {
+        if (header != m_fieldHeader)
+        {
+            m_fieldHeader = header;
+            m_rawDomain = false;
+            if (m_field.bind(header->getSchema(), m_fieldId, m_fieldIndex) && m_op != CO_Custom)
+            {
+                // the passing values as a closed range of scaled values
+                const double inf = std::numeric_limits<double>::infinity();
+                double v = static_cast<double>(value);
+                double low = -inf;
+                double high = inf;
+                switch (m_op)
+                {
+                case CO_Less: high = std::nextafter(v, -inf); break;
+                case CO_LessEqual: high = v; break;
+                case CO_Greater: low = std::nextafter(v, inf); break;
+                case CO_GreaterEqual: low = v; break;
+                default: low = high = v; break;
+                }
+                m_rawDomain = m_field.getRawRange(low, high, m_rawLow, m_rawHigh);
+            }
+        }
+        return m_field.isBound();
+    }
+
+    bool compareField(const uint8_t* record) const
+    {
+        if (m_rawDomain)
+        {
+            double raw = m_field.getRaw(record);
+            return raw >= static_cast<double>(m_rawLow) && raw <= static_cast<double>(m_rawHigh);
+        }
+
+        double v = m_field.getValue(record);
+        double limit = static_cast<double>(value);
+        switch (m_op)
+        {
+        case CO_Less: return v < limit;
+        case CO_LessEqual: return v <= limit;
+        case CO_Greater: return v > limit;
+        case CO_GreaterEqual: return v >= limit;
+        default: return detail::exactly_equal(v, limit);
+        }
+    }
+
+    void parse(std::string const& filter_string)
     {
-        compare_func compare;
+        m_op = CO_Custom;
 
         bool gt = HasPredicate(filter_string, ">");
         bool gte = HasPredicate(filter_string, ">=");
@@ -268,30 +562,35 @@ public:
         {
             // std::cout<<"have gte!" << std::endl;
             c = std::greater_equal<T>();
+            m_op = CO_GreaterEqual;
             pos = filter_string.find_first_of("=") + 1;
         }
         else if (gt) // .
         {
             // std::cout<<"have gt!" << std::endl;
             c = std::greater<T>();
+            m_op = CO_Greater;
             pos = filter_string.find_first_of(">") + 1;
         }
         else if (lte) // <=
         {
             // std::cout<<"have lte!" << std::endl;
             c = std::less_equal<T>();
+            m_op = CO_LessEqual;
             pos = filter_string.find_first_of("=") +1;
         }
         else if (lt) // <
         {
             // std::cout<<"have le!" << std::endl;
-            c = std::less<T>();    
+            c = std::less<T>();
+            m_op = CO_Less;
             pos = filter_string.find_first_of("<") + 1;
         }
         else if (eq) // ==
         {
             // std::cout<<"have eq!" << std::endl;
             c = std::equal_to<T>();
+            m_op = CO_Equal;
             pos = filter_string.find_last_of("=") + 1;
     
         }
@@ -302,41 +601,6 @@ public:
         // std::cout << "Value is: " << value << " pos " << pos << " out " << out << std::endl;
     }
             
-    bool filter(const hsl::Point& p)
-    {
-        bool output = false;
-
-        T v = f(&p);
-        // std::cout << std::endl<< "Checking c(v, value) v: " << v << " value: " << value;
-        if (c(v, value)){
-            // std::cout<< " ... succeeded "<<std::endl;
-            if (GetType() == eInclusion) {
-                output = true;
-            } else {
-                // std::cout << "Filter type is eExclusion and test passed" << std::endl;
-                output = false;
-            }    
-        } else {
-            // std::cout<<" ... failed" <<std::endl;
-            if (GetType() == eInclusion) {
-                output = false;
-            } else {
-                // std::cout << "Filter type is eExclusion and test failed" << std::endl;
-                output = true;
-            }    
-        }
-        // std::cout << " returning " << output << std::endl;
-        return output;
-    }
-    
-private:
-
-    ContinuousValueFilter(ContinuousValueFilter const& other);
-    ContinuousValueFilter& operator=(ContinuousValueFilter const& rhs);
-    filter_func f;
-    compare_func c;
-    T value;
-
     bool HasPredicate(std::string const& parse_string, std::string predicate)
     {
         // Check if the given string contains all of the characters of predicate
@@ -372,11 +636,13 @@ public:
                 Color::value_type low_green,
                 Color::value_type high_green);
     bool filter(const Point& point);
+    void filter(const PointBlock& block, Bitmask& mask);
     
 private:
     
     Color m_low;
     Color m_high;
+    std::vector<int32_t> m_column;
 
     ColorFilter(ColorFilter const& other);
     ColorFilter& operator=(ColorFilter const& rhs);
@@ -0,0 +1,128 @@
+/*************************************************************************************
+ * 
+ * 
+ * Copyright (c) 2021, Zhengjun Liu <zjliu@casm.ac.cn>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ ************************************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <iosfwd>
+#include <vector>
+#include "hslLIB.h"
+#include "Filter.h"
+#include "Bitmask.h"
+
+namespace hsl
+{
+
+/// What a FilterChain measured for one of its filters while sampling.
+struct LIBHSL_API FilterStatistics
+{
+    size_t      position;   ///< index of the filter in the list given to setFilters
+    uint64_t    evaluated;  ///< points the filter was evaluated on
+    uint64_t    passed;     ///< points of those that passed
+    double      seconds;    ///< time spent in the filter
+
+    FilterStatistics() : position(0), evaluated(0), passed(0), seconds(0.0) {}
+
+    /// Fraction of the evaluated points that passed, 1 if none were evaluated.
+    double getPassRate() const;
+
+    /// Mean time per evaluated point in seconds.
+    double getCost() const;
+};
+
+typedef std::vector<FilterStatistics> FilterStatisticsArray;
+
+/// Applies a list of filters to points or point blocks; a point is kept if
+/// it passes all of them. By default the filters run in the given order.
+///
+/// In adaptive mode the chain first samples the pass rate and the cost per
+/// point of every filter, evaluating each on all sampled points. Once
+/// enough points have been seen it sorts the filters by cost over reject
+/// rate, so that points are rejected as cheaply as possible, and keeps that
+/// order. Filters that are not stateless (see FilterInterface::isStateless)
+/// stay in place and no filter is moved across them, which keeps the result
+/// the same as in the given order.
+class LIBHSL_API FilterChain
+{
+public:
+    FilterChain();
+
+    void setFilters(std::vector<FilterPtr> const& filters);
+    std::vector<FilterPtr> const& getFilters() const { return _filters; }
+    bool empty() const { return _filters.empty(); }
+
+    /// Enables or disables adaptive ordering and restarts sampling, which
+    /// covers the first samplePoints points.
+    void setAdaptive(bool adaptive, uint64_t samplePoints = 65536);
+    bool isAdaptive() const { return _adaptive; }
+
+    /// Whether the chain is still measuring its filters.
+    bool isSampling() const { return _sampling; }
+
+    /// Forgets the statistics and restores the given order, sampling again
+    /// in adaptive mode.
+    void reset();
+
+    bool filter(const Point& point);
+
+    /// Clears the bits of mask of the records of block that do not pass,
+    /// see FilterInterface::filter(const PointBlock&, Bitmask&).
+    void filter(const PointBlock& block, Bitmask& mask);
+
+    /// Whether a filter rules out every point of chunk from the statistics
+    /// of zones. Only filters ahead of the first stateful one are asked, as
+    /// skipping points must not change what a stateful filter sees.
+    bool canSkip(ZoneMap const& zones, size_t chunk);
+
+    /// Evaluation order as positions in the list given to setFilters.
+    std::vector<size_t> const& getOrder() const { return _order; }
+
+    /// Statistics per filter, in the order given to setFilters.
+    FilterStatisticsArray const& getStatistics() const { return _statistics; }
+
+    /// Writes the evaluation order and the statistics of each filter.
+    void report(std::ostream& os) const;
+
+private:
+    bool sample(const Point& point);
+    void sample(const PointBlock& block, Bitmask& mask);
+    void chooseOrder();
+
+    std::vector<FilterPtr>  _filters;
+    std::vector<size_t>     _order;
+    FilterStatisticsArray   _statistics;
+    bool                    _adaptive;
+    bool                    _sampling;
+    uint64_t                _samplePoints;
+    uint64_t                _sampled;
+    Bitmask                 _input;
+    Bitmask                 _scratch;
+};
+
+}
@@ -0,0 +1,199 @@
+/*************************************************************************************
+ * 
+ * 
+ * Copyright (c) 2021, Zhengjun Liu <zjliu@casm.ac.cn>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ ************************************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "hslLIB.h"
+#include "Filter.h"
+#include "FieldAccessor.h"
+#include "ZoneMap.h"
+
+namespace hsl
+{
+
+class Schema;
+
+/// A boolean expression over the fields of a point record, compiled once
+/// against a Schema into flat bytecode that reads the raw record bytes.
+///
+/// Grammar, lowest precedence first:
+///     or:         and { ("||" | "or") and }
+///     and:        not { ("&&" | "and") not }
+///     not:        ("!" | "not") not | comparison
+///     comparison: sum [ ("<" | "<=" | ">" | ">=" | "==" | "=" | "!=") sum
+///                     | "in" "(" number { "," number } ")" ]
+///     sum:        product { ("+" | "-") product }
+///     product:    unary { ("*" | "/") unary }
+///     unary:      "-" unary | primary
+///     primary:    number | field [ "[" integer "]" ] | "(" or ")"
+///
+/// Fields are named like their FieldId without the prefix, or like the
+/// schema field, ignoring case, blanks and underscores: X, Intensity,
+/// ReturnNumber, Classification, GNSSTime (or Time), Red, ... . band[n] is
+/// the n-th band counting from 0, and name[n] the n-th field with the id of
+/// name. Values have the field scale and offset applied, a comparison is 1
+/// or 0 and any non-zero value is true.
+///
+///     hsl::FilterExpression e("Classification in (2,9) && Z > 120 && band[45]/band[30] > 1.4");
+///     e.compile(header.getSchema());
+///
+/// An arithmetic expression, such as the band math of SpectralIndexTransform,
+/// is evaluated to its values with evaluateValue and evaluateValues.
+class LIBHSL_API FilterExpression
+{
+public:
+    FilterExpression();
+
+    /// Parses text, throws hsl::invalid_expression on a syntax error.
+    explicit FilterExpression(std::string const& text);
+
+    /// Parses text, throws hsl::invalid_expression on a syntax error.
+    void parse(std::string const& text);
+
+    /// Binds the fields of the expression to schema. Throws
+    /// hsl::invalid_expression if a field is not in the schema or cannot be
+    /// read raw.
+    void compile(Schema const& schema);
+
+    bool isCompiled() const { return _compiled; }
+    std::string const& getText() const { return _text; }
+
+    /// Number of bytecode instructions.
+    size_t getInstructionCount() const { return _code.size(); }
+
+    /// Evaluates the compiled expression on one raw record.
+    bool evaluate(const uint8_t* record);
+
+    /// Evaluates the compiled expression on the records of block and clears
+    /// the bits of mask of the records where it is false. Records whose bit
+    /// is already clear may be skipped.
+    void evaluate(PointBlock const& block, Bitmask& mask);
+
+    /// Value of the compiled expression on one raw record.
+    double evaluateValue(const uint8_t* record);
+
+    /// Stores the values of the compiled expression on all records of block
+    /// in values.
+    void evaluateValues(PointBlock const& block, std::vector<double>& values);
+
+    /// Evaluates the compiled expression over the value ranges that zones
+    /// records for chunk, telling whether any point of the chunk may make
+    /// the expression true and whether any may make it false. Fields
+    /// without statistics may take any value.
+    void evaluate(ZoneMap const& zones, size_t chunk, bool& mayBeTrue, bool& mayBeFalse) const;
+
+private:
+    enum OpCode
+    {
+        OP_Load,
+        OP_Const,
+        OP_Add,
+        OP_Subtract,
+        OP_Multiply,
+        OP_Divide,
+        OP_Negate,
+        OP_Less,
+        OP_LessEqual,
+        OP_Greater,
+        OP_GreaterEqual,
+        OP_Equal,
+        OP_NotEqual,
+        OP_And,
+        OP_Or,
+        OP_Not,
+        OP_In
+    };
+
+    struct Instruction
+    {
+        OpCode  op;
+        bool    immediate;  // binary op whose right operand is value
+        size_t  arg;        // OP_Load: field, OP_In: set
+        double  value;
+    };
+
+    struct FieldReference
+    {
+        std::string name;
+        bool        indexed;
+        size_t      index;
+    };
+
+    class Parser;
+    friend class Parser;
+
+    void emit(OpCode op, size_t arg = 0, double value = 0.0);
+    template <typename R>
+    static void applyBinary(OpCode op, double* a, R const& b, size_t n);
+    void run(const uint8_t* records, size_t stride, size_t n, double* result);
+
+    std::string                         _text;
+    std::vector<Instruction>            _code;
+    std::vector<FieldReference>         _references;
+    std::vector<std::vector<double> >   _sets;
+    std::vector<FieldAccessor>          _fields;
+    ZoneMapFieldArray                   _fieldKeys;     // id and index of each bound field
+    std::vector<double>                 _stack;
+    size_t                              _depth;
+    size_t                              _maxDepth;
+    bool                                _compiled;
+};
+
+/// Keeps the points for which a FilterExpression is true. The expression is
+/// compiled against the schema of the first point or block it sees, and
+/// again whenever the header changes.
+class LIBHSL_API ExpressionFilter: public FilterInterface
+{
+public:
+
+    /// Throws hsl::invalid_expression on a syntax error.
+    ExpressionFilter(std::string const& expression);
+
+    bool filter(const Point& point);
+    void filter(const PointBlock& block, Bitmask& mask);
+    bool canSkip(ZoneMap const& zones, size_t chunk);
+
+    FilterExpression const& getExpression() const { return m_expression; }
+
+private:
+
+    FilterExpression m_expression;
+    Header const* m_header;
+    Bitmask m_matches;
+
+    void compile(Header const* header);
+
+    ExpressionFilter(ExpressionFilter const& other);
+    ExpressionFilter& operator=(ExpressionFilter const& rhs);
+};
+
+}
@@ -204,6 +204,11 @@ public:
     /// Set minimum values of extent of X, Y and Z coordinates.
     void setMin(double x, double y, double z);
     
+    /// Get/set absolute position of the chunk table, 0 if the file has none.
+    /// The chunk table is written by Writer when a chunk size is set.
+    uint64_t getChunkTableOffset() const;
+    void setChunkTableOffset(uint64_t v);
+
     /// Returns the schema.
     const Schema & getSchema() const;
     Schema & getSchema();
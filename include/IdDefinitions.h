@@ -59,7 +59,8 @@ enum FieldId
     FI_Blue,
     FI_NIR,
     FI_ByteOffsetToWaveformData,
-    FI_WaveformDataSize
+    FI_WaveformDataSize,
+    FI_Abundance
 
 };
 
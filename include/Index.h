@@ -45,6 +45,7 @@
 #include "Header.h"
 #include "Bounds.h"
 #include "index/IndexCell.h"
+#include "index/IndexFile.h"
 
 // std
 #include <stdexcept> // std::out_of_range
@@ -113,6 +114,11 @@ class LIBHSL_API IndexIterator;
 // Currently only one, two or three dimensional spatial window filters are supported. See IndexData below for 
 //		more info on filtering.
 
+// An index can also be kept in a standalone memory-mapped .hsx file (see index/IndexFile.h). When IndexData names
+//		such a file, IndexInit maps it and validates it against the point file header instead of rebuilding the 
+//		index; the file is only (re)built when it is missing or out of date and the index is not read-only.
+//		Filter and IndexIterator then walk the cell table and point ranges directly in the mapping.
+
 class LIBHSL_API Index
 {
 public:
@@ -145,6 +151,8 @@ private:
 	std::string m_indexComment;
 	std::string m_indexDate;
 	std::vector<uint32_t> m_filterResult;
+	std::string m_idxfs;
+	hsl::detail::IndexFile m_mappedIndex;
 	const char *m_ofs;
     FILE *m_tempFile, *m_outputFile;
     FILE *m_debugger;
@@ -153,6 +161,13 @@ private:
     bool IndexInit(void);
     void ClearOldIndex(void);
 	bool BuildIndex(void);
+	// sizes the X/Y cell matrix from the point count and bounds
+	void SetCellMatrix(void);
+	// maps the standalone .hsx index named in m_idxfs, building it first if allowed and needed
+	bool InitMappedIndex(void);
+	bool BuildMappedIndex(void);
+	void LoadMappedIndexValues(void);
+	bool FilterMapped(IndexData & ParamSrc);
 	bool Validate(void);
 	uint32_t GetDefaultReserve(void);
 	void SetCellFilterBounds(IndexData & ParamSrc);
@@ -251,6 +266,10 @@ public:
 	Header *GetIndexHeader(void) {return &m_idxheader;}
 	Reader *GetReader(void) const {return m_reader;}
 	Reader *GetIndexReader(void) const {return m_idxreader;}
+	// true if the index is served from a memory-mapped .hsx file
+	bool IsMapped(void) const	{return m_mappedIndex.IsOpen();}
+	hsl::detail::IndexFile const& GetMappedIndex(void) const	{return m_mappedIndex;}
+	const char *GetIndexFileName(void) const {return m_idxfs.c_str();}
 	const char *GetTempFileName(void) const {return m_tempFileName.c_str();}
 	// Returns the strings set in the index when built
 	const char *GetIndexAuthorStr(void)  const;
@@ -377,6 +396,13 @@ public:
 	bool SetReadOrBuildAloneValues(Reader *reader, const char *ofs, const char *tmpfilenme, const char *indexauthor = 0, 
 		const char *indexcomment = 0, const char *indexdate = 0, double zbinht = 0.0, 
 		uint32_t maxmem = LIBHSL_INDEX_MAXMEMDEFAULT, int debugoutputlevel = 0, FILE *debugger = 0);
+
+	// set the values needed for filtering with an existing memory-mapped .hsx index file
+	bool SetReadMappedValues(Reader *reader, const char *idxfs, int debugoutputlevel = 0, FILE *debugger = 0);
+
+	// set the values needed for filtering with a memory-mapped .hsx index file, building the file first
+	// if it does not exist or no longer matches the point file
+	bool SetReadOrBuildMappedValues(Reader *reader, const char *idxfs, int debugoutputlevel = 0, FILE *debugger = 0);
 	
 	// set the bounds for use in filtering
 	bool SetFilterValues(double LowFilterX, double HighFilterX, double LowFilterY, double HighFilterY, double LowFilterZ, double HighFilterZ, 
@@ -400,6 +426,7 @@ protected:
 	Bounds<double> m_filter;
 	const char *m_ifs;
 	const char *m_ofs;
+	const char *m_idxfs;
 	const char *m_tempFileName;
 	const char *m_indexAuthor;
 	const char *m_indexComment;
@@ -428,6 +455,7 @@ public:
 	Reader *GetReader(void) const {return m_reader;}
 	int GetDebugOutputLevel(void) const {return m_debugOutputLevel;}
 	const char *GetTempFileName(void) const {return m_tempFileName;}
+	const char *GetIndexFileName(void) const {return m_idxfs;}
 	const char *GetIndexAuthorStr(void)  const;
 	const char *GetIndexCommentStr(void)  const;
 	const char *GetIndexDateStr(void)  const;
@@ -441,6 +469,7 @@ public:
 	void SetReader(Reader *reader)	{m_reader = reader;}
 	void SetIStream(const char *ifs)	{m_ifs = ifs;}
 	void SetOStream(const char *ofs)	{m_ofs = ofs;}
+	void SetIndexFileName(const char *idxfs)	{m_idxfs = idxfs;}
 	void SetTmpFileName(const char *tmpfilenme)	{m_tempFileName = tmpfilenme;}
 	void SetIndexAuthor(const char *indexauthor)	{m_indexAuthor = indexauthor;}
 	void SetIndexComment(const char *indexcomment)	{m_indexComment = indexcomment;}
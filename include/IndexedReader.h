@@ -0,0 +1,98 @@
+/*************************************************************************************
+ * 
+ * 
+ * Copyright (c) 2021, Zhengjun Liu <zjliu@casm.ac.cn>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ ************************************************************************************/
+
+#pragma once
+
+#include <vector>
+#include "hslLIB.h"
+#include "Bounds.h"
+#include "Reader.h"
+#include "Index.h"
+#include "PointBlock.h"
+
+
+namespace hsl
+{
+
+/// Streams the points of a spatial window query in batches. The candidate
+/// point ranges of the query are taken from the Index, sorted by file position
+/// and coalesced, so that each range is fetched with one large read instead of
+/// a seek and a single-record read per point. Records are then tested against
+/// the window in their raw integer domain and returned in file order.
+///
+/// As with BoundsFilter, Z is not filtered when its low and high bounds are
+/// equal; X and Y always are.
+class LIBHSL_API IndexedReader
+{
+public:
+    IndexedReader(Reader& reader, Index& index, Bounds<double> const& bounds, uint32_t blockSize = 65536);
+
+    /// Replaces the content of block with the next batch of at most blockSize
+    /// points. Returns false once the query is exhausted.
+    /// @exception may throw std::exception
+    bool readNextBlock(PointBlock& block);
+
+    /// Restarts the query from its first point.
+    void reset();
+
+    /// Sets the largest gap, in records, that is read through rather than
+    /// skipped when two candidate ranges are coalesced. Default is 16.
+    void setMaxGap(uint32_t records);
+
+    /// Coalesced candidate ranges of the query.
+    std::vector<hsl::detail::IndexFileRange> const& getRanges();
+
+private:
+    IndexedReader(IndexedReader const& other);
+    IndexedReader& operator=(IndexedReader const& rhs);
+
+    void prepare();
+    void collectMappedRanges(std::vector<hsl::detail::IndexFileRange>& ranges) const;
+    void collectFilteredRanges(std::vector<hsl::detail::IndexFileRange>& ranges);
+    void setRawBounds();
+    bool contains(const uint8_t* record) const;
+
+private:
+    Reader&             _reader;
+    Index&              _index;
+    Bounds<double>      _bounds;
+    uint32_t            _blockSize;
+    uint32_t            _maxGap;
+    bool                _prepared;
+
+    std::vector<hsl::detail::IndexFileRange> _ranges;
+    size_t              _currentRange;
+    uint32_t            _currentOffset;
+
+    bool                _useDim[3];
+    int64_t             _rawMin[3];
+    int64_t             _rawMax[3];
+};
+
+}
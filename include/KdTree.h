@@ -0,0 +1,141 @@
+/*************************************************************************************
+ * 
+ * 
+ * Copyright (c) 2021, Zhengjun Liu <zjliu@casm.ac.cn>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ ************************************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <memory>
+#include "hslLIB.h"
+#include "ThreadPool.h"
+
+namespace hsl
+{
+
+class Reader;
+class PointBlock;
+
+/// A point found by a neighbourhood search.
+struct Neighbor
+{
+    uint32_t    id;         // index of the point record in its file
+    double      distance;   // Euclidean distance in world units
+
+    bool operator<(Neighbor const& other) const { return distance < other.distance; }
+};
+
+typedef std::vector<Neighbor> NeighborList;
+
+/// In-memory KD-tree over the raw int32 coordinates of point records, for
+/// k-nearest-neighbour and radius searches. Coordinates are kept in leaf
+/// order, 12 bytes per point plus its index, and are never converted to
+/// Point objects; scale and offset are only applied to the query and to
+/// the squared distance.
+///
+/// Queries are const and may run concurrently; the batch queries split the
+/// query set into batches claimed by the workers of a ThreadPool (see
+/// ThreadPool::parallelFor).
+class LIBHSL_API KdTree
+{
+public:
+    KdTree();
+
+    /// Builds the tree over all points of the file read by reader.
+    /// @exception may throw std::exception
+    bool build(Reader& reader);
+
+    /// Builds the tree over the records of block, identified by their ids.
+    void build(PointBlock const& block);
+
+    void clear();
+    size_t size() const { return _ids.size(); }
+    bool empty() const { return _ids.empty(); }
+
+    /// Points per leaf bucket, default 16. Takes effect on the next build.
+    void setLeafSize(uint32_t count) { _leafSize = count > 0 ? count : 1; }
+
+    /// Runs the batch queries on pool instead of a pool started for each
+    /// query. The calling thread is one of the workers.
+    void setThreadPool(ThreadPoolPtr pool) { _pool = pool; }
+
+    /// The k nearest points to (x, y, z), in world coordinates, nearest first.
+    void knn(double x, double y, double z, size_t k, NeighborList& result) const;
+
+    /// All points within radius of (x, y, z), nearest first.
+    void radius(double x, double y, double z, double radius, NeighborList& result) const;
+
+    /// knn for every query point; queries holds x, y, z triples. threads == 0
+    /// uses the hardware concurrency.
+    void knn(std::vector<double> const& queries, size_t k, std::vector<NeighborList>& results,
+        unsigned int threads = 0) const;
+
+    /// radius for every query point; queries holds x, y, z triples.
+    void radius(std::vector<double> const& queries, double radius, std::vector<NeighborList>& results,
+        unsigned int threads = 0) const;
+
+    /// knn around every indexed point. results[i] belongs to the point with the
+    /// i-th smallest id, which is point i for a tree built from a whole file.
+    /// Each point is its own nearest neighbour, at distance 0.
+    void knnAll(size_t k, std::vector<NeighborList>& results, unsigned int threads = 0) const;
+
+private:
+    struct Node
+    {
+        uint32_t    begin;      // range of points below this node
+        uint32_t    end;
+        uint32_t    right;      // index of the right child, 0 for a leaf; the left child follows
+        int32_t     split;
+        uint8_t     axis;
+    };
+
+    struct Query;
+
+    void setTransform(double const scale[3], double const offset[3]);
+    void buildTree();
+    uint32_t buildNode(uint32_t begin, uint32_t end);
+    void search(uint32_t node, Query& q) const;
+    void toRaw(double x, double y, double z, double raw[3]) const;
+    void knnRaw(double const raw[3], size_t k, NeighborList& result) const;
+
+    void runQueries(size_t count, unsigned int threads, ThreadPool::RangeFunction const& fn) const;
+
+private:
+    double                  _scale[3];
+    double                  _offset[3];
+    double                  _scale2[3];
+    uint32_t                _leafSize;
+    std::vector<int32_t>    _coords;    // x, y, z triples in leaf order
+    std::vector<uint32_t>   _ids;
+    std::vector<Node>       _nodes;
+    ThreadPoolPtr           _pool;
+};
+
+typedef std::shared_ptr<KdTree> KdTreePtr;
+
+}
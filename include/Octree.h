@@ -0,0 +1,190 @@
+/*************************************************************************************
+ * 
+ * 
+ * Copyright (c) 2021, Zhengjun Liu <zjliu@casm.ac.cn>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ ************************************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include "hslLIB.h"
+#include "Bounds.h"
+
+namespace hsl
+{
+
+class Reader;
+class PointBlock;
+
+namespace detail {
+
+#define LIBHSL_OCTREEFILE_SIGNATURE     "HSO"
+#define LIBHSL_OCTREEFILE_VERSIONMAJOR  1
+#define LIBHSL_OCTREEFILE_VERSIONMINOR  0
+
+// A standalone octree file (.hso) describes the level of detail hierarchy of
+// an HSP file written by OctreeBuilder:
+//      OctreeFileHeader
+//      OctreeFileNode[nodeCount]       breadth first, Morton order within a depth
+// Stored in little-endian order.
+
+#pragma pack(1)
+class OctreeFileHeader
+{
+public:
+    char        signature[4];
+    uint8_t     versionMajor;
+    uint8_t     versionMinor;
+    uint16_t    reserved;
+    uint32_t    nodeCount;
+    uint32_t    maxDepth;
+    uint32_t    gridBits;           // a node samples a 2^gridBits cube of cells
+    uint32_t    reserved2;
+    uint64_t    pointRecordsCount;
+    int64_t     origin[3];          // raw coordinates of the root cube corner
+    double      factor;             // key grid cells per raw coordinate unit
+    double      scale[3];
+    double      offset[3];
+};
+
+class OctreeFileNode
+{
+public:
+    uint32_t    depth;
+    uint32_t    x;
+    uint32_t    y;
+    uint32_t    z;
+    uint64_t    firstPoint;
+    uint32_t    pointCount;
+    uint32_t    reserved;
+};
+#pragma pack()
+
+}
+
+/// A node of the level of detail octree. Its points are one contiguous
+/// range of point records.
+struct OctreeNode
+{
+    uint32_t        depth;
+    uint32_t        x;              // position of the node among the 2^depth nodes per axis
+    uint32_t        y;
+    uint32_t        z;
+    uint64_t        firstPoint;
+    uint32_t        pointCount;
+    double          spacing;        // approximate distance between the points of this node
+    Bounds<double>  bounds;         // cube covered by the node, in world coordinates
+};
+
+/// Level of detail octree over an HSP file, similar to COPC/EPT. The root
+/// holds a coarse sample of all points and every depth refines its parent,
+/// so reading the nodes from the root down to some depth gives the points at
+/// the matching density. Build it with OctreeBuilder.
+class LIBHSL_API Octree
+{
+public:
+    Octree();
+
+    bool open(std::string const& filename);
+    void close();
+    bool isOpen() const { return !_nodes.empty(); }
+
+    detail::OctreeFileHeader const& getFileHeader() const { return _header; }
+    std::vector<OctreeNode> const& getNodes() const { return _nodes; }
+    uint32_t getMaxDepth() const { return _header.maxDepth; }
+
+    /// Point spacing, in X world units, of the nodes at depth.
+    double getSpacing(uint32_t depth) const;
+
+    /// Shallowest depth whose spacing is at most spacing, the deepest depth
+    /// if none is that fine.
+    uint32_t getDepthForSpacing(double spacing) const;
+
+    /// Nodes overlapping bounds down to maxDepth, shallowest first. A bounds
+    /// with zero Z extent is treated as two dimensional.
+    std::vector<OctreeNode> query(Bounds<double> const& bounds, uint32_t maxDepth) const;
+
+    /// Nodes overlapping bounds that together give at least density points per
+    /// square world unit, or all their points where the data is sparser.
+    std::vector<OctreeNode> queryByDensity(Bounds<double> const& bounds, double density) const;
+
+    /// Appends the points of node to block.
+    /// @exception may throw std::exception
+    static bool readNode(Reader& reader, OctreeNode const& node, PointBlock& block);
+
+private:
+    detail::OctreeFileHeader    _header;
+    std::vector<OctreeNode>     _nodes;
+    std::vector<size_t>         _depthStart;    // first node of each depth, plus the end
+};
+
+typedef std::shared_ptr<Octree> OctreePtr;
+
+/// Reorganises an HSP file into level of detail order and writes its octree.
+///
+/// Points are first sorted along the Morton curve. A streaming pass then keeps,
+/// at each depth, the first remaining point of every cell of the node's
+/// sampling grid, and passes the others down; the deepest depth takes all that
+/// are left. A second sort groups the points by node, breadth first, so each
+/// node is one contiguous record range. Both sorts are out-of-core.
+class LIBHSL_API OctreeBuilder
+{
+public:
+    OctreeBuilder();
+
+    /// A node samples its cube with 2^bits cells per axis. Default 7, that is
+    /// up to about 16K points for a node over a surface.
+    void setGridBits(uint32_t bits);
+    uint32_t getGridBits() const { return _gridBits; }
+
+    /// Deepest depth of the octree, 0 to derive it from the point count.
+    void setMaxDepth(uint32_t depth) { _maxDepth = depth; }
+    uint32_t getMaxDepth() const { return _maxDepth; }
+
+    void setMaxMemoryUsage(size_t bytes) { _maxMemory = bytes; }
+    void setTempFileName(std::string const& name) { _tempName = name; }
+
+    /// Points per chunk table entry of the output, 0 for none. Default 65536.
+    void setChunkSize(uint32_t count) { _chunkSize = count; }
+    uint32_t getChunkSize() const { return _chunkSize; }
+
+    /// Writes the points of inputFile in level of detail order to outputFile
+    /// and their hierarchy to octreeFile.
+    /// @exception may throw std::exception
+    bool build(std::string const& inputFile, std::string const& outputFile, std::string const& octreeFile);
+
+private:
+    uint32_t        _gridBits;
+    uint32_t        _maxDepth;
+    size_t          _maxMemory;
+    uint32_t        _chunkSize;
+    std::string     _tempName;
+};
+
+}
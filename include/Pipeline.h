@@ -0,0 +1,250 @@
+/*************************************************************************************
+ * 
+ * 
+ * Copyright (c) 2021, Zhengjun Liu <zjliu@casm.ac.cn>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ ************************************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <functional>
+#include <memory>
+#include <vector>
+#include "hslLIB.h"
+#include "Filter.h"
+#include "Transform.h"
+#include "PointBlock.h"
+#include "FieldAccessor.h"
+#include "Bitmask.h"
+
+namespace hsl
+{
+
+class Reader;
+class Writer;
+
+/// One step of a Pipeline, applied to each block in place. A stage may
+/// remove records from the block but not reorder them.
+class LIBHSL_API PipelineStage
+{
+public:
+    virtual ~PipelineStage() {}
+
+    /// Called by Pipeline::run before the first block with the number of
+    /// workers that will call process: 1 unless isConcurrent().
+    virtual void prepare(size_t workers) = 0;
+
+    /// Processes block on behalf of worker, in [0, workers).
+    virtual void process(PointBlock& block, size_t worker) = 0;
+
+    /// Whether process may run on several blocks at once, from different
+    /// workers. A stage that is not concurrent sees the blocks in order.
+    virtual bool isConcurrent() const = 0;
+};
+
+typedef std::shared_ptr<PipelineStage> PipelineStagePtr;
+
+/// Keeps the records of each block that pass a filter. Built from a filter,
+/// the stage runs on one block at a time in file order, which stateful
+/// filters need. Built from a factory, it runs concurrently with one filter
+/// made by the factory per worker.
+class LIBHSL_API FilterStage: public PipelineStage
+{
+public:
+    typedef std::function<FilterPtr()> Factory;
+
+    FilterStage(FilterPtr filter);
+    FilterStage(Factory const& factory);
+
+    void prepare(size_t workers);
+    void process(PointBlock& block, size_t worker);
+    bool isConcurrent() const { return static_cast<bool>(m_factory); }
+
+private:
+    Factory m_factory;
+    std::vector<FilterPtr> m_filters;
+    std::vector<Bitmask> m_masks;
+};
+
+/// Applies a transform to each block, see FilterStage for the choice
+/// between a single transform and a factory of per-worker transforms.
+class LIBHSL_API TransformStage: public PipelineStage
+{
+public:
+    typedef std::function<TransformPtr()> Factory;
+
+    TransformStage(TransformPtr transform);
+    TransformStage(Factory const& factory);
+
+    void prepare(size_t workers);
+    void process(PointBlock& block, size_t worker);
+    bool isConcurrent() const { return static_cast<bool>(m_factory); }
+
+private:
+    Factory m_factory;
+    std::vector<TransformPtr> m_transforms;
+};
+
+/// Calls a function on each point of each block, concurrently, with one
+/// Point per worker. The function returns false to drop the point. Built
+/// with writeBack, the stage stores the points the function changed back in
+/// the block; without, the points are only read.
+class LIBHSL_API PointStage: public PipelineStage
+{
+public:
+    typedef std::function<bool(Point& point)> Function;
+
+    PointStage(Function const& function, bool writeBack);
+
+    void prepare(size_t workers);
+    void process(PointBlock& block, size_t worker);
+    bool isConcurrent() const { return true; }
+
+private:
+    Function m_function;
+    bool m_writeBack;
+    std::vector<PointPtr> m_points;
+    std::vector<Bitmask> m_masks;
+};
+
+/// Base of the stages that rewrite each block into the records of another
+/// header, e.g. with derived bands in place of the source bands. process
+/// starts a block of target records with the ids of the source records,
+/// zeroed, copies the fields target shares with source except the excluded
+/// ones, lets rewrite fill in the rest, and replaces the block with it.
+class LIBHSL_API SchemaStage: public PipelineStage
+{
+public:
+    SchemaStage(Header const& source, Header const& target, std::vector<FieldId> const& excluded);
+
+    void prepare(size_t workers);
+    void process(PointBlock& block, size_t worker);
+    bool isConcurrent() const { return true; }
+
+protected:
+    /// Fills in the fields of the n records of out that were not copied
+    /// from the records of in.
+    virtual void rewrite(PointBlock const& in, PointBlock& out, size_t worker) = 0;
+
+    Header const* getSource() const { return m_source; }
+    Header const* getTarget() const { return m_target; }
+
+private:
+    struct Scratch
+    {
+        PointBlock block;
+        std::vector<double> values;
+        explicit Scratch(Header const* header) : block(header) {}
+    };
+
+    Header const* m_source;
+    Header const* m_target;
+    FieldCopier m_copier;
+    std::vector<Scratch> m_scratch;
+};
+
+/// Streams the points of a Reader through a chain of stages into a Writer
+/// or a callback. Blocks flow from stage to stage over bounded queues; the
+/// reader, each stage and the sink run on their own threads, so reading,
+/// processing and writing overlap, and a concurrent stage runs on several
+/// blocks at once. The sink receives the blocks in file order.
+///
+///     hsl::Pipeline pipeline(reader, writer);
+///     pipeline.addFilter(FilterPtr(new hsl::ThinFilter(2)));
+///     pipeline.addTransform([&] { return TransformPtr(new hsl::ReprojectionTransform(in, out, &header)); });
+///     pipeline.run();
+///
+/// The reader's own filters apply as it reads; its transforms do not.
+/// Waveform data is not carried through a pipeline, so a writer whose
+/// header has waveform data is rejected.
+class LIBHSL_API Pipeline
+{
+public:
+    typedef std::function<void(PointBlock const& block)> Sink;
+
+    Pipeline(Reader& reader, Writer& writer);
+    Pipeline(Reader& reader, Sink const& sink);
+
+    void addStage(PipelineStagePtr stage);
+    void addFilter(FilterPtr filter);
+    void addFilter(FilterStage::Factory const& factory);
+    void addTransform(TransformPtr transform);
+    void addTransform(TransformStage::Factory const& factory);
+
+    /// Records read per block, 4096 by default.
+    void setBlockSize(uint32_t size) { m_blockSize = size; }
+    uint32_t getBlockSize() const { return m_blockSize; }
+
+    /// Blocks each queue holds before its producer waits, 4 by default.
+    void setQueueCapacity(size_t capacity) { m_queueCapacity = capacity; }
+    size_t getQueueCapacity() const { return m_queueCapacity; }
+
+    /// Whether the sink receives the blocks in file order, the default. A
+    /// sink that does not care gets each block as soon as it is processed.
+    void setPreserveOrder(bool preserve) { m_preserveOrder = preserve; }
+    bool getPreserveOrder() const { return m_preserveOrder; }
+
+    /// Workers of each concurrent stage, one per hardware thread by default.
+    void setConcurrency(size_t workers) { m_concurrency = workers; }
+    size_t getConcurrency() const { return m_concurrency; }
+
+    /// Reads the reader from its current position to the end and returns
+    /// the number of points that reached the sink. An exception thrown by
+    /// any stage stops the pipeline and is rethrown.
+    uint64_t run();
+
+private:
+    Reader& m_reader;
+    Sink m_sink;
+    std::vector<PipelineStagePtr> m_stages;
+    uint32_t m_blockSize;
+    size_t m_queueCapacity;
+    size_t m_concurrency;
+    bool m_preserveOrder;
+
+    Pipeline(Pipeline const& other);
+    Pipeline& operator=(Pipeline const& rhs);
+};
+
+/// Calls function on every point left in reader, on concurrency threads
+/// (one per hardware thread if 0), each with a Point of its own. Points are
+/// read in blocks on another thread, with the reader's filters applied; the
+/// calls come in no particular order. An exception thrown by function stops
+/// the pass and is rethrown. Returns the number of points visited.
+///
+///     std::atomic<uint64_t> ground(0);
+///     hsl::parallelForEach(reader, [&](hsl::Point const& p) { if (isGround(p)) ++ground; });
+LIBHSL_API uint64_t parallelForEach(Reader& reader, std::function<void(Point const& point)> const& function,
+                                    size_t concurrency = 0);
+
+/// Calls function on every point left in reader, concurrently as
+/// parallelForEach, and writes the points it returns true for to writer,
+/// whose schema must be that of reader. The points are written in file
+/// order unless preserveOrder is false. Returns the number written.
+LIBHSL_API uint64_t parallelTransform(Reader& reader, Writer& writer, std::function<bool(Point& point)> const& function,
+                                      bool preserveOrder = true, size_t concurrency = 0);
+
+}
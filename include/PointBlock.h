@@ -0,0 +1,125 @@
+/*************************************************************************************
+ * 
+ * 
+ * Copyright (c) 2021, Zhengjun Liu <zjliu@casm.ac.cn>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ ************************************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <cstring>
+#include <memory>
+#include <vector>
+#include "hslLIB.h"
+#include "hslDefinitions.h"
+
+namespace hsl
+{
+
+class Header;
+class Point;
+class Bitmask;
+
+/// A block of point records stored contiguously in their raw on-disk layout,
+/// together with the index of each record in its file. Blocks are the unit of
+/// batch reading, filtering and transforming; records are not decoded unless
+/// a caller asks for them.
+class LIBHSL_API PointBlock
+{
+public:
+    PointBlock(Header const* header, size_t capacity = 0);
+
+    Header const* getHeader() const { return _header; }
+    /// Sets the header describing the records, clearing the block.
+    void setHeader(Header const* header);
+    /// Sets the header describing the records, keeping them. header must
+    /// have the record length of the current one.
+    void resetHeader(Header const* header);
+
+    inline size_t getRecordLength() const { return _recordLength; }
+    inline size_t size() const { return _ids.size(); }
+    inline bool empty() const { return _ids.empty(); }
+    void clear();
+    /// Removes the records at and after position count, if any.
+    void truncate(size_t count);
+    void reserve(size_t count);
+
+    /// Appends count uninitialised records with consecutive point indices starting
+    /// at firstId and returns the address of the first of them.
+    uint8_t* appendRecords(uint32_t firstId, size_t count);
+    void appendRecord(uint32_t id, const uint8_t* record);
+    void appendPoint(uint32_t id, Point const& point);
+
+    inline uint8_t* getRecord(size_t i) { return &_data[i * _recordLength]; }
+    inline const uint8_t* getRecord(size_t i) const { return &_data[i * _recordLength]; }
+    inline uint32_t getId(size_t i) const { return _ids[i]; }
+
+    std::vector<uint8_t> const& getData() const { return _data; }
+    std::vector<uint8_t> & getData() { return _data; }
+    std::vector<uint32_t> const& getIds() const { return _ids; }
+
+    /// Raw stored coordinates of record i, see Point::getRawX.
+    inline int32_t getRawX(size_t i) const { return getRawCoordinate(i, 0); }
+    inline int32_t getRawY(size_t i) const { return getRawCoordinate(i, 4); }
+    inline int32_t getRawZ(size_t i) const { return getRawCoordinate(i, 8); }
+    inline void setRawX(size_t i, int32_t v) { setRawCoordinate(i, 0, v); }
+    inline void setRawY(size_t i, int32_t v) { setRawCoordinate(i, 4, v); }
+    inline void setRawZ(size_t i, int32_t v) { setRawCoordinate(i, 8, v); }
+
+    /// Copies record i into point, which must use a header with the same schema.
+    void getPoint(size_t i, Point& point) const;
+    /// Overwrites record i with the record data of point.
+    void setPoint(size_t i, Point const& point);
+
+    /// Removes the records at and after position start whose flag in keep is false
+    /// (keep[0] refers to record start), preserving the order of the remaining
+    /// records. Records past the end of keep are removed. Returns the new size.
+    size_t compact(std::vector<bool> const& keep, size_t start = 0);
+    /// Removes the records whose bit in mask is clear, see compact above.
+    size_t compact(Bitmask const& mask);
+
+private:
+    inline int32_t getRawCoordinate(size_t i, size_t pos) const
+    {
+        int32_t v;
+        std::memcpy(&v, &_data[i * _recordLength + pos], sizeof(int32_t));
+        return v;
+    }
+    inline void setRawCoordinate(size_t i, size_t pos, int32_t v)
+    {
+        std::memcpy(&_data[i * _recordLength + pos], &v, sizeof(int32_t));
+    }
+
+private:
+    Header const*           _header;
+    size_t                  _recordLength;
+    std::vector<uint8_t>    _data;
+    std::vector<uint32_t>   _ids;
+};
+
+typedef std::shared_ptr<PointBlock> PointBlockPtr;
+
+}
@@ -37,8 +37,13 @@
 #include "hslDefinitions.h"
 #include "FileIO.h"
 #include "Point.h"
+#include "PointBlock.h"
 #include "Filter.h"
+#include "FilterChain.h"
+#include "ZoneMap.h"
 #include "Transform.h"
+#include "WaveformBatch.h"
+#include "WaveformCache.h"
 
 
 namespace hsl
@@ -65,6 +70,63 @@ public:
     /// @exception may throw std::exception
     Point const& readPointAt(size_t n, bool readWaveform = false);
 
+    /// Appends count consecutive point records starting at first to block with a
+    /// single read. Filters and transforms are not applied. Returns false if
+    /// the records cannot be read.
+    /// @exception may throw std::exception
+    bool readPointRange(uint32_t first, uint32_t count, PointBlock& block);
+
+    /// Replaces the contents of block with the records passing the filters
+    /// among the next count records from the current position, evaluating
+    /// the filters a block at a time (see FilterInterface). Reads further
+    /// ranges while none pass. Transforms are not applied. Returns false
+    /// once no records are left.
+    /// @exception may throw std::exception
+    bool readNextBlock(PointBlock& block, uint32_t count);
+
+    /// Appends the point records with the given indices to block in ascending
+    /// index order. Runs of consecutive indices are fetched with one read each.
+    /// Filters and transforms are not applied.
+    /// @exception may throw std::exception
+    bool readPoints(std::vector<uint32_t> const& ids, PointBlock& block);
+
+    /// Reads the waveform data of the records of block into batch, entry i
+    /// holding that of record i. The waveform ranges are sorted by offset,
+    /// and ranges that overlap or lie at most maxGap bytes apart are
+    /// fetched with one read, so a block costs a few mostly sequential
+    /// reads instead of a seek and read per point. The position of
+    /// readNextPoint is kept. Returns false if the file ends early.
+    /// @exception may throw std::exception
+    bool readWaveforms(PointBlock const& block, WaveformBatch& batch, uint32_t maxGap = 4096);
+
+    /// Reads the waveform data of points, see above. The points keep their
+    /// own waveform data.
+    /// @exception may throw std::exception
+    bool readWaveforms(std::vector<Point> const& points, WaveformBatch& batch, uint32_t maxGap = 4096);
+
+    /// Keeps the waveform data read by readNextPoint and readPointAt in
+    /// cache, which other readers and updaters of the file may share. 0,
+    /// the default, reads waveform data from the file every time.
+    void setWaveformCache(WaveformCachePtr cache) { _waveformCache = cache; }
+    WaveformCachePtr getWaveformCache() const { return _waveformCache; }
+
+    /// Raw coordinate extents of consecutive point runs, loaded on open()
+    /// when the file carries a chunk table (see Writer::setChunkSize).
+    /// Empty otherwise.
+    ChunkBoundsArray const& getChunkBounds() const { return _zoneMap.getChunkBounds(); }
+
+    /// Number of points per chunk, 0 if the file has no chunk table.
+    uint32_t getChunkSize() const { return _zoneMap.getChunkSize(); }
+
+    /// Per chunk statistics loaded from the chunk table. readNextPoint and
+    /// readNextBlock skip the chunks that the filters rule out with them,
+    /// without reading the chunks.
+    ZoneMap const& getZoneMap() const { return _zoneMap; }
+
+    /// Whether open() found a chunk table it could not use, e.g. one that
+    /// does not match the point count. The table is then ignored.
+    bool hasChunkTableError() const { return _chunkTableFailed; }
+
     /// Reinitializes state of the reader.
     /// @exception may throw std::exception
     void reset();
@@ -94,6 +156,16 @@ public:
     /// Gets the list of filters to be applied to points as they are read
     std::vector<hsl::FilterPtr> getFilters() const;
 
+    /// Lets the reader reorder the filters for speed: pass rate and cost of
+    /// each filter are measured over the first samplePoints points read,
+    /// then the filters run cheapest rejection first. The points kept do not
+    /// change. See FilterChain.
+    void setAdaptiveFilterOrder(bool adaptive, uint64_t samplePoints = 65536);
+
+    /// The filters with their evaluation order and statistics, see
+    /// FilterChain::report.
+    FilterChain const& getFilterChain() const { return _filterChain; }
+
     /// Sets transforms to apply to points.  Points are transformed in 
     /// place *in the order* of the transform list.
     /// Filters are applied *before* transforms.  
@@ -110,6 +182,26 @@ protected:
     /// @exception may throw std::exception
     bool readWaveformData();
 
+    /// Reads size bytes of waveform data at pos into data, keeping the file
+    /// position. Throws hsl::libhsl_error if the file ends first.
+    void loadWaveformData(uint64_t pos, uint32_t size, std::vector<uint8_t>& data);
+
+    bool loadChunkTable();
+
+    struct WaveformRange
+    {
+        uint64_t    offset;     // in file
+        uint32_t    size;
+        size_t      entry;      // in the batch
+    };
+
+    /// Reads the ranges, one entry each, into batch.
+    bool readWaveformRanges(std::vector<WaveformRange>& ranges, size_t entries, WaveformBatch& batch, uint32_t maxGap);
+
+    /// Moves the read position past the chunks starting at the current
+    /// point that no point of can pass the filters. Returns true if it moved.
+    bool skipChunks();
+
 private:
     bool            _needHeaderCheck;
     uint32_t        _size;
@@ -117,9 +209,13 @@ private:
        
     PointPtr        _point;
 
-    std::vector<hsl::FilterPtr>     _filters;
+    FilterChain                     _filterChain;
     std::vector<hsl::TransformPtr>  _transforms;
     std::vector<uint8_t>::size_type _recordSize;
+
+    ZoneMap         _zoneMap;
+    bool            _chunkTableFailed;
+    WaveformCachePtr _waveformCache;
 };
 
 typedef std::shared_ptr<Reader> ReaderPtr;
@@ -0,0 +1,138 @@
+/*************************************************************************************
+ * 
+ * 
+ * Copyright (c) 2021, Zhengjun Liu <zjliu@casm.ac.cn>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ ************************************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <memory>
+#include <functional>
+#include "hslLIB.h"
+#include "hslDefinitions.h"
+
+namespace hsl
+{
+
+class PointBlock;
+class Reader;
+
+/// Space filling curves supported by SpatialSorter.
+enum SpatialCurve
+{
+    SC_Morton,
+    SC_Hilbert
+};
+
+/// Number of bits per axis of the curve keys, three axes fill 63 bits.
+const unsigned int SpatialKeyBits = 21;
+
+/// Largest grid coordinate of the curve keys.
+const uint32_t SpatialKeyMax = (1u << SpatialKeyBits) - 1;
+
+/// Quantisation of raw (unscaled) coordinates onto the 21-bit key grid. The
+/// same cell size is used on all axes so the curves follow the real geometry.
+struct SpatialGrid
+{
+    int64_t origin[3];
+    double  factor;     // grid cells per raw coordinate unit
+
+    inline uint32_t getCell(int32_t raw, int axis) const
+    {
+        double c = static_cast<double>(raw - origin[axis]) * factor;
+        return c <= 0.0 ? 0 : (c >= SpatialKeyMax ? SpatialKeyMax : static_cast<uint32_t>(c));
+    }
+};
+
+/// Morton (Z-order) key of a grid cell, each coordinate uses its low 21 bits.
+LIBHSL_API uint64_t getMortonKey(uint32_t x, uint32_t y, uint32_t z);
+
+/// Hilbert key of a grid cell, each coordinate uses its low 21 bits.
+LIBHSL_API uint64_t getHilbertKey(uint32_t x, uint32_t y, uint32_t z);
+
+/// Reorders the point records of a file along a space filling curve so that
+/// points close in space are close in the file, which keeps the candidate
+/// ranges of an index or of chunk extents short.
+///
+/// The sort is out-of-core: sorted runs bounded by the memory budget are
+/// spilled to a temporary file and merged into the output. Internal waveform
+/// data travels with its point and the waveform address of every record is
+/// rewritten for the new layout. The output carries a chunk table
+/// (see Writer::setChunkSize) so readers can skip chunks by extent.
+class LIBHSL_API SpatialSorter
+{
+public:
+    /// Computes the sort key of record i of block. It is called once per
+    /// record in file order, so it may carry state from one record to the next.
+    typedef std::function<uint64_t(PointBlock const& block, size_t i)> KeyFunction;
+
+    SpatialSorter(SpatialCurve curve = SC_Hilbert);
+
+    void setCurve(SpatialCurve curve) { _curve = curve; }
+    SpatialCurve getCurve() const { return _curve; }
+
+    /// Upper bound, in bytes, of the records and waveforms held in memory
+    /// while building a run, and of the merge buffers. Default 256 MB.
+    void setMaxMemoryUsage(size_t bytes) { _maxMemory = bytes; }
+    size_t getMaxMemoryUsage() const { return _maxMemory; }
+
+    /// Points per entry of the output chunk table, 0 to write none. Default 65536.
+    void setChunkSize(uint32_t count) { _chunkSize = count; }
+    uint32_t getChunkSize() const { return _chunkSize; }
+
+    /// Prefix of the temporary run files, the output file name by default.
+    void setTempFileName(std::string const& name) { _tempName = name; }
+
+    /// Sorts the points of inputFile into outputFile. The input is not modified.
+    /// Returns false if outputFile cannot be created or its chunk table written.
+    /// @exception may throw std::exception
+    bool sort(std::string const& inputFile, std::string const& outputFile);
+
+    /// Sorts the points of inputFile into outputFile by the keys computed by
+    /// key. Points with equal keys keep their input order.
+    /// @exception may throw std::exception
+    bool sort(std::string const& inputFile, std::string const& outputFile, KeyFunction const& key);
+
+    /// Computes the key grid of the file read by reader from its header extent,
+    /// or from its points when the header extent is not set.
+    static bool computeGrid(Reader& reader, SpatialGrid& grid);
+
+    /// Number of sorted runs the last sort spilled, 1 when it fit in memory.
+    uint32_t getRunCount() const { return _runCount; }
+
+private:
+    SpatialCurve    _curve;
+    size_t          _maxMemory;
+    uint32_t        _chunkSize;
+    std::string     _tempName;
+    uint32_t        _runCount;
+};
+
+typedef std::shared_ptr<SpatialSorter> SpatialSorterPtr;
+
+}
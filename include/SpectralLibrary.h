@@ -0,0 +1,112 @@
+/*************************************************************************************
+ * 
+ * 
+ * Copyright (c) 2021, Zhengjun Liu <zjliu@casm.ac.cn>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ ************************************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+#include "hslLIB.h"
+
+namespace hsl
+{
+
+/// The reference spectrum of a material: one value per band, and the
+/// classification of points that match it.
+struct SpectralSignature
+{
+    std::string name;
+    uint8_t classification;
+    std::vector<double> values;
+};
+
+enum SpectralMetric
+{
+    SM_Angle,                   ///< spectral angle in radians, lower is better
+    SM_InformationDivergence,   ///< spectral information divergence, lower is better
+    SM_Correlation              ///< Pearson correlation, higher is better
+};
+
+/// A set of reference spectra that band vectors are matched against. The
+/// signatures are prepared for every metric as they are added, so that
+/// match() only reads the library and may run on several threads at once.
+///
+/// Band vectors are matched a tile of points at a time: the tile stays in
+/// cache while it is screened against every signature along the points of
+/// the tile, which vectorizes. Angles and correlations are screened in
+/// single precision, the divergence in double precision. The signatures
+/// screened within the error bound of the best one are then ranked by
+/// their score() in double precision, so the match is that of score().
+class LIBHSL_API SpectralLibrary
+{
+public:
+    /// An empty library of signatures with bands values each.
+    explicit SpectralLibrary(size_t bands);
+
+    /// Throws std::invalid_argument if signature does not have one value
+    /// per band or has no positive value.
+    void add(SpectralSignature const& signature);
+
+    size_t size() const { return m_signatures.size(); }
+    bool empty() const { return m_signatures.empty(); }
+    size_t getBandCount() const { return m_bands; }
+    SpectralSignature const& getSignature(size_t i) const { return m_signatures[i]; }
+
+    /// Whether score a is a better match than score b under metric.
+    static bool isBetter(SpectralMetric metric, double a, double b);
+
+    /// Finds the best signature for each of n band vectors, held as columns:
+    /// band b of vector p at columns[b * stride + p]. Stores its index in
+    /// best and its score in scores, or -1 and NaN for a vector without a
+    /// direction (all zero, or constant for SM_Correlation).
+    void match(const double* columns, size_t stride, size_t n, SpectralMetric metric,
+               int32_t* best, double* scores) const;
+
+    /// Score of the band values x against signature i.
+    double score(const double* x, size_t i, SpectralMetric metric) const;
+
+private:
+    size_t m_bands;
+    std::vector<SpectralSignature> m_signatures;
+
+    // prepared signatures, row-major signatures x bands, in double and,
+    // for the angle and correlation, in single precision
+    std::vector<double> m_unit;             // r / |r|
+    std::vector<double> m_centred;          // (r - mean) / |r - mean|, or 0
+    std::vector<double> m_distribution;     // q = r / sum(r), r clamped above 0
+    std::vector<double> m_logDistribution;  // log q
+    std::vector<float> m_unitSingle;
+    std::vector<float> m_centredSingle;
+};
+
+typedef std::shared_ptr<SpectralLibrary> SpectralLibraryPtr;
+
+}
@@ -0,0 +1,145 @@
+/*************************************************************************************
+ * 
+ * 
+ * Copyright (c) 2021, Zhengjun Liu <zjliu@casm.ac.cn>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ ************************************************************************************/
+#pragma once
+
+#include <stdint.h>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include "hslLIB.h"
+#include "FieldAccessor.h"
+#include "Header.h"
+#include "Pipeline.h"
+#include "SpectralLibrary.h"
+
+namespace hsl
+{
+
+class PointBlock;
+class Reader;
+class Writer;
+
+enum UnmixingConstraint
+{
+    UC_None,            ///< ordinary least squares
+    UC_SumToOne,        ///< abundances sum to one
+    UC_NonNegative,     ///< abundances are not negative
+    UC_Full             ///< abundances are not negative and sum to one
+};
+
+/// Linear spectral unmixing: the band values x of a point are modelled as
+/// a mix E a of the spectra of a few endmembers, the columns of E, and the
+/// abundances a are found by least squares under the chosen constraint.
+/// Everything that depends on the endmembers only, the Gram matrix E'E and
+/// its inverse, is computed once, so that unmix() only reads the unmixer
+/// and may run on several threads at once.
+///
+///     hsl::SpectralUnmixer unmixer(endmembers, hsl::UC_Full);
+///     hsl::Header header = unmixer.createHeader(reader.getHeader());
+///     hsl::Writer writer("abundances.hsp", header);
+///     writer.open();
+///     hsl::unmixBands(reader, writer, unmixer);
+class LIBHSL_API SpectralUnmixer
+{
+public:
+    /// Throws std::invalid_argument if there are no endmembers, their
+    /// spectra differ in length, there are more endmembers than bands or
+    /// the spectra are linearly dependent.
+    SpectralUnmixer(std::vector<SpectralSignature> const& endmembers, UnmixingConstraint constraint);
+
+    UnmixingConstraint getConstraint() const { return m_constraint; }
+    size_t getBandCount() const { return m_bands; }
+    size_t getEndmemberCount() const { return m_names.size(); }
+    std::string const& getEndmemberName(size_t k) const { return m_names[k]; }
+
+    /// Unmixes n band vectors held as columns: band b of vector p at
+    /// columns[b * stride + p]. Abundance k of vector p is written to
+    /// abundances[k * n + p] and, unless residuals is 0, the root mean
+    /// square of the residual bands to residuals[p].
+    void unmix(const double* columns, size_t stride, size_t n, double* abundances,
+               double* residuals = 0) const;
+
+    /// Unmixes the band values of one point.
+    void unmix(const double* bands, double* abundances) const;
+
+    /// header with one DT_FLOAT FI_Abundance field per endmember, described
+    /// by the name of the endmember, in place of any it had, and without
+    /// waveform data.
+    Header createHeader(Header const& header) const;
+
+private:
+    UnmixingConstraint          m_constraint;
+    size_t                      m_bands;
+    std::vector<std::string>    m_names;
+    std::vector<double>         m_endmembers;   // row-major endmembers x bands, E'
+    std::vector<double>         m_gram;         // E'E
+    std::vector<double>         m_inverse;      // (E'E)^-1
+    std::vector<double>         m_correction;   // (E'E)^-1 1 / (1'(E'E)^-1 1)
+};
+
+typedef std::shared_ptr<SpectralUnmixer> SpectralUnmixerPtr;
+
+/// Replaces the records of source in each block by records of target
+/// holding the abundances of the source bands in its FI_Abundance fields.
+/// The other fields that target shares with source are copied.
+class LIBHSL_API SpectralUnmixingStage: public SchemaStage
+{
+public:
+    /// Throws std::invalid_argument if source does not have the bands of
+    /// unmixer or target has fewer FI_Abundance fields than endmembers.
+    SpectralUnmixingStage(SpectralUnmixer const& unmixer, Header const& source, Header const& target);
+
+    void prepare(size_t workers);
+
+protected:
+    void rewrite(PointBlock const& in, PointBlock& out, size_t worker);
+
+private:
+    struct Scratch
+    {
+        std::vector<double> bands;
+        std::vector<double> abundances;
+    };
+
+    SpectralUnmixer m_unmixer;
+    std::vector<FieldAccessor> m_bands;             // source bands
+    std::vector<FieldAccessor> m_abundances;        // target abundances
+    std::vector<Scratch> m_scratch;
+};
+
+/// Writes the points left in reader to writer with the abundances of their
+/// bands, on concurrency threads (one per hardware thread if 0), in file
+/// order. The writer's header is usually unmixer.createHeader() of the
+/// reader's. Returns the number of points written.
+LIBHSL_API uint64_t unmixBands(Reader& reader, Writer& writer, SpectralUnmixer const& unmixer,
+                               size_t concurrency = 0);
+
+}
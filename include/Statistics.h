@@ -0,0 +1,242 @@
+/*************************************************************************************
+ * 
+ * 
+ * Copyright (c) 2021, Zhengjun Liu <zjliu@casm.ac.cn>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ ************************************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <vector>
+#include "hslLIB.h"
+#include "IdDefinitions.h"
+#include "FieldAccessor.h"
+
+namespace hsl
+{
+
+class Header;
+class PointBlock;
+class Reader;
+
+/// A bin of a Histogram, counting the values in [lower, upper).
+struct HistogramBin
+{
+    double lower;
+    double upper;
+    uint64_t count;
+};
+
+/// A histogram that needs no value range up front. Values fall into bins
+/// of a power-of-two width on a grid through 0; whenever the values span
+/// more bins than the histogram has, the width doubles and neighbouring
+/// bins join. The values therefore end up in between bins / 2 and bins
+/// bins, and two histograms of the same bin count merge exactly into the
+/// histogram of all their values, whichever width each had.
+class LIBHSL_API Histogram
+{
+public:
+    /// A histogram of at most bins bins (at least 2). Values that are
+    /// integral start out in bins of width 1.
+    explicit Histogram(size_t bins = 256, bool integral = false);
+
+    void clear();
+
+    /// Adds the n values at values. NaNs are skipped.
+    void add(const double* values, size_t n);
+
+    /// Adds the values of other, which must have the same bin count.
+    void merge(Histogram const& other);
+
+    size_t getMaxBinCount() const { return _counts.size(); }
+    uint64_t getCount() const { return _total; }
+    double getBinWidth() const;
+
+    /// The bins from the lowest to the highest value added, with their
+    /// bounds mapped by value * scale + offset.
+    std::vector<HistogramBin> getBins(double scale = 1.0, double offset = 0.0) const;
+
+private:
+    bool                    _integral;
+    int                     _exponent;  // bin width is 2^_exponent
+    int64_t                 _first;     // grid index of _counts[0]
+    int64_t                 _low;       // grid indices of the lowest and
+    int64_t                 _high;      // highest bins holding a value
+    uint64_t                _total;
+    std::vector<uint64_t>   _counts;
+
+    void insert(double value);
+    void coarsen();
+    void rebase(int64_t first);
+};
+
+/// A field of a statistics pass: the n-th schema field with id.
+typedef std::pair<FieldId, size_t> StatisticsField;
+typedef std::vector<StatisticsField> StatisticsFieldArray;
+
+/// Count, extremes, mean, variance and histogram of the values of one
+/// field. The moments and the histogram are kept on the stored values and
+/// reported with the scale and offset of the field applied.
+class LIBHSL_API FieldStatistics
+{
+public:
+    FieldStatistics(std::string const& name, FieldAccessor const& accessor, size_t n, size_t bins);
+
+    /// Adds the n stored values at raw. NaNs are skipped.
+    void add(const double* raw, size_t n);
+
+    /// Adds the values of other, a summary of the same field.
+    void merge(FieldStatistics const& other);
+
+    std::string const& getName() const { return _name; }
+    FieldId getId() const { return _accessor.getId(); }
+    size_t getIndex() const { return _index; }
+    FieldAccessor const& getAccessor() const { return _accessor; }
+
+    uint64_t getCount() const { return _count; }
+    double getMinimum() const;
+    double getMaximum() const;
+    /// NaN if the values were not read, see Statistics::computeFromHeader.
+    double getMean() const;
+    /// Population variance, NaN if the values were not read.
+    double getVariance() const;
+    double getStandardDeviation() const;
+
+    Histogram const& getHistogram() const { return _histogram; }
+    /// The bins of the histogram in the units of the field.
+    std::vector<HistogramBin> getBins() const;
+
+private:
+    friend class Statistics;
+
+    std::string     _name;
+    FieldAccessor   _accessor;
+    size_t          _index;
+    uint64_t        _count;
+    double          _minimum;       // stored values
+    double          _maximum;
+    double          _mean;
+    double          _m2;            // sum of squared deviations from _mean
+    bool            _moments;       // whether _mean and _m2 are known
+    Histogram       _histogram;
+
+    void combine(uint64_t count, double minimum, double maximum, double mean, double m2);
+    void setRange(uint64_t count, double minimum, double maximum);
+};
+
+/// Summary statistics of a point file: per field and per band count,
+/// minimum, maximum, mean, variance and histogram, the number of points of
+/// each return number and of each classification.
+///
+/// compute() reads the points in one pass on several threads, each adding
+/// the blocks it is handed to statistics of its own, which are merged at
+/// the end. computeFromHeader() only looks at the header and the zone map
+/// of a file and does not read any points.
+///
+///     hsl::Statistics stats;
+///     stats.compute(reader);
+///     hsl::FieldStatistics const* z = stats.findField(hsl::FI_Z);
+class LIBHSL_API Statistics
+{
+public:
+    Statistics();
+
+    /// Fields to summarize, by default every numeric field of the schema
+    /// but the waveform packet pointers.
+    void setFields(StatisticsFieldArray const& fields) { m_fields = fields; }
+    StatisticsFieldArray const& getFields() const { return m_fields; }
+    static StatisticsFieldArray getDefaultFields(Header const& header);
+
+    /// Maximum number of bins of each histogram, 256 by default.
+    void setBinCount(size_t bins);
+    size_t getBinCount() const { return m_bins; }
+
+    /// Threads reading points, one per hardware thread by default (0).
+    void setConcurrency(size_t threads) { m_concurrency = threads; }
+    /// Points per block handed to a thread, 4096 by default.
+    void setBlockSize(uint32_t size) { m_blockSize = size; }
+
+    /// Summarizes the points left in reader, after its filters, and
+    /// returns their number. Replaces any statistics held.
+    uint64_t compute(Reader& reader);
+
+    /// Summarizes reader from its header alone: the point and return
+    /// counts, and the minimum and maximum of the coordinates and of the
+    /// fields its zone map keeps, or of the header extent if the file has
+    /// no zone map. Fields without a range are left out.
+    void computeFromHeader(Reader const& reader);
+
+    /// Starts empty statistics of the points of header, to which add()
+    /// and merge() add.
+    void reset(Header const& header);
+
+    /// Adds the points of block, whose header must be that of reset().
+    void add(PointBlock const& block);
+
+    /// Adds the statistics of other, which must summarize the same fields
+    /// with the same bin count, e.g. those of another part of a file.
+    void merge(Statistics const& other);
+
+    /// Whether the statistics come from computeFromHeader().
+    bool isHeaderOnly() const { return m_headerOnly; }
+
+    uint64_t getPointCount() const { return m_count; }
+    std::vector<FieldStatistics> const& getFieldStatistics() const { return m_stats; }
+    /// The statistics of the n-th field with id, 0 if it was not summarized.
+    FieldStatistics const* findField(FieldId id, size_t n = 0) const;
+
+    /// Number of points of each return number, indexed by return number.
+    std::vector<uint64_t> const& getReturnCounts() const { return m_returns; }
+    /// Number of points of each classification, indexed by class; empty
+    /// if the classifications were not read.
+    std::vector<uint64_t> const& getClassificationCounts() const { return m_classes; }
+
+private:
+    StatisticsFieldArray            m_fields;
+    size_t                          m_bins;
+    size_t                          m_concurrency;
+    uint32_t                        m_blockSize;
+
+    Header const*                   m_header;
+    bool                            m_headerOnly;
+    uint64_t                        m_count;
+    std::vector<FieldStatistics>    m_stats;
+    std::vector<uint64_t>           m_returns;
+    std::vector<uint64_t>           m_classes;
+
+    // decoding of add()
+    FieldAccessor                   m_returnNumber;
+    FieldAccessor                   m_classification;
+    std::vector<double>             m_column;
+
+    static void tally(FieldAccessor const& accessor, PointBlock const& block,
+                      std::vector<double>& column, std::vector<uint64_t>& counts);
+};
+
+}
@@ -0,0 +1,103 @@
+/*************************************************************************************
+ * 
+ * 
+ * Copyright (c) 2021, Zhengjun Liu <zjliu@casm.ac.cn>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ ************************************************************************************/
+
+#pragma once
+
+#include <stddef.h>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include "hslLIB.h"
+
+namespace hsl
+{
+
+/// A fixed set of worker threads running submitted tasks in submission
+/// order. The destructor waits for the queued tasks to finish.
+///
+///     hsl::ThreadPool pool;
+///     std::future<size_t> n = pool.submit([&] { return countPoints(reader); });
+class LIBHSL_API ThreadPool
+{
+public:
+    /// Starts threads workers, one per hardware thread if 0.
+    explicit ThreadPool(size_t threads = 0);
+    ~ThreadPool();
+
+    size_t size() const { return _threads.size(); }
+
+    /// Queues f and returns a future for its result or exception.
+    template <typename F>
+    std::future<typename std::result_of<F()>::type> submit(F f)
+    {
+        typedef typename std::result_of<F()>::type R;
+        std::shared_ptr<std::packaged_task<R()> > task(new std::packaged_task<R()>(f));
+        std::future<R> result = task->get_future();
+        enqueue([task]() { (*task)(); });
+        return result;
+    }
+
+    typedef std::function<void(size_t begin, size_t end, size_t worker)> RangeFunction;
+
+    /// Calls fn(begin, end, worker) for consecutive ranges of at most grain
+    /// items that cover [0, count), and returns when all are done. The
+    /// calling thread and up to workers - 1 tasks of the pool (size() + 1
+    /// workers in all if 0) claim the next range as soon as they are done
+    /// with one, so ranges of uneven cost balance out. Calls on the same
+    /// worker, in [0, workers), never overlap. The first exception thrown by
+    /// fn stops the claiming and is rethrown. Since the caller works too, a
+    /// task of the pool may itself call parallelFor.
+    void parallelFor(size_t count, size_t grain, RangeFunction const& fn, size_t workers = 0);
+
+    /// Number of hardware threads, at least 1.
+    static size_t getDefaultSize();
+
+private:
+    void enqueue(std::function<void()> const& task);
+    void work();
+
+    std::vector<std::thread>            _threads;
+    std::deque<std::function<void()> >  _tasks;
+    std::mutex                          _mutex;
+    std::condition_variable             _ready;
+    bool                                _stop;
+
+    ThreadPool(ThreadPool const& other);
+    ThreadPool& operator=(ThreadPool const& rhs);
+};
+
+typedef std::shared_ptr<ThreadPool> ThreadPoolPtr;
+
+}
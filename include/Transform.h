@@ -40,8 +40,12 @@
 
 #include "hslLIB.h"
 #include "Point.h"
+#include "PointBlock.h"
+#include "FieldAccessor.h"
+#include "FilterExpression.h"
 #include "Exception.h"
 #include "SpatialReference.h"
+#include "SpectralLibrary.h"
 
 namespace hsl {
 
@@ -51,12 +55,31 @@ class LIBHSL_API TransformInterface
 public:
     
     virtual bool transform(Point& point) = 0;
+
+    /// Transforms every record of block in place. The default decodes one
+    /// point at a time; transforms with a cheaper bulk path override it.
+    /// A transform that moves points to another header leaves block
+    /// pointing at that header.
+    virtual bool transform(PointBlock& block);
+
     virtual bool ModifiesHeader() = 0;
     virtual ~TransformInterface() {}
 };
 
 typedef std::shared_ptr<TransformInterface> TransformPtr;
 
+namespace detail {
+
+// Coordinate kernels for batch transforms. decodeCoordinates scales the raw
+// X, Y and Z of the records of block by the scale and offset of header;
+// encodeCoordinates stores x, y and z back as raw values of header, rounding
+// like Point::setX, and throws std::domain_error for a value the raw
+// coordinates cannot hold. SSE2 is used when the target supports it.
+LIBHSL_API void decodeCoordinates(PointBlock const& block, Header const& header, double* x, double* y, double* z);
+LIBHSL_API void encodeCoordinates(PointBlock& block, Header const& header, const double* x, const double* y, const double* z);
+
+}
+
 class LIBHSL_API ReprojectionTransform: public TransformInterface
 {
 public:
@@ -85,14 +108,22 @@ private:
     void Initialize(SpatialReference const& inSRS, SpatialReference const& outSRS);
 };
 
+/// Scales and shifts coordinates. The expression is a space separated list
+/// of operations such as "x*0.3048 y*0.3048 z+12.5", applied in order. The
+/// operations are compiled into one affine matrix, which is applied to the
+/// raw coordinates with a single rounding per coordinate.
 class LIBHSL_API TranslationTransform: public TransformInterface
 {
 public:
     
     TranslationTransform(std::string const& expression);
+    /// A row-major 4x4 affine matrix applied to (x, y, z, 1), e.g. a rigid
+    /// or boresight correction. The last row must be 0 0 0 1.
+    TranslationTransform(boost::array<double, 16> const& matrix);
     ~TranslationTransform();
 
     bool transform(Point& point);
+    bool transform(PointBlock& block);
     bool ModifiesHeader() { return false; }
     
     enum OPER_TYPE
@@ -122,10 +153,19 @@ private:
     TranslationTransform& operator=(TranslationTransform const& rhs);
     
     operation GetOperation(std::string const& expression);
+    void setIdentity();
+    void compile(Header const* header);
     
     std::vector<operation> operations;
     
     std::string m_expression;
+
+    double m_matrix[12];        // affine rows of the scaled coordinates
+    Header const* m_header;     // header m_raw is compiled for
+    double m_raw[12];           // the same transform on raw coordinates of m_header
+    std::vector<double> m_x;
+    std::vector<double> m_y;
+    std::vector<double> m_z;
 };
 
 
@@ -166,6 +206,113 @@ private:
     void Initialize();
 };
 
+/// Computes a spectral index or any other band math for every point, such
+/// as the NDVI "(band[80] - band[52]) / (band[80] + band[52])" or a scaled
+/// ratio "band[30] / band[12] * 1000". The expression uses the syntax of
+/// FilterExpression and is compiled against the schema of each new header.
+///
+/// The result goes to the n-th field with id target, with the field scale
+/// and offset removed and integer fields rounded and saturated. Without a
+/// target the result is only kept as a column: getValues() holds one value
+/// per record of the last block transformed.
+class LIBHSL_API SpectralIndexTransform: public TransformInterface
+{
+public:
+
+    /// Throws hsl::invalid_expression on a syntax error.
+    SpectralIndexTransform(std::string const& expression);
+    SpectralIndexTransform(std::string const& expression, FieldId target, size_t n = 0);
+    ~SpectralIndexTransform();
+
+    bool transform(Point& point);
+    bool transform(PointBlock& block);
+    bool ModifiesHeader() { return false; }
+
+    FilterExpression const& getExpression() const { return m_expression; }
+    std::vector<double> const& getValues() const { return m_values; }
+
+private:
+
+    FilterExpression m_expression;
+    FieldId m_target_id;
+    size_t m_target_index;
+    Header const* m_header;
+    FieldAccessor m_target;
+    std::vector<double> m_values;
+
+    void compile(Header const* header);
+
+    SpectralIndexTransform(SpectralIndexTransform const& other);
+    SpectralIndexTransform& operator=(SpectralIndexTransform const& rhs);
+};
+
+/// Classifies points by the signature of a SpectralLibrary that their band
+/// values match best, under the spectral angle, the spectral information
+/// divergence or the correlation. The classification of the best signature
+/// goes to FI_Classification, or to another field set with setClassField;
+/// points whose best score is worse than the threshold, or that cannot be
+/// scored, get the unmatched class instead. The score may be stored in a
+/// field as well. The library is only read, so transforms running on
+/// several threads share it:
+///
+///     hsl::SpectralLibraryPtr library(new hsl::SpectralLibrary(bands));
+///     ...
+///     pipeline.addTransform([library]() {
+///         return hsl::TransformPtr(new hsl::SpectralMatchTransform(library, hsl::SM_Angle)); });
+class LIBHSL_API SpectralMatchTransform: public TransformInterface
+{
+public:
+
+    /// Throws std::invalid_argument for an empty library.
+    SpectralMatchTransform(SpectralLibraryPtr library, SpectralMetric metric);
+    ~SpectralMatchTransform();
+
+    /// The n-th field with id receives the classification, FI_Classification by default.
+    void setClassField(FieldId id, size_t n = 0);
+    /// The n-th field with id receives the score; by default it is not stored.
+    void setScoreField(FieldId id, size_t n = 0);
+    /// Scores worse than threshold do not match; by default all scores match.
+    void setThreshold(double threshold) { m_threshold = threshold; m_has_threshold = true; }
+    /// Classification of points that match no signature, 1 (unclassified) by default.
+    void setUnmatchedClass(uint8_t classification) { m_unmatched = classification; }
+
+    bool transform(Point& point);
+    bool transform(PointBlock& block);
+    bool ModifiesHeader() { return false; }
+
+    /// Index of the best signature, or -1, and its score, for every record
+    /// of the last block transformed.
+    std::vector<int32_t> const& getMatches() const { return m_matches; }
+    std::vector<double> const& getScores() const { return m_scores; }
+
+private:
+
+    SpectralLibraryPtr m_library;
+    SpectralMetric m_metric;
+    FieldId m_class_id;
+    size_t m_class_index;
+    FieldId m_score_id;
+    size_t m_score_index;
+    double m_threshold;
+    bool m_has_threshold;
+    uint8_t m_unmatched;
+
+    Header const* m_header;
+    std::vector<FieldAccessor> m_bands;
+    FieldAccessor m_class;
+    FieldAccessor m_score;
+    std::vector<double> m_columns;
+    std::vector<int32_t> m_matches;
+    std::vector<double> m_scores;
+    std::vector<double> m_classes;
+
+    void compile(Header const* header);
+    void classify(uint8_t* records, size_t stride, size_t n);
+
+    SpectralMatchTransform(SpectralMatchTransform const& other);
+    SpectralMatchTransform& operator=(SpectralMatchTransform const& rhs);
+};
+
 typedef std::shared_ptr<TransformInterface> TransformPtr;
 
 }
@@ -40,6 +40,7 @@
 #include "Point.h"
 #include "Filter.h"
 #include "Transform.h"
+#include "WaveformCache.h"
 
 namespace hsl
 {
@@ -94,6 +95,13 @@ public:
     // update the field value by field index for the current point record
     bool writeFieldValue(size_t index, Variant& value);
 
+    /// Keeps the waveform data read by readNextPoint and readPointAt in
+    /// cache, and stores the waveform data written by writePoint in it, so
+    /// readers sharing the cache see the update. 0, the default, disables
+    /// caching.
+    void setWaveformCache(WaveformCachePtr cache) { _waveformCache = cache; }
+    WaveformCachePtr getWaveformCache() const { return _waveformCache; }
+
     /// Sets filters that are used to determine whether or not to 
     /// keep a point that was read from the file.  Filters have *no* 
     /// effect for reading data at specific locations in the file.  
@@ -120,6 +128,10 @@ protected:
     /// @exception may throw std::exception
     bool readWaveformData();
 
+    /// Reads size bytes of waveform data at pos into data, keeping the file
+    /// position. Throws hsl::libhsl_error if the file ends first.
+    void loadWaveformData(uint64_t pos, uint32_t size, std::vector<uint8_t>& data);
+
 private:
     bool writeRawValueToField(const Field& field, const Variant& value);
 
@@ -133,6 +145,7 @@ private:
     std::vector<hsl::FilterPtr>     _filters;
     std::vector<hsl::TransformPtr>  _transforms;
     std::vector<uint8_t>::size_type _recordSize;
+    WaveformCachePtr                _waveformCache;
 };
 
 
@@ -0,0 +1,98 @@
+/*************************************************************************************
+ * 
+ * 
+ * Copyright (c) 2021, Zhengjun Liu <zjliu@casm.ac.cn>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ ************************************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <cstddef>
+#include <vector>
+#include "hslLIB.h"
+
+namespace hsl
+{
+
+/// The waveform data of a set of points, fetched by Reader::readWaveforms
+/// into one buffer. Entry i holds the data of the i-th point or record
+/// passed to the read, as a span of that buffer; entries of points that
+/// share data share the bytes.
+///
+///     hsl::WaveformBatch batch;
+///     reader.readWaveforms(block, batch);
+///     for (size_t i = 0; i < batch.size(); ++i)
+///         if (decoder.decode(batch.getData(i), batch.getSize(i), 0, samples))
+///             analyse(samples);
+class LIBHSL_API WaveformBatch
+{
+public:
+    WaveformBatch() : _reads(0) {}
+
+    size_t size() const { return _spans.size(); }
+    bool empty() const { return _spans.empty(); }
+    void clear()
+    {
+        _buffer.clear();
+        _spans.clear();
+        _reads = 0;
+    }
+
+    /// Waveform data of entry i, 0 if it has none.
+    const uint8_t* getData(size_t i) const
+    {
+        return _spans[i].size ? &_buffer[_spans[i].offset] : 0;
+    }
+    uint32_t getSize(size_t i) const { return _spans[i].size; }
+    bool hasData(size_t i) const { return _spans[i].size > 0; }
+
+    /// Copies the waveform data of entry i to data.
+    void getData(size_t i, std::vector<uint8_t>& data) const
+    {
+        const uint8_t* p = getData(i);
+        data.assign(p, p + getSize(i));
+    }
+
+    /// Bytes read into the batch, including gaps read through, and the
+    /// number of reads it took.
+    size_t getBytesRead() const { return _buffer.size(); }
+    size_t getReadCount() const { return _reads; }
+
+private:
+    friend class Reader;
+
+    struct Span
+    {
+        size_t      offset;     // in _buffer
+        uint32_t    size;
+    };
+
+    std::vector<uint8_t>    _buffer;
+    std::vector<Span>       _spans;
+    size_t                  _reads;
+};
+
+}
@@ -0,0 +1,111 @@
+/*************************************************************************************
+ * 
+ * 
+ * Copyright (c) 2021, Zhengjun Liu <zjliu@casm.ac.cn>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ ************************************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <cstddef>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "hslLIB.h"
+
+namespace hsl
+{
+
+/// A least recently used cache of waveform data, bounded by the bytes it
+/// holds and safe to share between threads. Entries are identified by the
+/// byte offset of the waveform data in its file, so a cache may be shared
+/// by any number of Reader and Updater instances of one file, but not
+/// across files.
+///
+///     hsl::WaveformCachePtr cache(new hsl::WaveformCache(64 << 20));
+///     reader.setWaveformCache(cache);
+///     updater.setWaveformCache(cache);
+///
+/// An Updater writing waveform data stores it in the cache as well, so the
+/// readers sharing the cache see the new data.
+class LIBHSL_API WaveformCache
+{
+public:
+    typedef std::vector<uint8_t> Data;
+    typedef std::shared_ptr<const Data> DataPtr;
+    typedef std::function<void(uint64_t offset, uint32_t size, Data& data)> Loader;
+
+    /// Holds up to capacity bytes of waveform data, 64 MiB by default.
+    explicit WaveformCache(size_t capacity = 64 << 20);
+
+    /// The size bytes of waveform data at offset, loaded with load if the
+    /// cache does not hold them. Loading runs without the cache locked.
+    /// Data larger than the capacity is returned but not kept.
+    DataPtr get(uint64_t offset, uint32_t size, Loader const& load);
+
+    /// Stores data as the waveform data at offset, replacing any held.
+    void put(uint64_t offset, Data const& data);
+
+    /// Drops the waveform data at offset.
+    void erase(uint64_t offset);
+
+    /// Maximum number of bytes held.
+    void setCapacity(size_t capacity);
+    size_t getCapacity() const;
+    /// Bytes and entries held.
+    size_t getByteSize() const;
+    size_t size() const;
+    void clear();
+
+    uint64_t getHits() const;
+    uint64_t getMisses() const;
+
+private:
+    typedef std::pair<uint64_t, DataPtr> Entry;
+    typedef std::list<Entry> EntryList;
+
+    void insert(uint64_t offset, DataPtr const& data);
+    void remove(std::unordered_map<uint64_t, EntryList::iterator>::iterator it);
+    void evict();
+
+    size_t _capacity;
+    size_t _bytes;
+    EntryList _entries;     // most recently used first
+    std::unordered_map<uint64_t, EntryList::iterator> _index;
+    uint64_t _hits;
+    uint64_t _misses;
+    mutable std::mutex _mutex;
+
+    WaveformCache(WaveformCache const& other);
+    WaveformCache& operator=(WaveformCache const& rhs);
+};
+
+typedef std::shared_ptr<WaveformCache> WaveformCachePtr;
+
+}
@@ -0,0 +1,114 @@
+/*************************************************************************************
+ * 
+ * 
+ * Copyright (c) 2021, Zhengjun Liu <zjliu@casm.ac.cn>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ ************************************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <cstddef>
+#include <vector>
+#include "hslLIB.h"
+#include "hslDefinitions.h"
+
+namespace hsl
+{
+
+class Header;
+class Point;
+
+/// Decodes the waveform packets of points into calibrated samples,
+///     value = gain * sample + offset
+/// with the gain and offset of the packet's WaveformPacketDesc. Samples are
+/// packed least significant bit first at the descriptor's sampleBits; 8, 12
+/// and 16 bit samples are unpacked with SIMD where the target supports it.
+///
+/// A packet refers to the descriptor whose id is its descriptorIndex, or,
+/// if there is none, to the descriptorIndex-th descriptor of the header.
+///
+///     hsl::WaveformDecoder decoder(reader.getHeader());
+///     while (reader.readNextPoint(true))
+///         if (decoder.decode(reader.getPoint(), 0, samples))
+///             analyse(samples);
+class LIBHSL_API WaveformDecoder
+{
+public:
+    explicit WaveformDecoder(Header const& header);
+
+    /// Samples of band in the waveform data of a point, as read by
+    /// Reader::readWaveformData. Returns false if the data has no packet for
+    /// band. Throws hsl::libhsl_error for a malformed or compressed packet.
+    bool decode(std::vector<uint8_t> const& waveformData, uint16_t band, std::vector<float>& samples) const;
+    bool decode(Point const& point, uint16_t band, std::vector<float>& samples) const;
+    /// The same for size bytes of waveform data, e.g. an entry of a
+    /// WaveformBatch.
+    bool decode(const uint8_t* waveformData, size_t size, uint16_t band, std::vector<float>& samples) const;
+
+    /// Samples of band of every point, concatenated in samples. offsets gets
+    /// points.size() + 1 entries; the samples of point i are
+    /// [offsets[i], offsets[i + 1]), empty if it has no packet for band.
+    /// Returns the number of points with a packet.
+    size_t decode(std::vector<Point> const& points, uint16_t band,
+                  std::vector<float>& samples, std::vector<size_t>& offsets) const;
+
+    /// Number of packets in the waveform data of a point.
+    static uint16_t getPacketCount(std::vector<uint8_t> const& waveformData);
+    static uint16_t getPacketCount(const uint8_t* waveformData, size_t size);
+
+    /// Samples of the index-th packet of waveformData, whose definition is
+    /// stored in def. Throws hsl::libhsl_error like decode, and for an index
+    /// beyond getPacketCount.
+    void decodePacket(std::vector<uint8_t> const& waveformData, uint16_t index,
+                      WaveformPacketDataDefinition& def, std::vector<float>& samples) const;
+    void decodePacket(const uint8_t* waveformData, size_t size, uint16_t index,
+                      WaveformPacketDataDefinition& def, std::vector<float>& samples) const;
+
+    /// Descriptor of a packet, 0 if the header has none.
+    WaveformPacketDesc const* getDescriptor(WaveformPacketDataDefinition const& def) const;
+
+    /// Unpacks count samples of bits bits (1 to 32) from packet and stores
+    /// gain * sample + offset in out.
+    static void unpack(const uint8_t* packet, size_t count, unsigned bits,
+                       double gain, double offset, float* out);
+
+    /// Bytes taken by count samples of bits bits.
+    static size_t getPacketSize(size_t count, unsigned bits)
+    {
+        return (count * bits + 7) / 8;
+    }
+
+private:
+    /// Appends the samples of band in waveformData to samples.
+    bool append(const uint8_t* waveformData, size_t size, uint16_t band, std::vector<float>& samples) const;
+    /// Appends the samples of the packet def of waveformData to samples.
+    void appendPacket(const uint8_t* waveformData, size_t size, WaveformPacketDataDefinition const& def,
+                      std::vector<float>& samples) const;
+
+    WaveformDesc _descriptors;
+};
+
+}
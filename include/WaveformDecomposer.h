@@ -0,0 +1,180 @@
+/*************************************************************************************
+ * 
+ * 
+ * Copyright (c) 2021, Zhengjun Liu <zjliu@casm.ac.cn>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ ************************************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <vector>
+#include "hslLIB.h"
+#include "WaveformDecoder.h"
+#include "WaveformBatch.h"
+#include "PointBlock.h"
+#include "ThreadPool.h"
+
+namespace hsl
+{
+
+class Header;
+class Point;
+class Writer;
+
+/// A return found in a waveform packet, one Gaussian component of the
+/// decomposition.
+struct WaveformReturn
+{
+    uint64_t    point;      ///< index of the point in the decomposed points
+    uint16_t    band;       ///< band of the packet
+    double      time;       ///< peak position, from the first sample, in units of the descriptor's interval
+    double      amplitude;  ///< peak height above the background, calibrated
+    double      width;      ///< standard deviation, in units of time
+    double      x;          ///< position of the peak along the pulse, scaled coordinates
+    double      y;
+    double      z;
+};
+
+/// Decomposes waveforms into a sum of Gaussians. Each packet is calibrated
+/// by a WaveformDecoder, its background and noise are estimated as the
+/// median and scaled median absolute deviation of the samples, peaks that
+/// rise noiseFactor noise levels above the background are detected on a
+/// smoothed copy, and their amplitudes, positions and widths are refined
+/// together by a Levenberg-Marquardt fit.
+///
+/// The position of a return is that of the point moved along the packet's
+/// (dx, dy, dz) by its temporalOffset minus the return time.
+///
+/// decompose(std::vector<Point> const&, ...) spreads the points over a pool
+/// of workers (see ThreadPool::parallelFor). Each worker claims small
+/// batches of points as it becomes free, so that a few expensive waveforms
+/// do not hold up the rest, and keeps its fitting buffers from one waveform
+/// to the next.
+///
+///     hsl::WaveformDecomposer decomposer(reader.getHeader());
+///     std::vector<hsl::WaveformReturn> returns;
+///     decomposer.decompose(points, returns);
+///     decomposer.write(points, returns, writer);
+///
+/// A decomposer may only run one decomposition at a time.
+class LIBHSL_API WaveformDecomposer
+{
+public:
+    explicit WaveformDecomposer(Header const& header);
+    ~WaveformDecomposer();
+
+    /// Peaks must exceed the background by this many noise levels, 3 by
+    /// default, and by at least the minimum amplitude, 0 by default.
+    void setNoiseFactor(double factor) { m_noiseFactor = factor; }
+    double getNoiseFactor() const { return m_noiseFactor; }
+    void setMinAmplitude(double amplitude) { m_minAmplitude = amplitude; }
+    double getMinAmplitude() const { return m_minAmplitude; }
+
+    /// Most returns per packet, the strongest peaks, 8 by default.
+    void setMaxReturns(size_t count);
+    size_t getMaxReturns() const { return m_maxReturns; }
+
+    /// Levenberg-Marquardt iterations per packet, 20 by default; 0 keeps
+    /// the detected peaks.
+    void setMaxIterations(size_t count) { m_maxIterations = count; }
+    size_t getMaxIterations() const { return m_maxIterations; }
+
+    /// Narrowest width of a return, in samples, 0.5 by default.
+    void setMinWidth(double samples) { m_minWidth = samples; }
+    double getMinWidth() const { return m_minWidth; }
+
+    /// Workers of decompose(std::vector<Point> const&, ...), one per
+    /// hardware thread if 0, the default.
+    void setConcurrency(size_t workers) { m_concurrency = workers; }
+    size_t getConcurrency() const { return m_concurrency; }
+
+    /// Points a worker claims at a time, 64 by default.
+    void setBatchSize(size_t points) { m_batchSize = points ? points : 1; }
+    size_t getBatchSize() const { return m_batchSize; }
+
+    /// Runs the workers on pool instead of a pool of the decomposer's own.
+    /// The calling thread is one of the workers.
+    void setThreadPool(ThreadPoolPtr pool) { m_pool = pool; }
+
+    /// Appends the returns of every packet of point to returns, with index
+    /// as their point. Returns the number appended. Throws
+    /// hsl::libhsl_error for malformed waveform data.
+    size_t decompose(Point const& point, uint64_t index, std::vector<WaveformReturn>& returns);
+
+    /// Replaces returns by those of all points, ordered by point, band and
+    /// time. Returns their number.
+    size_t decompose(std::vector<Point> const& points, std::vector<WaveformReturn>& returns);
+
+    /// Replaces returns by those of the records of block, whose waveform
+    /// data is in batch (see Reader::readWaveforms). The point of a return
+    /// is the position of its record in block.
+    size_t decompose(PointBlock const& block, WaveformBatch const& batch, std::vector<WaveformReturn>& returns);
+
+    /// Fits count samples of one waveform and appends the components to
+    /// returns, ordered by time. Only time, amplitude and width are set, in
+    /// samples. Returns the number appended.
+    size_t fit(const float* samples, size_t count, std::vector<WaveformReturn>& returns);
+
+    /// Writes each return as a copy of its point record moved to the
+    /// return, with the return number and number of returns among the
+    /// returns of its packet and the amplitude as intensity, where the
+    /// schema has those fields. The writer's schema must be that of the
+    /// points. Returns the number of points written.
+    uint64_t write(std::vector<Point> const& points, std::vector<WaveformReturn> const& returns, Writer& writer) const;
+
+private:
+    struct Scratch;
+
+    typedef std::function<void(size_t i, Scratch& scratch, std::vector<WaveformReturn>& returns)> Task;
+
+    size_t decompose(const uint8_t* data, size_t size, double x, double y, double z, uint64_t index,
+                     Scratch& scratch, std::vector<WaveformReturn>& returns) const;
+    /// Runs task for [0, count) on the workers, joining the returns in order.
+    size_t run(size_t count, Task const& task, std::vector<WaveformReturn>& returns);
+    size_t fit(const float* samples, size_t count, Scratch& scratch, std::vector<WaveformReturn>& returns) const;
+    void detect(Scratch& scratch, double threshold) const;
+    void refine(Scratch& scratch) const;
+    Scratch& getScratch(size_t worker);
+
+    WaveformDecoder m_decoder;
+    double m_noiseFactor;
+    double m_minAmplitude;
+    size_t m_maxReturns;
+    size_t m_maxIterations;
+    double m_minWidth;
+    size_t m_concurrency;
+    size_t m_batchSize;
+    ThreadPoolPtr m_pool;
+    std::vector<std::shared_ptr<Scratch> > m_scratch;   // per worker, reused across calls
+
+    WaveformDecomposer(WaveformDecomposer const& other);
+    WaveformDecomposer& operator=(WaveformDecomposer const& rhs);
+};
+
+}
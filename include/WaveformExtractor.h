@@ -0,0 +1,114 @@
+/*************************************************************************************
+ * 
+ * 
+ * Copyright (c) 2021, Zhengjun Liu <zjliu@casm.ac.cn>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ ************************************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <cstddef>
+#include <utility>
+#include <vector>
+#include "hslLIB.h"
+#include "FieldAccessor.h"
+#include "PointBlock.h"
+#include "WaveformDecomposer.h"
+
+namespace hsl
+{
+
+class Reader;
+class Writer;
+
+/// Turns the waveforms of a file into points in a single streaming pass.
+/// Blocks of points are read with their waveform data, every packet is
+/// decomposed into returns (see WaveformDecomposer) and each return of the
+/// reference band becomes a point of the writer:
+///
+///  - X, Y and Z are those of the return, the position of the point moved
+///    along the packet's (dx, dy, dz) by temporalOffset minus its time;
+///  - the n-th band value is the amplitude of the return of waveform band
+///    n closest in time, if it lies within two widths, else 0;
+///  - the intensity is the amplitude in the reference band, and the return
+///    number and number of returns count the returns of the packet;
+///  - other fields the writer's schema shares with the reader's are copied
+///    from the source point.
+///
+///     hsl::WaveformExtractor extractor(reader, writer);
+///     extractor.getDecomposer().setNoiseFactor(4.0);
+///     uint64_t returns = extractor.run();
+///
+/// Reading, decomposing and writing overlap, and the decomposition of a
+/// block runs on the decomposer's workers. The reader's filters apply. The
+/// writer's header must not carry waveform data.
+class LIBHSL_API WaveformExtractor
+{
+public:
+    WaveformExtractor(Reader& reader, Writer& writer);
+
+    /// The decomposer, to tune peak detection and concurrency.
+    WaveformDecomposer& getDecomposer() { return m_decomposer; }
+
+    /// Waveform band whose returns become points, 0 by default.
+    void setReferenceBand(uint16_t band) { m_referenceBand = band; }
+    uint16_t getReferenceBand() const { return m_referenceBand; }
+
+    /// Points read per block, 4096 by default.
+    void setBlockSize(uint32_t size) { m_blockSize = size ? size : 1; }
+    uint32_t getBlockSize() const { return m_blockSize; }
+
+    /// Extracts the returns of all points left in the reader and returns
+    /// the number of points written.
+    uint64_t run();
+
+private:
+    void bind();
+    void extract(PointBlock const& block, std::vector<WaveformReturn> const& returns, PointBlock& out);
+
+    Reader& m_reader;
+    Writer& m_writer;
+    WaveformDecomposer m_decomposer;
+    uint16_t m_referenceBand;
+    uint32_t m_blockSize;
+
+    // fields of the output records
+    FieldCopier m_copier;
+    std::vector<FieldAccessor> m_bands;
+    FieldAccessor m_intensity;
+    FieldAccessor m_returnNumber;
+    FieldAccessor m_returnCount;
+
+    std::vector<WaveformReturn> m_returns;
+    std::vector<double> m_x;
+    std::vector<double> m_y;
+    std::vector<double> m_z;
+
+    WaveformExtractor(WaveformExtractor const& other);
+    WaveformExtractor& operator=(WaveformExtractor const& rhs);
+};
+
+}
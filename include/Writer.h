@@ -40,6 +40,7 @@
 #include "Point.h"
 #include "Filter.h"
 #include "Transform.h"
+#include "ZoneMap.h"
 
 
 namespace hsl
@@ -59,6 +60,11 @@ public:
 	bool writePoint(const Point & point);
 	bool writePoint(Point & point);
 
+    /// Writes the records of block, which must share the schema of the
+    /// header, in order. Blocks carry no waveform data; the records are
+    /// written without any. Filters and transforms are not applied.
+    bool writeBlock(PointBlock const& block);
+
     /// Sets filters that are used to determine wither or not to 
     /// keep a point that before we write it
     /// Filters are applied *before* transforms.
@@ -78,6 +84,26 @@ public:
     /// Update in-memory and disk header
     bool updateHeader(Header const& header);
 
+    /// Record the raw coordinate extent of every run of count consecutive
+    /// points, together with the zone map statistics of the fields set by
+    /// setZoneMapFields. The table is appended to the file on close() and its
+    /// position stored in the file header. 0, the default, disables the table.
+    void setChunkSize(uint32_t count);
+    uint32_t getChunkSize() const { return _chunkSize; }
+    /// Whether close() failed to append the chunk table, leaving the file
+    /// without one.
+    bool hasChunkTableError() const { return _chunkTableFailed; }
+
+    /// Fields summarized per chunk besides X, Y and Z. Defaults to
+    /// ZoneMap::getDefaultFields of the schema.
+    void setZoneMapFields(ZoneMapFieldArray const& fields);
+
+    /// Chunk extents recorded so far.
+    ChunkBoundsArray const& getChunkBounds() const { return _zoneMap.getChunkBounds(); }
+
+    /// Chunk statistics recorded so far.
+    ZoneMap const& getZoneMap() const { return _zoneMap; }
+
 protected:
     bool filterPoint(hsl::Point const& p);
     void transformPoint(hsl::Point& p);
@@ -87,6 +113,8 @@ protected:
 
     void updatePointCount(uint64_t count);
 
+    bool writeChunkTable();
+
 private:
     bool            _needHeaderCheck;
     uint64_t        _size;
@@ -95,6 +123,12 @@ private:
     PointPtr        _point;
     uint64_t        _pointCount;
     uint64_t        _totalPointCount;
+    uint64_t        _waveformOffset;
+    uint32_t        _chunkSize;
+    bool            _defaultZoneMapFields;
+    bool            _chunkTableFailed;
+    ZoneMapFieldArray _zoneMapFields;
+    ZoneMap         _zoneMap;
 
     std::vector<hsl::FilterPtr>     _filters;
     std::vector<hsl::TransformPtr>  _transforms;
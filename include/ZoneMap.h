@@ -0,0 +1,111 @@
+/*************************************************************************************
+ * 
+ * 
+ * Copyright (c) 2021, Zhengjun Liu <zjliu@casm.ac.cn>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ ************************************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <cstdio>
+#include <utility>
+#include <vector>
+#include "hslLIB.h"
+#include "hslDefinitions.h"
+#include "IdDefinitions.h"
+#include "FieldAccessor.h"
+
+namespace hsl
+{
+
+class Header;
+
+/// A field of a zone map: the n-th schema field with id.
+typedef std::pair<FieldId, size_t> ZoneMapField;
+typedef std::vector<ZoneMapField> ZoneMapFieldArray;
+
+/// Per chunk minimum and maximum statistics of a point file. A chunk is a
+/// run of chunkSize consecutive point records; the zone map keeps the raw
+/// coordinate extent of each chunk (ChunkBounds) and the scaled value range
+/// of a set of further fields, by default GNSS time, classification and
+/// every band. Filters use it to skip chunks that cannot contain a match,
+/// see FilterInterface::canSkip.
+///
+/// Writer builds the zone map while points are written and stores it in
+/// the chunk table of the file, Reader loads it on open().
+class LIBHSL_API ZoneMap
+{
+public:
+    ZoneMap();
+
+    void clear();
+
+    /// Starts an empty zone map for points of header, summarizing fields.
+    void create(Header const& header, uint32_t chunkSize, ZoneMapFieldArray const& fields);
+
+    /// GNSS time, classification and every band, as far as schema has them.
+    static ZoneMapFieldArray getDefaultFields(Schema const& schema);
+
+    /// Adds the next point record.
+    void add(const uint8_t* record);
+
+    /// Writes the chunk table at the current position of fp.
+    bool write(std::FILE* fp) const;
+
+    /// Reads a chunk table written by write() at the current position of fp.
+    /// A table without zone map yields chunk bounds only. Returns false if
+    /// the chunks do not cover the points of header in regular runs of
+    /// chunkSize, or the zone map names fields that header does not have.
+    bool read(std::FILE* fp, Header const& header);
+
+    Header const* getHeader() const { return _header; }
+    uint32_t getChunkSize() const { return _chunkSize; }
+    size_t getChunkCount() const { return _chunks.size(); }
+    ChunkBoundsArray const& getChunkBounds() const { return _chunks; }
+    ZoneMapFieldArray const& getFields() const { return _fields; }
+
+    /// Chunk containing point record n; getChunkCount() if none does.
+    size_t findChunk(uint64_t n) const;
+
+    /// Range of the scaled values of the n-th field with id within chunk.
+    /// X, Y and Z are derived from the chunk bounds. Returns false if the
+    /// zone map does not summarize the field.
+    bool getRange(size_t chunk, FieldId id, size_t n, double& minimum, double& maximum) const;
+
+private:
+    Header const*               _header;
+    uint32_t                    _chunkSize;
+    ChunkBoundsArray            _chunks;
+    ZoneMapFieldArray           _fields;
+    std::vector<FieldAccessor>  _accessors;
+    std::vector<double>         _ranges;        // minimum, maximum per field, per chunk
+    double                      _scale[3];
+    double                      _offset[3];
+
+    void setCoordinateTransform(Header const& header);
+};
+
+}
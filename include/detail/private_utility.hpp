@@ -2,6 +2,8 @@
 
 #include <vector>
 #include <cmath>
+#include <cstdio>
+#include <functional>
 #include <boost/concept_check.hpp>
 #include "endian.hpp"
 #include "binary.hpp"
@@ -148,6 +150,15 @@ bool compare_distance(const T& actual, const T& expected)
     return true;
 }
 
+/// Exact equality of two doubles, false if either is NaN. Meant where the
+/// values must match exactly, such as an "==" in a filter or a scale that
+/// is exactly 1; where a tolerance will do, use compare_distance. Spelled
+/// as a call so that -Wfloat-equal still flags a bare ==.
+inline bool exactly_equal(double a, double b)
+{
+    return std::equal_to<double>()(a, b);
+}
+
 template<typename T>
 inline char* as_buffer(T& data)
 {
@@ -172,6 +183,26 @@ inline char const* as_bytes(T const* data)
     return static_cast<char const*>(static_cast<void const*>(data));
 }
 
+/// fseek with a 64-bit position. Returns 0 on success, as fseek does.
+inline int seek64(std::FILE* fp, uint64_t pos, int whence)
+{
+#ifdef _MSC_VER
+    return _fseeki64(fp, static_cast<__int64>(pos), whence);
+#else
+    return fseeko(fp, static_cast<off_t>(pos), whence);
+#endif
+}
+
+/// ftell with a 64-bit position.
+inline uint64_t tell64(std::FILE* fp)
+{
+#ifdef _MSC_VER
+    return _ftelli64(fp);
+#else
+    return ftello(fp);
+#endif
+}
+
 // adapted from http://www.cplusplus.com/forum/beginner/3076/
 template <typename IntegerType>
 inline IntegerType bitsToInt(IntegerType& output,
@@ -41,6 +41,8 @@
 #include "SpatialReference.h"
 #include "FileIO.h"
 #include "Filter.h"
+#include "FilterExpression.h"
+#include "FilterChain.h"
 #include "Transform.h"
 #include "Header.h"
 #include "WaveformPacketRecord.h"
@@ -50,4 +52,23 @@
 #include "Singleton.h"
 #include "Variant.h"
 #include "Index.h"
+#include "IndexedReader.h"
+#include "PointBlock.h"
+#include "Bitmask.h"
+#include "FieldAccessor.h"
+#include "ZoneMap.h"
+#include "ThreadPool.h"
+#include "Pipeline.h"
+#include "WaveformBatch.h"
+#include "WaveformCache.h"
+#include "WaveformDecoder.h"
+#include "WaveformDecomposer.h"
+#include "WaveformExtractor.h"
+#include "Statistics.h"
+#include "BandReduction.h"
+#include "SpectralLibrary.h"
+#include "SpectralUnmixing.h"
+#include "SpatialSort.h"
+#include "Octree.h"
+#include "KdTree.h"
 #include "Point.h"
@@ -87,7 +87,8 @@ public:
   double        yMax;
   double        zMin;
   double        zMax;
-  char          reserved[32];
+  uint64_t      chunkTableOffset;   // absolute position of the chunk table, 0 if absent
+  char          reserved[24];
   uint32_t      numberOfReturns;
 };
 
@@ -234,9 +235,57 @@ public:
 	unsigned long    size;
 };
 
+/// Header of the optional chunk table appended after the point and waveform
+/// data. It is followed by chunkCount ChunkBounds records and, from minor
+/// version 1 on, by a zone map (see ZoneMapHeader).
+class ChunkTableHeader
+{
+public:
+  char            signature[4];       // "HSCT"
+  unsigned char   majorVersion;
+  unsigned char   minorVersion;
+  unsigned short  reserved;
+  uint32_t        chunkSize;          // number of points per chunk, the last one may be shorter
+  uint32_t        chunkCount;
+};
+
+/// Raw (unscaled) coordinate extent of a run of consecutive point records.
+class ChunkBounds
+{
+public:
+  uint64_t        firstPoint;
+  uint32_t        pointCount;
+  int32_t         minX;
+  int32_t         minY;
+  int32_t         minZ;
+  int32_t         maxX;
+  int32_t         maxY;
+  int32_t         maxZ;
+};
+
+/// Header of the zone map behind the ChunkBounds records of a chunk table.
+/// It is followed by fieldCount ZoneMapFieldRecord records, then for every
+/// chunk the minimum and maximum scaled value of each field as two doubles.
+class ZoneMapHeader
+{
+public:
+  char            signature[4];       // "HSZM"
+  uint32_t        fieldCount;
+};
+
+/// A field summarized by a zone map, the index-th field with fieldId.
+class ZoneMapFieldRecord
+{
+public:
+  uint16_t        fieldId;
+  uint16_t        reserved;
+  uint32_t        index;
+};
+
 #pragma pack()
 
 typedef std::vector<WaveformPacketDesc> WaveformDesc;
+typedef std::vector<ChunkBounds> ChunkBoundsArray;
 
 #define RESERVED_BYTES_AFTER_FIELDS 128
 
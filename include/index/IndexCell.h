@@ -49,7 +49,7 @@ namespace hsl { namespace detail {
 
 typedef int16_t ElevExtrema;
 typedef uint32_t ElevRange;
-typedef uint8_t	ConsecPtAccumulator;
+typedef uint32_t	ConsecPtAccumulator;
 typedef std::map<uint32_t, ConsecPtAccumulator> IndexCellData;
 typedef std::map<uint32_t, IndexCellData> IndexSubCellData;
 typedef uint64_t	TempFileOffsetType;
@@ -79,7 +79,7 @@ public:
 	ElevExtrema GetMaxZ(void) const {return m_MaxZ;}
 	bool RoomToAdd(uint32_t a);
 	void AddPointRecord(uint32_t a);
-	void AddPointRecord(uint32_t a, uint8_t b);
+	void AddPointRecord(uint32_t a, ConsecPtAccumulator b);
 	bool IncrementPointRecord(uint32_t a);
 	void RemoveMainRecords(void);
 	void RemoveAllRecords(void);
@@ -89,7 +89,7 @@ public:
 	bool IncrementZCell(uint32_t a, uint32_t b);
 	void AddSubCell(uint32_t a, uint32_t b);
 	bool IncrementSubCell(uint32_t a, uint32_t b);
-	uint8_t GetPointRecordCount(uint32_t a);
+	ConsecPtAccumulator GetPointRecordCount(uint32_t a);
 	const IndexCellData::iterator GetFirstRecord(void);
 	const IndexCellData::iterator GetEnd(void);
 	const IndexSubCellData::iterator GetFirstSubCellRecord(void);
@@ -0,0 +1,133 @@
+/*************************************************************************************
+ * 
+ * 
+ * Copyright (c) 2021, Zhengjun Liu <zjliu@casm.ac.cn>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ ************************************************************************************/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "../hslLIB.h"
+
+namespace hsl { namespace detail {
+
+#define LIBHSL_INDEXFILE_SIGNATURE	"HSX"
+#define LIBHSL_INDEXFILE_VERSIONMAJOR	1
+#define LIBHSL_INDEXFILE_VERSIONMINOR	0
+
+// A standalone index file (.hsx) is laid out so that it can be mapped into memory and queried 
+// in place, without any deserialization:
+//		IndexFileHeader
+//		IndexFileCell[cellsX * cellsY]		cell table, x-major (cell x, y is at x * cellsY + y)
+//		IndexFileRange[rangeCount]			runs of consecutive point IDs, grouped by cell
+// All sections are 8-byte aligned and stored in little-endian order.
+
+#pragma pack(1)
+class IndexFileHeader
+{
+public:
+	char		signature[4];
+	uint8_t		versionMajor;
+	uint8_t		versionMinor;
+	uint16_t	reserved;
+	uint32_t	pointRecordsCount;
+	uint32_t	cellsX;
+	uint32_t	cellsY;
+	uint32_t	rangeCount;
+	double		minX, minY, minZ;
+	double		maxX, maxY, maxZ;
+	double		cellSizeX;
+	double		cellSizeY;
+	uint64_t	cellTableOffset;
+	uint64_t	rangeTableOffset;
+};
+
+class IndexFileCell
+{
+public:
+	uint32_t	firstRange;		// index of the first range of this cell in the range table
+	uint32_t	rangeCount;		// number of ranges belonging to this cell
+	uint32_t	numPoints;
+	uint32_t	reserved;
+	double		minZ;			// Z extrema of the points in this cell
+	double		maxZ;
+};
+
+class IndexFileRange
+{
+public:
+	uint32_t	firstPoint;
+	uint32_t	count;
+};
+#pragma pack()
+
+// IndexFile maps an .hsx file read-only. Cells and ranges are returned as pointers into the mapping
+// and stay valid until Close() is called or the IndexFile is destroyed.
+class LIBHSL_API IndexFile
+{
+public:
+	IndexFile();
+	~IndexFile();
+
+	bool Open(std::string const& filename);
+	void Close(void);
+	bool IsOpen(void) const	{return (m_base != 0);}
+
+	IndexFileHeader const& GetHeader(void) const	{return *m_header;}
+	uint32_t GetCellsX(void) const	{return m_header->cellsX;}
+	uint32_t GetCellsY(void) const	{return m_header->cellsY;}
+	IndexFileCell const& GetCell(uint32_t x, uint32_t y) const	{return m_cells[(uint64_t)x * m_header->cellsY + y];}
+	IndexFileRange const* GetFirstRange(IndexFileCell const& cell) const	{return m_ranges + cell.firstRange;}
+	IndexFileRange const* GetEndRange(IndexFileCell const& cell) const	{return m_ranges + cell.firstRange + cell.rangeCount;}
+
+	// writes an index file from a filled header, cell table and range table. Offsets, signature
+	// and version in the header are set by Write.
+	static bool Write(std::string const& filename, IndexFileHeader& header, 
+		std::vector<IndexFileCell> const& cells, std::vector<IndexFileRange> const& ranges);
+
+private:
+	// Blocked copying operations, declared but not defined.
+	IndexFile(IndexFile const& other);
+	IndexFile& operator=(IndexFile const& rhs);
+
+	bool Verify(void) const;
+
+	const uint8_t *m_base;
+	uint64_t m_size;
+	IndexFileHeader const *m_header;
+	IndexFileCell const *m_cells;
+	IndexFileRange const *m_ranges;
+#ifdef _WIN32
+	void *m_fileHandle;
+	void *m_mapHandle;
+#else
+	int m_fd;
+#endif
+};
+
+}} // namespace hsl::detail
@@ -0,0 +1,534 @@
+/*************************************************************************************
+ * 
+ * 
+ * Copyright (c) 2021, Zhengjun Liu <zjliu@casm.ac.cn>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ ************************************************************************************/
+
+#include "BandReduction.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include "Field.h"
+#include "Schema.h"
+#include "PointBlock.h"
+#include "Reader.h"
+#include "Writer.h"
+#include "Exception.h"
+
+namespace hsl
+{
+
+namespace
+{
+
+/// Eigenvalues of the symmetric n x n matrix a (row-major) in decreasing
+/// order, and the eigenvectors as the rows of vectors, by cyclic Jacobi
+/// rotations.
+void symmetricEigen(std::vector<double> a, size_t n, std::vector<double>& values, std::vector<double>& vectors)
+{
+    std::vector<double> v(n * n, 0.0);
+    for (size_t i = 0; i < n; ++i)
+        v[i * n + i] = 1.0;
+
+    for (int sweep = 0; sweep < 100; ++sweep)
+    {
+        double off = 0.0;
+        double diagonal = 0.0;
+        for (size_t i = 0; i < n; ++i)
+        {
+            diagonal += a[i * n + i] * a[i * n + i];
+            for (size_t j = i + 1; j < n; ++j)
+                off += a[i * n + j] * a[i * n + j];
+        }
+        if (off <= 1e-30 * diagonal || !(off > 0.0))
+            break;
+
+        for (size_t p = 0; p + 1 < n; ++p)
+        {
+            for (size_t q = p + 1; q < n; ++q)
+            {
+                const double apq = a[p * n + q];
+                if (std::fabs(apq) <= 1e-300)
+                    continue;
+
+                // rotation in the (p, q) plane that zeroes a[p][q]
+                const double theta = (a[q * n + q] - a[p * n + p]) / (2.0 * apq);
+                const double t = (theta >= 0.0 ? 1.0 : -1.0) / (std::fabs(theta) + std::sqrt(theta * theta + 1.0));
+                const double c = 1.0 / std::sqrt(t * t + 1.0);
+                const double s = t * c;
+
+                for (size_t k = 0; k < n; ++k)
+                {
+                    const double akp = a[k * n + p];
+                    const double akq = a[k * n + q];
+                    a[k * n + p] = c * akp - s * akq;
+                    a[k * n + q] = s * akp + c * akq;
+                }
+                for (size_t k = 0; k < n; ++k)
+                {
+                    const double apk = a[p * n + k];
+                    const double aqk = a[q * n + k];
+                    a[p * n + k] = c * apk - s * aqk;
+                    a[q * n + k] = s * apk + c * aqk;
+                }
+                for (size_t k = 0; k < n; ++k)
+                {
+                    const double vkp = v[k * n + p];
+                    const double vkq = v[k * n + q];
+                    v[k * n + p] = c * vkp - s * vkq;
+                    v[k * n + q] = s * vkp + c * vkq;
+                }
+            }
+        }
+    }
+
+    std::vector<size_t> order(n);
+    for (size_t i = 0; i < n; ++i)
+        order[i] = i;
+    std::sort(order.begin(), order.end(), [&a, n](size_t x, size_t y) { return a[x * n + x] > a[y * n + y]; });
+
+    values.resize(n);
+    vectors.resize(n * n);
+    for (size_t k = 0; k < n; ++k)
+    {
+        const size_t i = order[k];
+        values[k] = a[i * n + i];
+        for (size_t b = 0; b < n; ++b)
+            vectors[k * n + b] = v[b * n + i];
+    }
+}
+
+/// Gives each worker of a Pipeline a covariance of its own.
+class CovarianceStage: public PipelineStage
+{
+public:
+    explicit CovarianceStage(BandCovariance const& prototype) : m_prototype(prototype) {}
+
+    void prepare(size_t workers) { m_parts.assign(workers, m_prototype); }
+    void process(PointBlock& block, size_t worker) { m_parts[worker].add(block); }
+    bool isConcurrent() const { return true; }
+
+    std::vector<BandCovariance> const& getParts() const { return m_parts; }
+
+private:
+    BandCovariance m_prototype;
+    std::vector<BandCovariance> m_parts;
+};
+
+}
+
+void BandCovariance::Moments::reset(size_t size)
+{
+    count = 0;
+    mean.assign(size, 0.0);
+    comoment.assign(size * size, 0.0);
+}
+
+void BandCovariance::Moments::add(const double* columns, size_t stride, size_t n, std::vector<double>& centred)
+{
+    if (n == 0)
+        return;
+
+    // deviations from the mean of the new vectors, point by point, which
+    // moves the mean
+    const size_t size = mean.size();
+    const double na = static_cast<double>(count);
+    const double nb = static_cast<double>(n);
+    const double total = na + nb;
+    centred.resize(size * n + size);
+    double* delta = &centred[size * n];
+    for (size_t b = 0; b < size; ++b)
+    {
+        const double* x = columns + b * stride;
+        double sum = 0.0;
+        for (size_t p = 0; p < n; ++p)
+            sum += x[p];
+        const double m = sum / nb;
+        for (size_t p = 0; p < n; ++p)
+            centred[p * size + b] = x[p] - m;
+        delta[b] = m - mean[b];
+        mean[b] += delta[b] * nb / total;
+    }
+
+    const double weight = na * nb / total;
+    for (size_t i = 0; i < size; ++i)
+    {
+        for (size_t j = i; j < size; ++j)
+            comoment[i * size + j] += delta[i] * delta[j] * weight;
+    }
+
+    // rank one updates of the upper triangle, which vectorize along a row
+    for (size_t p = 0; p < n; ++p)
+    {
+        const double* d = &centred[p * size];
+        for (size_t i = 0; i < size; ++i)
+        {
+            const double di = d[i];
+            double* row = &comoment[i * size];
+            for (size_t j = i; j < size; ++j)
+                row[j] += di * d[j];
+        }
+    }
+    count += n;
+}
+
+void BandCovariance::Moments::merge(Moments const& other)
+{
+    if (other.count == 0)
+        return;
+    if (count == 0)
+    {
+        *this = other;
+        return;
+    }
+
+    const size_t size = mean.size();
+    const double na = static_cast<double>(count);
+    const double nb = static_cast<double>(other.count);
+    const double total = na + nb;
+    const double weight = na * nb / total;
+    for (size_t i = 0; i < size; ++i)
+    {
+        const double di = other.mean[i] - mean[i];
+        for (size_t j = i; j < size; ++j)
+        {
+            const double dj = other.mean[j] - mean[j];
+            comoment[i * size + j] += other.comoment[i * size + j] + di * dj * weight;
+        }
+    }
+    for (size_t i = 0; i < size; ++i)
+        mean[i] += (other.mean[i] - mean[i]) * nb / total;
+    count += other.count;
+}
+
+std::vector<double> BandCovariance::Moments::covariance() const
+{
+    const size_t size = mean.size();
+    std::vector<double> c(size * size, 0.0);
+    if (count == 0)
+        return c;
+
+    const double n = static_cast<double>(count);
+    for (size_t i = 0; i < size; ++i)
+    {
+        for (size_t j = i; j < size; ++j)
+            c[i * size + j] = c[j * size + i] = comoment[i * size + j] / n;
+    }
+    return c;
+}
+
+BandCovariance::BandCovariance()
+    : m_concurrency(0), m_blockSize(4096), m_header(0)
+{
+    m_signal.reset(0);
+    m_noise.reset(0);
+}
+
+void BandCovariance::reset(Header const& header)
+{
+    m_header = &header;
+    m_bands.clear();
+    FieldAccessor band;
+    while (band.bind(header.getSchema(), FI_BandValue, m_bands.size()))
+        m_bands.push_back(band);
+    if (m_bands.empty())
+        throw libhsl_error("the points have no bands to compute a covariance of");
+
+    m_signal.reset(m_bands.size());
+    m_noise.reset(m_bands.size());
+}
+
+void BandCovariance::add(PointBlock const& block)
+{
+    if (m_header == 0)
+        throw libhsl_error("BandCovariance::add called before reset");
+    if (block.getHeader() != m_header && block.getHeader()->getSchema() != m_header->getSchema())
+        throw std::invalid_argument("block does not have the schema of the covariance");
+
+    const size_t n = block.size();
+    if (n == 0)
+        return;
+
+    const size_t size = m_bands.size();
+    const uint8_t* records = block.getRecord(0);
+    const size_t stride = block.getRecordLength();
+    m_columns.resize(size * n);
+    for (size_t b = 0; b < size; ++b)
+        m_bands[b].gather(records, stride, n, &m_columns[b * n]);
+    m_signal.add(&m_columns[0], n, n, m_centred);
+
+    // differences of the points that follow each other in the file
+    m_pairs.clear();
+    for (size_t p = 0; p + 1 < n; ++p)
+    {
+        if (block.getId(p + 1) == block.getId(p) + 1)
+            m_pairs.push_back(p);
+    }
+    const size_t pairs = m_pairs.size();
+    for (size_t b = 0; b < size; ++b)
+    {
+        double* x = &m_columns[b * n];
+        for (size_t q = 0; q < pairs; ++q)
+            x[q] = x[m_pairs[q] + 1] - x[m_pairs[q]];
+    }
+    m_noise.add(&m_columns[0], n, pairs, m_centred);
+}
+
+void BandCovariance::merge(BandCovariance const& other)
+{
+    if (other.m_header == 0)
+        return;
+    if (m_header == 0)
+    {
+        *this = other;
+        return;
+    }
+    if (other.m_bands.size() != m_bands.size())
+        throw std::invalid_argument("cannot merge covariances of different bands");
+
+    m_signal.merge(other.m_signal);
+    m_noise.merge(other.m_noise);
+}
+
+std::vector<double> BandCovariance::getNoiseCovariance() const
+{
+    std::vector<double> c = m_noise.covariance();
+    for (size_t i = 0; i < c.size(); ++i)
+        c[i] *= 0.5;
+    return c;
+}
+
+uint64_t BandCovariance::compute(Reader& reader)
+{
+    reset(reader.getHeader());
+
+    std::shared_ptr<CovarianceStage> stage(new CovarianceStage(*this));
+    Pipeline pipeline(reader, [](PointBlock const&) {});
+    pipeline.setBlockSize(m_blockSize);
+    pipeline.setConcurrency(m_concurrency);
+    pipeline.setPreserveOrder(false);
+    pipeline.addStage(stage);
+    pipeline.run();
+
+    std::vector<BandCovariance> const& parts = stage->getParts();
+    for (size_t w = 0; w < parts.size(); ++w)
+        merge(parts[w]);
+    return getCount();
+}
+
+BandProjection::BandProjection(BandCovariance const& covariance, BandProjectionMethod method, size_t components)
+    : m_method(method), m_mean(covariance.getMean())
+{
+    const size_t n = covariance.getBandCount();
+    if (covariance.getCount() == 0)
+        throw libhsl_error("no points to compute a band projection from");
+    if (components == 0 || components > n)
+        throw std::invalid_argument("a band projection needs between 1 and as many components as bands");
+
+    std::vector<double> vectors;
+    if (method == BP_PCA)
+    {
+        symmetricEigen(covariance.getCovariance(), n, m_eigenvalues, vectors);
+        m_components.assign(vectors.begin(), vectors.begin() + components * n);
+        return;
+    }
+
+    if (covariance.getNoiseCount() == 0)
+        throw libhsl_error("MNF needs consecutive points to estimate the noise from");
+
+    // whiten the noise: w_i = e_i / sqrt(d_i) for the eigenpairs of the
+    // noise covariance, with tiny noise variances bounded from below
+    std::vector<double> noise;
+    std::vector<double> axes;
+    symmetricEigen(covariance.getNoiseCovariance(), n, noise, axes);
+    if (!(noise[0] > 0.0))
+        throw libhsl_error("the band values have no noise to compute an MNF from");
+    const double floor = noise[0] * 1e-12;
+    std::vector<double> w(n * n);
+    for (size_t i = 0; i < n; ++i)
+    {
+        const double f = 1.0 / std::sqrt((std::max)(noise[i], floor));
+        for (size_t b = 0; b < n; ++b)
+            w[i * n + b] = axes[i * n + b] * f;
+    }
+
+    // principal components of the whitened signal, W^T S W
+    std::vector<double> const signal = covariance.getCovariance();
+    std::vector<double> ws(n * n, 0.0);
+    for (size_t i = 0; i < n; ++i)
+    {
+        for (size_t b = 0; b < n; ++b)
+        {
+            const double wib = w[i * n + b];
+            for (size_t c = 0; c < n; ++c)
+                ws[i * n + c] += wib * signal[b * n + c];
+        }
+    }
+    std::vector<double> whitened(n * n);
+    for (size_t i = 0; i < n; ++i)
+    {
+        for (size_t j = i; j < n; ++j)
+        {
+            double sum = 0.0;
+            for (size_t c = 0; c < n; ++c)
+                sum += ws[i * n + c] * w[j * n + c];
+            whitened[i * n + j] = whitened[j * n + i] = sum;
+        }
+    }
+    symmetricEigen(whitened, n, m_eigenvalues, vectors);
+
+    // back to weights of the bands: u_k = W v_k
+    m_components.assign(components * n, 0.0);
+    for (size_t k = 0; k < components; ++k)
+    {
+        for (size_t i = 0; i < n; ++i)
+        {
+            const double vki = vectors[k * n + i];
+            for (size_t b = 0; b < n; ++b)
+                m_components[k * n + b] += vki * w[i * n + b];
+        }
+    }
+}
+
+void BandProjection::project(const double* bands, double* components) const
+{
+    const size_t n = m_mean.size();
+    const size_t count = getComponentCount();
+    for (size_t k = 0; k < count; ++k)
+    {
+        const double* u = &m_components[k * n];
+        double sum = 0.0;
+        for (size_t b = 0; b < n; ++b)
+            sum += u[b] * (bands[b] - m_mean[b]);
+        components[k] = sum;
+    }
+}
+
+Header BandProjection::createHeader(Header const& header) const
+{
+    Header reduced(header);
+    Schema& schema = reduced.getSchema();
+    size_t index = 0;
+    while (schema.getNthIndex(FI_ByteOffsetToWaveformData, 0, index) && schema.removeField(index))
+        ;
+    while (schema.getNthIndex(FI_WaveformDataSize, 0, index) && schema.removeField(index))
+        ;
+    schema.removeAllBands();
+    schema.addBands(BandDesc(DT_FLOAT, "Component", m_method == BP_PCA ? "principal component" : "noise fraction"),
+                    getComponentCount());
+    schema.calculateSizes();
+    return reduced;
+}
+
+namespace
+{
+
+std::vector<FieldId> projectedFields()
+{
+    std::vector<FieldId> ids;
+    ids.push_back(FI_BandValue);
+    ids.push_back(FI_ByteOffsetToWaveformData);
+    ids.push_back(FI_WaveformDataSize);
+    return ids;
+}
+
+}
+
+BandProjectionStage::BandProjectionStage(BandProjection const& projection, Header const& source, Header const& target)
+    : SchemaStage(source, target, projectedFields()), m_projection(projection)
+{
+    Schema const& from = source.getSchema();
+    Schema const& to = target.getSchema();
+
+    m_bands.resize(projection.getBandCount());
+    for (size_t b = 0; b < m_bands.size(); ++b)
+    {
+        if (!m_bands[b].bind(from, FI_BandValue, b))
+            throw std::invalid_argument("the points do not have the bands of the projection");
+    }
+    m_components.resize(projection.getComponentCount());
+    for (size_t k = 0; k < m_components.size(); ++k)
+    {
+        if (!m_components[k].bind(to, FI_BandValue, k))
+            throw std::invalid_argument("the output has fewer bands than the projection has components");
+    }
+}
+
+void BandProjectionStage::prepare(size_t workers)
+{
+    SchemaStage::prepare(workers);
+    m_scratch.assign(workers, Scratch());
+}
+
+void BandProjectionStage::rewrite(PointBlock const& in, PointBlock& out, size_t worker)
+{
+    Scratch& scratch = m_scratch[worker];
+    const size_t n = in.size();
+    const uint8_t* records = in.getRecord(0);
+    const size_t stride = in.getRecordLength();
+
+    // components as sums of weighted, centred band columns
+    const size_t bands = m_bands.size();
+    std::vector<double> const& mean = m_projection.getMean();
+    std::vector<double>& x = scratch.bands;
+    x.resize(bands * n);
+    for (size_t b = 0; b < bands; ++b)
+    {
+        double* column = &x[b * n];
+        m_bands[b].gather(records, stride, n, column);
+        for (size_t p = 0; p < n; ++p)
+            column[p] -= mean[b];
+    }
+
+    std::vector<double>& values = scratch.values;
+    values.resize(n);
+    for (size_t k = 0; k < m_components.size(); ++k)
+    {
+        const double* u = m_projection.getComponent(k);
+        std::fill(values.begin(), values.end(), 0.0);
+        for (size_t b = 0; b < bands; ++b)
+        {
+            const double weight = u[b];
+            const double* column = &x[b * n];
+            for (size_t p = 0; p < n; ++p)
+                values[p] += weight * column[p];
+        }
+        m_components[k].scatter(out.getRecord(0), out.getRecordLength(), n, &values[0]);
+    }
+}
+
+uint64_t reduceBands(Reader& reader, Writer& writer, BandProjection const& projection, size_t concurrency)
+{
+    if (writer.getHeader().hasWaveformData())
+        throw libhsl_error("the output of a band reduction cannot carry waveform data");
+
+    Pipeline pipeline(reader, writer);
+    pipeline.setConcurrency(concurrency);
+    pipeline.addStage(PipelineStagePtr(new BandProjectionStage(projection, reader.getHeader(), writer.getHeader())));
+    return pipeline.run();
+}
+
+}
@@ -0,0 +1,543 @@
+/*************************************************************************************
+ * 
+ * 
+ * Copyright (c) 2021, Zhengjun Liu <zjliu@casm.ac.cn>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ ************************************************************************************/
+
+
+#include "FieldAccessor.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <map>
+#include "Schema.h"
+#include "Field.h"
+#include "PointBlock.h"
+#include "detail/private_utility.hpp"
+
+
+namespace hsl
+{
+
+namespace
+{
+
+template <typename T>
+inline T loadRaw(const uint8_t* p)
+{
+    T v;
+    std::memcpy(&v, p, sizeof(T));
+    return v;
+}
+
+template <typename T>
+inline void storeRaw(uint8_t* p, T v)
+{
+    std::memcpy(p, &v, sizeof(T));
+}
+
+// v rounded to nearest and saturated to the range of T
+template <typename T>
+inline T saturate(double v)
+{
+    double const lo = static_cast<double>((std::numeric_limits<T>::min)());
+    double const hi = static_cast<double>((std::numeric_limits<T>::max)());
+    if (!(v > lo))
+        return std::isnan(v) ? T() : (std::numeric_limits<T>::min)();
+    if (!(v < hi))
+        return (std::numeric_limits<T>::max)();
+    double r = v < 0.0 ? std::ceil(v - 0.5) : std::floor(v + 0.5);
+    if (r >= hi)
+        return (std::numeric_limits<T>::max)();
+    if (r <= lo)
+        return (std::numeric_limits<T>::min)();
+    return static_cast<T>(r);
+}
+
+template <typename T>
+inline void scatterColumn(uint8_t* p, size_t stride, size_t n, const double* in, double scale, double offset)
+{
+    for (size_t i = 0; i < n; ++i, p += stride)
+        storeRaw(p, saturate<T>((in[i] - offset) / scale));
+}
+
+template <typename T>
+inline void gatherColumn(const uint8_t* p, size_t stride, size_t n, double* out)
+{
+    for (size_t i = 0; i < n; ++i, p += stride)
+        out[i] = static_cast<double>(loadRaw<T>(p));
+}
+
+}
+
+FieldAccessor::FieldAccessor()
+    : _id(FI_UNKNOWN), _type(DT_UNKNOWN), _byteOffset(0), _bitSize(0), _shift(0), _mask(0),
+    _signed(false), _scale(1.0), _offset(0.0)
+{
+}
+
+bool FieldAccessor::bind(Schema const& schema, FieldId id, size_t n)
+{
+    _type = DT_UNKNOWN;
+
+    size_t index = 0;
+    Field field;
+    if (!schema.getNthIndex(id, n, index) || !schema.getField(index, field))
+        return false;
+
+    _id = id;
+    _byteOffset = field.getByteOffset();
+    _bitSize = field.getBitSize();
+    _signed = field.isSigned();
+    _scale = field.isScaled() ? field.getScale() : 1.0;
+    _offset = field.isOffseted() ? field.getOffset() : 0.0;
+    _shift = 0;
+    _mask = 0;
+
+    switch (field.getDataType())
+    {
+    case DT_BIT:
+        {
+            // Schema stores the bit position following the field in the bit offset
+            size_t end = field.getBitOffset() == 0 ? 8 : field.getBitOffset();
+            if (_bitSize == 0 || _bitSize > 8 || end < _bitSize)
+                return false;
+            _shift = static_cast<unsigned>(end - _bitSize);
+            _mask = (1u << _bitSize) - 1;
+            _signed = false;
+        }
+        break;
+    case DT_UCHAR:
+    case DT_CHAR:
+        if (_bitSize != 8)
+            return false;
+        break;
+    case DT_USHORT:
+    case DT_SHORT:
+        if (_bitSize != 16)
+            return false;
+        break;
+    case DT_ULONG:
+    case DT_LONG:
+    case DT_FLOAT:
+        if (_bitSize != 32)
+            return false;
+        break;
+    case DT_ULONGLONG:
+    case DT_LONGLONG:
+    case DT_DOUBLE:
+        if (_bitSize != 64)
+            return false;
+        break;
+    default:
+        return false;
+    }
+
+    // coordinates are always stored as int32_t (see Point::getRawX), whether
+    // or not the schema read from a file kept the signed flag
+    DataType type = field.getDataType();
+    if (type == DT_CHAR || type == DT_SHORT || type == DT_LONG || type == DT_LONGLONG ||
+        id == FI_X || id == FI_Y || id == FI_Z)
+        _signed = true;
+
+    _type = type;
+    return true;
+}
+
+double FieldAccessor::getRaw(const uint8_t* record) const
+{
+    const uint8_t* p = record + _byteOffset;
+    switch (_type)
+    {
+    case DT_BIT:
+        return static_cast<double>((*p >> _shift) & _mask);
+    case DT_UCHAR:
+    case DT_CHAR:
+        return _signed ? static_cast<double>(static_cast<int8_t>(*p)) : static_cast<double>(*p);
+    case DT_USHORT:
+    case DT_SHORT:
+        return _signed ? static_cast<double>(loadRaw<int16_t>(p)) : static_cast<double>(loadRaw<uint16_t>(p));
+    case DT_ULONG:
+    case DT_LONG:
+        return _signed ? static_cast<double>(loadRaw<int32_t>(p)) : static_cast<double>(loadRaw<uint32_t>(p));
+    case DT_ULONGLONG:
+    case DT_LONGLONG:
+        return _signed ? static_cast<double>(loadRaw<int64_t>(p)) : static_cast<double>(loadRaw<uint64_t>(p));
+    case DT_FLOAT:
+        return static_cast<double>(loadRaw<float>(p));
+    case DT_DOUBLE:
+        return loadRaw<double>(p);
+    default:
+        return 0.0;
+    }
+}
+
+void FieldAccessor::setRaw(uint8_t* record, double raw) const
+{
+    uint8_t* p = record + _byteOffset;
+    switch (_type)
+    {
+    case DT_BIT:
+        {
+            uint32_t v = static_cast<uint32_t>(saturate<uint8_t>(raw)) & _mask;
+            if (raw > static_cast<double>(_mask))
+                v = _mask;
+            *p = static_cast<uint8_t>((*p & ~(_mask << _shift)) | (v << _shift));
+        }
+        break;
+    case DT_UCHAR:
+    case DT_CHAR:
+        if (_signed)
+            storeRaw(p, saturate<int8_t>(raw));
+        else
+            storeRaw(p, saturate<uint8_t>(raw));
+        break;
+    case DT_USHORT:
+    case DT_SHORT:
+        if (_signed)
+            storeRaw(p, saturate<int16_t>(raw));
+        else
+            storeRaw(p, saturate<uint16_t>(raw));
+        break;
+    case DT_ULONG:
+    case DT_LONG:
+        if (_signed)
+            storeRaw(p, saturate<int32_t>(raw));
+        else
+            storeRaw(p, saturate<uint32_t>(raw));
+        break;
+    case DT_ULONGLONG:
+    case DT_LONGLONG:
+        if (_signed)
+            storeRaw(p, saturate<int64_t>(raw));
+        else
+            storeRaw(p, saturate<uint64_t>(raw));
+        break;
+    case DT_FLOAT:
+        storeRaw(p, static_cast<float>(raw));
+        break;
+    case DT_DOUBLE:
+        storeRaw(p, raw);
+        break;
+    default:
+        break;
+    }
+}
+
+void FieldAccessor::scatter(uint8_t* records, size_t stride, size_t n, const double* in) const
+{
+    uint8_t* p = records + _byteOffset;
+    switch (_type)
+    {
+    case DT_UCHAR:
+    case DT_CHAR:
+        if (_signed)
+            scatterColumn<int8_t>(p, stride, n, in, _scale, _offset);
+        else
+            scatterColumn<uint8_t>(p, stride, n, in, _scale, _offset);
+        break;
+    case DT_USHORT:
+    case DT_SHORT:
+        if (_signed)
+            scatterColumn<int16_t>(p, stride, n, in, _scale, _offset);
+        else
+            scatterColumn<uint16_t>(p, stride, n, in, _scale, _offset);
+        break;
+    case DT_ULONG:
+    case DT_LONG:
+        if (_signed)
+            scatterColumn<int32_t>(p, stride, n, in, _scale, _offset);
+        else
+            scatterColumn<uint32_t>(p, stride, n, in, _scale, _offset);
+        break;
+    case DT_FLOAT:
+        for (size_t i = 0; i < n; ++i, p += stride)
+            storeRaw(p, static_cast<float>((in[i] - _offset) / _scale));
+        break;
+    case DT_DOUBLE:
+        for (size_t i = 0; i < n; ++i, p += stride)
+            storeRaw(p, (in[i] - _offset) / _scale);
+        break;
+    default:
+        for (size_t i = 0; i < n; ++i)
+            setValue(records + i * stride, in[i]);
+        break;
+    }
+}
+
+bool FieldAccessor::isInt32Raw() const
+{
+    switch (_type)
+    {
+    case DT_BIT:
+    case DT_UCHAR:
+    case DT_CHAR:
+    case DT_USHORT:
+    case DT_SHORT:
+        return true;
+    case DT_ULONG:
+    case DT_LONG:
+        return _signed;
+    default:
+        return false;
+    }
+}
+
+bool FieldAccessor::getRawRange(double low, double high, int64_t& rawLow, int64_t& rawHigh) const
+{
+    int64_t typeMin = 0;
+    int64_t typeMax = 0;
+    switch (_type)
+    {
+    case DT_BIT:
+        typeMax = _mask;
+        break;
+    case DT_UCHAR:
+    case DT_CHAR:
+        typeMin = _signed ? -128 : 0;
+        typeMax = _signed ? 127 : 255;
+        break;
+    case DT_USHORT:
+    case DT_SHORT:
+        typeMin = _signed ? -32768 : 0;
+        typeMax = _signed ? 32767 : 65535;
+        break;
+    case DT_ULONG:
+    case DT_LONG:
+        typeMin = _signed ? (std::numeric_limits<int32_t>::min)() : 0;
+        typeMax = _signed ? (std::numeric_limits<int32_t>::max)() : (std::numeric_limits<uint32_t>::max)();
+        break;
+    case DT_ULONGLONG:
+    case DT_LONGLONG:
+        // values beyond 2^53 are not exact as doubles anyway
+        typeMin = _signed ? -(static_cast<int64_t>(1) << 53) : 0;
+        typeMax = static_cast<int64_t>(1) << 53;
+        break;
+    default:
+        return false;
+    }
+
+    rawLow = typeMax;
+    rawHigh = typeMin - 1;
+    if (!(low <= high))
+        return true;
+
+    if (detail::exactly_equal(_scale, 0.0))
+    {
+        if (low <= _offset && _offset <= high)
+        {
+            rawLow = typeMin;
+            rawHigh = typeMax;
+        }
+        return true;
+    }
+
+    // value(r) = r * scale + offset is monotonic in r; estimate the raw
+    // bounds, then step them until they agree with value() exactly
+    const double scale = _scale;
+    const double offset = _offset;
+    const bool increasing = scale > 0;
+    double a = (low - offset) / scale;
+    double b = (high - offset) / scale;
+    double lo = (std::max)(static_cast<double>(typeMin), (std::min)(std::ceil(increasing ? a : b), static_cast<double>(typeMax) + 1));
+    double hi = (std::min)(static_cast<double>(typeMax), (std::max)(std::floor(increasing ? b : a), static_cast<double>(typeMin) - 1));
+    int64_t l = static_cast<int64_t>(lo);
+    int64_t h = static_cast<int64_t>(hi);
+
+    auto inside = [&](int64_t r) -> bool
+    {
+        double v = static_cast<double>(r) * scale + offset;
+        return v >= low && v <= high;
+    };
+    while (l > typeMin && inside(l - 1))
+        --l;
+    while (h < typeMax && inside(h + 1))
+        ++h;
+    while (l <= h && !inside(l))
+        ++l;
+    while (h >= l && !inside(h))
+        --h;
+
+    if (l <= h)
+    {
+        rawLow = l;
+        rawHigh = h;
+    }
+    return true;
+}
+
+void FieldAccessor::gather(PointBlock const& block, std::vector<double>& column) const
+{
+    size_t n = block.size();
+    column.resize(n);
+    if (n == 0)
+        return;
+
+    gather(block.getRecord(0), block.getRecordLength(), n, &column[0]);
+}
+
+void FieldAccessor::gather(const uint8_t* records, size_t stride, size_t n, double* out) const
+{
+    gatherRaw(records, stride, n, out);
+    if (!(detail::exactly_equal(_scale, 1.0) && detail::exactly_equal(_offset, 0.0)))
+    {
+        for (size_t i = 0; i < n; ++i)
+            out[i] = out[i] * _scale + _offset;
+    }
+}
+
+void FieldAccessor::gatherRaw(const uint8_t* records, size_t stride, size_t n, double* out) const
+{
+    const uint8_t* p = records + _byteOffset;
+    switch (_type)
+    {
+    case DT_BIT:
+        for (size_t i = 0; i < n; ++i, p += stride)
+            out[i] = static_cast<double>((*p >> _shift) & _mask);
+        break;
+    case DT_UCHAR:
+    case DT_CHAR:
+        if (_signed)
+            gatherColumn<int8_t>(p, stride, n, out);
+        else
+            gatherColumn<uint8_t>(p, stride, n, out);
+        break;
+    case DT_USHORT:
+    case DT_SHORT:
+        if (_signed)
+            gatherColumn<int16_t>(p, stride, n, out);
+        else
+            gatherColumn<uint16_t>(p, stride, n, out);
+        break;
+    case DT_ULONG:
+    case DT_LONG:
+        if (_signed)
+            gatherColumn<int32_t>(p, stride, n, out);
+        else
+            gatherColumn<uint32_t>(p, stride, n, out);
+        break;
+    case DT_FLOAT:
+        gatherColumn<float>(p, stride, n, out);
+        break;
+    default:
+        for (size_t i = 0; i < n; ++i, p += stride)
+            out[i] = getRaw(p - _byteOffset);
+        break;
+    }
+}
+
+void FieldAccessor::gatherRaw(PointBlock const& block, std::vector<int32_t>& column) const
+{
+    size_t n = block.size();
+    column.resize(n);
+    if (n == 0)
+        return;
+
+    const uint8_t* p = block.getRecord(0) + _byteOffset;
+    const size_t stride = block.getRecordLength();
+    switch (_type)
+    {
+    case DT_ULONG:
+    case DT_LONG:
+        for (size_t i = 0; i < n; ++i, p += stride)
+            column[i] = loadRaw<int32_t>(p);
+        break;
+    case DT_USHORT:
+        for (size_t i = 0; i < n; ++i, p += stride)
+            column[i] = loadRaw<uint16_t>(p);
+        break;
+    case DT_SHORT:
+        for (size_t i = 0; i < n; ++i, p += stride)
+            column[i] = loadRaw<int16_t>(p);
+        break;
+    default:
+        for (size_t i = 0; i < n; ++i, p += stride)
+            column[i] = static_cast<int32_t>(getRaw(p - _byteOffset));
+        break;
+    }
+}
+
+void FieldAccessor::gatherRaw(PointBlock const& block, std::vector<uint8_t>& column) const
+{
+    size_t n = block.size();
+    column.resize(n);
+    if (n == 0)
+        return;
+
+    const uint8_t* p = block.getRecord(0) + _byteOffset;
+    const size_t stride = block.getRecordLength();
+    if (_type == DT_BIT)
+    {
+        for (size_t i = 0; i < n; ++i, p += stride)
+            column[i] = static_cast<uint8_t>((*p >> _shift) & _mask);
+    }
+    else
+    {
+        for (size_t i = 0; i < n; ++i, p += stride)
+            column[i] = *p;
+    }
+}
+
+void FieldCopier::bind(Schema const& source, Schema const& target, std::vector<FieldId> const& excluded)
+{
+    _fields.clear();
+    std::map<FieldId, size_t> seen;
+    for (size_t i = 0; i < target.getFieldCount(); ++i)
+    {
+        Field field;
+        if (!target.getField(i, field))
+            continue;
+        FieldId id = field.getId();
+        size_t n = seen[id]++;
+        if (std::find(excluded.begin(), excluded.end(), id) != excluded.end())
+            continue;
+
+        std::pair<FieldAccessor, FieldAccessor> fields;
+        if (fields.first.bind(source, id, n) && fields.second.bind(target, id, n))
+            _fields.push_back(fields);
+    }
+}
+
+void FieldCopier::copy(const uint8_t* source, uint8_t* target) const
+{
+    for (size_t f = 0; f < _fields.size(); ++f)
+        _fields[f].second.setValue(target, _fields[f].first.getValue(source));
+}
+
+void FieldCopier::copy(const uint8_t* source, size_t sourceStride, uint8_t* target, size_t targetStride, size_t n,
+                       std::vector<double>& values) const
+{
+    if (n == 0)
+        return;
+    values.resize(n);
+    for (size_t f = 0; f < _fields.size(); ++f)
+    {
+        _fields[f].first.gather(source, sourceStride, n, &values[0]);
+        _fields[f].second.scatter(target, targetStride, n, &values[0]);
+    }
+}
+
+}
@@ -35,16 +35,201 @@
 #include "Filter.h"
 #include <boost/cstdint.hpp>
 #include <vector>
+#include <algorithm>
+#include <limits>
+#include <cstring>
 #include "Variant.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define LIBHSL_HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
 using namespace boost;
 
 namespace hsl { 
 
+namespace detail {
+
+namespace {
+
+inline void applyMatches(uint64_t* words, size_t w, uint64_t matches, bool invert)
+{
+    words[w] &= invert ? ~matches : matches;
+}
+
+// number of values in the 64-value group starting at base
+inline size_t groupSize(size_t base, size_t n)
+{
+    return (std::min)(static_cast<size_t>(64), n - base);
+}
+
+}
+
+void selectRange(const double* v, size_t n, double lo, double hi, bool invert, uint64_t* words)
+{
+    for (size_t base = 0, w = 0; base < n; base += 64, ++w)
+    {
+        size_t count = groupSize(base, n);
+        const double* g = v + base;
+        uint64_t m = 0;
+        size_t j = 0;
+#ifdef LIBHSL_HAVE_SSE2
+        __m128d vlo = _mm_set1_pd(lo);
+        __m128d vhi = _mm_set1_pd(hi);
+        for (; j + 2 <= count; j += 2)
+        {
+            __m128d x = _mm_loadu_pd(g + j);
+            __m128d in = _mm_and_pd(_mm_cmpge_pd(x, vlo), _mm_cmple_pd(x, vhi));
+            m |= static_cast<uint64_t>(_mm_movemask_pd(in)) << j;
+        }
+#endif
+        for (; j < count; ++j)
+            m |= static_cast<uint64_t>(g[j] >= lo && g[j] <= hi) << j;
+        applyMatches(words, w, m, invert);
+    }
+}
+
+void selectRange(const int32_t* v, size_t n, int32_t lo, int32_t hi, bool invert, uint64_t* words)
+{
+    for (size_t base = 0, w = 0; base < n; base += 64, ++w)
+    {
+        size_t count = groupSize(base, n);
+        const int32_t* g = v + base;
+        uint64_t m = 0;
+        size_t j = 0;
+#ifdef LIBHSL_HAVE_SSE2
+        __m128i vlo = _mm_set1_epi32(lo);
+        __m128i vhi = _mm_set1_epi32(hi);
+        for (; j + 4 <= count; j += 4)
+        {
+            __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(g + j));
+            __m128i out = _mm_or_si128(_mm_cmplt_epi32(x, vlo), _mm_cmpgt_epi32(x, vhi));
+            m |= static_cast<uint64_t>(~_mm_movemask_ps(_mm_castsi128_ps(out)) & 0xF) << j;
+        }
+#endif
+        for (; j < count; ++j)
+            m |= static_cast<uint64_t>(g[j] >= lo && g[j] <= hi) << j;
+        applyMatches(words, w, m, invert);
+    }
+}
+
+void selectMembers(const uint8_t* v, size_t n, std::vector<uint8_t> const& members, bool invert, uint64_t* words)
+{
+    bool table[256] = { false };
+    for (size_t i = 0; i < members.size(); ++i)
+        table[members[i]] = true;
+
+    // a short list is compared directly, a longer one through the table
+    const bool direct = members.size() <= 4;
+
+    for (size_t base = 0, w = 0; base < n; base += 64, ++w)
+    {
+        size_t count = groupSize(base, n);
+        const uint8_t* g = v + base;
+        uint64_t m = 0;
+        size_t j = 0;
+#ifdef LIBHSL_HAVE_SSE2
+        if (direct)
+        {
+            for (; j + 16 <= count; j += 16)
+            {
+                __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(g + j));
+                __m128i in = _mm_setzero_si128();
+                for (size_t k = 0; k < members.size(); ++k)
+                    in = _mm_or_si128(in, _mm_cmpeq_epi8(x, _mm_set1_epi8(static_cast<char>(members[k]))));
+                m |= static_cast<uint64_t>(_mm_movemask_epi8(in) & 0xFFFF) << j;
+            }
+        }
+#endif
+        for (; j < count; ++j)
+            m |= static_cast<uint64_t>(table[g[j]]) << j;
+        applyMatches(words, w, m, invert);
+    }
+}
+
+void selectEqual(const uint8_t* a, const uint8_t* b, size_t n, bool invert, uint64_t* words)
+{
+    for (size_t base = 0, w = 0; base < n; base += 64, ++w)
+    {
+        size_t count = groupSize(base, n);
+        const uint8_t* ga = a + base;
+        const uint8_t* gb = b + base;
+        uint64_t m = 0;
+        size_t j = 0;
+#ifdef LIBHSL_HAVE_SSE2
+        for (; j + 16 <= count; j += 16)
+        {
+            __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ga + j));
+            __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(gb + j));
+            m |= static_cast<uint64_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) & 0xFFFF) << j;
+        }
+#endif
+        for (; j < count; ++j)
+            m |= static_cast<uint64_t>(ga[j] == gb[j]) << j;
+        applyMatches(words, w, m, invert);
+    }
+}
+
+void selectCompare(const double* v, size_t n, ComparisonOperator op, double value, bool invert, uint64_t* words)
+{
+    switch (op)
+    {
+    case CO_GreaterEqual:
+        selectRange(v, n, value, std::numeric_limits<double>::infinity(), invert, words);
+        return;
+    case CO_LessEqual:
+        selectRange(v, n, -std::numeric_limits<double>::infinity(), value, invert, words);
+        return;
+    case CO_Equal:
+        selectRange(v, n, value, value, invert, words);
+        return;
+    default:
+        break;
+    }
+
+    for (size_t base = 0, w = 0; base < n; base += 64, ++w)
+    {
+        size_t count = groupSize(base, n);
+        const double* g = v + base;
+        uint64_t m = 0;
+        size_t j = 0;
+#ifdef LIBHSL_HAVE_SSE2
+        __m128d vv = _mm_set1_pd(value);
+        for (; j + 2 <= count; j += 2)
+        {
+            __m128d x = _mm_loadu_pd(g + j);
+            __m128d r = op == CO_Less ? _mm_cmplt_pd(x, vv) : _mm_cmpgt_pd(x, vv);
+            m |= static_cast<uint64_t>(_mm_movemask_pd(r)) << j;
+        }
+#endif
+        for (; j < count; ++j)
+            m |= static_cast<uint64_t>(op == CO_Less ? g[j] < value : g[j] > value) << j;
+        applyMatches(words, w, m, invert);
+    }
+}
+
+}
+
+void FilterInterface::filter(const PointBlock& block, Bitmask& mask)
+{
+    Point p(block.getHeader());
+    for (size_t i = 0; i < block.size(); ++i)
+    {
+        if (!mask.test(i))
+            continue;
+        block.getPoint(i, p);
+        if (!filter(p))
+            mask.reset(i);
+    }
+}
+
 ClassificationFilter::ClassificationFilter( std::vector<hsl::Classification> classes )
     : FilterInterface(eInclusion)
     , m_classes(classes) 
 {
+    for (class_list_type::const_iterator it = m_classes.begin(); it != m_classes.end(); ++it)
+        m_codes.push_back(static_cast<uint8_t>(it->GetFlags().to_ulong()));
 }
 
 bool ClassificationFilter::filter(const Point& p)
@@ -63,45 +248,168 @@ bool ClassificationFilter::filter(const Point& p)
     
     // If the user gave us an empty set of classes to filter
     // we're going to return true regardless
-    bool output = true;
+    if (m_classes.empty())
+        return true;
+
+    bool found = false;
     for (class_list_type::const_iterator it = m_classes.begin(); it != m_classes.end(); ++it) {
         if (c == *it) {
-            if (GetType() == eInclusion) {
-                output = true;
-            } else {
-                output = false;
-            }
+            found = true;
             break;
-        } else {
-            output = false;
         }
     }
-    return output;
+    return GetType() == eInclusion ? found : !found;
+}
+
+bool ClassificationFilter::canSkip(ZoneMap const& zones, size_t chunk)
+{
+    double low, high;
+    if (m_classes.empty() || !zones.getRange(chunk, FI_Classification, 0, low, high))
+        return false;
+
+    bool any = false;
+    for (std::vector<uint8_t>::const_iterator c = m_codes.begin(); c != m_codes.end() && !any; ++c)
+        any = low <= *c && *c <= high;
+
+    if (GetType() == eInclusion)
+        return !any;
+    // every point of the chunk has the one class, which is excluded
+    return any && !(low < high);
 }
 
-BoundsFilter::BoundsFilter( double minx, double miny, double maxx, double maxy ) : FilterInterface(eInclusion)
+void ClassificationFilter::filter(const PointBlock& block, Bitmask& mask)
+{
+    if (m_classes.empty() || block.empty())
+        return;
+
+    FieldAccessor field;
+    if (!field.bind(block.getHeader()->getSchema(), FI_Classification) || field.getDataType() != DT_UCHAR)
+    {
+        FilterInterface::filter(block, mask);
+        return;
+    }
+
+    field.gatherRaw(block, m_column);
+    detail::selectMembers(&m_column[0], m_column.size(), m_codes, GetType() == eExclusion, mask.words());
+}
+
+BoundsFilter::BoundsFilter( double minx, double miny, double maxx, double maxy ) : FilterInterface(eInclusion),
+    m_header(0), m_raw(false), m_dimensions(0), m_empty(false)
 {
     bounds = Bounds<double>(minx, miny, maxx, maxy);
 }
 
-BoundsFilter::BoundsFilter( double minx, double miny, double minz, double maxx, double maxy, double maxz ) : FilterInterface(eInclusion)
+BoundsFilter::BoundsFilter( double minx, double miny, double minz, double maxx, double maxy, double maxz ) : FilterInterface(eInclusion),
+    m_header(0), m_raw(false), m_dimensions(0), m_empty(false)
 {
     bounds = Bounds<double>(minx, miny, minz, maxx, maxy, maxz);
 }
 
-BoundsFilter::BoundsFilter( Bounds<double> const& b) : FilterInterface(eInclusion)
+BoundsFilter::BoundsFilter( Bounds<double> const& b) : FilterInterface(eInclusion),
+    m_header(0), m_raw(false), m_dimensions(0), m_empty(false)
 {
     bounds = b;
 }
+
+void BoundsFilter::prepare(Header const* header)
+{
+    if (header == m_header)
+        return;
+
+    m_header = header;
+    m_raw = false;
+    m_empty = false;
+
+    // same semantics as Bounds::contains(Point), Z is ignored by a flat bounds
+    m_dimensions = bounds.dimension() > 2 && !detail::compare_distance((bounds.max)(2) - (bounds.min)(2), 0.0) ? 3 : 2;
+
+    // translate the bounds once into the stored coordinates of the header
+    Schema const& schema = header->getSchema();
+    const FieldId ids[3] = { FI_X, FI_Y, FI_Z };
+    for (size_t d = 0; d < m_dimensions; ++d)
+    {
+        FieldAccessor field;
+        int64_t low = 0;
+        int64_t high = 0;
+        if (!field.bind(schema, ids[d]) || !field.isInt32Raw() || field.getByteOffset() != d * 4 ||
+            !field.getRawRange((bounds.min)(d), (bounds.max)(d), low, high))
+            return;
+
+        if (low > high)
+        {
+            m_empty = true;
+            low = 0;
+            high = -1;
+        }
+        m_rawMin[d] = static_cast<int32_t>(low);
+        m_rawMax[d] = static_cast<int32_t>(high);
+    }
+    m_raw = true;
+}
+
 bool BoundsFilter::filter(const Point& p)
 {
-    return bounds.contains(p);
+    prepare(p.getHeader());
+    if (!m_raw)
+        return bounds.contains(p);
+
+    if (m_empty)
+        return false;
+    const int32_t raw[3] = { p.getRawX(), p.getRawY(), m_dimensions > 2 ? p.getRawZ() : 0 };
+    for (size_t d = 0; d < m_dimensions; ++d)
+    {
+        if (raw[d] < m_rawMin[d] || raw[d] > m_rawMax[d])
+            return false;
+    }
+    return true;
     // lasinfo --extent 630000.00 4834500.00 46.83 630300 4834600.00 150.00 TO_core_las_zoom.las
     
     // lasinfo --minx 630000.00 --miny 4834500.00 --minz 46.83 --maxx 630300 --maxy 4834600.00 --maxz 150.00 TO_core_las_zoom.las
 
 }
 
+bool BoundsFilter::canSkip(ZoneMap const& zones, size_t chunk)
+{
+    size_t dimensions = bounds.dimension() > 2 && !detail::compare_distance((bounds.max)(2) - (bounds.min)(2), 0.0) ? 3 : 2;
+    const FieldId ids[3] = { FI_X, FI_Y, FI_Z };
+    for (size_t d = 0; d < dimensions; ++d)
+    {
+        double low, high;
+        if (zones.getRange(chunk, ids[d], 0, low, high) && (high < (bounds.min)(d) || low > (bounds.max)(d)))
+            return true;
+    }
+    return false;
+}
+
+void BoundsFilter::filter(const PointBlock& block, Bitmask& mask)
+{
+    if (block.empty())
+        return;
+
+    prepare(block.getHeader());
+    if (!m_raw)
+    {
+        FilterInterface::filter(block, mask);
+        return;
+    }
+
+    if (m_empty)
+    {
+        mask.assign(mask.size(), false);
+        return;
+    }
+
+    const size_t n = block.size();
+    const size_t stride = block.getRecordLength();
+    m_column.resize(n);
+    for (size_t d = 0; d < m_dimensions; ++d)
+    {
+        const uint8_t* record = block.getRecord(0) + d * 4;
+        for (size_t i = 0; i < n; ++i, record += stride)
+            std::memcpy(&m_column[i], record, sizeof(int32_t));
+        detail::selectRange(&m_column[0], n, m_rawMin[d], m_rawMax[d], false, mask.words());
+    }
+}
 
 
 ThinFilter::ThinFilter( uint32_t thin ) :
@@ -139,6 +447,12 @@ ReturnFilter::ReturnFilter( return_list_type returns, bool last_only )
     : FilterInterface(eInclusion)
     , m_returns(returns), last_only(last_only)
 {
+    for (return_list_type::const_iterator it = m_returns.begin(); it != m_returns.end(); ++it)
+    {
+        // return numbers are stored in a byte, larger values never match
+        if (*it <= 0xFF)
+            m_codes.push_back(static_cast<uint8_t>(*it));
+    }
 }
 
 bool ReturnFilter::filter(const Point& p)
@@ -161,7 +475,7 @@ bool ReturnFilter::filter(const Point& p)
         
         // If the type is switched to eExclusion, we'll throw out all last returns.
         if (GetType() == eExclusion)
-            isLast = false;
+            return !isLast;
         return isLast;
     }
     
@@ -174,21 +488,44 @@ bool ReturnFilter::filter(const Point& p)
     
     // If the user gave us an empty set of returns to filter
     // we're going to return true regardless
-    bool output = true;
+    if (m_returns.empty())
+        return true;
+
+    bool found = false;
     for (return_list_type::const_iterator it = m_returns.begin(); it != m_returns.end(); ++it) {
-        
         if (r == *it) {
-            if (GetType() == eInclusion) {
-                output = true;
-            } else {
-                output = false;
-            }
+            found = true;
             break;
-        } else {
-            output = false;
         }
     }
-    return output;
+    return GetType() == eInclusion ? found : !found;
+}
+
+void ReturnFilter::filter(const PointBlock& block, Bitmask& mask)
+{
+    if ((!last_only && m_returns.empty()) || block.empty())
+        return;
+
+    Schema const& schema = block.getHeader()->getSchema();
+    FieldAccessor returnNumber;
+    FieldAccessor numberOfReturns;
+    if (!returnNumber.bind(schema, FI_ReturnNumber) || returnNumber.getDataType() != DT_BIT ||
+        (last_only && (!numberOfReturns.bind(schema, FI_NumberOfReturns) || numberOfReturns.getDataType() != DT_BIT)))
+    {
+        FilterInterface::filter(block, mask);
+        return;
+    }
+
+    returnNumber.gatherRaw(block, m_column);
+    if (last_only)
+    {
+        numberOfReturns.gatherRaw(block, m_column2);
+        detail::selectEqual(&m_column[0], &m_column2[0], m_column.size(), GetType() == eExclusion, mask.words());
+    }
+    else
+    {
+        detail::selectMembers(&m_column[0], m_column.size(), m_codes, GetType() == eExclusion, mask.words());
+    }
 }
 
 ValidationFilter::ValidationFilter() :
@@ -227,7 +564,7 @@ ColorFilter::ColorFilter(hsl::Color::value_type low_red,
                 hsl::Color::value_type high_blue,
                 hsl::Color::value_type low_green,
                 hsl::Color::value_type high_green) :
- hsl::FilterInterface(eInclusion), m_low(low_red, low_green, low_blue), m_high(high_red, high_blue, high_green)
+ hsl::FilterInterface(eInclusion), m_low(low_red, low_green, low_blue), m_high(high_red, high_green, high_blue)
 {
 
 }
@@ -280,4 +617,34 @@ bool ColorFilter::filter(const hsl::Point& p)
     return DoExclude();
 }
 
+void ColorFilter::filter(const PointBlock& block, Bitmask& mask)
+{
+    if (block.empty())
+        return;
+
+    Schema const& schema = block.getHeader()->getSchema();
+    const FieldId ids[3] = { FI_Red, FI_Green, FI_Blue };
+    FieldAccessor fields[3];
+    for (int c = 0; c < 3; ++c)
+    {
+        if (!fields[c].bind(schema, ids[c]) || fields[c].getDataType() != DT_USHORT)
+        {
+            FilterInterface::filter(block, mask);
+            return;
+        }
+    }
+
+    // inclusion keeps the colors inside all three ranges, exclusion the others
+    Bitmask inside(block.size());
+    for (int c = 0; c < 3; ++c)
+    {
+        fields[c].gatherRaw(block, m_column);
+        detail::selectRange(&m_column[0], m_column.size(), static_cast<int32_t>(m_low[c]),
+            static_cast<int32_t>(m_high[c]), false, inside.words());
+    }
+    if (GetType() == eExclusion)
+        inside.flip();
+    mask &= inside;
+}
+
 } // namespace liblas
@@ -0,0 +1,253 @@
+/*************************************************************************************
+ * 
+ * 
+ * Copyright (c) 2021, Zhengjun Liu <zjliu@casm.ac.cn>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ ************************************************************************************/
+
+#include "FilterChain.h"
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <ostream>
+#include "Point.h"
+#include "PointBlock.h"
+
+namespace hsl
+{
+
+namespace
+{
+
+typedef std::chrono::steady_clock FilterClock;
+
+inline double elapsedSeconds(FilterClock::time_point start)
+{
+    return std::chrono::duration<double>(FilterClock::now() - start).count();
+}
+
+// expected cost of rejecting a point with the filter, lower runs first
+struct FilterRank
+{
+    FilterStatisticsArray const& statistics;
+
+    double rank(size_t i) const
+    {
+        double reject = 1.0 - statistics[i].getPassRate();
+        if (reject <= 0.0)
+            return std::numeric_limits<double>::infinity();
+        return statistics[i].getCost() / reject;
+    }
+
+    bool operator()(size_t a, size_t b) const
+    {
+        return rank(a) < rank(b);
+    }
+};
+
+}
+
+double FilterStatistics::getPassRate() const
+{
+    return evaluated ? static_cast<double>(passed) / static_cast<double>(evaluated) : 1.0;
+}
+
+double FilterStatistics::getCost() const
+{
+    return evaluated ? seconds / static_cast<double>(evaluated) : 0.0;
+}
+
+FilterChain::FilterChain()
+    : _adaptive(false), _sampling(false), _samplePoints(65536), _sampled(0)
+{
+}
+
+void FilterChain::setFilters(std::vector<FilterPtr> const& filters)
+{
+    _filters = filters;
+    reset();
+}
+
+void FilterChain::setAdaptive(bool adaptive, uint64_t samplePoints)
+{
+    _adaptive = adaptive;
+    _samplePoints = samplePoints;
+    reset();
+}
+
+void FilterChain::reset()
+{
+    _order.resize(_filters.size());
+    _statistics.assign(_filters.size(), FilterStatistics());
+    for (size_t i = 0; i < _filters.size(); ++i)
+    {
+        _order[i] = i;
+        _statistics[i].position = i;
+    }
+    _sampled = 0;
+    _sampling = _adaptive && _filters.size() > 1;
+}
+
+bool FilterChain::filter(const Point& point)
+{
+    if (_sampling)
+        return sample(point);
+
+    for (std::vector<size_t>::const_iterator i = _order.begin(); i != _order.end(); ++i)
+    {
+        if (!_filters[*i]->filter(point))
+            return false;
+    }
+    return true;
+}
+
+void FilterChain::filter(const PointBlock& block, Bitmask& mask)
+{
+    if (_sampling)
+    {
+        sample(block, mask);
+        return;
+    }
+
+    for (std::vector<size_t>::const_iterator i = _order.begin(); i != _order.end() && mask.any(); ++i)
+        _filters[*i]->filter(block, mask);
+}
+
+bool FilterChain::canSkip(ZoneMap const& zones, size_t chunk)
+{
+    for (std::vector<FilterPtr>::const_iterator f = _filters.begin(); f != _filters.end(); ++f)
+    {
+        if (!(*f)->isStateless())
+            return false;
+        if ((*f)->canSkip(zones, chunk))
+            return true;
+    }
+    return false;
+}
+
+bool FilterChain::sample(const Point& point)
+{
+    // stateless filters see every point so that their pass rates do not
+    // depend on the filters before them, stateful ones only what passed
+    bool keep = true;
+    for (size_t i = 0; i < _filters.size(); ++i)
+    {
+        FilterPtr const& f = _filters[i];
+        if (!keep && !f->isStateless())
+            continue;
+
+        FilterClock::time_point start = FilterClock::now();
+        bool passed = f->filter(point);
+        _statistics[i].seconds += elapsedSeconds(start);
+        ++_statistics[i].evaluated;
+        if (passed)
+            ++_statistics[i].passed;
+        keep = keep && passed;
+    }
+
+    if (++_sampled >= _samplePoints)
+        chooseOrder();
+    return keep;
+}
+
+void FilterChain::sample(const PointBlock& block, Bitmask& mask)
+{
+    _input = mask;
+    const size_t selected = _input.count();
+    for (size_t i = 0; i < _filters.size(); ++i)
+    {
+        FilterPtr const& f = _filters[i];
+        FilterStatistics& stats = _statistics[i];
+        FilterClock::time_point start;
+        if (f->isStateless())
+        {
+            _scratch = _input;
+            start = FilterClock::now();
+            f->filter(block, _scratch);
+            stats.seconds += elapsedSeconds(start);
+            stats.evaluated += selected;
+            stats.passed += _scratch.count();
+            mask &= _scratch;
+        }
+        else
+        {
+            size_t before = mask.count();
+            start = FilterClock::now();
+            f->filter(block, mask);
+            stats.seconds += elapsedSeconds(start);
+            stats.evaluated += before;
+            stats.passed += mask.count();
+        }
+    }
+
+    _sampled += selected;
+    if (_sampled >= _samplePoints)
+        chooseOrder();
+}
+
+void FilterChain::chooseOrder()
+{
+    _sampling = false;
+
+    // sort the runs of stateless filters between stateful ones
+    FilterRank rank = { _statistics };
+    std::vector<size_t>::iterator begin = _order.begin();
+    while (begin != _order.end())
+    {
+        std::vector<size_t>::iterator end = begin;
+        while (end != _order.end() && _filters[*end]->isStateless())
+            ++end;
+        std::stable_sort(begin, end, rank);
+        begin = end == _order.end() ? end : end + 1;
+    }
+}
+
+void FilterChain::report(std::ostream& os) const
+{
+    os << "filter order: ";
+    if (!_adaptive)
+        os << "as given";
+    else if (_sampling)
+        os << "sampling, " << _sampled << " of " << _samplePoints << " points";
+    else
+        os << "adaptive, sampled " << _sampled << " points";
+    os << std::endl;
+
+    for (size_t k = 0; k < _order.size(); ++k)
+    {
+        FilterStatistics const& stats = _statistics[_order[k]];
+        os << "  " << k + 1 << ". filter " << stats.position;
+        if (!_filters[_order[k]]->isStateless())
+            os << " (stateful)";
+        if (stats.evaluated)
+        {
+            os << ": passed " << stats.getPassRate() * 100.0 << "% of " << stats.evaluated
+               << " points, " << stats.getCost() * 1e9 << " ns per point";
+        }
+        os << std::endl;
+    }
+}
+
+}
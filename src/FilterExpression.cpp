@@ -0,0 +1,954 @@
+/*************************************************************************************
+ * 
+ * 
+ * Copyright (c) 2021, Zhengjun Liu <zjliu@casm.ac.cn>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ ************************************************************************************/
+
+#include "FilterExpression.h"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <sstream>
+#include "Exception.h"
+#include "Field.h"
+#include "Header.h"
+#include "Point.h"
+#include "PointBlock.h"
+#include "Schema.h"
+#include "Bitmask.h"
+#include "detail/private_utility.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define LIBHSL_HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace hsl
+{
+
+namespace
+{
+
+// records evaluated per pass of the bytecode, a multiple of 64
+const size_t ExpressionChunkSize = 256;
+
+struct FieldAlias
+{
+    const char* name;
+    FieldId     id;
+};
+
+const FieldAlias fieldAliases[] =
+{
+    { "x", FI_X },
+    { "y", FI_Y },
+    { "z", FI_Z },
+    { "intensity", FI_Intensity },
+    { "returnnumber", FI_ReturnNumber },
+    { "numberofreturns", FI_NumberOfReturns },
+    { "classificationflags", FI_ClassificationFlags },
+    { "scandirectionflag", FI_ScanDirectionFlag },
+    { "edgeofflightline", FI_EdgeOfFlightLine },
+    { "scannerchannel", FI_ScannerChannel },
+    { "classification", FI_Classification },
+    { "scananglerank", FI_ScanAngleRank },
+    { "pointsourceid", FI_PointSourceID },
+    { "gnsstime", FI_GNSSTime },
+    { "time", FI_GNSSTime },
+    { "band", FI_BandValue },
+    { "bandvalue", FI_BandValue },
+    { "red", FI_Red },
+    { "green", FI_Green },
+    { "blue", FI_Blue },
+    { "nir", FI_NIR },
+    { "waveformoffset", FI_ByteOffsetToWaveformData },
+    { "waveformsize", FI_WaveformDataSize },
+    { "abundance", FI_Abundance }
+};
+
+std::string normalizeName(std::string const& name)
+{
+    std::string out;
+    for (size_t i = 0; i < name.size(); ++i)
+    {
+        unsigned char c = static_cast<unsigned char>(name[i]);
+        if (std::isalnum(c))
+            out += static_cast<char>(std::tolower(c));
+    }
+    return out;
+}
+
+// whether a value is true: not zero, NaN included
+inline bool truthy(double a) { return !detail::exactly_equal(a, 0.0); }
+
+struct ConstOperand
+{
+    double v;
+    inline double operator[](size_t) const { return v; }
+#ifdef LIBHSL_HAVE_SSE2
+    inline __m128d load(size_t) const { return _mm_set1_pd(v); }
+#endif
+};
+
+struct ColumnOperand
+{
+    const double* p;
+    inline double operator[](size_t i) const { return p[i]; }
+#ifdef LIBHSL_HAVE_SSE2
+    inline __m128d load(size_t i) const { return _mm_loadu_pd(p + i); }
+#endif
+};
+
+#ifdef LIBHSL_HAVE_SSE2
+// kernels of the binary operations on two values at a time
+struct AddKernel { static inline __m128d apply(__m128d a, __m128d b) { return _mm_add_pd(a, b); } };
+struct SubtractKernel { static inline __m128d apply(__m128d a, __m128d b) { return _mm_sub_pd(a, b); } };
+struct MultiplyKernel { static inline __m128d apply(__m128d a, __m128d b) { return _mm_mul_pd(a, b); } };
+struct DivideKernel { static inline __m128d apply(__m128d a, __m128d b) { return _mm_div_pd(a, b); } };
+struct LessKernel { static inline __m128d apply(__m128d a, __m128d b) { return _mm_and_pd(_mm_cmplt_pd(a, b), _mm_set1_pd(1.0)); } };
+struct LessEqualKernel { static inline __m128d apply(__m128d a, __m128d b) { return _mm_and_pd(_mm_cmple_pd(a, b), _mm_set1_pd(1.0)); } };
+struct GreaterKernel { static inline __m128d apply(__m128d a, __m128d b) { return _mm_and_pd(_mm_cmpgt_pd(a, b), _mm_set1_pd(1.0)); } };
+struct GreaterEqualKernel { static inline __m128d apply(__m128d a, __m128d b) { return _mm_and_pd(_mm_cmpge_pd(a, b), _mm_set1_pd(1.0)); } };
+
+// applies K to the leading pairs of a and b, returning the count done
+template <typename K, typename R>
+inline size_t applyPairs(double* a, R const& b, size_t n)
+{
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2)
+        _mm_storeu_pd(a + i, K::apply(_mm_loadu_pd(a + i), b.load(i)));
+    return i;
+}
+#define LIBHSL_APPLY_PAIRS(K) applyPairs<K>(a, b, n)
+#else
+#define LIBHSL_APPLY_PAIRS(K) 0
+#endif
+
+}
+
+/// Recursive descent parser emitting postfix bytecode into a FilterExpression.
+class FilterExpression::Parser
+{
+public:
+    Parser(FilterExpression& e, std::string const& text) : _e(e), _text(text), _pos(0) {}
+
+    void parse()
+    {
+        parseOr();
+        skipBlanks();
+        if (_pos != _text.size())
+            fail("unexpected input");
+    }
+
+private:
+    FilterExpression&   _e;
+    std::string const&  _text;
+    size_t              _pos;
+
+    void fail(std::string const& what) const
+    {
+        std::ostringstream msg;
+        msg << "filter expression: " << what << " at position " << _pos << " in '" << _text << "'";
+        throw invalid_expression(msg.str());
+    }
+
+    void skipBlanks()
+    {
+        while (_pos < _text.size() && std::isspace(static_cast<unsigned char>(_text[_pos])))
+            ++_pos;
+    }
+
+    bool acceptSymbol(const char* symbol)
+    {
+        skipBlanks();
+        size_t len = std::strlen(symbol);
+        if (_text.compare(_pos, len, symbol) != 0)
+            return false;
+        _pos += len;
+        return true;
+    }
+
+    bool isWordChar(size_t pos) const
+    {
+        return pos < _text.size() &&
+            (std::isalnum(static_cast<unsigned char>(_text[pos])) || _text[pos] == '_');
+    }
+
+    bool acceptKeyword(const char* keyword)
+    {
+        skipBlanks();
+        size_t len = std::strlen(keyword);
+        if (_pos + len > _text.size() || isWordChar(_pos + len))
+            return false;
+        for (size_t i = 0; i < len; ++i)
+        {
+            if (std::tolower(static_cast<unsigned char>(_text[_pos + i])) != keyword[i])
+                return false;
+        }
+        _pos += len;
+        return true;
+    }
+
+    void expectSymbol(const char* symbol)
+    {
+        if (!acceptSymbol(symbol))
+            fail(std::string("expected '") + symbol + "'");
+    }
+
+    bool peekNumber()
+    {
+        skipBlanks();
+        return _pos < _text.size() &&
+            (std::isdigit(static_cast<unsigned char>(_text[_pos])) || _text[_pos] == '.');
+    }
+
+    double parseNumber()
+    {
+        skipBlanks();
+        const char* begin = _text.c_str() + _pos;
+        char* end = 0;
+        double v = std::strtod(begin, &end);
+        if (end == begin)
+            fail("expected a number");
+        _pos += end - begin;
+        return v;
+    }
+
+    double parseSignedNumber()
+    {
+        bool negative = acceptSymbol("-");
+        double v = parseNumber();
+        return negative ? -v : v;
+    }
+
+    void parseOr()
+    {
+        parseAnd();
+        while (acceptSymbol("||") || acceptKeyword("or"))
+        {
+            parseAnd();
+            _e.emit(OP_Or);
+        }
+    }
+
+    void parseAnd()
+    {
+        parseNot();
+        while (acceptSymbol("&&") || acceptKeyword("and"))
+        {
+            parseNot();
+            _e.emit(OP_And);
+        }
+    }
+
+    void parseNot()
+    {
+        skipBlanks();
+        if ((_text.compare(_pos, 1, "!") == 0 && _text.compare(_pos, 2, "!=") != 0 && acceptSymbol("!")) ||
+            acceptKeyword("not"))
+        {
+            parseNot();
+            _e.emit(OP_Not);
+            return;
+        }
+        parseComparison();
+    }
+
+    void parseComparison()
+    {
+        parseSum();
+
+        if (acceptKeyword("in"))
+        {
+            expectSymbol("(");
+            std::vector<double> set;
+            do
+            {
+                set.push_back(parseSignedNumber());
+            } while (acceptSymbol(","));
+            expectSymbol(")");
+
+            std::sort(set.begin(), set.end());
+            set.erase(std::unique(set.begin(), set.end()), set.end());
+            _e._sets.push_back(set);
+            _e.emit(OP_In, _e._sets.size() - 1);
+            return;
+        }
+
+        // longer symbols first
+        OpCode op;
+        if (acceptSymbol("<="))
+            op = OP_LessEqual;
+        else if (acceptSymbol(">="))
+            op = OP_GreaterEqual;
+        else if (acceptSymbol("=="))
+            op = OP_Equal;
+        else if (acceptSymbol("!="))
+            op = OP_NotEqual;
+        else if (acceptSymbol("<"))
+            op = OP_Less;
+        else if (acceptSymbol(">"))
+            op = OP_Greater;
+        else if (acceptSymbol("="))
+            op = OP_Equal;
+        else
+            return;
+
+        parseSum();
+        _e.emit(op);
+    }
+
+    void parseSum()
+    {
+        parseProduct();
+        for (;;)
+        {
+            if (acceptSymbol("+"))
+            {
+                parseProduct();
+                _e.emit(OP_Add);
+            }
+            else if (acceptSymbol("-"))
+            {
+                parseProduct();
+                _e.emit(OP_Subtract);
+            }
+            else
+                return;
+        }
+    }
+
+    void parseProduct()
+    {
+        parseUnary();
+        for (;;)
+        {
+            if (acceptSymbol("*"))
+            {
+                parseUnary();
+                _e.emit(OP_Multiply);
+            }
+            else if (acceptSymbol("/"))
+            {
+                parseUnary();
+                _e.emit(OP_Divide);
+            }
+            else
+                return;
+        }
+    }
+
+    void parseUnary()
+    {
+        if (acceptSymbol("-"))
+        {
+            parseUnary();
+            _e.emit(OP_Negate);
+            return;
+        }
+        parsePrimary();
+    }
+
+    void parsePrimary()
+    {
+        if (acceptSymbol("("))
+        {
+            parseOr();
+            expectSymbol(")");
+            return;
+        }
+
+        if (peekNumber())
+        {
+            _e.emit(OP_Const, 0, parseNumber());
+            return;
+        }
+
+        skipBlanks();
+        size_t begin = _pos;
+        while (isWordChar(_pos))
+            ++_pos;
+        if (begin == _pos)
+            fail("expected a number, a field or '('");
+
+        FieldReference ref;
+        ref.name = _text.substr(begin, _pos - begin);
+        ref.indexed = false;
+        ref.index = 0;
+        if (acceptSymbol("["))
+        {
+            double v = parseNumber();
+            if (v < 0 || !detail::exactly_equal(v, static_cast<double>(static_cast<size_t>(v))))
+                fail("expected a field index");
+            ref.indexed = true;
+            ref.index = static_cast<size_t>(v);
+            expectSymbol("]");
+        }
+
+        _e._references.push_back(ref);
+        _e.emit(OP_Load, _e._references.size() - 1);
+    }
+};
+
+FilterExpression::FilterExpression()
+    : _depth(0), _maxDepth(0), _compiled(false)
+{
+}
+
+FilterExpression::FilterExpression(std::string const& text)
+    : _depth(0), _maxDepth(0), _compiled(false)
+{
+    parse(text);
+}
+
+void FilterExpression::parse(std::string const& text)
+{
+    _text = text;
+    _code.clear();
+    _references.clear();
+    _sets.clear();
+    _fields.clear();
+    _stack.clear();
+    _depth = 0;
+    _maxDepth = 0;
+    _compiled = false;
+
+    Parser parser(*this, _text);
+    parser.parse();
+}
+
+void FilterExpression::emit(OpCode op, size_t arg, double value)
+{
+    Instruction ins;
+    ins.op = op;
+    ins.immediate = false;
+    ins.arg = arg;
+    ins.value = value;
+
+    switch (op)
+    {
+    case OP_Load:
+    case OP_Const:
+        ++_depth;
+        _maxDepth = (std::max)(_maxDepth, _depth);
+        break;
+    case OP_Negate:
+        // fold negative literals
+        if (!_code.empty() && _code.back().op == OP_Const)
+        {
+            _code.back().value = -_code.back().value;
+            return;
+        }
+        break;
+    case OP_Not:
+    case OP_In:
+        break;
+    default:
+        // a constant right operand becomes an immediate of the operation
+        --_depth;
+        if (!_code.empty() && _code.back().op == OP_Const)
+        {
+            ins.immediate = true;
+            ins.value = _code.back().value;
+            _code.pop_back();
+        }
+        break;
+    }
+
+    _code.push_back(ins);
+}
+
+void FilterExpression::compile(Schema const& schema)
+{
+    _compiled = false;
+    _fields.assign(_references.size(), FieldAccessor());
+    _fieldKeys.assign(_references.size(), ZoneMapField(FI_UNKNOWN, 0));
+
+    for (size_t i = 0; i < _references.size(); ++i)
+    {
+        FieldReference const& ref = _references[i];
+        std::string name = normalizeName(ref.name);
+
+        FieldId id = FI_UNKNOWN;
+        size_t n = ref.index;
+        for (size_t a = 0; a < sizeof(fieldAliases) / sizeof(fieldAliases[0]); ++a)
+        {
+            if (name == fieldAliases[a].name)
+            {
+                id = fieldAliases[a].id;
+                break;
+            }
+        }
+
+        if (id == FI_BandValue && !ref.indexed)
+            throw invalid_expression("filter expression: '" + ref.name + "' needs a band index");
+
+        if (id == FI_UNKNOWN)
+        {
+            // schema field names, counting earlier fields with the same id
+            std::map<FieldId, size_t> seen;
+            Field field;
+            for (size_t f = 0; f < schema.getFieldCount(); ++f)
+            {
+                if (!schema.getField(f, field))
+                    break;
+                if (normalizeName(field.getName()) == name)
+                {
+                    id = field.getId();
+                    if (!ref.indexed)
+                        n = seen[id];
+                    break;
+                }
+                ++seen[field.getId()];
+            }
+        }
+
+        if (id == FI_UNKNOWN || !_fields[i].bind(schema, id, n))
+        {
+            std::ostringstream msg;
+            msg << "filter expression: field '" << ref.name;
+            if (ref.indexed)
+                msg << "[" << ref.index << "]";
+            msg << "' is not in the schema or cannot be read";
+            throw invalid_expression(msg.str());
+        }
+        _fieldKeys[i] = ZoneMapField(id, n);
+    }
+
+    _stack.assign((std::max)(_maxDepth, static_cast<size_t>(1)) * ExpressionChunkSize, 0.0);
+    _compiled = true;
+}
+
+template <typename R>
+void FilterExpression::applyBinary(OpCode op, double* a, R const& b, size_t n)
+{
+    switch (op)
+    {
+    case OP_Add:
+        for (size_t i = LIBHSL_APPLY_PAIRS(AddKernel); i < n; ++i)
+            a[i] = a[i] + b[i];
+        break;
+    case OP_Subtract:
+        for (size_t i = LIBHSL_APPLY_PAIRS(SubtractKernel); i < n; ++i)
+            a[i] = a[i] - b[i];
+        break;
+    case OP_Multiply:
+        for (size_t i = LIBHSL_APPLY_PAIRS(MultiplyKernel); i < n; ++i)
+            a[i] = a[i] * b[i];
+        break;
+    case OP_Divide:
+        for (size_t i = LIBHSL_APPLY_PAIRS(DivideKernel); i < n; ++i)
+            a[i] = a[i] / b[i];
+        break;
+    case OP_Less:
+        for (size_t i = LIBHSL_APPLY_PAIRS(LessKernel); i < n; ++i)
+            a[i] = a[i] < b[i] ? 1.0 : 0.0;
+        break;
+    case OP_LessEqual:
+        for (size_t i = LIBHSL_APPLY_PAIRS(LessEqualKernel); i < n; ++i)
+            a[i] = a[i] <= b[i] ? 1.0 : 0.0;
+        break;
+    case OP_Greater:
+        for (size_t i = LIBHSL_APPLY_PAIRS(GreaterKernel); i < n; ++i)
+            a[i] = a[i] > b[i] ? 1.0 : 0.0;
+        break;
+    case OP_GreaterEqual:
+        for (size_t i = LIBHSL_APPLY_PAIRS(GreaterEqualKernel); i < n; ++i)
+            a[i] = a[i] >= b[i] ? 1.0 : 0.0;
+        break;
+    case OP_Equal:
+        for (size_t i = 0; i < n; ++i)
+            a[i] = detail::exactly_equal(a[i], b[i]) ? 1.0 : 0.0;
+        break;
+    case OP_NotEqual:
+        for (size_t i = 0; i < n; ++i)
+            a[i] = !detail::exactly_equal(a[i], b[i]) ? 1.0 : 0.0;
+        break;
+    case OP_And:
+        for (size_t i = 0; i < n; ++i)
+            a[i] = truthy(a[i]) && truthy(b[i]) ? 1.0 : 0.0;
+        break;
+    case OP_Or:
+        for (size_t i = 0; i < n; ++i)
+            a[i] = truthy(a[i]) || truthy(b[i]) ? 1.0 : 0.0;
+        break;
+    default:
+        break;
+    }
+}
+
+void FilterExpression::run(const uint8_t* records, size_t stride, size_t n, double* result)
+{
+    // each stack slot holds one value per record of the chunk
+    double* top = &_stack[0];
+    for (std::vector<Instruction>::const_iterator ins = _code.begin(); ins != _code.end(); ++ins)
+    {
+        switch (ins->op)
+        {
+        case OP_Load:
+            _fields[ins->arg].gather(records, stride, n, top);
+            top += ExpressionChunkSize;
+            break;
+        case OP_Const:
+            std::fill(top, top + n, ins->value);
+            top += ExpressionChunkSize;
+            break;
+        case OP_Negate:
+            {
+                double* a = top - ExpressionChunkSize;
+                for (size_t i = 0; i < n; ++i)
+                    a[i] = -a[i];
+            }
+            break;
+        case OP_Not:
+            {
+                double* a = top - ExpressionChunkSize;
+                for (size_t i = 0; i < n; ++i)
+                    a[i] = truthy(a[i]) ? 0.0 : 1.0;
+            }
+            break;
+        case OP_In:
+            {
+                double* a = top - ExpressionChunkSize;
+                std::vector<double> const& set = _sets[ins->arg];
+                if (set.size() <= 4)
+                {
+                    for (size_t i = 0; i < n; ++i)
+                    {
+                        bool found = false;
+                        for (size_t k = 0; k < set.size(); ++k)
+                            found |= detail::exactly_equal(a[i], set[k]);
+                        a[i] = found ? 1.0 : 0.0;
+                    }
+                }
+                else
+                {
+                    for (size_t i = 0; i < n; ++i)
+                        a[i] = std::binary_search(set.begin(), set.end(), a[i]) ? 1.0 : 0.0;
+                }
+            }
+            break;
+        default:
+            if (ins->immediate)
+            {
+                ConstOperand b = { ins->value };
+                applyBinary(ins->op, top - ExpressionChunkSize, b, n);
+            }
+            else
+            {
+                ColumnOperand b = { top - ExpressionChunkSize };
+                applyBinary(ins->op, top - 2 * ExpressionChunkSize, b, n);
+                top -= ExpressionChunkSize;
+            }
+            break;
+        }
+    }
+
+    std::copy(_stack.begin(), _stack.begin() + n, result);
+}
+
+bool FilterExpression::evaluate(const uint8_t* record)
+{
+    if (!_compiled)
+        throw libhsl_error("filter expression is not compiled");
+
+    double result;
+    run(record, 0, 1, &result);
+    return truthy(result);
+}
+
+double FilterExpression::evaluateValue(const uint8_t* record)
+{
+    if (!_compiled)
+        throw libhsl_error("filter expression is not compiled");
+
+    double result;
+    run(record, 0, 1, &result);
+    return result;
+}
+
+void FilterExpression::evaluateValues(PointBlock const& block, std::vector<double>& values)
+{
+    if (!_compiled)
+        throw libhsl_error("filter expression is not compiled");
+
+    const size_t n = block.size();
+    const size_t stride = block.getRecordLength();
+    values.resize(n);
+    for (size_t base = 0; base < n; base += ExpressionChunkSize)
+    {
+        size_t count = (std::min)(ExpressionChunkSize, n - base);
+        run(block.getRecord(base), stride, count, &values[base]);
+    }
+}
+
+void FilterExpression::evaluate(PointBlock const& block, Bitmask& mask)
+{
+    if (!_compiled)
+        throw libhsl_error("filter expression is not compiled");
+
+    const size_t n = block.size();
+    const size_t stride = block.getRecordLength();
+    uint64_t* words = mask.words();
+    double result[ExpressionChunkSize];
+
+    for (size_t base = 0; base < n; base += ExpressionChunkSize)
+    {
+        size_t count = (std::min)(ExpressionChunkSize, n - base);
+        size_t firstWord = base / 64;
+        size_t lastWord = (base + count + 63) / 64;
+
+        // skip chunks without selected records
+        bool selected = false;
+        for (size_t w = firstWord; w < lastWord && !selected; ++w)
+            selected = words[w] != 0;
+        if (!selected)
+            continue;
+
+        run(block.getRecord(base), stride, count, result);
+
+        for (size_t w = firstWord, j = 0; w < lastWord; ++w)
+        {
+            uint64_t matches = 0;
+            for (size_t bit = 0; bit < 64 && j < count; ++bit, ++j)
+                matches |= static_cast<uint64_t>(truthy(result[j])) << bit;
+            words[w] &= matches;
+        }
+    }
+}
+
+namespace
+{
+
+struct Interval
+{
+    double low;
+    double high;
+};
+
+const Interval anyValue = { -std::numeric_limits<double>::infinity(), std::numeric_limits<double>::infinity() };
+const Interval alwaysFalse = { 0.0, 0.0 };
+const Interval alwaysTrue = { 1.0, 1.0 };
+const Interval unknownTruth = { 0.0, 1.0 };
+
+inline Interval makeInterval(double a, double b)
+{
+    if (std::isnan(a) || std::isnan(b))
+        return anyValue;
+    Interval r = { (std::min)(a, b), (std::max)(a, b) };
+    return r;
+}
+
+inline Interval truth(bool mayBeFalse, bool mayBeTrue)
+{
+    return mayBeFalse ? (mayBeTrue ? unknownTruth : alwaysFalse) : alwaysTrue;
+}
+
+inline bool mayBeTrue(Interval const& v)
+{
+    return truthy(v.low) || truthy(v.high);
+}
+
+inline bool mayBeFalse(Interval const& v)
+{
+    return v.low <= 0.0 && v.high >= 0.0;
+}
+
+Interval multiply(Interval const& a, Interval const& b)
+{
+    double p[4] = { a.low * b.low, a.low * b.high, a.high * b.low, a.high * b.high };
+    Interval r = makeInterval(p[0], p[1]);
+    for (int i = 0; i < 4; ++i)
+    {
+        if (std::isnan(p[i]))
+            return anyValue;
+        r.low = (std::min)(r.low, p[i]);
+        r.high = (std::max)(r.high, p[i]);
+    }
+    return r;
+}
+
+}
+
+void FilterExpression::evaluate(ZoneMap const& zones, size_t chunk, bool& mayBeTrueOut, bool& mayBeFalseOut) const
+{
+    if (!_compiled)
+        throw libhsl_error("filter expression is not compiled");
+
+    std::vector<Interval> stack;
+    stack.reserve(_maxDepth);
+    for (std::vector<Instruction>::const_iterator ins = _code.begin(); ins != _code.end(); ++ins)
+    {
+        switch (ins->op)
+        {
+        case OP_Load:
+            {
+                Interval v = anyValue;
+                double low, high;
+                if (zones.getRange(chunk, _fieldKeys[ins->arg].first, _fieldKeys[ins->arg].second, low, high))
+                    v = makeInterval(low, high);
+                stack.push_back(v);
+            }
+            continue;
+        case OP_Const:
+            stack.push_back(makeInterval(ins->value, ins->value));
+            continue;
+        case OP_Negate:
+            stack.back() = makeInterval(-stack.back().high, -stack.back().low);
+            continue;
+        case OP_Not:
+            stack.back() = truth(mayBeTrue(stack.back()), mayBeFalse(stack.back()));
+            continue;
+        case OP_In:
+            {
+                Interval& a = stack.back();
+                std::vector<double> const& set = _sets[ins->arg];
+                std::vector<double>::const_iterator it = std::lower_bound(set.begin(), set.end(), a.low);
+                bool any = it != set.end() && *it <= a.high;
+                bool all = any && detail::exactly_equal(a.low, a.high);
+                a = truth(!all, any);
+            }
+            continue;
+        default:
+            break;
+        }
+
+        Interval b = makeInterval(ins->value, ins->value);
+        if (!ins->immediate)
+        {
+            b = stack.back();
+            stack.pop_back();
+        }
+        Interval& a = stack.back();
+        switch (ins->op)
+        {
+        case OP_Add:
+            a = makeInterval(a.low + b.low, a.high + b.high);
+            break;
+        case OP_Subtract:
+            a = makeInterval(a.low - b.high, a.high - b.low);
+            break;
+        case OP_Multiply:
+            a = multiply(a, b);
+            break;
+        case OP_Divide:
+            if (b.low <= 0.0 && b.high >= 0.0)
+                a = anyValue;
+            else
+                a = multiply(a, makeInterval(1.0 / b.low, 1.0 / b.high));
+            break;
+        case OP_Less:
+            a = truth(a.high >= b.low, a.low < b.high);
+            break;
+        case OP_LessEqual:
+            a = truth(a.high > b.low, a.low <= b.high);
+            break;
+        case OP_Greater:
+            a = truth(a.low <= b.high, a.high > b.low);
+            break;
+        case OP_GreaterEqual:
+            a = truth(a.low < b.high, a.high >= b.low);
+            break;
+        case OP_Equal:
+        case OP_NotEqual:
+            {
+                bool any = a.low <= b.high && b.low <= a.high;
+                bool all = detail::exactly_equal(a.low, a.high) && detail::exactly_equal(b.low, b.high) &&
+                    detail::exactly_equal(a.low, b.low);
+                a = ins->op == OP_Equal ? truth(!all, any) : truth(any, !all);
+            }
+            break;
+        case OP_And:
+            a = truth(mayBeFalse(a) || mayBeFalse(b), mayBeTrue(a) && mayBeTrue(b));
+            break;
+        case OP_Or:
+            a = truth(mayBeFalse(a) && mayBeFalse(b), mayBeTrue(a) || mayBeTrue(b));
+            break;
+        default:
+            break;
+        }
+    }
+
+    mayBeTrueOut = stack.empty() || mayBeTrue(stack.back());
+    mayBeFalseOut = stack.empty() || mayBeFalse(stack.back());
+}
+
+ExpressionFilter::ExpressionFilter(std::string const& expression)
+    : FilterInterface(eInclusion), m_expression(expression), m_header(0)
+{
+}
+
+void ExpressionFilter::compile(Header const* header)
+{
+    if (header != m_header)
+    {
+        m_expression.compile(header->getSchema());
+        m_header = header;
+    }
+}
+
+bool ExpressionFilter::filter(const Point& p)
+{
+    compile(p.getHeader());
+    bool matches = m_expression.evaluate(&p.getData()[0]);
+    return GetType() == eInclusion ? matches : !matches;
+}
+
+bool ExpressionFilter::canSkip(ZoneMap const& zones, size_t chunk)
+{
+    if (!zones.getHeader())
+        return false;
+
+    compile(zones.getHeader());
+    bool mayBeTrue, mayBeFalse;
+    m_expression.evaluate(zones, chunk, mayBeTrue, mayBeFalse);
+    return GetType() == eInclusion ? !mayBeTrue : !mayBeFalse;
+}
+
+void ExpressionFilter::filter(const PointBlock& block, Bitmask& mask)
+{
+    if (block.empty())
+        return;
+
+    compile(block.getHeader());
+    if (GetType() == eInclusion)
+    {
+        m_expression.evaluate(block, mask);
+        return;
+    }
+
+    // exclusion needs the result for every record that is still selected
+    m_matches = mask;
+    m_expression.evaluate(block, m_matches);
+    m_matches.flip();
+    mask &= m_matches;
+}
+
+}
@@ -49,7 +49,26 @@
 
 namespace hsl {
 
-const size_t FieldDefinitionBasicSize = 88;
+// serialized size of the FieldDefinition written for a field of the given data type
+static size_t getFieldDefinitionSize(DataType type)
+{
+    switch (type)
+    {
+    case DT_BIT:        return sizeof(BitField);
+    case DT_CHAR:       return sizeof(CharField);
+    case DT_UCHAR:      return sizeof(UCharField);
+    case DT_SHORT:      return sizeof(ShortField);
+    case DT_USHORT:     return sizeof(UShortField);
+    case DT_LONG:       return sizeof(LongField);
+    case DT_ULONG:      return sizeof(ULongField);
+    case DT_LONGLONG:   return sizeof(LongLongField);
+    case DT_ULONGLONG:  return sizeof(ULongLongField);
+    case DT_FLOAT:      return sizeof(FloatField);
+    case DT_DOUBLE:     return sizeof(DoubleField);
+    default:            return 0;
+    }
+}
+
 const unsigned short Header::_FileSignatureSize = 5;
 const std::string Header::_FileSignature = "HSPCD";
 
@@ -485,6 +504,16 @@ void Header::setMin(double x, double y, double z)
     _fileHeader->zMin = z;
 }
 
+uint64_t Header::getChunkTableOffset() const
+{
+    return _fileHeader->chunkTableOffset;
+}
+
+void Header::setChunkTableOffset(uint64_t v)
+{
+    _fileHeader->chunkTableOffset = v;
+}
+
 void Header::setExtent(Bounds<double> const& extent)
 {
     _fileHeader->xMax = extent.max(0);
@@ -506,11 +535,11 @@ size_t Header::calculateHeaderSize()
 
     for (size_t i = 0; i < _blockDesc->fieldCount; i++)
     {
-        size += sizeof(unsigned long); // count field id
+        size += sizeof(uint32_t); // count field id, written as uint32_t by FileIO::writeHeader
         Field dim;
         _schema.getField(i, dim);
         // FieldDefinition size is variable according to data type for no_data, min, max
-        size += dim.getByteSize() * 3 + FieldDefinitionBasicSize; 
+        size += getFieldDefinitionSize(dim.getDataType()); 
     }
 
     size += _blockDesc->numberOfWaveformPacketDesc * sizeof(WaveformPacketDesc); // count waveform field bytes
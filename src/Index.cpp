@@ -41,6 +41,9 @@
 
 #include "Index.h"
 #include <string>
+#include <cstring>
+#include <limits>
+#include <algorithm>
 #include "Writer.h"
 #include "index/IndexOutput.h"
 #include "index/IndexCell.h"
@@ -79,6 +82,7 @@ bool Index::Prep(IndexData const& ParamSrc)
  		} // catch
 	} // if
 	m_ofs = ParamSrc.m_ofs;
+	m_idxfs = ParamSrc.m_idxfs ? ParamSrc.m_idxfs: "";
     m_debugOutputLevel = ParamSrc.m_debugOutputLevel;
 	m_tempFileName = ParamSrc.m_tempFileName ? ParamSrc.m_tempFileName: "";
 	m_indexAuthor = ParamSrc.m_indexAuthor ? ParamSrc.m_indexAuthor: "";
@@ -106,6 +110,7 @@ void Index::SetValues(void)
     m_reader = 0;
 	m_idxreader = 0;
     m_ofs = 0;
+	m_idxfs = "";
   	m_readerCreated = false;
 	m_tempFile = 0;
 	m_outputFile = 0;
@@ -153,6 +158,10 @@ bool Index::IndexInit(void)
 		{
 			m_pointheader = m_reader->getHeader();
 		} // else
+		if (m_idxfs.size())
+		{
+			return (InitMappedIndex());
+		} // if
 
 		if (IndexFound)
 		{
@@ -225,6 +234,8 @@ const std::vector<uint32_t>& Index::Filter(IndexData & ParamSrc)
 			return (m_filterResult);
 			
 		m_filterResult.reserve(ParamSrc.m_iterator ? ParamSrc.m_iterator->m_chunkSize: GetDefaultReserve());
+		if (m_mappedIndex.IsOpen() && ! FilterMapped(ParamSrc))
+			m_filterResult.resize(0);
 	} // try
 	catch (std::bad_alloc const&) {
 		m_filterResult.resize(0);
@@ -629,7 +640,6 @@ bool Index::FilterOnePoint(int32_t x, int32_t y, int32_t z, int32_t PointID, int
 bool Index::BuildIndex(void)
 {
 	// Build an array of two dimensions. Sort data points into
-	uint32_t MaximumCells = LIBHSL_INDEX_MAXCELLS;
 	m_versionMajor = LIBHSL_INDEX_VERSIONMAJOR;
 	m_versionMinor = LIBHSL_INDEX_VERSIONMINOR;
 	
@@ -661,30 +671,7 @@ bool Index::BuildIndex(void)
 	} // if
 			
 	// fix a cell size and number of cells in X and Y to begin the process of indexing
-	double XRatio = m_rangeX >= m_rangeY ? 1.0: m_rangeX / m_rangeY;
-	double YRatio = m_rangeY >= m_rangeX ? 1.0: m_rangeY / m_rangeX;
-	
-	m_totalCells = m_pointRecordsCount / LIBHSL_INDEX_OPTPTSPERCELL;
-	m_totalCells = static_cast<uint32_t>(sqrt((double)m_totalCells));
-	if (m_totalCells < 10)
-		m_totalCells = 10;	// let's set a minimum number of cells to make the effort worthwhile
-	m_cellsX = static_cast<uint32_t>(XRatio * m_totalCells);
-	m_cellsY = static_cast<uint32_t>(YRatio * m_totalCells);
-	if (m_cellsX < 1)
-		m_cellsX = 1;
-	if (m_cellsY < 1)
-		m_cellsY = 1;
-	m_totalCells = m_cellsX * m_cellsY;
-	if (m_totalCells > MaximumCells)
-	{
-		double CellReductionRatio = (double)MaximumCells / (double)m_totalCells;
-		CellReductionRatio = sqrt(CellReductionRatio);
-		m_cellsX = static_cast<uint32_t>(m_cellsX * CellReductionRatio);
-		m_cellsY = static_cast<uint32_t>(m_cellsY * CellReductionRatio);
-		m_totalCells = m_cellsX * m_cellsY;
-	} // if
-	m_cellSizeX = m_rangeX / m_cellsX;
-	m_cellSizeY = m_rangeY / m_cellsY;
+	SetCellMatrix();
 
 	// print some statistics to the console
 	if (m_debugOutputLevel > 1)
@@ -898,6 +885,11 @@ bool Index::BuildIndex(void)
 					return false;
 			} // else
 		} // if
+		else
+		{
+			CloseTempFile();
+			return (OutputFileError("Index::BuildIndex"));
+		} // else
 	} // try
 	catch (std::bad_alloc const&) {
 		CloseTempFile();
@@ -908,6 +900,262 @@ bool Index::BuildIndex(void)
 
 } // Index::BuildIndex
 
+void Index::SetCellMatrix(void)
+{
+	uint32_t MaximumCells = LIBHSL_INDEX_MAXCELLS;
+	double XRatio = m_rangeX >= m_rangeY ? 1.0: m_rangeX / m_rangeY;
+	double YRatio = m_rangeY >= m_rangeX ? 1.0: m_rangeY / m_rangeX;
+	
+	m_totalCells = m_pointRecordsCount / LIBHSL_INDEX_OPTPTSPERCELL;
+	m_totalCells = static_cast<uint32_t>(sqrt((double)m_totalCells));
+	if (m_totalCells < 10)
+		m_totalCells = 10;	// let's set a minimum number of cells to make the effort worthwhile
+	m_cellsX = static_cast<uint32_t>(XRatio * m_totalCells);
+	m_cellsY = static_cast<uint32_t>(YRatio * m_totalCells);
+	if (m_cellsX < 1)
+		m_cellsX = 1;
+	if (m_cellsY < 1)
+		m_cellsY = 1;
+	m_totalCells = m_cellsX * m_cellsY;
+	if (m_totalCells > MaximumCells)
+	{
+		double CellReductionRatio = (double)MaximumCells / (double)m_totalCells;
+		CellReductionRatio = sqrt(CellReductionRatio);
+		m_cellsX = static_cast<uint32_t>(m_cellsX * CellReductionRatio);
+		m_cellsY = static_cast<uint32_t>(m_cellsY * CellReductionRatio);
+		m_totalCells = m_cellsX * m_cellsY;
+	} // if
+	m_cellSizeX = m_rangeX / m_cellsX;
+	m_cellSizeY = m_rangeY / m_cellsY;
+} // Index::SetCellMatrix
+
+bool Index::InitMappedIndex(void)
+{
+	if (! m_forceNewIndex && m_mappedIndex.Open(m_idxfs))
+	{
+		LoadMappedIndexValues();
+		if (Validate())
+		{
+			if (m_debugOutputLevel > 1)
+				fprintf(m_debugger, "Index file %s mapped.\n", m_idxfs.c_str());
+			return (true);
+		} // if
+		m_mappedIndex.Close();
+		if (m_debugOutputLevel > 1)
+			fprintf(m_debugger, "Existing index out of date.\n");
+	} // if
+	if (m_readOnly)
+	{
+		if (m_debugOutputLevel > 1)
+			fprintf(m_debugger, "Index not found nor created per user instructions.\n");
+		return (false);
+	} // if
+	if (! BuildMappedIndex())
+		return (false);
+	if (! m_mappedIndex.Open(m_idxfs))
+		return (InputFileError("Index::InitMappedIndex"));
+	LoadMappedIndexValues();
+	return (true);
+} // Index::InitMappedIndex
+
+void Index::LoadMappedIndexValues(void)
+{
+	hsl::detail::IndexFileHeader const& IdxHeader = m_mappedIndex.GetHeader();
+
+	m_pointRecordsCount = IdxHeader.pointRecordsCount;
+	m_bounds = Bounds<double>(IdxHeader.minX, IdxHeader.minY, IdxHeader.minZ, IdxHeader.maxX, IdxHeader.maxY, IdxHeader.maxZ);
+	CalcRangeX();
+	CalcRangeY();
+	CalcRangeZ();
+	m_cellsX = IdxHeader.cellsX;
+	m_cellsY = IdxHeader.cellsY;
+	m_cellsZ = 1;
+	m_totalCells = m_cellsX * m_cellsY;
+	m_cellSizeX = IdxHeader.cellSizeX;
+	m_cellSizeY = IdxHeader.cellSizeY;
+	m_cellSizeZ = 0.0;
+} // Index::LoadMappedIndexValues
+
+bool Index::BuildMappedIndex(void)
+{
+	m_pointRecordsCount = m_pointheader.getPointRecordsCount();
+	m_bounds = Bounds<double>(m_pointheader.getMinX(), m_pointheader.getMinY(), m_pointheader.getMinZ(), m_pointheader.getMaxX(), m_pointheader.getMaxY(), m_pointheader.getMaxZ());
+	try {
+		m_bounds.verify();
+	} // try
+	catch (std::runtime_error const&) {
+		return (InputBoundsError("Index::BuildMappedIndex"));
+	} // catch
+	CalcRangeX();
+	CalcRangeY(); 
+	CalcRangeZ();
+	if ((m_bounds.max)(0) <= (m_bounds.min)(0) || (m_bounds.max)(1) <= (m_bounds.min)(1))
+	{
+		return (PointBoundsError("Index::BuildMappedIndex"));
+	} // if
+	SetCellMatrix();
+	m_cellsZ = 1;
+
+	if (m_debugOutputLevel > 1)
+		fprintf(m_debugger, "Points in file %d, Cell matrix x %d, y %d\n", m_pointRecordsCount, m_cellsX, m_cellsY);
+
+	try {
+		// one pass over the points, collecting runs of consecutive point IDs per cell
+		std::vector<std::vector<hsl::detail::IndexFileRange> > CellRanges(m_totalCells);
+		hsl::detail::IndexFileCell EmptyCell;
+		memset(&EmptyCell, 0, sizeof(EmptyCell));
+		EmptyCell.minZ = (std::numeric_limits<double>::max)();
+		EmptyCell.maxZ = -(std::numeric_limits<double>::max)();
+		std::vector<hsl::detail::IndexFileCell> Cells(m_totalCells, EmptyCell);
+
+		if (m_pointRecordsCount)
+			m_reader->seek(0);
+		uint32_t PointID = 0;
+		while (PointID < m_pointRecordsCount && m_reader->readNextPoint())
+		{
+			uint32_t CurCellX, CurCellY;
+			Point const& CurPt = m_reader->getPoint();
+			if (IdentifyCell(CurPt, CurCellX, CurCellY))
+			{
+				uint32_t CellID = CurCellX * m_cellsY + CurCellY;
+				std::vector<hsl::detail::IndexFileRange>& Ranges = CellRanges[CellID];
+				if (! Ranges.empty() && Ranges.back().firstPoint + Ranges.back().count == PointID)
+					++Ranges.back().count;
+				else
+				{
+					hsl::detail::IndexFileRange NewRange = {PointID, 1};
+					Ranges.push_back(NewRange);
+				} // else
+				hsl::detail::IndexFileCell& Cell = Cells[CellID];
+				++Cell.numPoints;
+				double CurZ = CurPt.getZ();
+				if (CurZ < Cell.minZ)
+					Cell.minZ = CurZ;
+				if (CurZ > Cell.maxZ)
+					Cell.maxZ = CurZ;
+			} // if
+			++PointID;
+		} // while
+
+		// flatten the per-cell runs into the range table
+		std::vector<hsl::detail::IndexFileRange> AllRanges;
+		for (uint32_t CellID = 0; CellID < m_totalCells; ++CellID)
+		{
+			Cells[CellID].firstRange = static_cast<uint32_t>(AllRanges.size());
+			Cells[CellID].rangeCount = static_cast<uint32_t>(CellRanges[CellID].size());
+			AllRanges.insert(AllRanges.end(), CellRanges[CellID].begin(), CellRanges[CellID].end());
+			std::vector<hsl::detail::IndexFileRange>().swap(CellRanges[CellID]);
+		} // for
+
+		hsl::detail::IndexFileHeader IdxHeader;
+		memset(&IdxHeader, 0, sizeof(IdxHeader));
+		IdxHeader.pointRecordsCount = m_pointRecordsCount;
+		IdxHeader.cellsX = m_cellsX;
+		IdxHeader.cellsY = m_cellsY;
+		IdxHeader.minX = (m_bounds.min)(0);
+		IdxHeader.minY = (m_bounds.min)(1);
+		IdxHeader.minZ = (m_bounds.min)(2);
+		IdxHeader.maxX = (m_bounds.max)(0);
+		IdxHeader.maxY = (m_bounds.max)(1);
+		IdxHeader.maxZ = (m_bounds.max)(2);
+		IdxHeader.cellSizeX = m_cellSizeX;
+		IdxHeader.cellSizeY = m_cellSizeY;
+		if (! hsl::detail::IndexFile::Write(m_idxfs, IdxHeader, Cells, AllRanges))
+			return (OutputFileError("Index::BuildMappedIndex"));
+		if (m_debugOutputLevel > 1)
+			fprintf(m_debugger, "Index file %s written, %d point ranges.\n", m_idxfs.c_str(), IdxHeader.rangeCount);
+	} // try
+	catch (std::bad_alloc const&) {
+		return (MemoryError("Index::BuildMappedIndex"));
+	} // catch
+	return (true);
+} // Index::BuildMappedIndex
+
+bool Index::FilterMapped(IndexData & ParamSrc)
+{
+	IndexIterator *Iterator = ParamSrc.m_iterator;
+
+	ParamSrc.CalcFilterEnablers();
+	SetCellFilterBounds(ParamSrc);
+	// cells whose Z extrema lie entirely within the filter need no Z test of their points
+	IndexData NoFilterZParam(ParamSrc);
+	NoFilterZParam.m_noFilterZ = true;
+
+	int32_t LowX = 0, HighX = m_cellsX - 1, LowY = 0, HighY = m_cellsY - 1;
+	if (! ParamSrc.m_noFilterX)
+	{
+		LowX = (std::max)(LowX, ParamSrc.m_LowXBorderCell);
+		HighX = (std::min)(HighX, ParamSrc.m_HighXBorderCell);
+	} // if
+	if (! ParamSrc.m_noFilterY)
+	{
+		LowY = (std::max)(LowY, ParamSrc.m_LowYBorderCell);
+		HighY = (std::min)(HighY, ParamSrc.m_HighYBorderCell);
+	} // if
+
+	// resume an iterator in the cell where its last chunk ended
+	int32_t StartX = LowX, StartY = LowY;
+	uint32_t PointsToIgnore = 0;
+	if (Iterator && Iterator->m_totalPointsScanned)
+	{
+		StartX = (std::max)(LowX, static_cast<int32_t>(Iterator->m_curCellX));
+		if (StartX == static_cast<int32_t>(Iterator->m_curCellX))
+		{
+			StartY = (std::max)(LowY, static_cast<int32_t>(Iterator->m_curCellY));
+			if (StartY == static_cast<int32_t>(Iterator->m_curCellY))
+				PointsToIgnore = Iterator->m_ptsScannedCurCell;
+		} // if
+	} // if
+
+	for (int32_t x = StartX; x <= HighX; ++x)
+	{
+		for (int32_t y = (x == StartX ? StartY: LowY); y <= HighY; ++y)
+		{
+			hsl::detail::IndexFileCell const& Cell = m_mappedIndex.GetCell(x, y);
+			uint32_t CellPtsToIgnore = (x == StartX && y == StartY) ? PointsToIgnore: 0;
+			if (Iterator)
+			{
+				Iterator->m_curCellX = x;
+				Iterator->m_curCellY = y;
+				Iterator->m_ptsScannedCurCell = 0;
+			} // if
+			if (Cell.numPoints <= CellPtsToIgnore)
+				continue;
+			if (! ParamSrc.m_noFilterZ && 
+				(Cell.maxZ < ParamSrc.GetMinFilterZ() || Cell.minZ > ParamSrc.GetMaxFilterZ()))
+				continue;
+			bool ZInside = (ParamSrc.m_noFilterZ || 
+				(Cell.minZ >= ParamSrc.GetMinFilterZ() && Cell.maxZ <= ParamSrc.GetMaxFilterZ()));
+			IndexData const& CellParam = ZInside ? NoFilterZParam: ParamSrc;
+
+			uint32_t PointsScanned = 0;
+			hsl::detail::IndexFileRange const* RangeEnd = m_mappedIndex.GetEndRange(Cell);
+			for (hsl::detail::IndexFileRange const* Range = m_mappedIndex.GetFirstRange(Cell); Range != RangeEnd; ++Range)
+			{
+				// whole ranges already returned by a previous chunk are skipped without scanning
+				if (PointsScanned + Range->count <= CellPtsToIgnore)
+				{
+					PointsScanned += Range->count;
+					if (Iterator)
+						Iterator->m_ptsScannedCurCell += Range->count;
+					continue;
+				} // if
+				uint32_t PointID = Range->firstPoint;
+				if (! FilterPointSeries(PointID, PointsScanned, CellPtsToIgnore, x, y, 0, Range->count, Iterator, CellParam))
+					return (false);
+				if (Iterator && m_filterResult.size() >= Iterator->m_chunkSize)
+				{
+					Iterator->m_totalPointsScanned += PointsScanned - CellPtsToIgnore;
+					return (true);
+				} // if
+			} // for
+			if (Iterator)
+				Iterator->m_totalPointsScanned += PointsScanned - CellPtsToIgnore;
+		} // for y
+	} // for x
+	return (true);
+} // Index::FilterMapped
+
 bool Index::IdentifyCell(Point const& CurPt, uint32_t& CurCellX, uint32_t& CurCellY) const
 {
 	double OffsetX, OffsetY;
@@ -1352,6 +1600,7 @@ IndexData::IndexData(Index const& index)
 	SetValues();
 	m_reader = index.GetReader();
 	m_idxreader = index.GetIndexReader();
+	m_idxfs = index.IsMapped() ? index.GetIndexFileName(): 0;
 	m_filter = index.GetBounds();
     m_debugOutputLevel = index.GetDebugOutputLevel();
 	m_tempFileName = index.GetTempFileName() ? index.GetTempFileName(): "";
@@ -1391,6 +1640,7 @@ void IndexData::Copy(IndexData const& other)
 		m_iterator = other.m_iterator;
 		m_ifs = other.m_ifs;
 		m_ofs = other.m_ofs;
+		m_idxfs = other.m_idxfs;
 		m_tempFileName = other.m_tempFileName;
 		m_indexAuthor = other.m_indexAuthor;
 		m_indexComment = other.m_indexComment;
@@ -1433,6 +1683,7 @@ void IndexData::SetValues(void)
 	m_iterator = 0;
 	m_ifs = 0;
 	m_ofs = 0;
+	m_idxfs = 0;
 	m_tempFileName = 0;
 	m_indexAuthor = 0;
 	m_indexComment = 0;
@@ -1462,6 +1713,7 @@ bool IndexData::SetInitialValues(const char *ifs, Reader *reader, const char *of
 
 	m_ifs = ifs;
 	m_ofs = ofs;
+	m_idxfs = 0;
 	m_reader = reader;
 	m_idxreader = idxreader;
 	m_iterator = 0;
@@ -1493,6 +1745,7 @@ bool IndexData::SetBuildEmbedValues(Reader *reader, const char *ofs, const char
 
 	m_ifs = 0;
 	m_ofs = ofs;
+	m_idxfs = 0;
 	m_reader = reader;
 	m_idxreader = 0;
 	m_iterator = 0;
@@ -1519,6 +1772,7 @@ bool IndexData::SetBuildAloneValues(Reader *reader, const char *ofs, const char
 
 	m_ifs = 0;
 	m_ofs = ofs;
+	m_idxfs = 0;
 	m_reader = reader;
 	m_idxreader = 0;
 	m_iterator = 0;
@@ -1543,6 +1797,7 @@ bool IndexData::SetReadEmbedValues(Reader *reader, int debugoutputlevel, FILE *d
 
 	m_ifs = 0;
 	m_ofs = 0;
+	m_idxfs = 0;
 	m_reader = reader;
 	m_idxreader = 0;
 	m_iterator = 0;
@@ -1567,6 +1822,7 @@ bool IndexData::SetReadAloneValues(Reader *reader, Reader *idxreader, int debugo
 
 	m_ifs = 0;
 	m_ofs = 0;
+	m_idxfs = 0;
 	m_reader = reader;
 	m_idxreader = idxreader;
 	m_iterator = 0;
@@ -1612,6 +1868,24 @@ bool IndexData::SetReadOrBuildAloneValues(Reader *reader, const char *ofs, const
 	
 } // IndexData::SetBuildAloneValues
 
+bool IndexData::SetReadMappedValues(Reader *reader, const char *idxfs, int debugoutputlevel, FILE *debugger)
+{
+
+	SetReadEmbedValues(reader, debugoutputlevel, debugger);
+	m_idxfs = idxfs;
+	return (m_reader && m_idxfs);
+	
+} // IndexData::SetReadMappedValues
+
+bool IndexData::SetReadOrBuildMappedValues(Reader *reader, const char *idxfs, int debugoutputlevel, FILE *debugger)
+{
+
+	SetReadMappedValues(reader, idxfs, debugoutputlevel, debugger);
+	m_readOnly = false;
+	return (m_reader && m_idxfs);
+	
+} // IndexData::SetReadOrBuildMappedValues
+
 bool IndexData::SetFilterValues(double LowFilterX, double HighFilterX, double LowFilterY, double HighFilterY, 
 	double LowFilterZ, double HighFilterZ, Index const& index)
 {
@@ -0,0 +1,248 @@
+/*************************************************************************************
+ * 
+ * 
+ * Copyright (c) 2021, Zhengjun Liu <zjliu@casm.ac.cn>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ ************************************************************************************/
+
+
+#include "IndexedReader.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include "Header.h"
+#include "FieldAccessor.h"
+#include "Exception.h"
+#include "detail/private_utility.hpp"
+
+
+namespace hsl
+{
+
+namespace
+{
+
+bool compareRangeStart(hsl::detail::IndexFileRange const& a, hsl::detail::IndexFileRange const& b)
+{
+    return a.firstPoint < b.firstPoint;
+}
+
+}
+
+IndexedReader::IndexedReader(Reader& reader, Index& index, Bounds<double> const& bounds, uint32_t blockSize) :
+    _reader(reader), _index(index), _bounds(bounds), _blockSize(blockSize ? blockSize : 1), _maxGap(16),
+    _prepared(false), _currentRange(0), _currentOffset(0)
+{
+    setRawBounds();
+}
+
+void IndexedReader::reset()
+{
+    _currentRange = 0;
+    _currentOffset = 0;
+}
+
+void IndexedReader::setMaxGap(uint32_t records)
+{
+    _maxGap = records;
+    _prepared = false;
+    reset();
+}
+
+std::vector<hsl::detail::IndexFileRange> const& IndexedReader::getRanges()
+{
+    if (!_prepared)
+        prepare();
+
+    return _ranges;
+}
+
+void IndexedReader::setRawBounds()
+{
+    Schema const& schema = _reader.getHeader().getSchema();
+
+    // as BoundsFilter: a flat bounds ignores Z, X and Y always count
+    const size_t dimensions = _bounds.dimension() > 2 &&
+        !detail::compare_distance((_bounds.max)(2) - (_bounds.min)(2), 0.0) ? 3 : (std::min)(_bounds.dimension(), size_t(2));
+    const FieldId ids[3] = { FI_X, FI_Y, FI_Z };
+    for (size_t d = 0; d < 3; ++d)
+    {
+        _useDim[d] = d < dimensions;
+        if (!_useDim[d])
+            continue;
+
+        // smallest and largest stored integers whose scaled value lies inside the bounds
+        FieldAccessor field;
+        int64_t low = 0;
+        int64_t high = 0;
+        if (!field.bind(schema, ids[d]) || !field.isInt32Raw() || field.getByteOffset() != d * 4 ||
+            !field.getRawRange((_bounds.min)(d), (_bounds.max)(d), low, high))
+            throw libhsl_error("IndexedReader needs X, Y and Z stored as the leading 32-bit integers of a record");
+        _rawMin[d] = low;
+        _rawMax[d] = high;
+    }
+}
+
+bool IndexedReader::contains(const uint8_t* record) const
+{
+    for (size_t d = 0; d < 3; ++d)
+    {
+        if (!_useDim[d])
+            continue;
+        int32_t v;
+        std::memcpy(&v, record + d * sizeof(int32_t), sizeof(int32_t));
+        if (v < _rawMin[d] || v > _rawMax[d])
+            return false;
+    }
+    return true;
+}
+
+void IndexedReader::collectMappedRanges(std::vector<hsl::detail::IndexFileRange>& ranges) const
+{
+    hsl::detail::IndexFile const& mapped = _index.GetMappedIndex();
+    hsl::detail::IndexFileHeader const& idx = mapped.GetHeader();
+
+    int64_t lowX = 0, highX = idx.cellsX - 1, lowY = 0, highY = idx.cellsY - 1;
+    if (_useDim[0])
+    {
+        lowX = std::max<int64_t>(lowX, static_cast<int64_t>(std::floor(((_bounds.min)(0) - idx.minX) / idx.cellSizeX)));
+        highX = std::min<int64_t>(highX, static_cast<int64_t>(std::floor(((_bounds.max)(0) - idx.minX) / idx.cellSizeX)));
+    }
+    if (_useDim[1])
+    {
+        lowY = std::max<int64_t>(lowY, static_cast<int64_t>(std::floor(((_bounds.min)(1) - idx.minY) / idx.cellSizeY)));
+        highY = std::min<int64_t>(highY, static_cast<int64_t>(std::floor(((_bounds.max)(1) - idx.minY) / idx.cellSizeY)));
+    }
+
+    for (int64_t x = lowX; x <= highX; ++x)
+    {
+        for (int64_t y = lowY; y <= highY; ++y)
+        {
+            hsl::detail::IndexFileCell const& cell = mapped.GetCell(static_cast<uint32_t>(x), static_cast<uint32_t>(y));
+            if (!cell.numPoints)
+                continue;
+            if (_useDim[2] && (cell.maxZ < (_bounds.min)(2) || cell.minZ > (_bounds.max)(2)))
+                continue;
+            ranges.insert(ranges.end(), mapped.GetFirstRange(cell), mapped.GetEndRange(cell));
+        }
+    }
+}
+
+void IndexedReader::collectFilteredRanges(std::vector<hsl::detail::IndexFileRange>& ranges)
+{
+    IndexData query(_index);
+    query.SetFilterValues(_bounds, _index);
+    std::vector<uint32_t> ids = _index.Filter(query);
+    std::sort(ids.begin(), ids.end());
+
+    for (size_t i = 0; i < ids.size(); ++i)
+    {
+        if (!ranges.empty() && ranges.back().firstPoint + ranges.back().count == ids[i])
+        {
+            ++ranges.back().count;
+        }
+        else
+        {
+            hsl::detail::IndexFileRange range = { ids[i], 1 };
+            ranges.push_back(range);
+        }
+    }
+}
+
+void IndexedReader::prepare()
+{
+    std::vector<hsl::detail::IndexFileRange> ranges;
+    if (_index.IsMapped())
+        collectMappedRanges(ranges);
+    else if (_index.IndexReady())
+        collectFilteredRanges(ranges);
+
+    std::sort(ranges.begin(), ranges.end(), compareRangeStart);
+
+    // coalesce ranges that touch or are separated by at most _maxGap records
+    _ranges.clear();
+    for (size_t i = 0; i < ranges.size(); ++i)
+    {
+        if (!_ranges.empty())
+        {
+            hsl::detail::IndexFileRange& last = _ranges.back();
+            uint64_t lastEnd = static_cast<uint64_t>(last.firstPoint) + last.count;
+            if (ranges[i].firstPoint <= lastEnd + _maxGap)
+            {
+                uint64_t end = std::max<uint64_t>(lastEnd, static_cast<uint64_t>(ranges[i].firstPoint) + ranges[i].count);
+                last.count = static_cast<uint32_t>(end - last.firstPoint);
+                continue;
+            }
+        }
+        _ranges.push_back(ranges[i]);
+    }
+
+    _prepared = true;
+}
+
+bool IndexedReader::readNextBlock(PointBlock& block)
+{
+    if (!_prepared)
+        prepare();
+
+    block.clear();
+    block.reserve(_blockSize);
+
+    std::vector<bool> keep;
+    while (block.size() < _blockSize && _currentRange < _ranges.size())
+    {
+        hsl::detail::IndexFileRange const& range = _ranges[_currentRange];
+        uint32_t count = std::min<uint32_t>(range.count - _currentOffset, _blockSize - static_cast<uint32_t>(block.size()));
+
+        size_t start = block.size();
+        if (!_reader.readPointRange(range.firstPoint + _currentOffset, count, block))
+            return false;
+
+        _currentOffset += count;
+        if (_currentOffset >= range.count)
+        {
+            ++_currentRange;
+            _currentOffset = 0;
+        }
+
+        // drop the records of border cells and coalescing gaps that are outside the window
+        keep.assign(count, true);
+        bool dropAny = false;
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            if (!contains(block.getRecord(start + i)))
+            {
+                keep[i] = false;
+                dropAny = true;
+            }
+        }
+        if (dropAny)
+            block.compact(keep, start);
+    }
+
+    return !block.empty();
+}
+
+}
@@ -0,0 +1,387 @@
+/*************************************************************************************
+ * 
+ * 
+ * Copyright (c) 2021, Zhengjun Liu <zjliu@casm.ac.cn>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ ************************************************************************************/
+
+
+#include "KdTree.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include "Header.h"
+#include "Reader.h"
+#include "PointBlock.h"
+#include "Exception.h"
+
+
+namespace hsl
+{
+
+namespace
+{
+
+const uint32_t KdTreeReadBlockSize = 65536;
+
+/// Number of queries a worker takes at a time.
+const size_t KdTreeQueryBatch = 64;
+
+}
+
+struct KdTree::Query
+{
+    double          q[3];       // query position in raw coordinates
+    size_t          k;          // 0 for a radius search
+    double          r2;         // squared search radius, shrinks as a knn heap fills
+    NeighborList*   out;        // distances hold squared distances until the search ends
+};
+
+KdTree::KdTree() : _leafSize(16)
+{
+    double one[3] = { 1.0, 1.0, 1.0 };
+    double zero[3] = { 0.0, 0.0, 0.0 };
+    setTransform(one, zero);
+}
+
+void KdTree::setTransform(double const scale[3], double const offset[3])
+{
+    for (int a = 0; a < 3; ++a)
+    {
+        _scale[a] = scale[a];
+        _offset[a] = offset[a];
+        _scale2[a] = scale[a] * scale[a];
+    }
+}
+
+void KdTree::clear()
+{
+    _coords.clear();
+    _ids.clear();
+    _nodes.clear();
+}
+
+bool KdTree::build(Reader& reader)
+{
+    clear();
+
+    Header const& header = reader.getHeader();
+    double scale[3] = { header.getScaleX(), header.getScaleY(), header.getScaleZ() };
+    double offset[3] = { header.getOffsetX(), header.getOffsetY(), header.getOffsetZ() };
+    setTransform(scale, offset);
+
+    uint64_t total = header.getPointRecordsCount();
+    if (total > 0xFFFFFFFFULL)
+        throw libhsl_error("too many points for a KD-tree");
+    uint32_t count = static_cast<uint32_t>(total);
+
+    _coords.reserve(static_cast<size_t>(count) * 3);
+    _ids.reserve(count);
+
+    PointBlock block(&header, KdTreeReadBlockSize);
+    for (uint32_t first = 0; first < count; first += KdTreeReadBlockSize)
+    {
+        block.clear();
+        if (!reader.readPointRange(first, (std::min)(KdTreeReadBlockSize, count - first), block))
+        {
+            clear();
+            return false;
+        }
+        for (size_t i = 0; i < block.size(); ++i)
+        {
+            _coords.push_back(block.getRawX(i));
+            _coords.push_back(block.getRawY(i));
+            _coords.push_back(block.getRawZ(i));
+            _ids.push_back(block.getId(i));
+        }
+    }
+
+    buildTree();
+    return true;
+}
+
+void KdTree::build(PointBlock const& block)
+{
+    clear();
+
+    Header const* header = block.getHeader();
+    double scale[3] = { header->getScaleX(), header->getScaleY(), header->getScaleZ() };
+    double offset[3] = { header->getOffsetX(), header->getOffsetY(), header->getOffsetZ() };
+    setTransform(scale, offset);
+
+    _coords.reserve(block.size() * 3);
+    _ids.reserve(block.size());
+    for (size_t i = 0; i < block.size(); ++i)
+    {
+        _coords.push_back(block.getRawX(i));
+        _coords.push_back(block.getRawY(i));
+        _coords.push_back(block.getRawZ(i));
+        _ids.push_back(block.getId(i));
+    }
+
+    buildTree();
+}
+
+void KdTree::buildTree()
+{
+    _nodes.clear();
+    if (_ids.empty())
+        return;
+
+    // build over a permutation, then store the points in leaf order
+    std::vector<uint32_t> perm(_ids.size());
+    for (uint32_t i = 0; i < perm.size(); ++i)
+        perm[i] = i;
+    _ids.swap(perm);
+    _nodes.reserve(2 * (_ids.size() / _leafSize + 1));
+    buildNode(0, static_cast<uint32_t>(_ids.size()));
+    _ids.swap(perm);
+
+    std::vector<int32_t> coords(_coords.size());
+    std::vector<uint32_t> ids(_ids.size());
+    for (size_t i = 0; i < perm.size(); ++i)
+    {
+        uint32_t p = perm[i];
+        coords[3 * i] = _coords[3 * p];
+        coords[3 * i + 1] = _coords[3 * p + 1];
+        coords[3 * i + 2] = _coords[3 * p + 2];
+        ids[i] = _ids[p];
+    }
+    _coords.swap(coords);
+    _ids.swap(ids);
+}
+
+uint32_t KdTree::buildNode(uint32_t begin, uint32_t end)
+{
+    // while building, _ids holds the permutation of the points into _coords
+    uint32_t index = static_cast<uint32_t>(_nodes.size());
+    Node node;
+    node.begin = begin;
+    node.end = end;
+    node.right = 0;
+    node.split = 0;
+    node.axis = 0;
+    _nodes.push_back(node);
+
+    if (end - begin <= _leafSize)
+        return index;
+
+    // split the widest scaled extent at its median
+    double widest = -1.0;
+    for (uint8_t a = 0; a < 3; ++a)
+    {
+        int32_t lo = (std::numeric_limits<int32_t>::max)();
+        int32_t hi = (std::numeric_limits<int32_t>::min)();
+        for (uint32_t i = begin; i < end; ++i)
+        {
+            int32_t v = _coords[3 * _ids[i] + a];
+            lo = (std::min)(lo, v);
+            hi = (std::max)(hi, v);
+        }
+        double extent = (static_cast<double>(hi) - lo) * std::fabs(_scale[a]);
+        if (extent > widest)
+        {
+            widest = extent;
+            node.axis = a;
+        }
+    }
+
+    uint32_t mid = begin + (end - begin) / 2;
+    const int32_t* coords = &_coords[0];
+    const uint8_t axis = node.axis;
+    std::nth_element(_ids.begin() + begin, _ids.begin() + mid, _ids.begin() + end,
+        [coords, axis](uint32_t a, uint32_t b) { return coords[3 * a + axis] < coords[3 * b + axis]; });
+
+    _nodes[index].axis = axis;
+    _nodes[index].split = _coords[3 * _ids[mid] + axis];
+    buildNode(begin, mid);
+    uint32_t right = buildNode(mid, end);
+    _nodes[index].right = right;
+
+    return index;
+}
+
+void KdTree::toRaw(double x, double y, double z, double raw[3]) const
+{
+    raw[0] = (x - _offset[0]) / _scale[0];
+    raw[1] = (y - _offset[1]) / _scale[1];
+    raw[2] = (z - _offset[2]) / _scale[2];
+}
+
+void KdTree::search(uint32_t index, Query& q) const
+{
+    Node const& node = _nodes[index];
+
+    if (node.right == 0)
+    {
+        NeighborList& out = *q.out;
+        for (uint32_t i = node.begin; i < node.end; ++i)
+        {
+            const int32_t* p = &_coords[3 * i];
+            double dx = p[0] - q.q[0];
+            double dy = p[1] - q.q[1];
+            double dz = p[2] - q.q[2];
+            double d2 = dx * dx * _scale2[0] + dy * dy * _scale2[1] + dz * dz * _scale2[2];
+            if (d2 > q.r2)
+                continue;
+
+            Neighbor n;
+            n.id = _ids[i];
+            n.distance = d2;
+            if (q.k == 0)
+            {
+                out.push_back(n);
+            }
+            else if (out.size() < q.k)
+            {
+                out.push_back(n);
+                std::push_heap(out.begin(), out.end());
+                if (out.size() == q.k)
+                    q.r2 = out.front().distance;
+            }
+            else if (d2 < out.front().distance)
+            {
+                std::pop_heap(out.begin(), out.end());
+                out.back() = n;
+                std::push_heap(out.begin(), out.end());
+                q.r2 = out.front().distance;
+            }
+        }
+        return;
+    }
+
+    double diff = q.q[node.axis] - node.split;
+    uint32_t nearChild = diff < 0 ? index + 1 : node.right;
+    uint32_t farChild = diff < 0 ? node.right : index + 1;
+
+    search(nearChild, q);
+    if (diff * diff * _scale2[node.axis] <= q.r2)
+        search(farChild, q);
+}
+
+void KdTree::knn(double x, double y, double z, size_t k, NeighborList& result) const
+{
+    double raw[3];
+    toRaw(x, y, z, raw);
+    knnRaw(raw, k, result);
+}
+
+void KdTree::knnRaw(double const raw[3], size_t k, NeighborList& result) const
+{
+    result.clear();
+    if (k == 0 || _nodes.empty())
+        return;
+
+    result.reserve(k);
+    Query q;
+    q.q[0] = raw[0];
+    q.q[1] = raw[1];
+    q.q[2] = raw[2];
+    q.k = k;
+    q.r2 = (std::numeric_limits<double>::max)();
+    q.out = &result;
+    search(0, q);
+
+    std::sort_heap(result.begin(), result.end());
+    for (size_t i = 0; i < result.size(); ++i)
+        result[i].distance = std::sqrt(result[i].distance);
+}
+
+void KdTree::radius(double x, double y, double z, double radius, NeighborList& result) const
+{
+    result.clear();
+    if (radius < 0 || _nodes.empty())
+        return;
+
+    Query q;
+    toRaw(x, y, z, q.q);
+    q.k = 0;
+    q.r2 = radius * radius;
+    q.out = &result;
+    search(0, q);
+
+    std::sort(result.begin(), result.end());
+    for (size_t i = 0; i < result.size(); ++i)
+        result[i].distance = std::sqrt(result[i].distance);
+}
+
+// calls fn on batches of queries, on the calling thread alone or on the
+// workers of the tree's pool, or of a pool for this call if none was set
+void KdTree::runQueries(size_t count, unsigned int threads, ThreadPool::RangeFunction const& fn) const
+{
+    size_t workers = threads ? threads : ThreadPool::getDefaultSize();
+    workers = (std::min)(workers, (count + KdTreeQueryBatch - 1) / KdTreeQueryBatch);
+    if (workers <= 1)
+    {
+        fn(0, count, 0);
+        return;
+    }
+
+    ThreadPoolPtr pool = _pool ? _pool : ThreadPoolPtr(new ThreadPool(workers - 1));
+    pool->parallelFor(count, KdTreeQueryBatch, fn, workers);
+}
+
+void KdTree::knn(std::vector<double> const& queries, size_t k, std::vector<NeighborList>& results,
+    unsigned int threads) const
+{
+    size_t count = queries.size() / 3;
+    results.resize(count);
+    runQueries(count, threads, [&](size_t begin, size_t end, size_t) {
+        for (size_t i = begin; i < end; ++i)
+            knn(queries[3 * i], queries[3 * i + 1], queries[3 * i + 2], k, results[i]);
+    });
+}
+
+void KdTree::radius(std::vector<double> const& queries, double radius, std::vector<NeighborList>& results,
+    unsigned int threads) const
+{
+    size_t count = queries.size() / 3;
+    results.resize(count);
+    runQueries(count, threads, [&](size_t begin, size_t end, size_t) {
+        for (size_t i = begin; i < end; ++i)
+            this->radius(queries[3 * i], queries[3 * i + 1], queries[3 * i + 2], radius, results[i]);
+    });
+}
+
+void KdTree::knnAll(size_t k, std::vector<NeighborList>& results, unsigned int threads) const
+{
+    // position of every point in leaf order, by ascending id
+    std::vector<uint32_t> order(_ids.size());
+    for (uint32_t i = 0; i < order.size(); ++i)
+        order[i] = i;
+    std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) { return _ids[a] < _ids[b]; });
+
+    results.resize(order.size());
+    runQueries(order.size(), threads, [&](size_t begin, size_t end, size_t) {
+        for (size_t i = begin; i < end; ++i)
+        {
+            const int32_t* p = &_coords[3 * order[i]];
+            double raw[3] = { static_cast<double>(p[0]), static_cast<double>(p[1]), static_cast<double>(p[2]) };
+            knnRaw(raw, k, results[i]);
+        }
+    });
+}
+
+}
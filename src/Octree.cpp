@@ -0,0 +1,342 @@
+/*************************************************************************************
+ * 
+ * 
+ * Copyright (c) 2021, Zhengjun Liu <zjliu@casm.ac.cn>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ ************************************************************************************/
+
+
+#include "Octree.h"
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <map>
+#include <stdexcept>
+#include <algorithm>
+#include "Header.h"
+#include "Reader.h"
+#include "PointBlock.h"
+#include "SpatialSort.h"
+#include "Exception.h"
+
+
+namespace hsl
+{
+
+namespace
+{
+
+// the node key puts the depth above the node's Morton prefix, so that
+// sorting by it gives breadth first order
+const uint32_t OctreeKeyDepthShift = 58;
+const uint32_t OctreeMaxDepth = OctreeKeyDepthShift / 3;
+
+inline uint32_t compactBits(uint64_t v, uint32_t axis, uint32_t depth)
+{
+    uint32_t r = 0;
+    for (uint32_t b = 0; b < depth; ++b)
+        r |= static_cast<uint32_t>((v >> (3 * b + axis)) & 1) << b;
+    return r;
+}
+
+/// Removes a file on every exit path.
+struct TempFile
+{
+    TempFile(std::string const& name) : name(name) {}
+    ~TempFile() { std::remove(name.c_str()); }
+
+    std::string name;
+};
+
+}
+
+Octree::Octree()
+{
+    std::memset(&_header, 0, sizeof(_header));
+}
+
+bool Octree::open(std::string const& filename)
+{
+    close();
+
+    FILE* fp = fopen(filename.c_str(), "rb");
+    if (fp == nullptr)
+        return false;
+
+    std::vector<detail::OctreeFileNode> records;
+    bool ok = fread(&_header, sizeof(_header), 1, fp) == 1 &&
+        std::memcmp(_header.signature, LIBHSL_OCTREEFILE_SIGNATURE, 4) == 0 &&
+        _header.versionMajor == LIBHSL_OCTREEFILE_VERSIONMAJOR &&
+        _header.maxDepth <= OctreeMaxDepth;
+    if (ok && _header.nodeCount > 0)
+    {
+        records.resize(_header.nodeCount);
+        ok = fread(&records.front(), sizeof(detail::OctreeFileNode), records.size(), fp) == records.size();
+    }
+    fclose(fp);
+
+    if (!ok)
+    {
+        close();
+        return false;
+    }
+
+    _depthStart.assign(_header.maxDepth + 2, records.size());
+    _nodes.reserve(records.size());
+    for (size_t i = 0; i < records.size(); ++i)
+    {
+        detail::OctreeFileNode const& r = records[i];
+        if (r.depth > _header.maxDepth || (i > 0 && r.depth < records[i - 1].depth))
+        {
+            close();
+            return false;
+        }
+        if (i == 0 || r.depth != records[i - 1].depth)
+        {
+            for (uint32_t d = (i == 0 ? 0 : records[i - 1].depth + 1); d <= r.depth; ++d)
+                _depthStart[d] = i;
+        }
+
+        OctreeNode node;
+        node.depth = r.depth;
+        node.x = r.x;
+        node.y = r.y;
+        node.z = r.z;
+        node.firstPoint = r.firstPoint;
+        node.pointCount = r.pointCount;
+        node.spacing = getSpacing(r.depth);
+
+        // cube of the node on the key grid, back to world coordinates
+        double cells = std::ldexp(1.0, static_cast<int>(SpatialKeyBits - r.depth));
+        uint32_t pos[3] = { r.x, r.y, r.z };
+        for (int a = 0; a < 3; ++a)
+        {
+            double lo = static_cast<double>(_header.origin[a]);
+            double hi = lo;
+            if (_header.factor > 0.0)
+            {
+                lo += pos[a] * cells / _header.factor;
+                hi += (pos[a] + 1) * cells / _header.factor;
+            }
+            (node.bounds.min)(a, lo * _header.scale[a] + _header.offset[a]);
+            (node.bounds.max)(a, hi * _header.scale[a] + _header.offset[a]);
+        }
+
+        _nodes.push_back(node);
+    }
+
+    return true;
+}
+
+void Octree::close()
+{
+    std::memset(&_header, 0, sizeof(_header));
+    _nodes.clear();
+    _depthStart.clear();
+}
+
+double Octree::getSpacing(uint32_t depth) const
+{
+    if (_header.factor <= 0.0)
+        return 0.0;
+
+    int bits = static_cast<int>(SpatialKeyBits) - static_cast<int>(depth + _header.gridBits);
+    return std::ldexp(1.0, bits) / _header.factor * _header.scale[0];
+}
+
+uint32_t Octree::getDepthForSpacing(double spacing) const
+{
+    for (uint32_t d = 0; d < _header.maxDepth; ++d)
+    {
+        if (getSpacing(d) <= spacing)
+            return d;
+    }
+    return _header.maxDepth;
+}
+
+std::vector<OctreeNode> Octree::query(Bounds<double> const& bounds, uint32_t maxDepth) const
+{
+    std::vector<OctreeNode> result;
+    if (_nodes.empty())
+        return result;
+
+    bool useZ = bounds.dimension() > 2 && (bounds.max)(2) > (bounds.min)(2);
+    size_t end = _depthStart[(std::min)(maxDepth, _header.maxDepth) + 1];
+    for (size_t i = 0; i < end; ++i)
+    {
+        Bounds<double> const& b = _nodes[i].bounds;
+        bool overlaps = (b.min)(0) <= (bounds.max)(0) && (bounds.min)(0) <= (b.max)(0) &&
+            (b.min)(1) <= (bounds.max)(1) && (bounds.min)(1) <= (b.max)(1);
+        if (overlaps && useZ)
+            overlaps = (b.min)(2) <= (bounds.max)(2) && (bounds.min)(2) <= (b.max)(2);
+        if (overlaps)
+            result.push_back(_nodes[i]);
+    }
+
+    return result;
+}
+
+std::vector<OctreeNode> Octree::queryByDensity(Bounds<double> const& bounds, double density) const
+{
+    if (density <= 0.0)
+        return query(bounds, 0);
+
+    return query(bounds, getDepthForSpacing(1.0 / std::sqrt(density)));
+}
+
+bool Octree::readNode(Reader& reader, OctreeNode const& node, PointBlock& block)
+{
+    return reader.readPointRange(static_cast<uint32_t>(node.firstPoint), node.pointCount, block);
+}
+
+OctreeBuilder::OctreeBuilder() : _gridBits(7), _maxDepth(0), _maxMemory(256 * 1024 * 1024), _chunkSize(65536)
+{
+}
+
+void OctreeBuilder::setGridBits(uint32_t bits)
+{
+    if (bits == 0 || bits >= SpatialKeyBits)
+        throw std::invalid_argument("octree grid bits must be between 1 and 20");
+
+    _gridBits = bits;
+}
+
+bool OctreeBuilder::build(std::string const& inputFile, std::string const& outputFile, std::string const& octreeFile)
+{
+    std::string tempBase = _tempName.empty() ? outputFile : _tempName;
+    TempFile mortonFile(tempBase + ".morton.tmp");
+
+    SpatialSorter sorter(SC_Morton);
+    sorter.setMaxMemoryUsage(_maxMemory);
+    sorter.setTempFileName(tempBase);
+    sorter.setChunkSize(0);
+    if (!sorter.sort(inputFile, mortonFile.name))
+        return false;
+
+    detail::OctreeFileHeader fileHeader;
+    std::memset(&fileHeader, 0, sizeof(fileHeader));
+    SpatialGrid grid;
+    {
+        Reader reader(mortonFile.name);
+        if (!reader.open())
+            return false;
+        bool ok = SpatialSorter::computeGrid(reader, grid);
+        Header const& header = reader.getHeader();
+        fileHeader.pointRecordsCount = header.getPointRecordsCount();
+        fileHeader.scale[0] = header.getScaleX();
+        fileHeader.scale[1] = header.getScaleY();
+        fileHeader.scale[2] = header.getScaleZ();
+        fileHeader.offset[0] = header.getOffsetX();
+        fileHeader.offset[1] = header.getOffsetY();
+        fileHeader.offset[2] = header.getOffsetZ();
+        reader.close();
+        if (!ok)
+            return false;
+    }
+
+    const uint32_t gridBits = _gridBits;
+    uint32_t maxDepth = _maxDepth;
+    if (maxDepth == 0)
+    {
+        // nodes over a surface hold about 4^gridBits points, one more depth
+        // absorbs uneven density
+        uint64_t capacity = 1ULL << (2 * gridBits);
+        while (capacity < fileHeader.pointRecordsCount && maxDepth < OctreeMaxDepth)
+        {
+            capacity <<= 2;
+            ++maxDepth;
+        }
+        ++maxDepth;
+    }
+    maxDepth = (std::min)(maxDepth, (std::min)(SpatialKeyBits - gridBits, OctreeMaxDepth));
+
+    // cell last claimed at each depth; points sharing a cell are adjacent in
+    // Morton order, so the first of them is the one the depth keeps
+    std::vector<uint64_t> claimed(maxDepth, ~0ULL);
+    std::map<uint64_t, uint32_t> nodeCounts;
+    SpatialSorter::KeyFunction key = [&](PointBlock const& block, size_t i) -> uint64_t {
+        uint64_t m = getMortonKey(grid.getCell(block.getRawX(i), 0),
+            grid.getCell(block.getRawY(i), 1), grid.getCell(block.getRawZ(i), 2));
+
+        uint32_t d = 0;
+        for (; d < maxDepth; ++d)
+        {
+            uint64_t cell = m >> (3 * (SpatialKeyBits - d - gridBits));
+            if (cell != claimed[d])
+            {
+                claimed[d] = cell;
+                break;
+            }
+        }
+
+        uint64_t node = d == 0 ? 0 : m >> (3 * (SpatialKeyBits - d));
+        uint64_t k = (static_cast<uint64_t>(d) << OctreeKeyDepthShift) | (node << (OctreeKeyDepthShift - 3 * d));
+        ++nodeCounts[k];
+        return k;
+    };
+
+    sorter.setChunkSize(_chunkSize);
+    if (!sorter.sort(mortonFile.name, outputFile, key))
+        return false;
+
+    std::vector<detail::OctreeFileNode> nodes;
+    nodes.reserve(nodeCounts.size());
+    uint64_t first = 0;
+    for (std::map<uint64_t, uint32_t>::const_iterator it = nodeCounts.begin(); it != nodeCounts.end(); ++it)
+    {
+        detail::OctreeFileNode n;
+        n.depth = static_cast<uint32_t>(it->first >> OctreeKeyDepthShift);
+        uint64_t prefix = (it->first & ((1ULL << OctreeKeyDepthShift) - 1)) >> (OctreeKeyDepthShift - 3 * n.depth);
+        n.x = compactBits(prefix, 0, n.depth);
+        n.y = compactBits(prefix, 1, n.depth);
+        n.z = compactBits(prefix, 2, n.depth);
+        n.firstPoint = first;
+        n.pointCount = it->second;
+        n.reserved = 0;
+        first += it->second;
+        nodes.push_back(n);
+    }
+
+    std::memcpy(fileHeader.signature, LIBHSL_OCTREEFILE_SIGNATURE, 4);
+    fileHeader.versionMajor = LIBHSL_OCTREEFILE_VERSIONMAJOR;
+    fileHeader.versionMinor = LIBHSL_OCTREEFILE_VERSIONMINOR;
+    fileHeader.nodeCount = static_cast<uint32_t>(nodes.size());
+    fileHeader.maxDepth = maxDepth;
+    fileHeader.gridBits = gridBits;
+    for (int a = 0; a < 3; ++a)
+        fileHeader.origin[a] = grid.origin[a];
+    fileHeader.factor = grid.factor;
+
+    FILE* fp = fopen(octreeFile.c_str(), "wb");
+    if (fp == nullptr)
+        return false;
+    bool ok = fwrite(&fileHeader, sizeof(fileHeader), 1, fp) == 1 &&
+        (nodes.empty() || fwrite(&nodes.front(), sizeof(detail::OctreeFileNode), nodes.size(), fp) == nodes.size());
+    ok = (fclose(fp) == 0) && ok;
+
+    return ok;
+}
+
+}
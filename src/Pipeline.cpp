@@ -0,0 +1,558 @@
+/*************************************************************************************
+ * 
+ * 
+ * Copyright (c) 2021, Zhengjun Liu <zjliu@casm.ac.cn>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ ************************************************************************************/
+
+#include "Pipeline.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <map>
+#include <mutex>
+#include "Reader.h"
+#include "Writer.h"
+#include "ThreadPool.h"
+#include "Header.h"
+#include "Exception.h"
+
+namespace hsl
+{
+
+FilterStage::FilterStage(FilterPtr filter)
+{
+    if (!filter)
+        throw libhsl_error("FilterStage needs a filter");
+    m_filters.push_back(filter);
+}
+
+FilterStage::FilterStage(Factory const& factory)
+    : m_factory(factory)
+{
+    if (!factory)
+        throw libhsl_error("FilterStage needs a filter factory");
+}
+
+void FilterStage::prepare(size_t workers)
+{
+    if (m_factory)
+    {
+        m_filters.clear();
+        for (size_t i = 0; i < workers; ++i)
+            m_filters.push_back(m_factory());
+    }
+    m_masks.resize(m_filters.size());
+}
+
+void FilterStage::process(PointBlock& block, size_t worker)
+{
+    Bitmask& mask = m_masks[worker];
+    mask.assign(block.size(), true);
+    m_filters[worker]->filter(block, mask);
+    block.compact(mask);
+}
+
+TransformStage::TransformStage(TransformPtr transform)
+{
+    if (!transform)
+        throw libhsl_error("TransformStage needs a transform");
+    m_transforms.push_back(transform);
+}
+
+TransformStage::TransformStage(Factory const& factory)
+    : m_factory(factory)
+{
+    if (!factory)
+        throw libhsl_error("TransformStage needs a transform factory");
+}
+
+void TransformStage::prepare(size_t workers)
+{
+    if (m_factory)
+    {
+        m_transforms.clear();
+        for (size_t i = 0; i < workers; ++i)
+            m_transforms.push_back(m_factory());
+    }
+}
+
+void TransformStage::process(PointBlock& block, size_t worker)
+{
+    m_transforms[worker]->transform(block);
+}
+
+PointStage::PointStage(Function const& function, bool writeBack)
+    : m_function(function), m_writeBack(writeBack)
+{
+    if (!function)
+        throw libhsl_error("PointStage needs a function");
+}
+
+void PointStage::prepare(size_t workers)
+{
+    m_points.assign(workers, PointPtr());
+    m_masks.resize(workers);
+}
+
+void PointStage::process(PointBlock& block, size_t worker)
+{
+    PointPtr& point = m_points[worker];
+    if (!point || point->getHeader() != block.getHeader())
+        point.reset(new Point(block.getHeader()));
+
+    Bitmask& mask = m_masks[worker];
+    mask.assign(block.size(), true);
+    bool dropped = false;
+    for (size_t i = 0; i < block.size(); ++i)
+    {
+        block.getPoint(i, *point);
+        if (!m_function(*point))
+        {
+            mask.reset(i);
+            dropped = true;
+        }
+        else if (m_writeBack)
+        {
+            block.setPoint(i, *point);
+        }
+    }
+    if (dropped)
+        block.compact(mask);
+}
+
+SchemaStage::SchemaStage(Header const& source, Header const& target, std::vector<FieldId> const& excluded)
+    : m_source(&source), m_target(&target)
+{
+    m_copier.bind(source.getSchema(), target.getSchema(), excluded);
+}
+
+void SchemaStage::prepare(size_t workers)
+{
+    m_scratch.assign(workers, Scratch(m_target));
+}
+
+void SchemaStage::process(PointBlock& block, size_t worker)
+{
+    Scratch& scratch = m_scratch[worker];
+    PointBlock& out = scratch.block;
+    out.setHeader(m_target);
+
+    const size_t n = block.size();
+    if (n > 0)
+    {
+        out.reserve(n);
+        const size_t length = out.getRecordLength();
+        for (size_t i = 0; i < n; ++i)
+            std::memset(out.appendRecords(block.getId(i), 1), 0, length);
+
+        m_copier.copy(block.getRecord(0), block.getRecordLength(), out.getRecord(0), length, n, scratch.values);
+        rewrite(block, out, worker);
+    }
+
+    std::swap(block, out);
+}
+
+namespace
+{
+
+struct SequencedBlock
+{
+    uint64_t sequence;
+    PointBlockPtr block;
+};
+
+/// Queue of blocks between two stages. push waits while the queue is full,
+/// pop while it is empty; both return false once the queue is aborted, and
+/// pop also once it is closed and drained.
+class BlockQueue
+{
+public:
+    explicit BlockQueue(size_t capacity)
+        : _capacity(capacity > 0 ? capacity : 1), _closed(false), _aborted(false)
+    {
+    }
+
+    bool push(SequencedBlock const& item)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (!_aborted && _items.size() >= _capacity)
+            _notFull.wait(lock);
+        if (_aborted)
+            return false;
+        _items.push_back(item);
+        _notEmpty.notify_one();
+        return true;
+    }
+
+    bool pop(SequencedBlock& item)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (!_aborted && !_closed && _items.empty())
+            _notEmpty.wait(lock);
+        if (_aborted || _items.empty())
+            return false;
+        item = _items.front();
+        _items.pop_front();
+        _notFull.notify_one();
+        return true;
+    }
+
+    /// No more blocks will be pushed.
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _closed = true;
+        _notEmpty.notify_all();
+    }
+
+    /// Drops the queued blocks and releases every waiting thread.
+    void abort()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _aborted = true;
+        _items.clear();
+        _notEmpty.notify_all();
+        _notFull.notify_all();
+    }
+
+private:
+    size_t _capacity;
+    std::deque<SequencedBlock> _items;
+    bool _closed;
+    bool _aborted;
+    std::mutex _mutex;
+    std::condition_variable _notEmpty;
+    std::condition_variable _notFull;
+};
+
+/// State shared by the tasks of one Pipeline::run. Besides the queues it
+/// keeps a window on the blocks in flight: the reader may not start block
+/// sequence before the sink has taken all blocks up to sequence - window,
+/// which bounds the blocks waiting to be put back in order.
+class PipelineRun
+{
+public:
+    PipelineRun(size_t queues, size_t capacity, uint64_t window)
+        : _window(window > 0 ? window : 1), _released(0), _failed(false)
+    {
+        for (size_t i = 0; i < queues; ++i)
+            _queues.push_back(std::make_shared<BlockQueue>(capacity));
+    }
+
+    BlockQueue& queue(size_t i) { return *_queues[i]; }
+
+    /// Waits until block sequence fits in the window; false once failed.
+    bool acquire(uint64_t sequence)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (!_failed && sequence >= _released + _window)
+            _windowOpen.wait(lock);
+        return !_failed;
+    }
+
+    /// The sink is done with one more block.
+    void release()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        ++_released;
+        _windowOpen.notify_all();
+    }
+
+    /// Keeps the first error and stops every queue.
+    void fail(std::exception_ptr error)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_failed)
+                return;
+            _failed = true;
+            _error = error;
+            _windowOpen.notify_all();
+        }
+        for (size_t i = 0; i < _queues.size(); ++i)
+            _queues[i]->abort();
+    }
+
+    void rethrow()
+    {
+        if (_error)
+            std::rethrow_exception(_error);
+    }
+
+private:
+    std::vector<std::shared_ptr<BlockQueue> > _queues;
+    std::mutex _mutex;
+    std::condition_variable _windowOpen;
+    uint64_t _window;
+    uint64_t _released;
+    bool _failed;
+    std::exception_ptr _error;
+};
+
+/// Pops the blocks of in in sequence order, calling f for each. Blocks of
+/// a concurrent stage arrive slightly out of order and wait in pending,
+/// which the window of PipelineRun keeps bounded.
+template <typename F>
+void popInOrder(BlockQueue& in, F f)
+{
+    std::map<uint64_t, PointBlockPtr> pending;
+    uint64_t next = 0;
+    SequencedBlock item;
+    while (in.pop(item))
+    {
+        pending[item.sequence] = item.block;
+        std::map<uint64_t, PointBlockPtr>::iterator it;
+        while ((it = pending.find(next)) != pending.end())
+        {
+            SequencedBlock ready = { next, it->second };
+            pending.erase(it);
+            if (!f(ready))
+                return;
+            ++next;
+        }
+    }
+}
+
+}
+
+Pipeline::Pipeline(Reader& reader, Writer& writer)
+    : m_reader(reader), m_blockSize(4096), m_queueCapacity(4), m_concurrency(0), m_preserveOrder(true)
+{
+    if (writer.getHeader().hasWaveformData())
+        throw libhsl_error("the output of a pipeline cannot carry waveform data");
+
+    Writer* w = &writer;
+    m_sink = [w](PointBlock const& block)
+    {
+        if (!w->writeBlock(block))
+            throw libhsl_error("pipeline could not write a block of points");
+    };
+}
+
+Pipeline::Pipeline(Reader& reader, Sink const& sink)
+    : m_reader(reader), m_sink(sink), m_blockSize(4096), m_queueCapacity(4), m_concurrency(0), m_preserveOrder(true)
+{
+}
+
+void Pipeline::addStage(PipelineStagePtr stage)
+{
+    m_stages.push_back(stage);
+}
+
+void Pipeline::addFilter(FilterPtr filter)
+{
+    addStage(PipelineStagePtr(new FilterStage(filter)));
+}
+
+void Pipeline::addFilter(FilterStage::Factory const& factory)
+{
+    addStage(PipelineStagePtr(new FilterStage(factory)));
+}
+
+void Pipeline::addTransform(TransformPtr transform)
+{
+    addStage(PipelineStagePtr(new TransformStage(transform)));
+}
+
+void Pipeline::addTransform(TransformStage::Factory const& factory)
+{
+    addStage(PipelineStagePtr(new TransformStage(factory)));
+}
+
+uint64_t Pipeline::run()
+{
+    if (m_blockSize == 0)
+        throw libhsl_error("pipeline block size must be positive");
+
+    const size_t concurrency = m_concurrency > 0 ? m_concurrency : ThreadPool::getDefaultSize();
+    std::vector<size_t> workers(m_stages.size());
+    size_t threads = 2;     // reader and sink
+    for (size_t s = 0; s < m_stages.size(); ++s)
+    {
+        workers[s] = m_stages[s]->isConcurrent() ? concurrency : 1;
+        m_stages[s]->prepare(workers[s]);
+        threads += workers[s];
+    }
+
+    // queue s feeds stage s, the last one the sink; the window admits as
+    // many blocks as the queues and workers can hold
+    const size_t queues = m_stages.size() + 1;
+    PipelineRun state(queues, m_queueCapacity, queues * (std::max)(m_queueCapacity, size_t(1)) + threads);
+    std::atomic<uint64_t> written(0);
+    {
+        ThreadPool pool(threads);
+        std::vector<std::future<void> > tasks;
+
+        Reader& reader = m_reader;
+        uint32_t blockSize = m_blockSize;
+        tasks.push_back(pool.submit([&state, &reader, blockSize]()
+        {
+            try
+            {
+                BlockQueue& out = state.queue(0);
+                for (uint64_t sequence = 0; ; ++sequence)
+                {
+                    if (!state.acquire(sequence))
+                        return;
+                    PointBlockPtr block(new PointBlock(&reader.getHeader()));
+                    if (!reader.readNextBlock(*block, blockSize))
+                        break;
+                    SequencedBlock item = { sequence, block };
+                    if (!out.push(item))
+                        return;
+                }
+                out.close();
+            }
+            catch (...)
+            {
+                state.fail(std::current_exception());
+            }
+        }));
+
+        for (size_t s = 0; s < m_stages.size(); ++s)
+        {
+            PipelineStage* stage = m_stages[s].get();
+            BlockQueue* in = &state.queue(s);
+            BlockQueue* out = &state.queue(s + 1);
+            if (!stage->isConcurrent())
+            {
+                tasks.push_back(pool.submit([&state, stage, in, out]()
+                {
+                    try
+                    {
+                        popInOrder(*in, [stage, out](SequencedBlock const& item)
+                        {
+                            stage->process(*item.block, 0);
+                            return out->push(item);
+                        });
+                        out->close();
+                    }
+                    catch (...)
+                    {
+                        state.fail(std::current_exception());
+                    }
+                }));
+                continue;
+            }
+
+            // the last worker to finish closes the output
+            std::shared_ptr<std::atomic<size_t> > running(new std::atomic<size_t>(workers[s]));
+            for (size_t w = 0; w < workers[s]; ++w)
+            {
+                tasks.push_back(pool.submit([&state, stage, in, out, w, running]()
+                {
+                    try
+                    {
+                        SequencedBlock item;
+                        while (in->pop(item))
+                        {
+                            stage->process(*item.block, w);
+                            if (!out->push(item))
+                                return;
+                        }
+                        if (--*running == 0)
+                            out->close();
+                    }
+                    catch (...)
+                    {
+                        state.fail(std::current_exception());
+                    }
+                }));
+            }
+        }
+
+        Sink& sink = m_sink;
+        BlockQueue* last = &state.queue(m_stages.size());
+        const bool ordered = m_preserveOrder;
+        tasks.push_back(pool.submit([&state, &sink, &written, last, ordered]()
+        {
+            try
+            {
+                auto consume = [&state, &sink, &written](SequencedBlock const& item)
+                {
+                    if (!item.block->empty())
+                    {
+                        sink(*item.block);
+                        written += item.block->size();
+                    }
+                    state.release();
+                    return true;
+                };
+                if (ordered)
+                {
+                    popInOrder(*last, consume);
+                }
+                else
+                {
+                    SequencedBlock item;
+                    while (last->pop(item))
+                        consume(item);
+                }
+            }
+            catch (...)
+            {
+                state.fail(std::current_exception());
+            }
+        }));
+
+        for (size_t i = 0; i < tasks.size(); ++i)
+            tasks[i].get();
+    }
+
+    state.rethrow();
+    return written;
+}
+
+uint64_t parallelForEach(Reader& reader, std::function<void(Point const& point)> const& function, size_t concurrency)
+{
+    std::atomic<uint64_t> visited(0);
+    Pipeline pipeline(reader, [](PointBlock const&) {});
+    pipeline.setConcurrency(concurrency);
+    pipeline.setPreserveOrder(false);
+    pipeline.addStage(PipelineStagePtr(new PointStage([&function, &visited](Point& point)
+    {
+        function(point);
+        ++visited;
+        return false;   // nothing to pass on to the sink
+    }, false)));
+    pipeline.run();
+    return visited;
+}
+
+uint64_t parallelTransform(Reader& reader, Writer& writer, std::function<bool(Point& point)> const& function,
+                           bool preserveOrder, size_t concurrency)
+{
+    Pipeline pipeline(reader, writer);
+    pipeline.setConcurrency(concurrency);
+    pipeline.setPreserveOrder(preserveOrder);
+    pipeline.addStage(PipelineStagePtr(new PointStage(function, true)));
+    return pipeline.run();
+}
+
+}
@@ -1023,12 +1023,12 @@ bool Point::getRawWaveformPacketData(uint16_t band, std::vector<uint8_t> &data)
 	if (!getWaveformPacketDefinition(band, wd))
 		return false;
 
-	uint64_t offset = 0;
-	if (!getWaveformDataByteOffset(offset))
-		return false; 
-
-	offset = offset + wd.byteOffset;
+	// packet offsets are relative to the start of the waveform data of the
+	// point, not to its position in the file
+	uint64_t offset = wd.byteOffset;
     uint32_t size = wd.size;
+    if (offset + size > _waveformData.size())
+        return false;
     data.resize(size);
     memcpy(&data[0], &_waveformData[0] + offset, size);
 
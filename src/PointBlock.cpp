@@ -0,0 +1,176 @@
+/*************************************************************************************
+ * 
+ * 
+ * Copyright (c) 2021, Zhengjun Liu <zjliu@casm.ac.cn>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ ************************************************************************************/
+
+
+#include "PointBlock.h"
+#include "Header.h"
+#include "Point.h"
+#include "Exception.h"
+#include "Bitmask.h"
+
+
+namespace hsl
+{
+
+PointBlock::PointBlock(Header const* header, size_t capacity) : _header(0), _recordLength(0)
+{
+    setHeader(header);
+    reserve(capacity);
+}
+
+void PointBlock::setHeader(Header const* header)
+{
+    if (!header)
+    {
+        throw libhsl_error("header reference for PointBlock is void");
+    }
+
+    _header = header;
+    _recordLength = header->getDataRecordLength();
+    clear();
+}
+
+void PointBlock::resetHeader(Header const* header)
+{
+    if (!header)
+    {
+        throw libhsl_error("header reference for PointBlock is void");
+    }
+    if (header->getDataRecordLength() != _recordLength)
+    {
+        throw libhsl_error("header record length does not match the block");
+    }
+
+    _header = header;
+}
+
+void PointBlock::clear()
+{
+    _data.clear();
+    _ids.clear();
+}
+
+void PointBlock::truncate(size_t count)
+{
+    if (count >= _ids.size())
+        return;
+    _data.resize(count * _recordLength);
+    _ids.resize(count);
+}
+
+void PointBlock::reserve(size_t count)
+{
+    _data.reserve(count * _recordLength);
+    _ids.reserve(count);
+}
+
+uint8_t* PointBlock::appendRecords(uint32_t firstId, size_t count)
+{
+    size_t n = _ids.size();
+    _data.resize((n + count) * _recordLength);
+    _ids.resize(n + count);
+    for (size_t i = 0; i < count; ++i)
+        _ids[n + i] = firstId + static_cast<uint32_t>(i);
+
+    return &_data[n * _recordLength];
+}
+
+void PointBlock::appendRecord(uint32_t id, const uint8_t* record)
+{
+    _data.insert(_data.end(), record, record + _recordLength);
+    _ids.push_back(id);
+}
+
+void PointBlock::appendPoint(uint32_t id, Point const& point)
+{
+    if (point.getData().size() != _recordLength)
+        throw libhsl_error("point record length does not match the block");
+
+    appendRecord(id, &point.getData().front());
+}
+
+void PointBlock::getPoint(size_t i, Point& point) const
+{
+    std::vector<uint8_t>& data = point.getData();
+    data.resize(_recordLength);
+    std::memcpy(&data.front(), getRecord(i), _recordLength);
+    point.getWaveformData().clear();
+}
+
+void PointBlock::setPoint(size_t i, Point const& point)
+{
+    if (point.getData().size() != _recordLength)
+        throw libhsl_error("point record length does not match the block");
+
+    std::memcpy(getRecord(i), &point.getData().front(), _recordLength);
+}
+
+size_t PointBlock::compact(std::vector<bool> const& keep, size_t start)
+{
+    size_t n = _ids.size();
+    size_t out = start;
+    for (size_t i = start; i < n; ++i)
+    {
+        if (i - start >= keep.size() || !keep[i - start])
+            continue;
+        if (out != i)
+        {
+            std::memcpy(&_data[out * _recordLength], &_data[i * _recordLength], _recordLength);
+            _ids[out] = _ids[i];
+        }
+        ++out;
+    }
+    _data.resize(out * _recordLength);
+    _ids.resize(out);
+
+    return out;
+}
+
+size_t PointBlock::compact(Bitmask const& mask)
+{
+    size_t n = _ids.size();
+    size_t out = 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (i >= mask.size() || !mask.test(i))
+            continue;
+        if (out != i)
+        {
+            std::memcpy(&_data[out * _recordLength], &_data[i * _recordLength], _recordLength);
+            _ids[out] = _ids[i];
+        }
+        ++out;
+    }
+    _data.resize(out * _recordLength);
+    _ids.resize(out);
+
+    return out;
+}
+
+}
@@ -30,16 +30,22 @@
 
 #include "Reader.h"
 #include <cfloat>
+#include <algorithm>
+#include <cstring>
 #include "Point.h"
 #include "Transform.h"
 #include "Filter.h"
+#include "Bitmask.h"
+#include "FieldAccessor.h"
+#include "detail/private_utility.hpp"
 
 
 namespace hsl
 {
 
 Reader::Reader(std::string filename) : FileIO(filename), _needHeaderCheck(false), _size(0), 
-_point(PointPtr(new Point(&DefaultHeader::get()))), _current(0), _filters(0), _transforms(0), _recordSize(0)
+_point(PointPtr(new Point(&DefaultHeader::get()))), _current(0), _transforms(0), _recordSize(0),
+_chunkTableFailed(false)
 {
 }
 
@@ -61,11 +67,59 @@ bool Reader::open()
 		return false;
 
 	_point->setHeader(_header.get());
+
+	// a damaged chunk table only costs the chunk extents, not the file
+	_chunkTableFailed = !loadChunkTable();
+	if (_chunkTableFailed)
+		_zoneMap.clear();
+
 	reset();
 
 	return true;
 }
 
+bool Reader::loadChunkTable()
+{
+	_zoneMap.clear();
+
+	uint64_t pos = _header->getChunkTableOffset();
+	if (pos == 0)
+		return true;
+
+	if (detail::seek64(_fp, pos, SEEK_SET) != 0)
+		return false;
+
+	return _zoneMap.read(_fp, *_header);
+}
+
+bool Reader::skipChunks()
+{
+	if (_filterChain.empty() || _zoneMap.getChunkCount() == 0)
+		return false;
+
+	uint32_t start = _current;
+	for (;;)
+	{
+		size_t chunk = _zoneMap.findChunk(_current);
+		if (chunk == _zoneMap.getChunkCount() || !_filterChain.canSkip(_zoneMap, chunk))
+			break;
+		ChunkBounds const& c = _zoneMap.getChunkBounds()[chunk];
+		_current = static_cast<uint32_t>((std::min)(c.firstPoint + c.pointCount, static_cast<uint64_t>(_size)));
+	}
+
+	if (_current == start)
+		return false;
+
+	// if the seek fails, read on from where the skip started
+	uint64_t pos = static_cast<uint64_t>(_current) * _header->getDataRecordLength() + _header->getDataOffset();
+	if (detail::seek64(_fp, pos, SEEK_SET) != 0)
+	{
+		_current = start;
+		return false;
+	}
+	return true;
+}
+
 void Reader::close()
 {
     fclose(_fp);
@@ -104,72 +158,41 @@ bool Reader::readNextPoint(bool readWaveform)
             _point->setHeader(_header.get());
     }
     
-    try
-    {
-        size_t count = fread(&_point->getData()[0], _recordSize, 1, _fp);
-		if (count != 1)
-			return false;
-
-        ++_current;
-        
-    } catch (std::runtime_error&)
-    {
-        // If the stream is no good anymore, we're done reading points
-        return false;
-    }
-
     // Filter the points and continue reading until we either find 
-    // one to keep or throw an exception.
-
-    bool bLastPoint = false;
-    
-    if (!_filters.empty())
+    // one to keep or run out of points. Chunks the filters rule out
+    // are skipped on the way.
+    const uint32_t chunkSize = _filterChain.empty() ? 0 : _zoneMap.getChunkSize();
+    for (;;)
     {
-        if (!filterPoint(*_point))
-        {
+        if (chunkSize > 0 && _current % chunkSize == 0 && skipChunks() && _current >= _size)
+            return false;
 
-            try
-            {
-                fread(&_point->getData().front(), _recordSize, 1, _fp);
-                ++_current;
-        
-            } catch (std::runtime_error&)
-            {
-                // If the stream is no good anymore, we're done reading points
+        try
+        {
+            size_t count = fread(&_point->getData()[0], _recordSize, 1, _fp);
+            if (count != 1)
                 return false;
-            }
 
-            while (!filterPoint(*_point))
-            {
+            ++_current;
 
-                try
-                {
-                    fread(&_point->getData().front(), _recordSize, 1, _fp);
-                    ++_current;
-        
-                } catch (std::runtime_error&)
-                {
-                    // If the stream is no good anymore, we're done reading points
-                    return false;
-                }
-                if (_current == _size) 
-                {
-                    bLastPoint = true;
-                    break;
-                }
-            }
+        } catch (std::runtime_error&)
+        {
+            // If the stream is no good anymore, we're done reading points
+            return false;
         }
-    }
 
+        if (filterPoint(*_point))
+            break;
+
+        if (_current >= _size)
+            return false;
+    }
 
     if (!_transforms.empty())
     {
         transformPoint(*_point);
     }
 
-    if (bLastPoint)
-        return false;
-
     if (readWaveform)
     {
         if(!readWaveformData())
@@ -215,6 +238,99 @@ Point const& Reader::readPointAt(std::size_t n, bool readWaveform)
     return *_point;
 }
 
+bool Reader::readPointRange(uint32_t first, uint32_t count, PointBlock& block)
+{
+    if (count == 0)
+        return true;
+
+    if (static_cast<uint64_t>(first) + count > _size)
+    {
+        std::ostringstream msg;
+        msg << "readPointRange:: range [" << first << ", " << first + count << ") exceeds the number of points: " << _size;
+        throw std::out_of_range(msg.str());
+    }
+
+    if (block.getRecordLength() != _recordSize)
+        throw libhsl_error("point block record length does not match the file");
+
+    uint64_t pos = static_cast<uint64_t>(first) * _header->getDataRecordLength() + _header->getDataOffset();
+    if (detail::seek64(_fp, pos, SEEK_SET) != 0)
+        return false;
+
+    size_t start = block.size();
+    uint8_t* data = block.appendRecords(first, count);
+    if (fread(data, _recordSize, count, _fp) != count)
+    {
+        block.truncate(start);
+        return false;
+    }
+
+    // keep readNextPoint() consistent with the new file position
+    _current = first + count;
+
+    return true;
+}
+
+bool Reader::readNextBlock(PointBlock& block, uint32_t count)
+{
+    block.clear();
+    if (count == 0)
+        return _current < _size;
+
+    Bitmask mask;
+    const uint32_t chunkSize = _filterChain.empty() ? 0 : _zoneMap.getChunkSize();
+    while (block.empty() && _current < _size)
+    {
+        uint32_t n = (std::min)(count, _size - _current);
+        if (chunkSize > 0)
+        {
+            // blocks stay within one chunk so that whole chunks can be skipped
+            skipChunks();
+            if (_current >= _size)
+                break;
+            n = (std::min)(n, chunkSize - _current % chunkSize);
+            n = (std::min)(n, _size - _current);
+        }
+        if (!readPointRange(_current, n, block))
+            return false;
+
+        if (_filterChain.empty())
+            break;
+
+        mask.assign(block.size(), true);
+        _filterChain.filter(block, mask);
+        block.compact(mask);
+    }
+
+    return !block.empty();
+}
+
+bool Reader::readPoints(std::vector<uint32_t> const& ids, PointBlock& block)
+{
+    if (ids.empty())
+        return true;
+
+    std::vector<uint32_t> sorted(ids);
+    if (!std::is_sorted(sorted.begin(), sorted.end()))
+        std::sort(sorted.begin(), sorted.end());
+    sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+
+    block.reserve(block.size() + sorted.size());
+
+    size_t i = 0;
+    while (i < sorted.size())
+    {
+        size_t j = i + 1;
+        while (j < sorted.size() && sorted[j] == sorted[j - 1] + 1)
+            ++j;
+        if (!readPointRange(sorted[i], static_cast<uint32_t>(j - i), block))
+            return false;
+        i = j;
+    }
+
+    return true;
+}
+
 bool Reader::readWaveformData()
 {  
     try
@@ -225,13 +341,20 @@ bool Reader::readWaveformData()
 		_point->getWaveformDataSize(size);
         if (_point->isValid() && size > 0)   
         {
-            long pre = ftell(_fp);
-            fseek(_fp, pos, SEEK_SET);
-            _point->getWaveformData().resize(size);         
-            fread(&_point->getWaveformData().front(), size, 1, _fp);
-            fseek(_fp, pre, SEEK_SET);    // back to previous position 
+            if (_waveformCache)
+            {
+                WaveformCache::DataPtr data = _waveformCache->get(pos, size,
+                    [this](uint64_t offset, uint32_t n, WaveformCache::Data& out) { loadWaveformData(offset, n, out); });
+                _point->getWaveformData().assign(data->begin(), data->end());
+            }
+            else
+            {
+                loadWaveformData(pos, size, _point->getWaveformData());
+            }
             return true;
         }       
+        // a point without waveform must not keep that of the previous one
+        _point->getWaveformData().clear();
     } catch (std::runtime_error&)
     {
         // If the stream is no good anymore, we're done reading waveform data
@@ -241,6 +364,116 @@ bool Reader::readWaveformData()
     return true;
 }
 
+void Reader::loadWaveformData(uint64_t pos, uint32_t size, std::vector<uint8_t>& data)
+{
+    uint64_t pre = detail::tell64(_fp);
+    if (detail::seek64(_fp, pos, SEEK_SET) != 0)
+        throw libhsl_error("cannot seek to the waveform data");
+    data.resize(size);
+    size_t read = fread(&data.front(), 1, size, _fp);
+    if (detail::seek64(_fp, pre, SEEK_SET) != 0)    // back to previous position 
+        throw libhsl_error("cannot seek back from the waveform data");
+    if (read != size)
+        throw libhsl_error("waveform data extends beyond the end of the file");
+}
+
+bool Reader::readWaveforms(PointBlock const& block, WaveformBatch& batch, uint32_t maxGap)
+{
+    if (block.getRecordLength() != _recordSize)
+        throw libhsl_error("point block record length does not match the file");
+
+    FieldAccessor offset;
+    FieldAccessor size;
+    std::vector<WaveformRange> ranges;
+    if (offset.bind(_header->getSchema(), FI_ByteOffsetToWaveformData) &&
+        size.bind(_header->getSchema(), FI_WaveformDataSize))
+    {
+        ranges.reserve(block.size());
+        for (size_t i = 0; i < block.size(); ++i)
+        {
+            const uint8_t* record = block.getRecord(i);
+            WaveformRange range;
+            range.offset = static_cast<uint64_t>(offset.getRaw(record));
+            range.size = static_cast<uint32_t>(size.getRaw(record));
+            range.entry = i;
+            if (range.size > 0)
+                ranges.push_back(range);
+        }
+    }
+    return readWaveformRanges(ranges, block.size(), batch, maxGap);
+}
+
+bool Reader::readWaveforms(std::vector<Point> const& points, WaveformBatch& batch, uint32_t maxGap)
+{
+    std::vector<WaveformRange> ranges;
+    ranges.reserve(points.size());
+    for (size_t i = 0; i < points.size(); ++i)
+    {
+        WaveformRange range;
+        range.entry = i;
+        if (points[i].getWaveformDataByteOffset(range.offset) &&
+            points[i].getWaveformDataSize(range.size) && range.size > 0)
+            ranges.push_back(range);
+    }
+    return readWaveformRanges(ranges, points.size(), batch, maxGap);
+}
+
+bool Reader::readWaveformRanges(std::vector<WaveformRange>& ranges, size_t entries, WaveformBatch& batch, uint32_t maxGap)
+{
+    batch.clear();
+    WaveformBatch::Span none = { 0, 0 };
+    batch._spans.assign(entries, none);
+    if (ranges.empty())
+        return true;
+
+    std::sort(ranges.begin(), ranges.end(),
+              [](WaveformRange const& a, WaveformRange const& b) { return a.offset < b.offset; });
+
+    // size the buffer for the merged runs first, so it is allocated once
+    size_t total = 0;
+    for (size_t i = 0; i < ranges.size(); )
+    {
+        uint64_t begin = ranges[i].offset;
+        uint64_t end = begin + ranges[i].size;
+        size_t j = i + 1;
+        for (; j < ranges.size() && ranges[j].offset <= end + maxGap; ++j)
+            end = std::max(end, ranges[j].offset + ranges[j].size);
+        total += static_cast<size_t>(end - begin);
+        i = j;
+    }
+    batch._buffer.resize(total);
+
+    uint64_t pre = detail::tell64(_fp);
+    bool ok = true;
+    size_t filled = 0;
+    for (size_t i = 0; i < ranges.size() && ok; )
+    {
+        uint64_t begin = ranges[i].offset;
+        uint64_t end = begin + ranges[i].size;
+        size_t j = i + 1;
+        for (; j < ranges.size() && ranges[j].offset <= end + maxGap; ++j)
+            end = std::max(end, ranges[j].offset + ranges[j].size);
+
+        size_t length = static_cast<size_t>(end - begin);
+        ok = detail::seek64(_fp, begin, SEEK_SET) == 0 &&
+             fread(&batch._buffer[filled], 1, length, _fp) == length;
+        ++batch._reads;
+
+        for (; i < j; ++i)
+        {
+            WaveformBatch::Span& span = batch._spans[ranges[i].entry];
+            span.offset = filled + static_cast<size_t>(ranges[i].offset - begin);
+            span.size = ranges[i].size;
+        }
+        filled += length;
+    }
+    detail::seek64(_fp, pre, SEEK_SET);    // back to previous position
+
+    if (!ok)
+        batch.clear();
+    return ok;
+}
+
 bool Reader::seek(size_t n)
 {
     if (_size == n) {
@@ -282,30 +515,26 @@ bool Reader::filterPoint(hsl::Point const& p)
 {    
     // If there's no filters on this reader, we keep 
     // the point no matter what.
-    if (_filters.empty() ) {
+    if (_filterChain.empty() ) {
         return true;
     }
 
-    std::vector<hsl::FilterPtr>::const_iterator fi;
-    for (fi = _filters.begin(); fi != _filters.end(); ++fi)
-    {
-        hsl::FilterPtr filter = *fi;
-        if (!filter->filter(p))
-        {
-            return false;
-        }
-    }
-    return true;
+    return _filterChain.filter(p);
 }
 
 void Reader::setFilters(std::vector<hsl::FilterPtr> const& filters)
 {
-    _filters = filters;
+    _filterChain.setFilters(filters);
+}
+
+void Reader::setAdaptiveFilterOrder(bool adaptive, uint64_t samplePoints)
+{
+    _filterChain.setAdaptive(adaptive, samplePoints);
 }
 
 std::vector<hsl::FilterPtr> Reader::getFilters() const
 {
-    return _filters;
+    return _filterChain.getFilters();
 }
 
 void Reader::setTransforms(std::vector<hsl::TransformPtr> const& transforms)
@@ -0,0 +1,593 @@
+/*************************************************************************************
+ * 
+ * 
+ * Copyright (c) 2021, Zhengjun Liu <zjliu@casm.ac.cn>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ ************************************************************************************/
+
+
+#include "SpatialSort.h"
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <functional>
+#include <queue>
+#include <vector>
+#include <stdexcept>
+#include "Header.h"
+#include "Point.h"
+#include "PointBlock.h"
+#include "Reader.h"
+#include "Writer.h"
+#include "Exception.h"
+#include "detail/private_utility.hpp"
+
+
+namespace hsl
+{
+
+namespace
+{
+
+/// Number of records fetched per read while building runs.
+const uint32_t SortReadBlockSize = 4096;
+
+/// Largest number of runs merged at once, more runs are merged in passes.
+const size_t SortMaxFanIn = 128;
+
+const size_t SortMinRunBuffer = 64 * 1024;
+
+// spreads the low 21 bits of v so that two zero bits follow each of them
+inline uint64_t spreadBits(uint32_t v)
+{
+    uint64_t x = v & SpatialKeyMax;
+    x = (x | x << 32) & 0x1f00000000ffffULL;
+    x = (x | x << 16) & 0x1f0000ff0000ffULL;
+    x = (x | x << 8)  & 0x100f00f00f00f00fULL;
+    x = (x | x << 4)  & 0x10c30c30c30c30c3ULL;
+    x = (x | x << 2)  & 0x1249249249249249ULL;
+    return x;
+}
+
+/// A sorted run inside a temporary file.
+struct SortRun
+{
+    uint64_t offset;
+    uint64_t count;
+};
+
+/// One record of a run: [uint64 key][uint32 id][record][uint32 size][waveform].
+/// The id is the index in the input file and keeps equal keys in input order.
+struct SortEntry
+{
+    uint64_t key;
+    uint32_t id;
+    std::vector<uint8_t> record;
+    std::vector<uint8_t> waveform;
+};
+
+bool writeEntry(FILE* fp, uint64_t key, uint32_t id, const uint8_t* record, size_t recordLength,
+    const uint8_t* waveform, uint32_t waveformSize)
+{
+    if (fwrite(&key, sizeof(key), 1, fp) != 1 ||
+        fwrite(&id, sizeof(id), 1, fp) != 1 ||
+        fwrite(record, recordLength, 1, fp) != 1 ||
+        fwrite(&waveformSize, sizeof(waveformSize), 1, fp) != 1)
+        return false;
+
+    if (waveformSize > 0 && fwrite(waveform, waveformSize, 1, fp) != 1)
+        return false;
+
+    return true;
+}
+
+/// Sequential reader of one run.
+class RunCursor
+{
+public:
+    RunCursor(std::string const& filename, SortRun const& run, size_t recordLength, size_t bufferSize)
+        : _fp(nullptr), _remaining(run.count), _buffer(bufferSize)
+    {
+        entry.record.resize(recordLength);
+
+        _fp = fopen(filename.c_str(), "rb");
+        if (_fp == nullptr)
+            throw libhsl_error("cannot open temporary sort file " + filename);
+        setvbuf(_fp, &_buffer[0], _IOFBF, _buffer.size());
+        if (detail::seek64(_fp, run.offset, SEEK_SET) != 0)
+        {
+            fclose(_fp);
+            throw libhsl_error("cannot seek in temporary sort file " + filename);
+        }
+    }
+
+    ~RunCursor()
+    {
+        if (_fp != nullptr)
+            fclose(_fp);
+    }
+
+    bool next()
+    {
+        if (_remaining == 0)
+            return false;
+
+        uint32_t size = 0;
+        if (fread(&entry.key, sizeof(entry.key), 1, _fp) != 1 ||
+            fread(&entry.id, sizeof(entry.id), 1, _fp) != 1 ||
+            fread(&entry.record[0], entry.record.size(), 1, _fp) != 1 ||
+            fread(&size, sizeof(size), 1, _fp) != 1)
+            throw libhsl_error("temporary sort file is truncated");
+
+        entry.waveform.resize(size);
+        if (size > 0 && fread(&entry.waveform[0], size, 1, _fp) != 1)
+            throw libhsl_error("temporary sort file is truncated");
+
+        --_remaining;
+        return true;
+    }
+
+    SortEntry entry;
+
+private:
+    RunCursor(RunCursor const&);
+    RunCursor& operator=(RunCursor const&);
+
+    FILE*               _fp;
+    uint64_t            _remaining;
+    std::vector<char>   _buffer;
+};
+
+typedef std::shared_ptr<RunCursor> RunCursorPtr;
+
+struct CursorGreater
+{
+    bool operator()(RunCursor const* a, RunCursor const* b) const
+    {
+        if (a->entry.key != b->entry.key)
+            return a->entry.key > b->entry.key;
+        return a->entry.id > b->entry.id;
+    }
+};
+
+/// Merges runs [first, last) of filename in key order into sink.
+template <typename Sink>
+void mergeRuns(std::string const& filename, std::vector<SortRun> const& runs, size_t first, size_t last,
+    size_t recordLength, size_t maxMemory, Sink& sink)
+{
+    size_t bufferSize = (std::max)(SortMinRunBuffer, maxMemory / (last - first + 1));
+
+    std::vector<RunCursorPtr> cursors;
+    std::priority_queue<RunCursor*, std::vector<RunCursor*>, CursorGreater> queue;
+    for (size_t i = first; i < last; ++i)
+    {
+        cursors.push_back(std::make_shared<RunCursor>(filename, runs[i], recordLength, bufferSize));
+        if (cursors.back()->next())
+            queue.push(cursors.back().get());
+    }
+
+    while (!queue.empty())
+    {
+        RunCursor* cursor = queue.top();
+        queue.pop();
+        sink(cursor->entry);
+        if (cursor->next())
+            queue.push(cursor);
+    }
+}
+
+/// Appends merged entries to a temporary file as a single run.
+struct RunFileSink
+{
+    RunFileSink(FILE* fp, size_t recordLength) : fp(fp), recordLength(recordLength), count(0) {}
+
+    void operator()(SortEntry const& e)
+    {
+        const uint8_t* wf = e.waveform.empty() ? nullptr : &e.waveform[0];
+        if (!writeEntry(fp, e.key, e.id, &e.record[0], recordLength, wf, static_cast<uint32_t>(e.waveform.size())))
+            throw libhsl_error("cannot write temporary sort file");
+        ++count;
+    }
+
+    FILE*       fp;
+    size_t      recordLength;
+    uint64_t    count;
+};
+
+/// Writes merged entries to the output file.
+struct WriterSink
+{
+    WriterSink(Writer& writer) : writer(writer), point(&writer.getHeader()) {}
+
+    void operator()(SortEntry const& e)
+    {
+        std::memcpy(&point.getData()[0], &e.record[0], e.record.size());
+        point.setWaveformData(e.waveform);
+        if (!writer.writePoint(point))
+            throw libhsl_error("cannot write sorted point");
+    }
+
+    Writer&     writer;
+    Point       point;
+};
+
+/// Removes the temporary files on every exit path.
+struct TempFiles
+{
+    ~TempFiles()
+    {
+        for (size_t i = 0; i < names.size(); ++i)
+            std::remove(names[i].c_str());
+    }
+
+    std::vector<std::string> names;
+};
+
+/// Position of a record and its waveform in the in-memory run buffers.
+struct RunItem
+{
+    uint64_t key;
+    uint32_t index;         // position in the point block
+    uint32_t waveformSize;
+    size_t   waveformOffset;
+
+    bool operator<(RunItem const& other) const
+    {
+        if (key != other.key)
+            return key < other.key;
+        return index < other.index;
+    }
+};
+
+}
+
+uint64_t getMortonKey(uint32_t x, uint32_t y, uint32_t z)
+{
+    return spreadBits(x) | (spreadBits(y) << 1) | (spreadBits(z) << 2);
+}
+
+uint64_t getHilbertKey(uint32_t x, uint32_t y, uint32_t z)
+{
+    // Skilling's transpose algorithm, "Programming the Hilbert curve" (2004)
+    uint32_t X[3] = { x & SpatialKeyMax, y & SpatialKeyMax, z & SpatialKeyMax };
+    const uint32_t M = 1u << (SpatialKeyBits - 1);
+
+    // inverse undo
+    for (uint32_t Q = M; Q > 1; Q >>= 1)
+    {
+        uint32_t P = Q - 1;
+        for (int i = 0; i < 3; ++i)
+        {
+            if (X[i] & Q)
+            {
+                X[0] ^= P;
+            }
+            else
+            {
+                uint32_t t = (X[0] ^ X[i]) & P;
+                X[0] ^= t;
+                X[i] ^= t;
+            }
+        }
+    }
+
+    // Gray encode
+    X[1] ^= X[0];
+    X[2] ^= X[1];
+    uint32_t t = 0;
+    for (uint32_t Q = M; Q > 1; Q >>= 1)
+    {
+        if (X[2] & Q)
+            t ^= Q - 1;
+    }
+    for (int i = 0; i < 3; ++i)
+        X[i] ^= t;
+
+    // the transposed form interleaves into the key with x most significant
+    return (spreadBits(X[0]) << 2) | (spreadBits(X[1]) << 1) | spreadBits(X[2]);
+}
+
+SpatialSorter::SpatialSorter(SpatialCurve curve)
+    : _curve(curve), _maxMemory(256 * 1024 * 1024), _chunkSize(65536), _runCount(0)
+{
+}
+
+bool SpatialSorter::computeGrid(Reader& reader, SpatialGrid& grid)
+{
+    Header const& header = reader.getHeader();
+    const uint64_t pointCount = header.getPointRecordsCount();
+    if (pointCount > 0xFFFFFFFFULL)
+        throw libhsl_error("too many points to sort");
+    const uint32_t count = static_cast<uint32_t>(pointCount);
+
+    // grid origin and cell size in the raw coordinate domain, one cell size
+    // for all axes so the curve follows the real geometry
+    int64_t rawMax[3];
+    double mins[3] = { header.getMinX(), header.getMinY(), header.getMinZ() };
+    double maxs[3] = { header.getMaxX(), header.getMaxY(), header.getMaxZ() };
+    double scales[3] = { header.getScaleX(), header.getScaleY(), header.getScaleZ() };
+    double offsets[3] = { header.getOffsetX(), header.getOffsetY(), header.getOffsetZ() };
+    bool validExtent = true;
+    for (int i = 0; i < 3; ++i)
+    {
+        if (!(mins[i] <= maxs[i]) || !(std::fabs(scales[i]) > 0.0))
+            validExtent = false;
+    }
+    if (validExtent && detail::exactly_equal(mins[0], maxs[0]) && detail::exactly_equal(mins[1], maxs[1]))
+        validExtent = false;
+
+    if (validExtent)
+    {
+        for (int i = 0; i < 3; ++i)
+        {
+            grid.origin[i] = static_cast<int64_t>(std::floor((mins[i] - offsets[i]) / scales[i]));
+            rawMax[i] = static_cast<int64_t>(std::ceil((maxs[i] - offsets[i]) / scales[i]));
+        }
+    }
+    else
+    {
+        // the header extent cannot be trusted, measure it
+        for (int i = 0; i < 3; ++i)
+        {
+            grid.origin[i] = (std::numeric_limits<int32_t>::max)();
+            rawMax[i] = (std::numeric_limits<int32_t>::min)();
+        }
+        PointBlock block(&header, SortReadBlockSize);
+        for (uint32_t first = 0; first < count; first += SortReadBlockSize)
+        {
+            block.clear();
+            uint32_t n = (std::min)(SortReadBlockSize, count - first);
+            if (!reader.readPointRange(first, n, block))
+                return false;
+            for (size_t j = 0; j < block.size(); ++j)
+            {
+                int64_t v[3] = { block.getRawX(j), block.getRawY(j), block.getRawZ(j) };
+                for (int i = 0; i < 3; ++i)
+                {
+                    grid.origin[i] = (std::min)(grid.origin[i], v[i]);
+                    rawMax[i] = (std::max)(rawMax[i], v[i]);
+                }
+            }
+        }
+        if (count == 0)
+        {
+            for (int i = 0; i < 3; ++i)
+                grid.origin[i] = rawMax[i] = 0;
+        }
+    }
+
+    int64_t span = 0;
+    for (int i = 0; i < 3; ++i)
+        span = (std::max)(span, rawMax[i] - grid.origin[i]);
+    grid.factor = span > 0 ? static_cast<double>(SpatialKeyMax) / static_cast<double>(span) : 0.0;
+
+    return true;
+}
+
+bool SpatialSorter::sort(std::string const& inputFile, std::string const& outputFile)
+{
+    SpatialGrid grid;
+    {
+        Reader reader(inputFile);
+        if (!reader.open())
+            return false;
+        bool ok = computeGrid(reader, grid);
+        reader.close();
+        if (!ok)
+            return false;
+    }
+
+    const SpatialCurve curve = _curve;
+    return sort(inputFile, outputFile, [&grid, curve](PointBlock const& block, size_t i) -> uint64_t {
+        uint32_t x = grid.getCell(block.getRawX(i), 0);
+        uint32_t y = grid.getCell(block.getRawY(i), 1);
+        uint32_t z = grid.getCell(block.getRawZ(i), 2);
+        return curve == SC_Morton ? getMortonKey(x, y, z) : getHilbertKey(x, y, z);
+    });
+}
+
+bool SpatialSorter::sort(std::string const& inputFile, std::string const& outputFile, KeyFunction const& key)
+{
+    _runCount = 0;
+
+    Reader reader(inputFile);
+    if (!reader.open())
+        return false;
+
+    Header header(reader.getHeader());
+    const size_t recordLength = header.getDataRecordLength();
+    const uint64_t pointCount = header.getPointRecordsCount();
+    if (pointCount > 0xFFFFFFFFULL)
+        throw libhsl_error("too many points to sort");
+    const uint32_t count = static_cast<uint32_t>(pointCount);
+
+    PointBlock block(&header, SortReadBlockSize);
+
+    // waveforms travel with their points only when they are stored in this file
+    const bool hasWaveform = header.hasWaveformData() && header.isInternalWaveformData();
+    size_t waveformOffsetPos = 0;
+    size_t waveformSizePos = 0;
+    FILE* wfp = nullptr;
+    if (hasWaveform)
+    {
+        waveformOffsetPos = header.getSchema().getFieldById(FI_ByteOffsetToWaveformData)->getByteOffset();
+        waveformSizePos = header.getSchema().getFieldById(FI_WaveformDataSize)->getByteOffset();
+        wfp = fopen(inputFile.c_str(), "rb");
+        if (wfp == nullptr)
+            return false;
+    }
+    std::shared_ptr<FILE> waveformFile(wfp, [](FILE* fp) { if (fp != nullptr) fclose(fp); });
+
+    TempFiles temps;
+    std::string tempBase = _tempName.empty() ? outputFile : _tempName;
+    temps.names.push_back(tempBase + ".run0.tmp");
+    temps.names.push_back(tempBase + ".run1.tmp");
+
+    std::vector<SortRun> runs;
+    FILE* runFile = nullptr;
+    std::shared_ptr<FILE> runFileGuard;
+
+    std::vector<RunItem> items;
+    std::vector<uint8_t> waveforms;
+    block.clear();
+
+    // flushes the in-memory run to the temporary file
+    auto spill = [&]() {
+        if (items.empty())
+            return;
+        if (runFile == nullptr)
+        {
+            runFile = fopen(temps.names[0].c_str(), "wb");
+            if (runFile == nullptr)
+                throw libhsl_error("cannot create temporary sort file " + temps.names[0]);
+            runFileGuard.reset(runFile, [](FILE* fp) { fclose(fp); });
+        }
+
+        std::sort(items.begin(), items.end());
+        SortRun run;
+        run.offset = detail::tell64(runFile);
+        run.count = items.size();
+        for (size_t i = 0; i < items.size(); ++i)
+        {
+            RunItem const& item = items[i];
+            const uint8_t* wf = item.waveformSize > 0 ? &waveforms[item.waveformOffset] : nullptr;
+            if (!writeEntry(runFile, item.key, block.getId(item.index), block.getRecord(item.index),
+                    recordLength, wf, item.waveformSize))
+                throw libhsl_error("cannot write temporary sort file");
+        }
+        runs.push_back(run);
+
+        items.clear();
+        waveforms.clear();
+        block.clear();
+    };
+
+    for (uint32_t first = 0; first < count; first += SortReadBlockSize)
+    {
+        size_t start = block.size();
+        uint32_t n = (std::min)(SortReadBlockSize, count - first);
+        if (!reader.readPointRange(first, n, block))
+            return false;
+
+        for (size_t j = start; j < block.size(); ++j)
+        {
+            RunItem item;
+            item.key = key(block, j);
+            item.index = static_cast<uint32_t>(j);
+            item.waveformSize = 0;
+            item.waveformOffset = waveforms.size();
+
+            if (hasWaveform)
+            {
+                uint64_t offset;
+                uint32_t size;
+                std::memcpy(&offset, block.getRecord(j) + waveformOffsetPos, sizeof(offset));
+                std::memcpy(&size, block.getRecord(j) + waveformSizePos, sizeof(size));
+                if (size > 0)
+                {
+                    waveforms.resize(item.waveformOffset + size);
+                    if (detail::seek64(wfp, offset, SEEK_SET) != 0 ||
+                        fread(&waveforms[item.waveformOffset], size, 1, wfp) != 1)
+                        throw libhsl_error("cannot read waveform data of the point to sort");
+                    item.waveformSize = size;
+                }
+            }
+
+            items.push_back(item);
+        }
+
+        size_t used = block.getData().size() + waveforms.size() + items.size() * (sizeof(RunItem) + sizeof(uint32_t));
+        if (used >= _maxMemory)
+            spill();
+    }
+    reader.close();
+
+    Header outHeader(header);
+    Writer writer(outputFile, outHeader);
+    writer.setChunkSize(_chunkSize);
+    if (!writer.open())
+        return false;
+    WriterSink sink(writer);
+
+    if (runs.empty())
+    {
+        // everything fit in memory, no temporary file needed
+        _runCount = 1;
+        std::sort(items.begin(), items.end());
+        SortEntry e;
+        for (size_t i = 0; i < items.size(); ++i)
+        {
+            RunItem const& item = items[i];
+            e.record.assign(block.getRecord(item.index), block.getRecord(item.index) + recordLength);
+            if (item.waveformSize > 0)
+                e.waveform.assign(&waveforms[item.waveformOffset], &waveforms[item.waveformOffset] + item.waveformSize);
+            else
+                e.waveform.clear();
+            sink(e);
+        }
+        writer.close();
+        return !writer.hasChunkTableError();
+    }
+
+    spill();
+    runFileGuard.reset();
+    runFile = nullptr;
+    _runCount = static_cast<uint32_t>(runs.size());
+
+    // merge passes until the remaining runs can be merged at once
+    int current = 0;
+    while (runs.size() > SortMaxFanIn)
+    {
+        int next = 1 - current;
+        FILE* out = fopen(temps.names[next].c_str(), "wb");
+        if (out == nullptr)
+            throw libhsl_error("cannot create temporary sort file " + temps.names[next]);
+        std::shared_ptr<FILE> outGuard(out, [](FILE* fp) { fclose(fp); });
+
+        std::vector<SortRun> merged;
+        for (size_t first = 0; first < runs.size(); first += SortMaxFanIn)
+        {
+            size_t last = (std::min)(first + SortMaxFanIn, runs.size());
+            SortRun run;
+            run.offset = detail::tell64(out);
+            RunFileSink runSink(out, recordLength);
+            mergeRuns(temps.names[current], runs, first, last, recordLength, _maxMemory, runSink);
+            run.count = runSink.count;
+            merged.push_back(run);
+        }
+
+        runs.swap(merged);
+        current = next;
+    }
+
+    mergeRuns(temps.names[current], runs, 0, runs.size(), recordLength, _maxMemory, sink);
+    writer.close();
+
+    return !writer.hasChunkTableError();
+}
+
+}
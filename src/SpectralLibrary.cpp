@@ -0,0 +1,319 @@
+/*************************************************************************************
+ * 
+ * 
+ * Copyright (c) 2021, Zhengjun Liu <zjliu@casm.ac.cn>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ ************************************************************************************/
+
+#include "SpectralLibrary.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+namespace hsl
+{
+
+namespace
+{
+
+// points compared with the signatures at a time
+const size_t kTileSize = 64;
+
+// band values are clamped to this for the information divergence, which
+// takes their logarithm
+const double kMinimumValue = 1e-12;
+
+}
+
+SpectralLibrary::SpectralLibrary(size_t bands)
+    : m_bands(bands)
+{
+    if (bands == 0)
+        throw std::invalid_argument("a spectral library needs at least one band");
+}
+
+void SpectralLibrary::add(SpectralSignature const& signature)
+{
+    std::vector<double> const& r = signature.values;
+    if (r.size() != m_bands)
+        throw std::invalid_argument("signature " + signature.name + " does not have one value per band");
+
+    double norm = 0.0;
+    double sum = 0.0;
+    double clamped = 0.0;
+    bool positive = false;
+    for (size_t b = 0; b < m_bands; ++b)
+    {
+        norm += r[b] * r[b];
+        sum += r[b];
+        clamped += (std::max)(r[b], kMinimumValue);
+        positive = positive || r[b] > 0.0;
+    }
+    if (!positive)
+        throw std::invalid_argument("signature " + signature.name + " has no positive value");
+    norm = std::sqrt(norm);
+
+    const double mean = sum / static_cast<double>(m_bands);
+    double spread = 0.0;
+    for (size_t b = 0; b < m_bands; ++b)
+        spread += (r[b] - mean) * (r[b] - mean);
+    spread = std::sqrt(spread);
+
+    for (size_t b = 0; b < m_bands; ++b)
+    {
+        const double q = (std::max)(r[b], kMinimumValue) / clamped;
+        m_unit.push_back(r[b] / norm);
+        m_centred.push_back(spread > 0.0 ? (r[b] - mean) / spread : 0.0);
+        m_distribution.push_back(q);
+        m_logDistribution.push_back(std::log(q));
+    }
+
+    const size_t first = m_signatures.size() * m_bands;
+    m_unitSingle.insert(m_unitSingle.end(), m_unit.begin() + first, m_unit.end());
+    m_centredSingle.insert(m_centredSingle.end(), m_centred.begin() + first, m_centred.end());
+    m_signatures.push_back(signature);
+}
+
+bool SpectralLibrary::isBetter(SpectralMetric metric, double a, double b)
+{
+    return metric == SM_Correlation ? a > b : a < b;
+}
+
+double SpectralLibrary::score(const double* x, size_t i, SpectralMetric metric) const
+{
+    const size_t n = m_bands;
+    switch (metric)
+    {
+    case SM_Angle:
+        {
+            const double* u = &m_unit[i * n];
+            double dot = 0.0;
+            double norm = 0.0;
+            for (size_t b = 0; b < n; ++b)
+            {
+                dot += x[b] * u[b];
+                norm += x[b] * x[b];
+            }
+            if (!(norm > 0.0))
+                return std::numeric_limits<double>::quiet_NaN();
+            return std::acos((std::max)(-1.0, (std::min)(1.0, dot / std::sqrt(norm))));
+        }
+    case SM_Correlation:
+        {
+            const double* u = &m_centred[i * n];
+            double sum = 0.0;
+            for (size_t b = 0; b < n; ++b)
+                sum += x[b];
+            const double mean = sum / static_cast<double>(n);
+            double dot = 0.0;
+            double spread = 0.0;
+            for (size_t b = 0; b < n; ++b)
+            {
+                dot += (x[b] - mean) * u[b];
+                spread += (x[b] - mean) * (x[b] - mean);
+            }
+            if (!(spread > 0.0))
+                return std::numeric_limits<double>::quiet_NaN();
+            return dot / std::sqrt(spread);
+        }
+    case SM_InformationDivergence:
+        {
+            const double* q = &m_distribution[i * n];
+            const double* lq = &m_logDistribution[i * n];
+            double total = 0.0;
+            for (size_t b = 0; b < n; ++b)
+                total += (std::max)(x[b], kMinimumValue);
+            double divergence = 0.0;
+            for (size_t b = 0; b < n; ++b)
+            {
+                const double p = (std::max)(x[b], kMinimumValue) / total;
+                divergence += (p - q[b]) * (std::log(p) - lq[b]);
+            }
+            return divergence;
+        }
+    }
+    return std::numeric_limits<double>::quiet_NaN();
+}
+
+void SpectralLibrary::match(const double* columns, size_t stride, size_t n, SpectralMetric metric,
+                            int32_t* best, double* scores) const
+{
+    const size_t bands = m_bands;
+    const size_t count = m_signatures.size();
+    const bool divergence = metric == SM_InformationDivergence;
+    const float* prepared = metric == SM_Angle ? (count ? &m_unitSingle[0] : 0) :
+                            (count ? &m_centredSingle[0] : 0);
+
+    // Bound on the error of a screened cosine: the single precision dot
+    // product of unit vectors is off by at most (bands + 2) epsilon, and
+    // two of them are compared. The divergence is screened in double
+    // precision as a sum of non-negative terms, so its error is relative.
+    const double cosineMargin = 2.0 * static_cast<double>(bands + 2) * std::numeric_limits<float>::epsilon();
+    const double divergenceMargin = 1e-9;
+
+    // a tile of band vectors, band-major, in single precision for the angle
+    // and correlation and as distributions and their logarithms for the
+    // divergence; points past the end of the last tile stay 0
+    std::vector<float> tile(divergence ? 0 : bands * kTileSize);
+    std::vector<double> distributions(divergence ? bands * kTileSize : 0);
+    std::vector<double> logs(divergence ? bands * kTileSize : 0);
+    std::vector<double> screened(count * kTileSize);    // higher is better
+    std::vector<double> x(bands);
+    float dot[kTileSize];
+    double sum[kTileSize];
+    double square[kTileSize];
+    double factor[kTileSize];       // 1 / norm
+    double divergences[kTileSize];
+    double top[kTileSize];
+
+    for (size_t first = 0; first < n; first += kTileSize)
+    {
+        const size_t t = (std::min)(kTileSize, n - first);
+        const double* in = columns + first;
+
+        // per point sums, then the tile
+        std::fill(sum, sum + kTileSize, 0.0);
+        std::fill(square, square + kTileSize, 0.0);
+        for (size_t b = 0; b < bands; ++b)
+        {
+            const double* v = in + b * stride;
+            for (size_t p = 0; p < t; ++p)
+            {
+                const double value = divergence ? (std::max)(v[p], kMinimumValue) : v[p];
+                sum[p] += value;
+                square[p] += value * value;
+            }
+        }
+        for (size_t p = 0; p < kTileSize; ++p)
+        {
+            const double mean = sum[p] / static_cast<double>(bands);
+            factor[p] = 0.0;
+            if (p >= t || divergence)
+                continue;
+            const double norm = metric == SM_Angle ? square[p] : square[p] - sum[p] * mean;
+            if (norm > 0.0)
+                factor[p] = 1.0 / std::sqrt(norm);
+        }
+        for (size_t b = 0; b < bands; ++b)
+        {
+            const double* v = in + b * stride;
+            if (divergence)
+            {
+                double* row = &distributions[b * kTileSize];
+                double* logRow = &logs[b * kTileSize];
+                for (size_t p = 0; p < t; ++p)
+                {
+                    row[p] = (std::max)(v[p], kMinimumValue) / sum[p];
+                    logRow[p] = std::log(row[p]);
+                }
+                std::fill(row + t, row + kTileSize, 0.0);
+                std::fill(logRow + t, logRow + kTileSize, 0.0);
+                continue;
+            }
+
+            float* row = &tile[b * kTileSize];
+            for (size_t p = 0; p < t; ++p)
+            {
+                if (metric == SM_Angle)
+                    row[p] = static_cast<float>(v[p]);
+                else
+                    row[p] = static_cast<float>(v[p] - sum[p] / static_cast<double>(bands));
+            }
+            std::fill(row + t, row + kTileSize, 0.0f);
+        }
+
+        // screen every signature against the tile
+        std::fill(top, top + kTileSize, -std::numeric_limits<double>::infinity());
+        for (size_t s = 0; s < count; ++s)
+        {
+            double* value = &screened[s * kTileSize];
+            if (divergence)
+            {
+                std::fill(divergences, divergences + kTileSize, 0.0);
+                const double* q = &m_distribution[s * bands];
+                const double* lq = &m_logDistribution[s * bands];
+                for (size_t b = 0; b < bands; ++b)
+                {
+                    const double w = q[b];
+                    const double lw = lq[b];
+                    const double* v = &distributions[b * kTileSize];
+                    const double* lv = &logs[b * kTileSize];
+                    for (size_t p = 0; p < kTileSize; ++p)
+                        divergences[p] += (v[p] - w) * (lv[p] - lw);
+                }
+                for (size_t p = 0; p < t; ++p)
+                    value[p] = -divergences[p];
+            }
+            else
+            {
+                std::fill(dot, dot + kTileSize, 0.0f);
+                const float* r = prepared + s * bands;
+                for (size_t b = 0; b < bands; ++b)
+                {
+                    const float w = r[b];
+                    const float* v = &tile[b * kTileSize];
+                    for (size_t p = 0; p < kTileSize; ++p)
+                        dot[p] += w * v[p];
+                }
+                for (size_t p = 0; p < t; ++p)
+                {
+                    value[p] = factor[p] > 0.0 ? dot[p] * factor[p]
+                                               : -std::numeric_limits<double>::infinity();
+                }
+            }
+            for (size_t p = 0; p < t; ++p)
+                top[p] = (std::max)(top[p], value[p]);
+        }
+
+        // the signatures screened within the error bound of the best are
+        // candidates, ranked by their exact score
+        for (size_t p = 0; p < t; ++p)
+        {
+            best[first + p] = -1;
+            scores[first + p] = std::numeric_limits<double>::quiet_NaN();
+            if (!(top[p] > -std::numeric_limits<double>::infinity()))
+                continue;
+            const double margin = divergence ? divergenceMargin * (1.0 - top[p]) : cosineMargin;
+            const double threshold = top[p] - margin;
+
+            for (size_t b = 0; b < bands; ++b)
+                x[b] = in[b * stride + p];
+            for (size_t s = 0; s < count; ++s)
+            {
+                if (screened[s * kTileSize + p] < threshold)
+                    continue;
+                const double exact = score(&x[0], s, metric);
+                if (best[first + p] < 0 || isBetter(metric, exact, scores[first + p]))
+                {
+                    best[first + p] = static_cast<int32_t>(s);
+                    scores[first + p] = exact;
+                }
+            }
+        }
+    }
+}
+
+}
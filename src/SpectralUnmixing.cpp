@@ -0,0 +1,522 @@
+/*************************************************************************************
+ * 
+ * 
+ * Copyright (c) 2021, Zhengjun Liu <zjliu@casm.ac.cn>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ ************************************************************************************/
+#include "SpectralUnmixing.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include "Field.h"
+#include "Schema.h"
+#include "PointBlock.h"
+#include "Reader.h"
+#include "Writer.h"
+#include "Exception.h"
+
+namespace hsl
+{
+
+namespace
+{
+
+/// Replaces the symmetric n x n matrix a (row-major) by its Cholesky factor
+/// in the lower triangle. False if a is not positive definite, a pivot
+/// falling below 1e-12 of the largest diagonal element.
+bool cholesky(double* a, size_t n)
+{
+    double largest = 0.0;
+    for (size_t i = 0; i < n; ++i)
+        largest = std::max(largest, a[i * n + i]);
+
+    for (size_t j = 0; j < n; ++j)
+    {
+        double pivot = a[j * n + j];
+        for (size_t k = 0; k < j; ++k)
+            pivot -= a[j * n + k] * a[j * n + k];
+        if (!(pivot > 1e-12 * largest))
+            return false;
+        pivot = std::sqrt(pivot);
+        a[j * n + j] = pivot;
+
+        for (size_t i = j + 1; i < n; ++i)
+        {
+            double sum = a[i * n + j];
+            for (size_t k = 0; k < j; ++k)
+                sum -= a[i * n + k] * a[j * n + k];
+            a[i * n + j] = sum / pivot;
+        }
+    }
+    return true;
+}
+
+/// Solves L L' x = rhs in place, with L from cholesky().
+void choleskySolve(const double* l, size_t n, double* x)
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        double sum = x[i];
+        for (size_t k = 0; k < i; ++k)
+            sum -= l[i * n + k] * x[k];
+        x[i] = sum / l[i * n + i];
+    }
+    for (size_t i = n; i-- > 0;)
+    {
+        double sum = x[i];
+        for (size_t k = i + 1; k < n; ++k)
+            sum -= l[k * n + i] * x[k];
+        x[i] = sum / l[i * n + i];
+    }
+}
+
+/// Buffers of the active set method for n endmembers.
+struct ActiveSet
+{
+    std::vector<size_t> passive;
+    std::vector<char> inPassive;
+    std::vector<double> factor;
+    std::vector<double> y;
+    std::vector<double> c;
+    std::vector<double> z;
+    std::vector<double> gradient;
+
+    explicit ActiveSet(size_t n)
+        : inPassive(n), factor(n * n), y(n), c(n), z(n), gradient(n)
+    {
+        passive.reserve(n);
+    }
+};
+
+/// Least squares abundances z of the passive endmembers, the others held at
+/// zero, summing to one if sumToOne. False if the passive endmembers are
+/// linearly dependent.
+bool solvePassive(const double* gram, const double* b, size_t n, bool sumToOne, ActiveSet& s)
+{
+    const size_t m = s.passive.size();
+    for (size_t i = 0; i < m; ++i)
+    {
+        for (size_t j = 0; j < m; ++j)
+            s.factor[i * m + j] = gram[s.passive[i] * n + s.passive[j]];
+        s.y[i] = b[s.passive[i]];
+        s.c[i] = 1.0;
+    }
+    if (!cholesky(&s.factor[0], m))
+        return false;
+
+    choleskySolve(&s.factor[0], m, &s.y[0]);
+    if (sumToOne)
+    {
+        choleskySolve(&s.factor[0], m, &s.c[0]);
+        double sumY = 0.0;
+        double sumC = 0.0;
+        for (size_t i = 0; i < m; ++i)
+        {
+            sumY += s.y[i];
+            sumC += s.c[i];
+        }
+        const double shift = (1.0 - sumY) / sumC;
+        for (size_t i = 0; i < m; ++i)
+            s.y[i] += shift * s.c[i];
+    }
+
+    std::fill(s.z.begin(), s.z.end(), 0.0);
+    for (size_t i = 0; i < m; ++i)
+        s.z[s.passive[i]] = s.y[i];
+    return true;
+}
+
+/// Minimizes a'Ga / 2 - b'a over a >= 0, with the abundances summing to one
+/// if sumToOne, by the active set method of Lawson and Hanson. With the sum
+/// constrained, the multiplier of the sum is minus the gradient on the
+/// passive set, and an endmember enters where the gradient is lower.
+void solveActiveSet(const double* gram, const double* b, size_t n, bool sumToOne, double* a, ActiveSet& s)
+{
+    std::fill(a, a + n, 0.0);
+    std::fill(s.inPassive.begin(), s.inPassive.end(), 0);
+    s.passive.clear();
+
+    double scale = 0.0;
+    for (size_t j = 0; j < n; ++j)
+        scale = std::max(scale, std::max(gram[j * n + j], std::fabs(b[j])));
+    const double tolerance = 1e-12 * scale;
+
+    if (sumToOne)
+    {
+        // start from the endmember closest to the point
+        size_t closest = 0;
+        for (size_t j = 1; j < n; ++j)
+        {
+            if (0.5 * gram[j * n + j] - b[j] < 0.5 * gram[closest * n + closest] - b[closest])
+                closest = j;
+        }
+        a[closest] = 1.0;
+        s.inPassive[closest] = 1;
+        s.passive.push_back(closest);
+    }
+
+    for (size_t iteration = 0; iteration < 3 * n; ++iteration)
+    {
+        for (size_t i = 0; i < n; ++i)
+        {
+            double sum = -b[i];
+            for (size_t j = 0; j < n; ++j)
+                sum += gram[i * n + j] * a[j];
+            s.gradient[i] = sum;
+        }
+        double multiplier = 0.0;
+        if (sumToOne)
+        {
+            for (size_t i = 0; i < s.passive.size(); ++i)
+                multiplier -= s.gradient[s.passive[i]];
+            multiplier /= static_cast<double>(s.passive.size());
+        }
+
+        size_t entering = n;
+        double steepest = tolerance;
+        for (size_t j = 0; j < n; ++j)
+        {
+            const double descent = -(s.gradient[j] + multiplier);
+            if (!s.inPassive[j] && descent > steepest)
+            {
+                entering = j;
+                steepest = descent;
+            }
+        }
+        if (entering == n)
+            break;
+        s.inPassive[entering] = 1;
+        s.passive.push_back(entering);
+
+        for (size_t inner = 0; inner < 3 * n; ++inner)
+        {
+            if (!solvePassive(gram, b, n, sumToOne, s))
+            {
+                s.inPassive[entering] = 0;
+                s.passive.erase(std::find(s.passive.begin(), s.passive.end(), entering));
+                return;
+            }
+
+            // step towards z as far as the abundances stay positive
+            double step = 1.0;
+            size_t blocking = n;
+            for (size_t i = 0; i < s.passive.size(); ++i)
+            {
+                const size_t k = s.passive[i];
+                if (s.z[k] <= 0.0 && a[k] / (a[k] - s.z[k]) < step)
+                {
+                    step = a[k] / (a[k] - s.z[k]);
+                    blocking = k;
+                }
+            }
+            for (size_t i = 0; i < s.passive.size(); ++i)
+            {
+                const size_t k = s.passive[i];
+                a[k] += step * (s.z[k] - a[k]);
+            }
+            if (blocking == n)
+                break;
+
+            a[blocking] = 0.0;
+            size_t kept = 0;
+            for (size_t i = 0; i < s.passive.size(); ++i)
+            {
+                const size_t k = s.passive[i];
+                if (a[k] > 0.0)
+                    s.passive[kept++] = k;
+                else
+                {
+                    a[k] = 0.0;
+                    s.inPassive[k] = 0;
+                }
+            }
+            s.passive.resize(kept);
+        }
+    }
+}
+
+}
+
+SpectralUnmixer::SpectralUnmixer(std::vector<SpectralSignature> const& endmembers, UnmixingConstraint constraint)
+    : m_constraint(constraint), m_bands(0)
+{
+    if (endmembers.empty())
+        throw std::invalid_argument("SpectralUnmixer: no endmembers");
+    m_bands = endmembers[0].values.size();
+    const size_t count = endmembers.size();
+    if (count > m_bands)
+        throw std::invalid_argument("SpectralUnmixer: more endmembers than bands");
+
+    m_names.resize(count);
+    m_endmembers.resize(count * m_bands);
+    for (size_t k = 0; k < count; ++k)
+    {
+        if (endmembers[k].values.size() != m_bands)
+            throw std::invalid_argument("SpectralUnmixer: the endmember spectra differ in length");
+        m_names[k] = endmembers[k].name;
+        std::copy(endmembers[k].values.begin(), endmembers[k].values.end(), &m_endmembers[k * m_bands]);
+    }
+
+    m_gram.assign(count * count, 0.0);
+    for (size_t i = 0; i < count; ++i)
+    {
+        for (size_t j = i; j < count; ++j)
+        {
+            const double* ei = &m_endmembers[i * m_bands];
+            const double* ej = &m_endmembers[j * m_bands];
+            double sum = 0.0;
+            for (size_t b = 0; b < m_bands; ++b)
+                sum += ei[b] * ej[b];
+            m_gram[i * count + j] = m_gram[j * count + i] = sum;
+        }
+    }
+
+    std::vector<double> factor(m_gram);
+    if (!cholesky(&factor[0], count))
+        throw std::invalid_argument("SpectralUnmixer: the endmember spectra are linearly dependent");
+
+    m_inverse.assign(count * count, 0.0);
+    std::vector<double> column(count);
+    for (size_t j = 0; j < count; ++j)
+    {
+        std::fill(column.begin(), column.end(), 0.0);
+        column[j] = 1.0;
+        choleskySolve(&factor[0], count, &column[0]);
+        for (size_t i = 0; i < count; ++i)
+            m_inverse[i * count + j] = column[i];
+    }
+
+    m_correction.assign(count, 1.0);
+    choleskySolve(&factor[0], count, &m_correction[0]);
+    double sum = 0.0;
+    for (size_t k = 0; k < count; ++k)
+        sum += m_correction[k];
+    for (size_t k = 0; k < count; ++k)
+        m_correction[k] /= sum;
+}
+
+void SpectralUnmixer::unmix(const double* columns, size_t stride, size_t n, double* abundances,
+                            double* residuals) const
+{
+    if (n == 0)
+        return;
+    const size_t count = m_names.size();
+
+    // E'x of every point, then (E'E)^-1 E'x, as weighted sums of columns
+    // along the points
+    std::vector<double> projected(count * n, 0.0);
+    for (size_t k = 0; k < count; ++k)
+    {
+        const double* e = &m_endmembers[k * m_bands];
+        double* row = &projected[k * n];
+        for (size_t b = 0; b < m_bands; ++b)
+        {
+            const double weight = e[b];
+            const double* column = columns + b * stride;
+            for (size_t p = 0; p < n; ++p)
+                row[p] += weight * column[p];
+        }
+    }
+    std::fill(abundances, abundances + count * n, 0.0);
+    for (size_t k = 0; k < count; ++k)
+    {
+        double* row = abundances + k * n;
+        for (size_t j = 0; j < count; ++j)
+        {
+            const double weight = m_inverse[k * count + j];
+            const double* column = &projected[j * n];
+            for (size_t p = 0; p < n; ++p)
+                row[p] += weight * column[p];
+        }
+    }
+
+    const bool sumToOne = m_constraint == UC_SumToOne || m_constraint == UC_Full;
+    if (sumToOne)
+    {
+        std::vector<double> deficit(n, 1.0);
+        for (size_t k = 0; k < count; ++k)
+        {
+            const double* row = abundances + k * n;
+            for (size_t p = 0; p < n; ++p)
+                deficit[p] -= row[p];
+        }
+        for (size_t k = 0; k < count; ++k)
+        {
+            const double weight = m_correction[k];
+            double* row = abundances + k * n;
+            for (size_t p = 0; p < n; ++p)
+                row[p] += weight * deficit[p];
+        }
+    }
+
+    // the constrained solution is the unconstrained one wherever that has
+    // no negative abundance, which is most points for well chosen endmembers
+    if (m_constraint == UC_NonNegative || m_constraint == UC_Full)
+    {
+        ActiveSet set(count);
+        std::vector<double> b(count);
+        std::vector<double> a(count);
+        for (size_t p = 0; p < n; ++p)
+        {
+            bool negative = false;
+            for (size_t k = 0; k < count; ++k)
+                negative = negative || abundances[k * n + p] < 0.0;
+            if (!negative)
+                continue;
+
+            for (size_t k = 0; k < count; ++k)
+                b[k] = projected[k * n + p];
+            solveActiveSet(&m_gram[0], &b[0], count, sumToOne, &a[0], set);
+            for (size_t k = 0; k < count; ++k)
+                abundances[k * n + p] = a[k];
+        }
+    }
+
+    if (residuals)
+    {
+        std::vector<double> residual(n);
+        std::fill(residuals, residuals + n, 0.0);
+        for (size_t b = 0; b < m_bands; ++b)
+        {
+            const double* column = columns + b * stride;
+            std::copy(column, column + n, residual.begin());
+            for (size_t k = 0; k < count; ++k)
+            {
+                const double weight = m_endmembers[k * m_bands + b];
+                const double* row = abundances + k * n;
+                for (size_t p = 0; p < n; ++p)
+                    residual[p] -= weight * row[p];
+            }
+            for (size_t p = 0; p < n; ++p)
+                residuals[p] += residual[p] * residual[p];
+        }
+        for (size_t p = 0; p < n; ++p)
+            residuals[p] = std::sqrt(residuals[p] / static_cast<double>(m_bands));
+    }
+}
+
+void SpectralUnmixer::unmix(const double* bands, double* abundances) const
+{
+    unmix(bands, 1, 1, abundances);
+}
+
+Header SpectralUnmixer::createHeader(Header const& header) const
+{
+    Header unmixed(header);
+    Schema& schema = unmixed.getSchema();
+    size_t index = 0;
+    while (schema.getNthIndex(FI_ByteOffsetToWaveformData, 0, index) && schema.removeField(index))
+        ;
+    while (schema.getNthIndex(FI_WaveformDataSize, 0, index) && schema.removeField(index))
+        ;
+    while (schema.getNthIndex(FI_Abundance, 0, index) && schema.removeField(index))
+        ;
+
+    for (size_t k = 0; k < m_names.size(); ++k)
+    {
+        Field abundance(FI_Abundance, "Abundance", DT_FLOAT, 32);
+        abundance.setDescription(m_names[k].substr(0, FIELD_DESCRIPTION_LENGTH - 1));
+        abundance.isRequired(false);
+        abundance.isActive(true);
+        abundance.isNumeric(true);
+        abundance.isScaled(false);
+        abundance.isOffseted(false);
+        schema.addField(abundance);
+    }
+    schema.calculateSizes();
+    return unmixed;
+}
+
+namespace
+{
+
+std::vector<FieldId> unmixedFields()
+{
+    std::vector<FieldId> ids;
+    ids.push_back(FI_Abundance);
+    ids.push_back(FI_ByteOffsetToWaveformData);
+    ids.push_back(FI_WaveformDataSize);
+    return ids;
+}
+
+}
+
+SpectralUnmixingStage::SpectralUnmixingStage(SpectralUnmixer const& unmixer, Header const& source, Header const& target)
+    : SchemaStage(source, target, unmixedFields()), m_unmixer(unmixer)
+{
+    Schema const& from = source.getSchema();
+    Schema const& to = target.getSchema();
+
+    m_bands.resize(unmixer.getBandCount());
+    for (size_t b = 0; b < m_bands.size(); ++b)
+    {
+        if (!m_bands[b].bind(from, FI_BandValue, b))
+            throw std::invalid_argument("the points do not have the bands of the endmembers");
+    }
+    m_abundances.resize(unmixer.getEndmemberCount());
+    for (size_t k = 0; k < m_abundances.size(); ++k)
+    {
+        if (!m_abundances[k].bind(to, FI_Abundance, k))
+            throw std::invalid_argument("the output has fewer abundance fields than endmembers");
+    }
+}
+
+void SpectralUnmixingStage::prepare(size_t workers)
+{
+    SchemaStage::prepare(workers);
+    m_scratch.assign(workers, Scratch());
+}
+
+void SpectralUnmixingStage::rewrite(PointBlock const& in, PointBlock& out, size_t worker)
+{
+    Scratch& scratch = m_scratch[worker];
+    const size_t n = in.size();
+    const uint8_t* records = in.getRecord(0);
+    const size_t stride = in.getRecordLength();
+
+    std::vector<double>& x = scratch.bands;
+    x.resize(m_bands.size() * n);
+    for (size_t b = 0; b < m_bands.size(); ++b)
+        m_bands[b].gather(records, stride, n, &x[b * n]);
+
+    std::vector<double>& values = scratch.abundances;
+    values.resize(m_abundances.size() * n);
+    m_unmixer.unmix(&x[0], n, n, &values[0]);
+    for (size_t k = 0; k < m_abundances.size(); ++k)
+        m_abundances[k].scatter(out.getRecord(0), out.getRecordLength(), n, &values[k * n]);
+}
+
+uint64_t unmixBands(Reader& reader, Writer& writer, SpectralUnmixer const& unmixer, size_t concurrency)
+{
+    if (writer.getHeader().hasWaveformData())
+        throw libhsl_error("the output of spectral unmixing cannot carry waveform data");
+
+    Pipeline pipeline(reader, writer);
+    pipeline.setConcurrency(concurrency);
+    pipeline.addStage(PipelineStagePtr(new SpectralUnmixingStage(unmixer, reader.getHeader(), writer.getHeader())));
+    return pipeline.run();
+}
+
+}
@@ -0,0 +1,605 @@
+/*************************************************************************************
+ * 
+ * 
+ * Copyright (c) 2021, Zhengjun Liu <zjliu@casm.ac.cn>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ ************************************************************************************/
+
+#include "Statistics.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include "Header.h"
+#include "Schema.h"
+#include "Field.h"
+#include "PointBlock.h"
+#include "Reader.h"
+#include "Pipeline.h"
+#include "Exception.h"
+
+namespace hsl
+{
+
+namespace
+{
+
+// bins are addressed by int64_t grid indices; keep them exact in a double
+const double kIndexLimit = 4503599627370496.0;     // 2^52
+
+// bins of a histogram of non integral values start out 2^-30 as wide as
+// the first value
+const int kFloatStart = 30;
+
+inline int64_t floorHalf(int64_t v)
+{
+    return v >= 0 ? v / 2 : -((1 - v) / 2);
+}
+
+}
+
+Histogram::Histogram(size_t bins, bool integral)
+    : _integral(integral), _counts((std::max)(bins, size_t(2)), 0)
+{
+    clear();
+}
+
+void Histogram::clear()
+{
+    _exponent = 0;
+    _first = _low = _high = 0;
+    _total = 0;
+    std::fill(_counts.begin(), _counts.end(), 0);
+}
+
+void Histogram::add(const double* values, size_t n)
+{
+    const int64_t size = static_cast<int64_t>(_counts.size());
+    double inverse = std::ldexp(1.0, -_exponent);
+    for (size_t i = 0; i < n; ++i)
+    {
+        const double v = values[i];
+        if (std::isnan(v))
+            continue;
+
+        // the common case: the value falls into one of the bins
+        const double s = std::floor(v * inverse);
+        if (_total > 0 && s >= static_cast<double>(_first) && s < static_cast<double>(_first + size))
+        {
+            const int64_t j = static_cast<int64_t>(s);
+            ++_counts[static_cast<size_t>(j - _first)];
+            ++_total;
+            _low = (std::min)(_low, j);
+            _high = (std::max)(_high, j);
+        }
+        else
+        {
+            insert(v);
+            inverse = std::ldexp(1.0, -_exponent);
+        }
+    }
+}
+
+void Histogram::insert(double value)
+{
+    const int64_t size = static_cast<int64_t>(_counts.size());
+    if (_total == 0)
+    {
+        _exponent = 0;
+        if (!_integral)
+        {
+            _exponent = -kFloatStart;
+            if (std::fpclassify(value) != FP_ZERO)
+                _exponent += std::ilogb(value);
+        }
+        double s = std::floor(std::ldexp(value, -_exponent));
+        while (std::fabs(s) >= kIndexLimit)
+            s = std::floor(std::ldexp(value, -++_exponent));
+
+        _first = _low = _high = static_cast<int64_t>(s);
+        _counts[0] = 1;
+        _total = 1;
+        return;
+    }
+
+    int64_t j = 0;
+    for (;;)
+    {
+        const double s = std::floor(std::ldexp(value, -_exponent));
+        if (std::fabs(s) < kIndexLimit)
+        {
+            j = static_cast<int64_t>(s);
+            if ((std::max)(_high, j) - (std::min)(_low, j) < size)
+                break;
+        }
+        coarsen();
+    }
+
+    if (j < _first)
+        rebase(j);
+    else if (j >= _first + size)
+        rebase(j - size + 1);
+    ++_counts[static_cast<size_t>(j - _first)];
+    ++_total;
+    _low = (std::min)(_low, j);
+    _high = (std::max)(_high, j);
+}
+
+void Histogram::coarsen()
+{
+    const size_t size = _counts.size();
+    const int64_t first = floorHalf(_first);
+    std::vector<uint64_t> counts(size, 0);
+    for (size_t i = 0; i < size; ++i)
+    {
+        if (_counts[i])
+            counts[static_cast<size_t>(floorHalf(_first + static_cast<int64_t>(i)) - first)] += _counts[i];
+    }
+    _counts.swap(counts);
+    _first = first;
+    _low = floorHalf(_low);
+    _high = floorHalf(_high);
+    ++_exponent;
+}
+
+void Histogram::rebase(int64_t first)
+{
+    std::vector<uint64_t> counts(_counts.size(), 0);
+    for (int64_t j = _low; j <= _high; ++j)
+        counts[static_cast<size_t>(j - first)] = _counts[static_cast<size_t>(j - _first)];
+    _counts.swap(counts);
+    _first = first;
+}
+
+void Histogram::merge(Histogram const& other)
+{
+    if (other._counts.size() != _counts.size())
+        throw std::invalid_argument("cannot merge histograms of different bin counts");
+    if (other._total == 0)
+        return;
+    if (_total == 0)
+    {
+        *this = other;
+        return;
+    }
+
+    // bring both to the same width, wide enough for the values of both
+    Histogram b(other);
+    while (_exponent < b._exponent)
+        coarsen();
+    while (b._exponent < _exponent)
+        b.coarsen();
+    const int64_t size = static_cast<int64_t>(_counts.size());
+    while ((std::max)(_high, b._high) - (std::min)(_low, b._low) >= size)
+    {
+        coarsen();
+        b.coarsen();
+    }
+
+    const int64_t low = (std::min)(_low, b._low);
+    if (low != _first)
+        rebase(low);
+    for (int64_t j = b._low; j <= b._high; ++j)
+        _counts[static_cast<size_t>(j - _first)] += b._counts[static_cast<size_t>(j - b._first)];
+    _low = low;
+    _high = (std::max)(_high, b._high);
+    _total += b._total;
+}
+
+double Histogram::getBinWidth() const
+{
+    return std::ldexp(1.0, _exponent);
+}
+
+std::vector<HistogramBin> Histogram::getBins(double scale, double offset) const
+{
+    std::vector<HistogramBin> bins;
+    if (_total == 0)
+        return bins;
+
+    bins.reserve(static_cast<size_t>(_high - _low + 1));
+    for (int64_t j = _low; j <= _high; ++j)
+    {
+        HistogramBin bin;
+        bin.lower = std::ldexp(static_cast<double>(j), _exponent) * scale + offset;
+        bin.upper = std::ldexp(static_cast<double>(j + 1), _exponent) * scale + offset;
+        if (scale < 0.0)
+            std::swap(bin.lower, bin.upper);
+        bin.count = _counts[static_cast<size_t>(j - _first)];
+        bins.push_back(bin);
+    }
+    return bins;
+}
+
+FieldStatistics::FieldStatistics(std::string const& name, FieldAccessor const& accessor, size_t n, size_t bins)
+    : _name(name), _accessor(accessor), _index(n), _count(0),
+      _minimum(std::numeric_limits<double>::infinity()),
+      _maximum(-std::numeric_limits<double>::infinity()),
+      _mean(0.0), _m2(0.0), _moments(true),
+      _histogram(bins, accessor.getDataType() != DT_FLOAT && accessor.getDataType() != DT_DOUBLE)
+{
+}
+
+void FieldStatistics::add(const double* raw, size_t n)
+{
+    // moments of the new values about their own mean, then combined
+    uint64_t count = 0;
+    double minimum = std::numeric_limits<double>::infinity();
+    double maximum = -std::numeric_limits<double>::infinity();
+    double sum = 0.0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        const double v = raw[i];
+        if (std::isnan(v))
+            continue;
+        ++count;
+        minimum = (std::min)(minimum, v);
+        maximum = (std::max)(maximum, v);
+        sum += v;
+    }
+    if (count == 0)
+        return;
+
+    const double mean = sum / static_cast<double>(count);
+    double m2 = 0.0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        const double d = raw[i] - mean;
+        if (!std::isnan(d))
+            m2 += d * d;
+    }
+
+    combine(count, minimum, maximum, mean, m2);
+    _histogram.add(raw, n);
+}
+
+void FieldStatistics::merge(FieldStatistics const& other)
+{
+    if (other._count == 0)
+        return;
+    _moments = _moments && other._moments;
+    combine(other._count, other._minimum, other._maximum, other._mean, other._m2);
+    _histogram.merge(other._histogram);
+}
+
+void FieldStatistics::combine(uint64_t count, double minimum, double maximum, double mean, double m2)
+{
+    const double na = static_cast<double>(_count);
+    const double nb = static_cast<double>(count);
+    const double n = na + nb;
+    const double delta = mean - _mean;
+
+    _mean += delta * nb / n;
+    _m2 += m2 + delta * delta * na * nb / n;
+    _count += count;
+    _minimum = (std::min)(_minimum, minimum);
+    _maximum = (std::max)(_maximum, maximum);
+}
+
+void FieldStatistics::setRange(uint64_t count, double minimum, double maximum)
+{
+    const double scale = _accessor.getScale();
+    const double offset = _accessor.getOffset();
+    double a = (minimum - offset) / scale;
+    double b = (maximum - offset) / scale;
+    _count = count;
+    _minimum = (std::min)(a, b);
+    _maximum = (std::max)(a, b);
+    _mean = 0.0;
+    _m2 = 0.0;
+    _moments = false;
+    _histogram.clear();
+}
+
+double FieldStatistics::getMinimum() const
+{
+    if (_count == 0)
+        return std::numeric_limits<double>::quiet_NaN();
+    const double scale = _accessor.getScale();
+    return (scale < 0.0 ? _maximum : _minimum) * scale + _accessor.getOffset();
+}
+
+double FieldStatistics::getMaximum() const
+{
+    if (_count == 0)
+        return std::numeric_limits<double>::quiet_NaN();
+    const double scale = _accessor.getScale();
+    return (scale < 0.0 ? _minimum : _maximum) * scale + _accessor.getOffset();
+}
+
+double FieldStatistics::getMean() const
+{
+    if (_count == 0 || !_moments)
+        return std::numeric_limits<double>::quiet_NaN();
+    return _mean * _accessor.getScale() + _accessor.getOffset();
+}
+
+double FieldStatistics::getVariance() const
+{
+    if (_count == 0 || !_moments)
+        return std::numeric_limits<double>::quiet_NaN();
+    const double scale = _accessor.getScale();
+    return _m2 / static_cast<double>(_count) * scale * scale;
+}
+
+double FieldStatistics::getStandardDeviation() const
+{
+    return std::sqrt(getVariance());
+}
+
+std::vector<HistogramBin> FieldStatistics::getBins() const
+{
+    return _histogram.getBins(_accessor.getScale(), _accessor.getOffset());
+}
+
+namespace
+{
+
+/// Gives each worker of a Pipeline statistics of its own.
+class StatisticsStage: public PipelineStage
+{
+public:
+    explicit StatisticsStage(Statistics const& prototype) : m_prototype(prototype) {}
+
+    void prepare(size_t workers) { m_parts.assign(workers, m_prototype); }
+    void process(PointBlock& block, size_t worker) { m_parts[worker].add(block); }
+    bool isConcurrent() const { return true; }
+
+    std::vector<Statistics> const& getParts() const { return m_parts; }
+
+private:
+    Statistics m_prototype;
+    std::vector<Statistics> m_parts;
+};
+
+}
+
+Statistics::Statistics()
+    : m_bins(256), m_concurrency(0), m_blockSize(4096),
+      m_header(0), m_headerOnly(false), m_count(0)
+{
+}
+
+StatisticsFieldArray Statistics::getDefaultFields(Header const& header)
+{
+    Schema const& schema = header.getSchema();
+    StatisticsFieldArray fields;
+    std::vector<size_t> seen;
+    for (size_t i = 0; i < schema.getFieldCount(); ++i)
+    {
+        Field field;
+        if (!schema.getField(i, field))
+            continue;
+
+        const FieldId id = field.getId();
+        if (static_cast<size_t>(id) >= seen.size())
+            seen.resize(static_cast<size_t>(id) + 1, 0);
+        const size_t n = seen[id]++;
+        if (id == FI_UNKNOWN || id == FI_ByteOffsetToWaveformData || id == FI_WaveformDataSize)
+            continue;
+
+        FieldAccessor accessor;
+        if (accessor.bind(schema, id, n))
+            fields.push_back(StatisticsField(id, n));
+    }
+    return fields;
+}
+
+void Statistics::setBinCount(size_t bins)
+{
+    if (bins < 2)
+        throw std::invalid_argument("a histogram needs at least 2 bins");
+    m_bins = bins;
+}
+
+void Statistics::reset(Header const& header)
+{
+    Schema const& schema = header.getSchema();
+    StatisticsFieldArray const fields = m_fields.empty() ? getDefaultFields(header) : m_fields;
+
+    m_header = &header;
+    m_headerOnly = false;
+    m_count = 0;
+    m_stats.clear();
+    m_stats.reserve(fields.size());
+    for (StatisticsFieldArray::const_iterator f = fields.begin(); f != fields.end(); ++f)
+    {
+        FieldAccessor accessor;
+        size_t index = 0;
+        Field field;
+        if (!accessor.bind(schema, f->first, f->second) ||
+            !schema.getNthIndex(f->first, f->second, index) || !schema.getField(index, field))
+        {
+            std::ostringstream msg;
+            msg << "cannot summarize field " << f->first << " #" << f->second;
+            throw libhsl_error(msg.str());
+        }
+
+        std::ostringstream name;
+        name << field.getName();
+        if (schema.getFieldCountById(f->first) > 1)
+            name << "[" << f->second << "]";
+        m_stats.push_back(FieldStatistics(name.str(), accessor, f->second, m_bins));
+    }
+
+    m_returnNumber.bind(schema, FI_ReturnNumber);
+    m_classification.bind(schema, FI_Classification);
+    m_returns.clear();
+    m_classes.clear();
+}
+
+void Statistics::tally(FieldAccessor const& accessor, PointBlock const& block,
+                       std::vector<double>& column, std::vector<uint64_t>& counts)
+{
+    const size_t n = block.size();
+    accessor.gatherRaw(block.getRecord(0), block.getRecordLength(), n, &column[0]);
+    for (size_t i = 0; i < n; ++i)
+    {
+        const double v = column[i];
+        if (!(v >= 0.0 && v < 65536.0))
+            continue;
+        const size_t k = static_cast<size_t>(v);
+        if (k >= counts.size())
+            counts.resize(k + 1, 0);
+        ++counts[k];
+    }
+}
+
+void Statistics::add(PointBlock const& block)
+{
+    if (m_header == 0)
+        throw libhsl_error("Statistics::add called before reset");
+    if (block.getHeader() != m_header && block.getHeader()->getSchema() != m_header->getSchema())
+        throw std::invalid_argument("block does not have the schema of the statistics");
+
+    const size_t n = block.size();
+    if (n == 0)
+        return;
+
+    m_column.resize(n);
+    const uint8_t* records = block.getRecord(0);
+    const size_t stride = block.getRecordLength();
+    for (std::vector<FieldStatistics>::iterator s = m_stats.begin(); s != m_stats.end(); ++s)
+    {
+        s->getAccessor().gatherRaw(records, stride, n, &m_column[0]);
+        s->add(&m_column[0], n);
+    }
+
+    if (m_returnNumber.isBound())
+        tally(m_returnNumber, block, m_column, m_returns);
+    if (m_classification.isBound())
+        tally(m_classification, block, m_column, m_classes);
+    m_count += n;
+}
+
+void Statistics::merge(Statistics const& other)
+{
+    if (other.m_header == 0)
+        return;
+    if (m_header == 0)
+    {
+        *this = other;
+        return;
+    }
+    if (other.m_stats.size() != m_stats.size())
+        throw std::invalid_argument("cannot merge statistics of different fields");
+
+    for (size_t i = 0; i < m_stats.size(); ++i)
+    {
+        if (m_stats[i].getId() != other.m_stats[i].getId() || m_stats[i].getIndex() != other.m_stats[i].getIndex())
+            throw std::invalid_argument("cannot merge statistics of different fields");
+        m_stats[i].merge(other.m_stats[i]);
+    }
+
+    if (m_returns.size() < other.m_returns.size())
+        m_returns.resize(other.m_returns.size(), 0);
+    for (size_t k = 0; k < other.m_returns.size(); ++k)
+        m_returns[k] += other.m_returns[k];
+    if (m_classes.size() < other.m_classes.size())
+        m_classes.resize(other.m_classes.size(), 0);
+    for (size_t k = 0; k < other.m_classes.size(); ++k)
+        m_classes[k] += other.m_classes[k];
+
+    m_headerOnly = m_headerOnly || other.m_headerOnly;
+    m_count += other.m_count;
+}
+
+uint64_t Statistics::compute(Reader& reader)
+{
+    reset(reader.getHeader());
+
+    std::shared_ptr<StatisticsStage> stage(new StatisticsStage(*this));
+    Pipeline pipeline(reader, [](PointBlock const&) {});
+    pipeline.setBlockSize(m_blockSize);
+    pipeline.setConcurrency(m_concurrency);
+    pipeline.setPreserveOrder(false);
+    pipeline.addStage(stage);
+    pipeline.run();
+
+    std::vector<Statistics> const& parts = stage->getParts();
+    for (size_t w = 0; w < parts.size(); ++w)
+        merge(parts[w]);
+    return m_count;
+}
+
+void Statistics::computeFromHeader(Reader const& reader)
+{
+    Header const& header = reader.getHeader();
+    reset(header);
+    m_headerOnly = true;
+    m_count = header.getPointRecordsCount();
+
+    ZoneMap const& zones = reader.getZoneMap();
+    std::vector<FieldStatistics> kept;
+    for (std::vector<FieldStatistics>::iterator s = m_stats.begin(); s != m_stats.end(); ++s)
+    {
+        double minimum = std::numeric_limits<double>::infinity();
+        double maximum = -std::numeric_limits<double>::infinity();
+        bool known = zones.getChunkCount() > 0;
+        for (size_t c = 0; c < zones.getChunkCount() && known; ++c)
+        {
+            double lo, hi;
+            known = zones.getRange(c, s->getId(), s->getIndex(), lo, hi);
+            if (known && zones.getChunkBounds()[c].pointCount > 0)
+            {
+                minimum = (std::min)(minimum, lo);
+                maximum = (std::max)(maximum, hi);
+            }
+        }
+        if (!known && (s->getId() == FI_X || s->getId() == FI_Y || s->getId() == FI_Z) && s->getIndex() == 0)
+        {
+            // no zone map: fall back on the extent of the header
+            const int d = s->getId() == FI_X ? 0 : (s->getId() == FI_Y ? 1 : 2);
+            minimum = d == 0 ? header.getMinX() : (d == 1 ? header.getMinY() : header.getMinZ());
+            maximum = d == 0 ? header.getMaxX() : (d == 1 ? header.getMaxY() : header.getMaxZ());
+            known = true;
+        }
+
+        if (known && m_count > 0)
+        {
+            s->setRange(m_count, minimum, maximum);
+            kept.push_back(*s);
+        }
+    }
+    m_stats.swap(kept);
+
+    std::vector<uint64_t> const byReturn = header.getPointRecordsByReturnCount();
+    m_returns.assign(byReturn.size() + 1, 0);
+    for (size_t i = 0; i < byReturn.size(); ++i)
+        m_returns[i + 1] = byReturn[i];
+}
+
+FieldStatistics const* Statistics::findField(FieldId id, size_t n) const
+{
+    for (size_t i = 0; i < m_stats.size(); ++i)
+    {
+        if (m_stats[i].getId() == id && m_stats[i].getIndex() == n)
+            return &m_stats[i];
+    }
+    return 0;
+}
+
+}
@@ -0,0 +1,191 @@
+/*************************************************************************************
+ * 
+ * 
+ * Copyright (c) 2021, Zhengjun Liu <zjliu@casm.ac.cn>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ ************************************************************************************/
+
+#include "ThreadPool.h"
+#include <algorithm>
+#include <exception>
+
+namespace hsl
+{
+
+namespace
+{
+
+/// Ranges of one ThreadPool::parallelFor. Tasks of the pool that start after
+/// the call returned find nothing to claim, so the state is shared with them.
+class RangeClaims
+{
+public:
+    RangeClaims(size_t count, size_t grain, ThreadPool::RangeFunction const& fn)
+        : _count(count), _grain(grain), _fn(fn), _next(0), _busy(0), _failed(false)
+    {
+    }
+
+    /// Processes ranges on behalf of worker until none are left.
+    void work(size_t worker)
+    {
+        size_t begin, end;
+        while (claim(begin, end))
+        {
+            std::exception_ptr error;
+            try
+            {
+                _fn(begin, end, worker);
+            }
+            catch (...)
+            {
+                error = std::current_exception();
+            }
+            release(error);
+        }
+    }
+
+    /// Waits until every claimed range is done and no more will be claimed.
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (_busy > 0 || !(_failed || _next >= _count))
+            _idle.wait(lock);
+        if (_error)
+            std::rethrow_exception(_error);
+    }
+
+private:
+    bool claim(size_t& begin, size_t& end)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_failed || _next >= _count)
+            return false;
+        begin = _next;
+        end = std::min(_count, begin + _grain);
+        _next = end;
+        ++_busy;
+        return true;
+    }
+
+    void release(std::exception_ptr error)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        --_busy;
+        if (error && !_failed)
+        {
+            _failed = true;
+            _error = error;
+        }
+        if (_busy == 0 && (_failed || _next >= _count))
+            _idle.notify_all();
+    }
+
+    const size_t _count;
+    const size_t _grain;
+    ThreadPool::RangeFunction _fn;
+    std::mutex _mutex;
+    std::condition_variable _idle;
+    size_t _next;
+    size_t _busy;
+    bool _failed;
+    std::exception_ptr _error;
+};
+
+}
+
+ThreadPool::ThreadPool(size_t threads)
+    : _stop(false)
+{
+    if (threads == 0)
+        threads = getDefaultSize();
+
+    _threads.reserve(threads);
+    for (size_t i = 0; i < threads; ++i)
+        _threads.push_back(std::thread(&ThreadPool::work, this));
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _ready.notify_all();
+    for (size_t i = 0; i < _threads.size(); ++i)
+        _threads[i].join();
+}
+
+size_t ThreadPool::getDefaultSize()
+{
+    unsigned n = std::thread::hardware_concurrency();
+    return n > 0 ? n : 1;
+}
+
+void ThreadPool::parallelFor(size_t count, size_t grain, RangeFunction const& fn, size_t workers)
+{
+    if (count == 0)
+        return;
+    if (grain == 0)
+        grain = 1;
+    if (workers == 0)
+        workers = size() + 1;
+    workers = std::min(workers, (count + grain - 1) / grain);
+
+    std::shared_ptr<RangeClaims> claims(new RangeClaims(count, grain, fn));
+    for (size_t w = 1; w < workers; ++w)
+        enqueue([claims, w]() { claims->work(w); });
+    claims->work(0);
+    claims->wait();
+}
+
+void ThreadPool::enqueue(std::function<void()> const& task)
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _tasks.push_back(task);
+    }
+    _ready.notify_one();
+}
+
+void ThreadPool::work()
+{
+    for (;;)
+    {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            while (!_stop && _tasks.empty())
+                _ready.wait(lock);
+            if (_tasks.empty())
+                return;
+            task = _tasks.front();
+            _tasks.pop_front();
+        }
+        // exceptions are stored in the future by packaged_task
+        task();
+    }
+}
+
+}
@@ -52,6 +52,14 @@
 #include <stdexcept>
 #include <string>
 #include <algorithm>
+#include <limits>
+#include <cstring>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define LIBHSL_HAVE_SSE2
+#include <emmintrin.h>
+#endif
 
 #ifdef HAVE_GDAL
 #include <gdal.h>
@@ -59,6 +67,7 @@
 #endif
 
 #include "Header.h"
+#include "Color.h"
 #include "detail/private_utility.hpp"
 
 typedef boost::tokenizer<boost::char_separator<char> > tokenizer;
@@ -98,6 +107,126 @@ namespace hsl {
 
 #endif
 
+namespace detail {
+
+namespace {
+
+// scaled values of the int32 column at records, stride bytes apart
+void decodeColumn(const uint8_t* records, size_t stride, size_t n, double scale, double offset, double* out)
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        int32_t v;
+        std::memcpy(&v, records + i * stride, sizeof(int32_t));
+        out[i] = v * scale + offset;
+    }
+}
+
+// a value rounds into int32 when the rounded magnitude stays below 2^31
+const double rawUpper = 2147483648.0;
+const double rawLower = -2147483649.0;
+
+void throwRawOverflow(const char* name)
+{
+    std::ostringstream msg;
+    msg << name << " scale and offset combination is insufficient to represent the data";
+    throw std::domain_error(msg.str());
+}
+
+// d rounded like detail::sround, throwing if int32 cannot hold it
+inline int32_t roundRaw(double d, const char* name)
+{
+    double r = d + (d < 0.0 ? -0.5 : 0.5);
+    if (!(r < rawUpper && r > rawLower))
+        throwRawOverflow(name);
+    return static_cast<int32_t>(r);
+}
+
+// stores the values of in as int32 column at records, stride bytes apart
+void encodeColumn(uint8_t* records, size_t stride, size_t n, double scale, double offset, const double* in, const char* name)
+{
+    size_t i = 0;
+#ifdef LIBHSL_HAVE_SSE2
+    __m128d vscale = _mm_set1_pd(scale);
+    __m128d voffset = _mm_set1_pd(offset);
+    __m128d vhalf = _mm_set1_pd(0.5);
+    __m128d vsign = _mm_set1_pd(-0.0);
+    __m128d vupper = _mm_set1_pd(rawUpper);
+    __m128d vlower = _mm_set1_pd(rawLower);
+    __m128d vbad = _mm_setzero_pd();
+    for (; i + 2 <= n; i += 2)
+    {
+        __m128d d = _mm_div_pd(_mm_sub_pd(_mm_loadu_pd(in + i), voffset), vscale);
+        // sround: truncate d + 0.5 carrying the sign of d
+        __m128d r = _mm_add_pd(d, _mm_or_pd(vhalf, _mm_and_pd(d, vsign)));
+        vbad = _mm_or_pd(vbad, _mm_or_pd(_mm_cmpnlt_pd(r, vupper), _mm_cmpngt_pd(r, vlower)));
+        __m128i v = _mm_cvttpd_epi32(r);
+        int32_t lanes[4];
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), v);
+        std::memcpy(records + i * stride, &lanes[0], sizeof(int32_t));
+        std::memcpy(records + (i + 1) * stride, &lanes[1], sizeof(int32_t));
+    }
+    if (_mm_movemask_pd(vbad) != 0)
+        throwRawOverflow(name);
+#endif
+    for (; i < n; ++i)
+    {
+        int32_t v = roundRaw((in[i] - offset) / scale, name);
+        std::memcpy(records + i * stride, &v, sizeof(int32_t));
+    }
+}
+
+}
+
+void decodeCoordinates(PointBlock const& block, Header const& header, double* x, double* y, double* z)
+{
+    if (block.empty())
+        return;
+
+    const uint8_t* records = block.getRecord(0);
+    size_t stride = block.getRecordLength();
+    decodeColumn(records, stride, block.size(), header.getScaleX(), header.getOffsetX(), x);
+    decodeColumn(records + 4, stride, block.size(), header.getScaleY(), header.getOffsetY(), y);
+    decodeColumn(records + 8, stride, block.size(), header.getScaleZ(), header.getOffsetZ(), z);
+}
+
+void encodeCoordinates(PointBlock& block, Header const& header, const double* x, const double* y, const double* z)
+{
+    if (block.empty())
+        return;
+
+    uint8_t* records = block.getRecord(0);
+    size_t stride = block.getRecordLength();
+    encodeColumn(records, stride, block.size(), header.getScaleX(), header.getOffsetX(), x, "X");
+    encodeColumn(records + 4, stride, block.size(), header.getScaleY(), header.getOffsetY(), y, "Y");
+    encodeColumn(records + 8, stride, block.size(), header.getScaleZ(), header.getOffsetZ(), z, "Z");
+}
+
+}
+
+bool TransformInterface::transform(PointBlock& block)
+{
+    Header const* header = block.getHeader();
+    Header const* result = header;
+    Point point(header);
+    for (size_t i = 0; i < block.size(); ++i)
+    {
+        block.getPoint(i, point);
+        if (!transform(point))
+            return false;
+        block.setPoint(i, point);
+        if (point.getHeader() != header)
+        {
+            // the transform moved the point; start the next one afresh
+            result = point.getHeader();
+            point = Point(header);
+        }
+    }
+
+    if (result != header)
+        block.resetHeader(result);
+    return true;
+}
 
 ReprojectionTransform::ReprojectionTransform(const SpatialReference& inSRS, const SpatialReference& outSRS)
     : m_new_header(0)
@@ -164,9 +293,9 @@ bool ReprojectionTransform::transform(Point& point)
 #ifdef HAVE_GDAL
     
     int ret = 0;
-    double x = point.GetX();
-    double y = point.GetY();
-    double z = point.GetZ();
+    double x = point.getX();
+    double y = point.getY();
+    double z = point.getZ();
 
     ret = OCTTransform(reinterpret_cast<OGRCoordinateTransformationH>(m_transform_ptr.get()), 1, &x, &y, &z);
     if (!ret)
@@ -179,29 +308,29 @@ bool ReprojectionTransform::transform(Point& point)
     if (this->ModifiesHeader()) 
     {
         if (m_new_header)
-            point.SetHeader(m_new_header);
+            point.setHeader(m_new_header);
         else 
         {
             // FIXME? 
         }
     }
 
-    point.SetX(x);
-    point.SetY(y);
-    point.SetZ(z);
+    point.setX(x);
+    point.setY(y);
+    point.setZ(z);
     
-    if (detail::compare_distance(point.GetRawX(), (std::numeric_limits<int32_t>::max)()) ||
-        detail::compare_distance(point.GetRawX(), (std::numeric_limits<int32_t>::min)())) {
+    if (detail::compare_distance(point.getRawX(), (std::numeric_limits<int32_t>::max)()) ||
+        detail::compare_distance(point.getRawX(), (std::numeric_limits<int32_t>::min)())) {
         throw std::domain_error("X scale and offset combination is insufficient to represent the data");
     }
 
-    if (detail::compare_distance(point.GetRawY(), (std::numeric_limits<int32_t>::max)()) ||
-        detail::compare_distance(point.GetRawY(), (std::numeric_limits<int32_t>::min)())) {
+    if (detail::compare_distance(point.getRawY(), (std::numeric_limits<int32_t>::max)()) ||
+        detail::compare_distance(point.getRawY(), (std::numeric_limits<int32_t>::min)())) {
         throw std::domain_error("Y scale and offset combination is insufficient to represent the data");
     }    
 
-    if (detail::compare_distance(point.GetRawZ(), (std::numeric_limits<int32_t>::max)()) ||
-        detail::compare_distance(point.GetRawZ(), (std::numeric_limits<int32_t>::min)())) {
+    if (detail::compare_distance(point.getRawZ(), (std::numeric_limits<int32_t>::max)()) ||
+        detail::compare_distance(point.getRawZ(), (std::numeric_limits<int32_t>::min)())) {
         throw std::domain_error("Z scale and offset combination is insufficient to represent the data");
     }        
 
@@ -215,6 +344,7 @@ bool ReprojectionTransform::transform(Point& point)
 
 
 TranslationTransform::TranslationTransform(std::string const& expression)
+    : m_expression(expression), m_header(0)
 {
     if (expression.size() == 0) 
         throw std::runtime_error("no expression was given to TranslationTransform");
@@ -228,7 +358,74 @@ TranslationTransform::TranslationTransform(std::string const& expression)
         operation op = GetOperation(s);
         operations.push_back(op);
     }
-    
+
+    // fold the operations, in order, into the rows of an affine matrix
+    setIdentity();
+    for (std::vector<operation>::const_iterator op = operations.begin(); op != operations.end(); ++op)
+    {
+        double* row = &m_matrix[(op->dimension == "X" ? 0 : op->dimension == "Y" ? 1 : 2) * 4];
+        switch (op->oper)
+        {
+            case eOPER_MULTIPLY:
+                for (int j = 0; j < 4; ++j)
+                    row[j] *= op->value;
+                break;
+            case eOPER_DIVIDE:
+                for (int j = 0; j < 4; ++j)
+                    row[j] /= op->value;
+                break;
+            case eOPER_ADD:
+                row[3] += op->value;
+                break;
+            case eOPER_SUBTRACT:
+                row[3] -= op->value;
+                break;
+            default:
+                std::ostringstream oss;
+                oss << "Unhandled expression operation id " << static_cast<int32_t>(op->oper);
+                throw std::runtime_error(oss.str());
+        }
+    }
+}
+
+TranslationTransform::TranslationTransform(boost::array<double, 16> const& matrix)
+    : m_header(0)
+{
+    if (!detail::compare_distance(matrix[12], 0.0) || !detail::compare_distance(matrix[13], 0.0) ||
+        !detail::compare_distance(matrix[14], 0.0) || !detail::compare_distance(matrix[15], 1.0))
+        throw std::runtime_error("TranslationTransform matrix must be affine, its last row 0 0 0 1");
+
+    for (int i = 0; i < 12; ++i)
+        m_matrix[i] = matrix[i];
+}
+
+void TranslationTransform::setIdentity()
+{
+    for (int i = 0; i < 12; ++i)
+        m_matrix[i] = (i % 5 == 0) ? 1.0 : 0.0;
+}
+
+void TranslationTransform::compile(Header const* header)
+{
+    if (header == m_header)
+        return;
+
+    // raw' = (M (s raw + o) - o') / s with s and o the scale and offset of header
+    double const scale[3] = { header->getScaleX(), header->getScaleY(), header->getScaleZ() };
+    double const offset[3] = { header->getOffsetX(), header->getOffsetY(), header->getOffsetZ() };
+    for (int i = 0; i < 3; ++i)
+    {
+        double const* row = &m_matrix[i * 4];
+        double* raw = &m_raw[i * 4];
+        double constant = row[3] - offset[i];
+        for (int j = 0; j < 3; ++j)
+        {
+            raw[j] = row[j] * scale[j] / scale[i];
+            constant += row[j] * offset[j];
+        }
+        raw[3] = constant / scale[i];
+    }
+    m_header = header;
 }
 
 TranslationTransform::operation TranslationTransform::GetOperation(std::string const& expr)
@@ -337,93 +534,66 @@ TranslationTransform::operation TranslationTransform::GetOperation(std::string c
 }
 bool TranslationTransform::transform(Point& point)
 {
-    for(std::vector<TranslationTransform::operation>::const_iterator op = operations.begin();
-        op != operations.end();
-        op++) 
-    {
-
-        switch (op->oper) 
-            {
-                case eOPER_MULTIPLY:
-                    if (!op->dimension.compare("X")) 
-                    {
-                        point.setX(point.getX() * op->value);
-                    }
-                    if (!op->dimension.compare("Y")) 
-                    {
-                        point.setY(point.getY() * op->value);
-                    }
-                    if (!op->dimension.compare("Z")) 
-                    {
-                        point.setZ(point.getZ() * op->value);
-                    }
-                    break;
-                case eOPER_DIVIDE:
-                    if (!op->dimension.compare("X")) 
-                    {
-                        point.setX(point.getX() / op->value);
-                    }
-                    if (!op->dimension.compare("Y")) 
-                    {
-                        point.setY(point.getY() / op->value);
-                    }
-                    if (!op->dimension.compare("Z")) 
-                    {
-                        point.setZ(point.getZ() / op->value);
-                    }
-                    break;
-                case eOPER_ADD:
-                    if (!op->dimension.compare("X")) 
-                    {
-                        point.setX(point.getX() + op->value);
-                    }
-                    if (!op->dimension.compare("Y")) 
-                    {
-                        point.setY(point.getY() + op->value);
-                    }
-                    if (!op->dimension.compare("Z")) 
-                    {
-                        point.setZ(point.getZ() + op->value);
-                    }
-
-                    break;
-                case eOPER_SUBTRACT:
-                    if (!op->dimension.compare("X")) 
-                    {
-                        point.setX(point.getX() - op->value);
-                    }
-                    if (!op->dimension.compare("Y")) 
-                    {
-                        point.setY(point.getY() - op->value);
-                    }
-                    if (!op->dimension.compare("Z")) 
-                    {
-                        point.setZ(point.getZ() - op->value);
-                    }
-                    break;
-
-                default:
-                    std::ostringstream oss;
-                    oss << "Unhandled expression operation id " << static_cast<int32_t>(op->oper);
-                    throw std::runtime_error(oss.str());
-            }
+    compile(point.getHeader());
+
+    double const x = point.getRawX();
+    double const y = point.getRawY();
+    double const z = point.getRawZ();
+    double const* m = m_raw;
+    // same association as the batch path, so both round alike
+    point.setRawX(detail::roundRaw((m[0] * x + m[1] * y) + (m[2] * z + m[3]), "X"));
+    point.setRawY(detail::roundRaw((m[4] * x + m[5] * y) + (m[6] * z + m[7]), "Y"));
+    point.setRawZ(detail::roundRaw((m[8] * x + m[9] * y) + (m[10] * z + m[11]), "Z"));
+    return true;
+}
 
-    if (detail::compare_distance(point.getRawX(), (std::numeric_limits<int32_t>::max)()) ||
-        detail::compare_distance(point.getRawX(), (std::numeric_limits<int32_t>::min)())) {
-        throw std::domain_error("X scale and offset combination of this file is insufficient to represent the data given the expression ");
+bool TranslationTransform::transform(PointBlock& block)
+{
+    size_t n = block.size();
+    if (!n)
+        return true;
+    compile(block.getHeader());
+
+    m_x.resize(n);
+    m_y.resize(n);
+    m_z.resize(n);
+    double* x = &m_x.front();
+    double* y = &m_y.front();
+    double* z = &m_z.front();
+    const uint8_t* records = block.getRecord(0);
+    size_t stride = block.getRecordLength();
+    detail::decodeColumn(records, stride, n, 1.0, 0.0, x);
+    detail::decodeColumn(records + 4, stride, n, 1.0, 0.0, y);
+    detail::decodeColumn(records + 8, stride, n, 1.0, 0.0, z);
+
+    double const* m = m_raw;
+    size_t i = 0;
+#ifdef LIBHSL_HAVE_SSE2
+    __m128d m0 = _mm_set1_pd(m[0]), m1 = _mm_set1_pd(m[1]), m2 = _mm_set1_pd(m[2]), m3 = _mm_set1_pd(m[3]);
+    __m128d m4 = _mm_set1_pd(m[4]), m5 = _mm_set1_pd(m[5]), m6 = _mm_set1_pd(m[6]), m7 = _mm_set1_pd(m[7]);
+    __m128d m8 = _mm_set1_pd(m[8]), m9 = _mm_set1_pd(m[9]), m10 = _mm_set1_pd(m[10]), m11 = _mm_set1_pd(m[11]);
+    for (; i + 2 <= n; i += 2)
+    {
+        __m128d vx = _mm_loadu_pd(x + i);
+        __m128d vy = _mm_loadu_pd(y + i);
+        __m128d vz = _mm_loadu_pd(z + i);
+        _mm_storeu_pd(x + i, _mm_add_pd(_mm_add_pd(_mm_mul_pd(m0, vx), _mm_mul_pd(m1, vy)), _mm_add_pd(_mm_mul_pd(m2, vz), m3)));
+        _mm_storeu_pd(y + i, _mm_add_pd(_mm_add_pd(_mm_mul_pd(m4, vx), _mm_mul_pd(m5, vy)), _mm_add_pd(_mm_mul_pd(m6, vz), m7)));
+        _mm_storeu_pd(z + i, _mm_add_pd(_mm_add_pd(_mm_mul_pd(m8, vx), _mm_mul_pd(m9, vy)), _mm_add_pd(_mm_mul_pd(m10, vz), m11)));
     }
-
-    if (detail::compare_distance(point.getRawY(), (std::numeric_limits<int32_t>::max)()) ||
-        detail::compare_distance(point.getRawY(), (std::numeric_limits<int32_t>::min)())) {
-        throw std::domain_error("Y scale and offset combination of this file is insufficient to represent the data given the expression");
-    }    
-
-    if (detail::compare_distance(point.getRawZ(), (std::numeric_limits<int32_t>::max)()) ||
-        detail::compare_distance(point.getRawZ(), (std::numeric_limits<int32_t>::min)())) {
-        throw std::domain_error("Z scale and offset combination of this file is insufficient to represent the data given the expression");
-    }   
-
+#endif
+    for (; i < n; ++i)
+    {
+        double const vx = x[i], vy = y[i], vz = z[i];
+        x[i] = (m[0] * vx + m[1] * vy) + (m[2] * vz + m[3]);
+        y[i] = (m[4] * vx + m[5] * vy) + (m[6] * vz + m[7]);
+        z[i] = (m[8] * vx + m[9] * vy) + (m[10] * vz + m[11]);
     }
+
+    uint8_t* out = block.getRecord(0);
+    detail::encodeColumn(out, stride, n, 1.0, 0.0, x, "X");
+    detail::encodeColumn(out + 4, stride, n, 1.0, 0.0, y, "Y");
+    detail::encodeColumn(out + 8, stride, n, 1.0, 0.0, z, "Z");
     return true;
 }
 
@@ -582,4 +752,164 @@ ColorFetchingTransform::~ColorFetchingTransform()
 #endif
 }
 
+SpectralIndexTransform::SpectralIndexTransform(std::string const& expression)
+    : m_expression(expression), m_target_id(FI_UNKNOWN), m_target_index(0), m_header(0)
+{
+}
+
+SpectralIndexTransform::SpectralIndexTransform(std::string const& expression, FieldId target, size_t n)
+    : m_expression(expression), m_target_id(target), m_target_index(n), m_header(0)
+{
+}
+
+SpectralIndexTransform::~SpectralIndexTransform()
+{
+}
+
+void SpectralIndexTransform::compile(Header const* header)
+{
+    if (header == m_header)
+        return;
+
+    m_expression.compile(header->getSchema());
+    if (m_target_id != FI_UNKNOWN && !m_target.bind(header->getSchema(), m_target_id, m_target_index))
+    {
+        std::ostringstream msg;
+        msg << "SpectralIndexTransform: target field " << m_target_id << "[" << m_target_index
+            << "] is not in the schema or cannot be written";
+        throw std::runtime_error(msg.str());
+    }
+    m_header = header;
+}
+
+bool SpectralIndexTransform::transform(Point& point)
+{
+    compile(point.getHeader());
+
+    uint8_t* record = &point.getData().front();
+    double value = m_expression.evaluateValue(record);
+    m_values.assign(1, value);
+    if (m_target.isBound())
+        m_target.setValue(record, value);
+    return true;
+}
+
+bool SpectralIndexTransform::transform(PointBlock& block)
+{
+    if (block.empty())
+    {
+        m_values.clear();
+        return true;
+    }
+    compile(block.getHeader());
+
+    m_expression.evaluateValues(block, m_values);
+    if (m_target.isBound())
+        m_target.scatter(block.getRecord(0), block.getRecordLength(), block.size(), &m_values.front());
+    return true;
+}
+
+SpectralMatchTransform::SpectralMatchTransform(SpectralLibraryPtr library, SpectralMetric metric)
+    : m_library(library), m_metric(metric),
+      m_class_id(FI_Classification), m_class_index(0),
+      m_score_id(FI_UNKNOWN), m_score_index(0),
+      m_threshold(0.0), m_has_threshold(false), m_unmatched(1), m_header(0)
+{
+    if (!library || library->empty())
+        throw std::invalid_argument("SpectralMatchTransform: the spectral library is empty");
+}
+
+SpectralMatchTransform::~SpectralMatchTransform()
+{
+}
+
+void SpectralMatchTransform::setClassField(FieldId id, size_t n)
+{
+    m_class_id = id;
+    m_class_index = n;
+    m_header = 0;
+}
+
+void SpectralMatchTransform::setScoreField(FieldId id, size_t n)
+{
+    m_score_id = id;
+    m_score_index = n;
+    m_header = 0;
+}
+
+void SpectralMatchTransform::compile(Header const* header)
+{
+    if (header == m_header)
+        return;
+
+    Schema const& schema = header->getSchema();
+    m_bands.resize(m_library->getBandCount());
+    for (size_t b = 0; b < m_bands.size(); ++b)
+    {
+        if (!m_bands[b].bind(schema, FI_BandValue, b))
+            throw std::runtime_error("SpectralMatchTransform: the points have fewer bands than the spectral library");
+    }
+
+    if (!m_class.bind(schema, m_class_id, m_class_index))
+    {
+        std::ostringstream msg;
+        msg << "SpectralMatchTransform: class field " << m_class_id << "[" << m_class_index
+            << "] is not in the schema or cannot be written";
+        throw std::runtime_error(msg.str());
+    }
+    m_score = FieldAccessor();
+    if (m_score_id != FI_UNKNOWN && !m_score.bind(schema, m_score_id, m_score_index))
+    {
+        std::ostringstream msg;
+        msg << "SpectralMatchTransform: score field " << m_score_id << "[" << m_score_index
+            << "] is not in the schema or cannot be written";
+        throw std::runtime_error(msg.str());
+    }
+    m_header = header;
+}
+
+void SpectralMatchTransform::classify(uint8_t* records, size_t stride, size_t n)
+{
+    const size_t bands = m_bands.size();
+    m_columns.resize(bands * n);
+    for (size_t b = 0; b < bands; ++b)
+        m_bands[b].gather(records, stride, n, &m_columns[b * n]);
+
+    m_matches.resize(n);
+    m_scores.resize(n);
+    m_library->match(&m_columns[0], n, n, m_metric, &m_matches[0], &m_scores[0]);
+
+    m_classes.resize(n);
+    for (size_t i = 0; i < n; ++i)
+    {
+        const bool matched = m_matches[i] >= 0 &&
+            !(m_has_threshold && SpectralLibrary::isBetter(m_metric, m_threshold, m_scores[i]));
+        m_classes[i] = matched ? m_library->getSignature(static_cast<size_t>(m_matches[i])).classification : m_unmatched;
+    }
+    m_class.scatter(records, stride, n, &m_classes[0]);
+    if (m_score.isBound())
+        m_score.scatter(records, stride, n, &m_scores[0]);
+}
+
+bool SpectralMatchTransform::transform(Point& point)
+{
+    compile(point.getHeader());
+    std::vector<uint8_t>& data = point.getData();
+    classify(&data.front(), data.size(), 1);
+    return true;
+}
+
+bool SpectralMatchTransform::transform(PointBlock& block)
+{
+    if (block.empty())
+    {
+        m_matches.clear();
+        m_scores.clear();
+        return true;
+    }
+    compile(block.getHeader());
+    classify(block.getRecord(0), block.getRecordLength(), block.size());
+    return true;
+}
+
 } // namespace liblas
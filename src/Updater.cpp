@@ -30,6 +30,7 @@
 
 #include "Updater.h"
 #include <cfloat>
+#include "detail/private_utility.hpp"
 
 namespace hsl
 {
@@ -232,13 +233,20 @@ bool Updater::readWaveformData()
         _point->getWaveformDataSize(size);
         if (_point->isValid() && size > 0)
         {
-            long pre = ftell(_fp);
-            fseek(_fp, pos, SEEK_SET);
-            _point->getWaveformData().resize(size);
-            fread(&_point->getWaveformData().front(), size, 1, _fp);
-            fseek(_fp, pre, SEEK_SET);    // back to previous position 
+            if (_waveformCache)
+            {
+                WaveformCache::DataPtr data = _waveformCache->get(pos, size,
+                    [this](uint64_t offset, uint32_t n, WaveformCache::Data& out) { loadWaveformData(offset, n, out); });
+                _point->getWaveformData().assign(data->begin(), data->end());
+            }
+            else
+            {
+                loadWaveformData(pos, size, _point->getWaveformData());
+            }
             return true;
         }
+        // a point without waveform must not keep that of the previous one
+        _point->getWaveformData().clear();
     }
     catch (std::runtime_error&)
     {
@@ -249,6 +257,19 @@ bool Updater::readWaveformData()
     return true;
 }
 
+void Updater::loadWaveformData(uint64_t pos, uint32_t size, std::vector<uint8_t>& data)
+{
+    uint64_t pre = detail::tell64(_fp);
+    if (detail::seek64(_fp, pos, SEEK_SET) != 0)
+        throw libhsl_error("cannot seek to the waveform data");
+    data.resize(size);
+    size_t read = fread(&data.front(), 1, size, _fp);
+    if (detail::seek64(_fp, pre, SEEK_SET) != 0)    // back to previous position 
+        throw libhsl_error("cannot seek back from the waveform data");
+    if (read != size)
+        throw libhsl_error("waveform data extends beyond the end of the file");
+}
+
 bool Updater::seek(size_t n)
 {
     if (_size == n) {
@@ -299,10 +320,20 @@ bool Updater::writePoint(Point& point, bool updateWaveform)
             if (getHeader().isInternalWaveformData())
             {
                 // write waveform data to the file
-                long pre = ftell(_fp);
-                fseek(_fp, offset, SEEK_SET);
-                fwrite(&waveformData.front(), size, 1, _fp);
-                fseek(_fp, pre, SEEK_SET);    // back to previous position     
+                uint64_t pre = detail::tell64(_fp);
+                if (detail::seek64(_fp, offset, SEEK_SET) != 0 ||
+                    fwrite(&waveformData.front(), size, 1, _fp) != 1 ||
+                    detail::seek64(_fp, pre, SEEK_SET) != 0)    // back to previous position     
+                    throw libhsl_error("cannot write the waveform data");
+
+                // readers sharing the cache must see the new data
+                if (_waveformCache)
+                {
+                    if (waveformData.size() == size)
+                        _waveformCache->put(offset, waveformData);
+                    else
+                        _waveformCache->erase(offset);
+                }
             }
             else
             {
@@ -0,0 +1,160 @@
+/*************************************************************************************
+ * 
+ * 
+ * Copyright (c) 2021, Zhengjun Liu <zjliu@casm.ac.cn>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ ************************************************************************************/
+
+#include "WaveformCache.h"
+
+namespace hsl
+{
+
+WaveformCache::WaveformCache(size_t capacity)
+    : _capacity(capacity), _bytes(0), _hits(0), _misses(0)
+{
+}
+
+WaveformCache::DataPtr WaveformCache::get(uint64_t offset, uint32_t size, Loader const& load)
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        std::unordered_map<uint64_t, EntryList::iterator>::iterator it = _index.find(offset);
+        if (it != _index.end() && it->second->second->size() == size)
+        {
+            _entries.splice(_entries.begin(), _entries, it->second);
+            ++_hits;
+            return it->second->second;
+        }
+        ++_misses;
+    }
+
+    std::shared_ptr<Data> data(new Data());
+    load(offset, size, *data);
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    std::unordered_map<uint64_t, EntryList::iterator>::iterator it = _index.find(offset);
+    if (it != _index.end() && it->second->second->size() == size)
+    {
+        // another thread loaded it meanwhile
+        _entries.splice(_entries.begin(), _entries, it->second);
+        return it->second->second;
+    }
+    insert(offset, data);
+    return data;
+}
+
+void WaveformCache::put(uint64_t offset, Data const& data)
+{
+    DataPtr copy(new Data(data));
+    std::lock_guard<std::mutex> lock(_mutex);
+    insert(offset, copy);
+}
+
+void WaveformCache::insert(uint64_t offset, DataPtr const& data)
+{
+    std::unordered_map<uint64_t, EntryList::iterator>::iterator it = _index.find(offset);
+    if (it != _index.end())
+        remove(it);
+    if (data->size() > _capacity)
+        return;
+
+    _entries.push_front(Entry(offset, data));
+    _index[offset] = _entries.begin();
+    _bytes += data->size();
+    evict();
+}
+
+void WaveformCache::remove(std::unordered_map<uint64_t, EntryList::iterator>::iterator it)
+{
+    _bytes -= it->second->second->size();
+    _entries.erase(it->second);
+    _index.erase(it);
+}
+
+void WaveformCache::erase(uint64_t offset)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    std::unordered_map<uint64_t, EntryList::iterator>::iterator it = _index.find(offset);
+    if (it != _index.end())
+        remove(it);
+}
+
+void WaveformCache::evict()
+{
+    while (_bytes > _capacity && !_entries.empty())
+    {
+        _bytes -= _entries.back().second->size();
+        _index.erase(_entries.back().first);
+        _entries.pop_back();
+    }
+}
+
+void WaveformCache::setCapacity(size_t capacity)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _capacity = capacity;
+    evict();
+}
+
+size_t WaveformCache::getCapacity() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _capacity;
+}
+
+size_t WaveformCache::getByteSize() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _bytes;
+}
+
+size_t WaveformCache::size() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _entries.size();
+}
+
+void WaveformCache::clear()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _entries.clear();
+    _index.clear();
+    _bytes = 0;
+}
+
+uint64_t WaveformCache::getHits() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _hits;
+}
+
+uint64_t WaveformCache::getMisses() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _misses;
+}
+
+}
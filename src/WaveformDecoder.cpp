@@ -0,0 +1,328 @@
+/*************************************************************************************
+ * 
+ * 
+ * Copyright (c) 2021, Zhengjun Liu <zjliu@casm.ac.cn>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ ************************************************************************************/
+
+#include "WaveformDecoder.h"
+#include <cstring>
+#include <sstream>
+#include "Header.h"
+#include "Point.h"
+#include "Exception.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define LIBHSL_HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace hsl
+{
+
+namespace
+{
+
+#ifdef LIBHSL_HAVE_SSE2
+// gain * v + offset for four int32 samples
+inline void storeCalibrated(__m128i v, __m128 gain, __m128 offset, float* out)
+{
+    _mm_storeu_ps(out, _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(v), gain), offset));
+}
+#endif
+
+size_t unpack8(const uint8_t* p, size_t count, float gain, float offset, float* out)
+{
+    size_t i = 0;
+#ifdef LIBHSL_HAVE_SSE2
+    __m128 vgain = _mm_set1_ps(gain);
+    __m128 voffset = _mm_set1_ps(offset);
+    __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= count; i += 16)
+    {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+        __m128i lo = _mm_unpacklo_epi8(bytes, zero);
+        __m128i hi = _mm_unpackhi_epi8(bytes, zero);
+        storeCalibrated(_mm_unpacklo_epi16(lo, zero), vgain, voffset, out + i);
+        storeCalibrated(_mm_unpackhi_epi16(lo, zero), vgain, voffset, out + i + 4);
+        storeCalibrated(_mm_unpacklo_epi16(hi, zero), vgain, voffset, out + i + 8);
+        storeCalibrated(_mm_unpackhi_epi16(hi, zero), vgain, voffset, out + i + 12);
+    }
+#endif
+    for (; i < count; ++i)
+        out[i] = p[i] * gain + offset;
+    return i;
+}
+
+size_t unpack16(const uint8_t* p, size_t count, float gain, float offset, float* out)
+{
+    size_t i = 0;
+#ifdef LIBHSL_HAVE_SSE2
+    __m128 vgain = _mm_set1_ps(gain);
+    __m128 voffset = _mm_set1_ps(offset);
+    __m128i zero = _mm_setzero_si128();
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i words = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 2 * i));
+        storeCalibrated(_mm_unpacklo_epi16(words, zero), vgain, voffset, out + i);
+        storeCalibrated(_mm_unpackhi_epi16(words, zero), vgain, voffset, out + i + 4);
+    }
+#endif
+    for (; i < count; ++i)
+    {
+        uint16_t v;
+        std::memcpy(&v, p + 2 * i, sizeof(v));
+        out[i] = v * gain + offset;
+    }
+    return i;
+}
+
+size_t unpack12(const uint8_t* p, size_t count, float gain, float offset, float* out)
+{
+    size_t i = 0;
+#ifdef LIBHSL_HAVE_SSE2
+    __m128 vgain = _mm_set1_ps(gain);
+    __m128 voffset = _mm_set1_ps(offset);
+    // four samples take six bytes; an eight byte load must stay in the packet
+    size_t packetSize = (count * 12 + 7) / 8;
+    for (; i + 4 <= count && (i / 2) * 3 + 8 <= packetSize; i += 4)
+    {
+        uint64_t bits;
+        std::memcpy(&bits, p + (i / 2) * 3, sizeof(bits));
+        __m128i v = _mm_set_epi32(static_cast<int>((bits >> 36) & 0xFFF), static_cast<int>((bits >> 24) & 0xFFF),
+                                  static_cast<int>((bits >> 12) & 0xFFF), static_cast<int>(bits & 0xFFF));
+        storeCalibrated(v, vgain, voffset, out + i);
+    }
+#endif
+    for (; i < count; ++i)
+    {
+        const uint8_t* q = p + (i / 2) * 3;
+        uint32_t v = (i & 1) ? (q[1] >> 4) | (static_cast<uint32_t>(q[2]) << 4)
+                             : q[0] | (static_cast<uint32_t>(q[1] & 0x0F) << 8);
+        out[i] = v * gain + offset;
+    }
+    return i;
+}
+
+}
+
+WaveformDecoder::WaveformDecoder(Header const& header)
+{
+    if (header.getWaveformDesc())
+        _descriptors = *header.getWaveformDesc();
+}
+
+void WaveformDecoder::unpack(const uint8_t* packet, size_t count, unsigned bits,
+                             double gain, double offset, float* out)
+{
+    if (bits == 0 || bits > 32)
+        throw libhsl_error("waveform samples must have 1 to 32 bits");
+
+    float g = static_cast<float>(gain);
+    float o = static_cast<float>(offset);
+    switch (bits)
+    {
+    case 8:
+        unpack8(packet, count, g, o, out);
+        return;
+    case 12:
+        unpack12(packet, count, g, o, out);
+        return;
+    case 16:
+        unpack16(packet, count, g, o, out);
+        return;
+    default:
+        break;
+    }
+
+    // any other width, bit by bit from the least significant end
+    uint64_t mask = (static_cast<uint64_t>(1) << bits) - 1;
+    for (size_t i = 0; i < count; ++i)
+    {
+        size_t bit = i * bits;
+        size_t first = bit / 8;
+        size_t last = (bit + bits - 1) / 8;
+        uint64_t v = 0;
+        for (size_t b = last + 1; b-- > first; )
+            v = (v << 8) | packet[b];
+        v = (v >> (bit % 8)) & mask;
+        out[i] = static_cast<float>(static_cast<double>(v) * gain + offset);
+    }
+}
+
+WaveformPacketDesc const* WaveformDecoder::getDescriptor(WaveformPacketDataDefinition const& def) const
+{
+    for (size_t i = 0; i < _descriptors.size(); ++i)
+    {
+        if (_descriptors[i].id == def.descriptorIndex)
+            return &_descriptors[i];
+    }
+    if (def.descriptorIndex < _descriptors.size())
+        return &_descriptors[def.descriptorIndex];
+    return 0;
+}
+
+namespace
+{
+
+// number of packets in waveform data of size bytes, checking that their
+// definitions are there
+uint16_t getDefinitionCount(const uint8_t* data, size_t size)
+{
+    if (size < sizeof(uint16_t))
+        return 0;
+
+    uint16_t count;
+    std::memcpy(&count, data, sizeof(count));
+    if (sizeof(uint16_t) + count * sizeof(WaveformPacketDataDefinition) > size)
+        throw libhsl_error("waveform data is shorter than its packet definitions");
+    return count;
+}
+
+void getDefinition(const uint8_t* data, uint16_t index, WaveformPacketDataDefinition& def)
+{
+    std::memcpy(&def, data + sizeof(uint16_t) + index * sizeof(WaveformPacketDataDefinition), sizeof(def));
+}
+
+}
+
+void WaveformDecoder::appendPacket(const uint8_t* data, size_t size, WaveformPacketDataDefinition const& def,
+                                   std::vector<float>& samples) const
+{
+    WaveformPacketDesc const* desc = getDescriptor(def);
+    if (!desc)
+    {
+        std::ostringstream msg;
+        msg << "waveform packet of band " << def.bandIndex << " refers to unknown descriptor " << def.descriptorIndex;
+        throw libhsl_error(msg.str());
+    }
+    if (desc->compressType != 0)
+        throw libhsl_error("compressed waveform packets are not supported");
+
+    uint16_t count;
+    std::memcpy(&count, data, sizeof(count));
+    const size_t definitions = sizeof(uint16_t) + count * sizeof(WaveformPacketDataDefinition);
+    size_t needed = getPacketSize(desc->samples, desc->sampleBits);
+    if (def.byteOffset < definitions || def.byteOffset > size || size - def.byteOffset < needed || def.size < needed)
+    {
+        std::ostringstream msg;
+        msg << "waveform packet of band " << def.bandIndex << " is too short for " << desc->samples
+            << " samples of " << static_cast<unsigned>(desc->sampleBits) << " bits";
+        throw libhsl_error(msg.str());
+    }
+
+    size_t first = samples.size();
+    samples.resize(first + desc->samples);
+    if (desc->samples > 0)
+        unpack(data + def.byteOffset, desc->samples, desc->sampleBits, desc->gain, desc->offset, &samples[first]);
+}
+
+bool WaveformDecoder::append(const uint8_t* data, size_t size, uint16_t band, std::vector<float>& samples) const
+{
+    uint16_t count = getDefinitionCount(data, size);
+    for (uint16_t i = 0; i < count; ++i)
+    {
+        WaveformPacketDataDefinition def;
+        getDefinition(data, i, def);
+        if (def.bandIndex == band)
+        {
+            appendPacket(data, size, def, samples);
+            return true;
+        }
+    }
+    return false;
+}
+
+uint16_t WaveformDecoder::getPacketCount(std::vector<uint8_t> const& waveformData)
+{
+    if (waveformData.empty())
+        return 0;
+    return getDefinitionCount(&waveformData.front(), waveformData.size());
+}
+
+uint16_t WaveformDecoder::getPacketCount(const uint8_t* waveformData, size_t size)
+{
+    if (!waveformData)
+        return 0;
+    return getDefinitionCount(waveformData, size);
+}
+
+void WaveformDecoder::decodePacket(std::vector<uint8_t> const& waveformData, uint16_t index,
+                                   WaveformPacketDataDefinition& def, std::vector<float>& samples) const
+{
+    decodePacket(waveformData.empty() ? 0 : &waveformData.front(), waveformData.size(), index, def, samples);
+}
+
+void WaveformDecoder::decodePacket(const uint8_t* waveformData, size_t size, uint16_t index,
+                                   WaveformPacketDataDefinition& def, std::vector<float>& samples) const
+{
+    samples.clear();
+    if (index >= getPacketCount(waveformData, size))
+        throw libhsl_error("waveform packet index out of range");
+
+    getDefinition(waveformData, index, def);
+    appendPacket(waveformData, size, def, samples);
+}
+
+bool WaveformDecoder::decode(std::vector<uint8_t> const& waveformData, uint16_t band, std::vector<float>& samples) const
+{
+    samples.clear();
+    if (waveformData.empty())
+        return false;
+    return append(&waveformData.front(), waveformData.size(), band, samples);
+}
+
+bool WaveformDecoder::decode(const uint8_t* waveformData, size_t size, uint16_t band, std::vector<float>& samples) const
+{
+    samples.clear();
+    if (!waveformData || size == 0)
+        return false;
+    return append(waveformData, size, band, samples);
+}
+
+bool WaveformDecoder::decode(Point const& point, uint16_t band, std::vector<float>& samples) const
+{
+    return decode(point.getWaveformData(), band, samples);
+}
+
+size_t WaveformDecoder::decode(std::vector<Point> const& points, uint16_t band,
+                               std::vector<float>& samples, std::vector<size_t>& offsets) const
+{
+    samples.clear();
+    offsets.resize(points.size() + 1);
+    offsets[0] = 0;
+
+    size_t found = 0;
+    for (size_t i = 0; i < points.size(); ++i)
+    {
+        std::vector<uint8_t> const& data = points[i].getWaveformData();
+        if (!data.empty() && append(&data.front(), data.size(), band, samples))
+            ++found;
+        offsets[i + 1] = samples.size();
+    }
+    return found;
+}
+
+}
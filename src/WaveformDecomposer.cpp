@@ -0,0 +1,581 @@
+/*************************************************************************************
+ * 
+ * 
+ * Copyright (c) 2021, Zhengjun Liu <zjliu@casm.ac.cn>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ ************************************************************************************/
+
+#include "WaveformDecomposer.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include "Header.h"
+#include "Point.h"
+#include "Writer.h"
+#include "FieldAccessor.h"
+#include "Exception.h"
+
+namespace hsl
+{
+
+namespace
+{
+
+// consistent estimator of the standard deviation from the median absolute deviation
+const double kMadScale = 1.4826;
+// full width at half maximum of a Gaussian of unit standard deviation
+const double kFwhmScale = 2.3548200450309493;
+// components are evaluated within this many widths of their centre
+const double kSupport = 5.0;
+
+// median of values, which are reordered
+double median(std::vector<double>& values)
+{
+    size_t half = values.size() / 2;
+    std::nth_element(values.begin(), values.begin() + half, values.end());
+    double m = values[half];
+    if (values.size() % 2 == 0)
+        m = 0.5 * (m + *std::max_element(values.begin(), values.begin() + half));
+    return m;
+}
+
+// position where signal crosses level between sample a, at or below it,
+// and the neighbouring sample b above it
+double crossing(std::vector<double> const& signal, size_t a, size_t b, double level)
+{
+    double t = (level - signal[a]) / (signal[b] - signal[a]);
+    return a + t * (static_cast<double>(b) - static_cast<double>(a));
+}
+
+// Solves the symmetric positive definite system a x = b of order n in
+// place by Cholesky decomposition; a is overwritten. Returns false if a is
+// not positive definite.
+bool solveCholesky(double* a, double* b, size_t n)
+{
+    for (size_t j = 0; j < n; ++j)
+    {
+        double d = a[j * n + j];
+        for (size_t k = 0; k < j; ++k)
+            d -= a[j * n + k] * a[j * n + k];
+        if (!(d > 0.0))
+            return false;
+        d = std::sqrt(d);
+        a[j * n + j] = d;
+        for (size_t i = j + 1; i < n; ++i)
+        {
+            double s = a[i * n + j];
+            for (size_t k = 0; k < j; ++k)
+                s -= a[i * n + k] * a[j * n + k];
+            a[i * n + j] = s / d;
+        }
+    }
+    for (size_t i = 0; i < n; ++i)
+    {
+        double s = b[i];
+        for (size_t k = 0; k < i; ++k)
+            s -= a[i * n + k] * b[k];
+        b[i] = s / a[i * n + i];
+    }
+    for (size_t i = n; i-- > 0; )
+    {
+        double s = b[i];
+        for (size_t k = i + 1; k < n; ++k)
+            s -= a[k * n + i] * b[k];
+        b[i] = s / a[i * n + i];
+    }
+    return true;
+}
+
+bool byBandAndTime(WaveformReturn const& a, WaveformReturn const& b)
+{
+    if (a.band != b.band)
+        return a.band < b.band;
+    return a.time < b.time;
+}
+
+bool byTime(WaveformReturn const& a, WaveformReturn const& b)
+{
+    return a.time < b.time;
+}
+
+}
+
+/// Buffers of one worker. Parameters are stored as amplitude, centre and
+/// width triples, one per component.
+struct WaveformDecomposer::Scratch
+{
+    std::vector<float> samples;         // calibrated packet
+    std::vector<double> signal;         // samples above the background
+    std::vector<double> smooth;
+    std::vector<double> sorted;
+    std::vector<size_t> peaks;
+    std::vector<double> params;
+    std::vector<double> trial;
+    std::vector<double> normal;         // J'J of the model
+    std::vector<double> factor;
+    std::vector<double> gradient;       // J'r
+    std::vector<double> step;
+    std::vector<size_t> active;         // components near a sample
+    std::vector<double> derivatives;
+    std::vector<WaveformReturn> components;
+};
+
+WaveformDecomposer::WaveformDecomposer(Header const& header)
+    : m_decoder(header)
+    , m_noiseFactor(3.0)
+    , m_minAmplitude(0.0)
+    , m_maxReturns(8)
+    , m_maxIterations(20)
+    , m_minWidth(0.5)
+    , m_concurrency(0)
+    , m_batchSize(64)
+{
+}
+
+WaveformDecomposer::~WaveformDecomposer()
+{
+}
+
+void WaveformDecomposer::setMaxReturns(size_t count)
+{
+    if (count == 0)
+        throw std::invalid_argument("a waveform must be allowed at least one return");
+    m_maxReturns = count;
+}
+
+WaveformDecomposer::Scratch& WaveformDecomposer::getScratch(size_t worker)
+{
+    while (m_scratch.size() <= worker)
+        m_scratch.push_back(std::shared_ptr<Scratch>(new Scratch()));
+    return *m_scratch[worker];
+}
+
+namespace
+{
+
+// sum of the components of params at sample j
+inline double evaluateModel(std::vector<double> const& params, double j)
+{
+    double model = 0.0;
+    for (size_t c = 0; c < params.size(); c += 3)
+    {
+        double u = (j - params[c + 1]) / params[c + 2];
+        if (std::fabs(u) < kSupport)
+            model += params[c] * std::exp(-0.5 * u * u);
+    }
+    return model;
+}
+
+// sum of squared residuals of the components of params
+double evaluateCost(std::vector<double> const& signal, std::vector<double> const& params)
+{
+    double cost = 0.0;
+    for (size_t j = 0; j < signal.size(); ++j)
+    {
+        double r = signal[j] - evaluateModel(params, static_cast<double>(j));
+        cost += r * r;
+    }
+    return cost;
+}
+
+}
+
+void WaveformDecomposer::detect(Scratch& scratch, double threshold) const
+{
+    std::vector<double>& signal = scratch.signal;
+    std::vector<double>& smooth = scratch.smooth;
+    const size_t n = signal.size();
+
+    smooth.resize(n);
+    for (size_t j = 0; j < n; ++j)
+    {
+        double left = signal[j > 0 ? j - 1 : j];
+        double right = signal[j + 1 < n ? j + 1 : j];
+        smooth[j] = 0.25 * (left + 2.0 * signal[j] + right);
+    }
+
+    // local maxima; a plateau counts once, at its first sample
+    std::vector<size_t>& peaks = scratch.peaks;
+    peaks.clear();
+    for (size_t j = 1; j + 1 < n; ++j)
+    {
+        if (smooth[j] > threshold && smooth[j] > smooth[j - 1] && smooth[j] >= smooth[j + 1])
+            peaks.push_back(j);
+    }
+    if (peaks.size() > m_maxReturns)
+    {
+        std::partial_sort(peaks.begin(), peaks.begin() + m_maxReturns, peaks.end(),
+                          [&smooth](size_t a, size_t b) { return smooth[a] > smooth[b]; });
+        peaks.resize(m_maxReturns);
+        std::sort(peaks.begin(), peaks.end());
+    }
+
+    // initial components: the peak height and the width at half of it
+    std::vector<double>& params = scratch.params;
+    params.clear();
+    for (size_t p = 0; p < peaks.size(); ++p)
+    {
+        size_t j = peaks[p];
+        double amplitude = std::max(signal[j], smooth[j]);
+        double half = 0.5 * amplitude;
+
+        size_t l = j;
+        while (l > 0 && signal[l] > half)
+            --l;
+        size_t r = j;
+        while (r + 1 < n && signal[r] > half)
+            ++r;
+        double left = signal[l] > half ? static_cast<double>(l) : crossing(signal, l, l + 1, half);
+        double right = signal[r] > half ? static_cast<double>(r) : crossing(signal, r, r - 1, half);
+
+        params.push_back(amplitude);
+        params.push_back(static_cast<double>(j));
+        params.push_back(std::max(m_minWidth, (right - left) / kFwhmScale));
+    }
+}
+
+void WaveformDecomposer::refine(Scratch& scratch) const
+{
+    std::vector<double> const& signal = scratch.signal;
+    std::vector<double>& params = scratch.params;
+    std::vector<double>& trial = scratch.trial;
+    const size_t n = signal.size();
+    const size_t m = params.size();
+    const double maxWidth = static_cast<double>(n);
+    if (m == 0)
+        return;
+
+    std::vector<double>& normal = scratch.normal;
+    std::vector<double>& factor = scratch.factor;
+    std::vector<double>& gradient = scratch.gradient;
+    std::vector<double>& step = scratch.step;
+    std::vector<size_t>& active = scratch.active;
+    std::vector<double>& derivatives = scratch.derivatives;
+    normal.resize(m * m);
+    factor.resize(m * m);
+    gradient.resize(m);
+    step.resize(m);
+    trial.resize(m);
+    active.resize(m / 3);
+    derivatives.resize(m);
+
+    double cost = evaluateCost(signal, params);
+    double lambda = 1e-3;
+    for (size_t iteration = 0; iteration < m_maxIterations; ++iteration)
+    {
+        // normal equations of the linearized model, accumulated over the
+        // few components that reach each sample
+        std::fill(normal.begin(), normal.end(), 0.0);
+        std::fill(gradient.begin(), gradient.end(), 0.0);
+        for (size_t j = 0; j < n; ++j)
+        {
+            double t = static_cast<double>(j);
+            double model = 0.0;
+            size_t count = 0;
+            for (size_t c = 0; c < m; c += 3)
+            {
+                double a = params[c];
+                double s = params[c + 2];
+                double d = t - params[c + 1];
+                double u = d / s;
+                if (std::fabs(u) >= kSupport)
+                    continue;
+                double g = std::exp(-0.5 * u * u);
+                model += a * g;
+                active[count] = c;
+                derivatives[3 * count] = g;
+                derivatives[3 * count + 1] = a * g * u / s;
+                derivatives[3 * count + 2] = a * g * u * u / s;
+                ++count;
+            }
+            if (count == 0)
+                continue;
+
+            double r = signal[j] - model;
+            for (size_t p = 0; p < count; ++p)
+            {
+                for (size_t a = 0; a < 3; ++a)
+                {
+                    size_t row = active[p] + a;
+                    double da = derivatives[3 * p + a];
+                    gradient[row] += da * r;
+                    for (size_t q = 0; q < count; ++q)
+                        for (size_t b = 0; b < 3; ++b)
+                            normal[row * m + active[q] + b] += da * derivatives[3 * q + b];
+                }
+            }
+        }
+
+        // damp until a step lowers the cost
+        bool improved = false;
+        while (!improved && lambda < 1e10)
+        {
+            factor = normal;
+            for (size_t i = 0; i < m; ++i)
+                factor[i * m + i] += lambda * std::max(normal[i * m + i], 1e-12);
+            std::copy(gradient.begin(), gradient.end(), step.begin());
+            if (!solveCholesky(&factor[0], &step[0], m))
+            {
+                lambda *= 10.0;
+                continue;
+            }
+
+            for (size_t c = 0; c < m; c += 3)
+            {
+                trial[c] = std::max(params[c] + step[c], 0.0);
+                trial[c + 1] = std::min(std::max(params[c + 1] + step[c + 1], -1.0), maxWidth);
+                trial[c + 2] = std::min(std::max(params[c + 2] + step[c + 2], m_minWidth), maxWidth);
+            }
+            double trialCost = evaluateCost(signal, trial);
+            if (trialCost < cost)
+            {
+                improved = true;
+                params.swap(trial);
+                lambda = std::max(lambda * 0.1, 1e-12);
+                bool converged = cost - trialCost <= 1e-10 * cost;
+                cost = trialCost;
+                if (converged)
+                    return;
+            }
+            else
+            {
+                lambda *= 10.0;
+            }
+        }
+        if (!improved)
+            return;
+    }
+}
+
+size_t WaveformDecomposer::fit(const float* samples, size_t count, Scratch& scratch,
+                               std::vector<WaveformReturn>& returns) const
+{
+    if (count < 3)
+        return 0;
+
+    // background and noise level, robust to the returns themselves
+    std::vector<double>& sorted = scratch.sorted;
+    sorted.assign(samples, samples + count);
+    double background = median(sorted);
+    for (size_t j = 0; j < count; ++j)
+        sorted[j] = std::fabs(samples[j] - background);
+    double noise = kMadScale * median(sorted);
+    double threshold = std::max(m_noiseFactor * noise, m_minAmplitude);
+
+    std::vector<double>& signal = scratch.signal;
+    signal.resize(count);
+    for (size_t j = 0; j < count; ++j)
+        signal[j] = samples[j] - background;
+
+    detect(scratch, threshold);
+    refine(scratch);
+
+    std::vector<double> const& params = scratch.params;
+    size_t first = returns.size();
+    for (size_t c = 0; c < params.size(); c += 3)
+    {
+        double amplitude = params[c];
+        double centre = params[c + 1];
+        if (!(amplitude > threshold) || centre < 0.0 || centre > static_cast<double>(count - 1))
+            continue;
+
+        WaveformReturn r = WaveformReturn();
+        r.time = centre;
+        r.amplitude = amplitude;
+        r.width = params[c + 2];
+        returns.push_back(r);
+    }
+    std::sort(returns.begin() + first, returns.end(), byTime);
+    return returns.size() - first;
+}
+
+size_t WaveformDecomposer::fit(const float* samples, size_t count, std::vector<WaveformReturn>& returns)
+{
+    return fit(samples, count, getScratch(0), returns);
+}
+
+size_t WaveformDecomposer::decompose(const uint8_t* data, size_t size, double x, double y, double z, uint64_t index,
+                                     Scratch& scratch, std::vector<WaveformReturn>& returns) const
+{
+    uint16_t packets = WaveformDecoder::getPacketCount(data, size);
+    if (packets == 0)
+        return 0;
+
+    size_t first = returns.size();
+    for (uint16_t i = 0; i < packets; ++i)
+    {
+        WaveformPacketDataDefinition def;
+        m_decoder.decodePacket(data, size, i, def, scratch.samples);
+        if (scratch.samples.empty())
+            continue;
+
+        std::vector<WaveformReturn>& components = scratch.components;
+        components.clear();
+        fit(&scratch.samples[0], scratch.samples.size(), scratch, components);
+
+        const double interval = static_cast<double>(m_decoder.getDescriptor(def)->interval);
+        for (size_t c = 0; c < components.size(); ++c)
+        {
+            WaveformReturn r = components[c];
+            r.point = index;
+            r.band = def.bandIndex;
+            r.time *= interval;
+            r.width *= interval;
+            double along = def.temporalOffset - r.time;
+            r.x = x + along * def.dx;
+            r.y = y + along * def.dy;
+            r.z = z + along * def.dz;
+            returns.push_back(r);
+        }
+    }
+    std::stable_sort(returns.begin() + first, returns.end(), byBandAndTime);
+    return returns.size() - first;
+}
+
+size_t WaveformDecomposer::decompose(Point const& point, uint64_t index, std::vector<WaveformReturn>& returns)
+{
+    std::vector<uint8_t> const& data = point.getWaveformData();
+    if (data.empty())
+        return 0;
+    return decompose(&data.front(), data.size(), point.getX(), point.getY(), point.getZ(), index, getScratch(0), returns);
+}
+
+size_t WaveformDecomposer::decompose(std::vector<Point> const& points, std::vector<WaveformReturn>& returns)
+{
+    return run(points.size(), [this, &points](size_t i, Scratch& scratch, std::vector<WaveformReturn>& out)
+    {
+        std::vector<uint8_t> const& data = points[i].getWaveformData();
+        if (!data.empty())
+            decompose(&data.front(), data.size(), points[i].getX(), points[i].getY(), points[i].getZ(), i, scratch, out);
+    }, returns);
+}
+
+size_t WaveformDecomposer::decompose(PointBlock const& block, WaveformBatch const& batch, std::vector<WaveformReturn>& returns)
+{
+    if (batch.size() != block.size())
+        throw libhsl_error("waveform batch does not belong to the point block");
+
+    Header const& header = *block.getHeader();
+    const double scale[3] = { header.getScaleX(), header.getScaleY(), header.getScaleZ() };
+    const double offset[3] = { header.getOffsetX(), header.getOffsetY(), header.getOffsetZ() };
+    return run(block.size(), [this, &block, &batch, &scale, &offset](size_t i, Scratch& scratch, std::vector<WaveformReturn>& out)
+    {
+        if (batch.hasData(i))
+            decompose(batch.getData(i), batch.getSize(i),
+                      block.getRawX(i) * scale[0] + offset[0],
+                      block.getRawY(i) * scale[1] + offset[1],
+                      block.getRawZ(i) * scale[2] + offset[2], i, scratch, out);
+    }, returns);
+}
+
+size_t WaveformDecomposer::run(size_t count, Task const& task, std::vector<WaveformReturn>& returns)
+{
+    returns.clear();
+    const size_t batchSize = m_batchSize;
+    const size_t batches = (count + batchSize - 1) / batchSize;
+    size_t workers = m_concurrency ? m_concurrency : ThreadPool::getDefaultSize();
+    workers = std::min(workers, batches);
+
+    if (workers <= 1)
+    {
+        Scratch& scratch = getScratch(0);
+        for (size_t i = 0; i < count; ++i)
+            task(i, scratch, returns);
+        return returns.size();
+    }
+
+    for (size_t w = 0; w < workers; ++w)
+        getScratch(w);
+    if (!m_pool)
+        m_pool.reset(new ThreadPool(workers - 1));
+
+    // workers claim batches as they become free; the returns of a batch are
+    // kept apart so that they join in order
+    std::vector<std::vector<WaveformReturn> > results(batches);
+    std::vector<std::shared_ptr<Scratch> >& scratch = m_scratch;
+    m_pool->parallelFor(count, batchSize, [&task, &results, &scratch, batchSize](size_t begin, size_t end, size_t worker)
+    {
+        std::vector<WaveformReturn>& out = results[begin / batchSize];
+        for (size_t i = begin; i < end; ++i)
+            task(i, *scratch[worker], out);
+    }, workers);
+
+    size_t total = 0;
+    for (size_t b = 0; b < batches; ++b)
+        total += results[b].size();
+    returns.reserve(total);
+    for (size_t b = 0; b < batches; ++b)
+        returns.insert(returns.end(), results[b].begin(), results[b].end());
+    return returns.size();
+}
+
+uint64_t WaveformDecomposer::write(std::vector<Point> const& points, std::vector<WaveformReturn> const& returns,
+                                   Writer& writer) const
+{
+    Header const& header = writer.getHeader();
+    Schema const& schema = header.getSchema();
+    FieldAccessor returnNumber;
+    FieldAccessor returnCount;
+    FieldAccessor intensity;
+    returnNumber.bind(schema, FI_ReturnNumber);
+    returnCount.bind(schema, FI_NumberOfReturns);
+    intensity.bind(schema, FI_Intensity);
+
+    Point out(&header);
+    uint64_t written = 0;
+    for (size_t i = 0; i < returns.size(); )
+    {
+        // the returns of one packet
+        size_t end = i + 1;
+        while (end < returns.size() && returns[end].point == returns[i].point && returns[end].band == returns[i].band)
+            ++end;
+
+        if (returns[i].point >= points.size())
+            throw libhsl_error("waveform return refers to a point that was not decomposed");
+        std::vector<uint8_t> const& source = points[returns[i].point].getData();
+        if (source.size() != header.getDataRecordLength())
+            throw libhsl_error("waveform returns must be written with the schema of their points");
+
+        for (size_t k = i; k < end; ++k)
+        {
+            WaveformReturn const& r = returns[k];
+            out.getData() = source;
+            out.setCoordinates(r.x, r.y, r.z);
+            uint8_t* record = &out.getData().front();
+            if (returnNumber.isBound())
+                returnNumber.setValue(record, static_cast<double>(k - i + 1));
+            if (returnCount.isBound())
+                returnCount.setValue(record, static_cast<double>(end - i));
+            if (intensity.isBound())
+                intensity.setValue(record, r.amplitude);
+            writer.writePoint(out);
+            ++written;
+        }
+        i = end;
+    }
+    return written;
+}
+
+}
@@ -0,0 +1,215 @@
+/*************************************************************************************
+ * 
+ * 
+ * Copyright (c) 2021, Zhengjun Liu <zjliu@casm.ac.cn>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ ************************************************************************************/
+
+#include "WaveformExtractor.h"
+#include <cmath>
+#include <cstring>
+#include <future>
+#include "Reader.h"
+#include "Writer.h"
+#include "Transform.h"
+#include "Exception.h"
+
+namespace hsl
+{
+
+namespace
+{
+
+// fields that the extraction sets itself
+std::vector<FieldId> derivedFields()
+{
+    const FieldId ids[] = { FI_X, FI_Y, FI_Z, FI_Intensity, FI_ReturnNumber, FI_NumberOfReturns,
+                            FI_BandValue, FI_ByteOffsetToWaveformData, FI_WaveformDataSize };
+    return std::vector<FieldId>(ids, ids + sizeof(ids) / sizeof(ids[0]));
+}
+
+}
+
+WaveformExtractor::WaveformExtractor(Reader& reader, Writer& writer)
+    : m_reader(reader)
+    , m_writer(writer)
+    , m_decomposer(reader.getHeader())
+    , m_referenceBand(0)
+    , m_blockSize(4096)
+{
+}
+
+void WaveformExtractor::bind()
+{
+    Schema const& source = m_reader.getHeader().getSchema();
+    Schema const& target = m_writer.getHeader().getSchema();
+
+    m_copier.bind(source, target, derivedFields());
+
+    m_bands.clear();
+    FieldAccessor band;
+    while (band.bind(target, FI_BandValue, m_bands.size()))
+        m_bands.push_back(band);
+
+    m_intensity = FieldAccessor();
+    m_returnNumber = FieldAccessor();
+    m_returnCount = FieldAccessor();
+    m_intensity.bind(target, FI_Intensity);
+    m_returnNumber.bind(target, FI_ReturnNumber);
+    m_returnCount.bind(target, FI_NumberOfReturns);
+}
+
+void WaveformExtractor::extract(PointBlock const& block, std::vector<WaveformReturn> const& returns, PointBlock& out)
+{
+    out.clear();
+    m_x.clear();
+    m_y.clear();
+    m_z.clear();
+
+    const size_t length = out.getRecordLength();
+    for (size_t i = 0; i < returns.size(); )
+    {
+        // the returns of one point, ordered by band and time
+        size_t end = i + 1;
+        while (end < returns.size() && returns[end].point == returns[i].point)
+            ++end;
+
+        size_t first = i;
+        while (first < end && returns[first].band != m_referenceBand)
+            ++first;
+        size_t last = first;
+        while (last < end && returns[last].band == m_referenceBand)
+            ++last;
+
+        const uint8_t* source = block.getRecord(static_cast<size_t>(returns[i].point));
+        uint32_t id = block.getId(static_cast<size_t>(returns[i].point));
+        for (size_t k = first; k < last; ++k)
+        {
+            WaveformReturn const& r = returns[k];
+            uint8_t* record = out.appendRecords(id, 1);
+            std::memset(record, 0, length);
+
+            m_copier.copy(source, record);
+
+            // amplitude of each band at the time of the return
+            for (size_t j = i; j < end; ++j)
+            {
+                WaveformReturn const& other = returns[j];
+                if (other.band >= m_bands.size())
+                    continue;
+                double tolerance = 2.0 * std::max(r.width, other.width);
+                if (std::fabs(other.time - r.time) > tolerance)
+                    continue;
+
+                // the closest return of the band wins
+                bool closest = true;
+                for (size_t o = i; o < end && closest; ++o)
+                {
+                    if (o != j && returns[o].band == other.band &&
+                        std::fabs(returns[o].time - r.time) < std::fabs(other.time - r.time))
+                        closest = false;
+                }
+                if (closest)
+                    m_bands[other.band].setValue(record, other.amplitude);
+            }
+
+            if (m_intensity.isBound())
+                m_intensity.setValue(record, r.amplitude);
+            if (m_returnNumber.isBound())
+                m_returnNumber.setValue(record, static_cast<double>(k - first + 1));
+            if (m_returnCount.isBound())
+                m_returnCount.setValue(record, static_cast<double>(last - first));
+
+            m_x.push_back(r.x);
+            m_y.push_back(r.y);
+            m_z.push_back(r.z);
+        }
+        i = end;
+    }
+
+    if (!out.empty())
+        detail::encodeCoordinates(out, *out.getHeader(), &m_x[0], &m_y[0], &m_z[0]);
+}
+
+uint64_t WaveformExtractor::run()
+{
+    Header const& header = m_reader.getHeader();
+    if (!header.hasWaveformData())
+        throw libhsl_error("the input of a waveform extraction has no waveform data");
+    if (m_writer.getHeader().hasWaveformData())
+        throw libhsl_error("the output of a waveform extraction cannot carry waveform data");
+    bind();
+
+    // two input and two output blocks: the next block is read and the last
+    // one written while the current one is decomposed
+    PointBlock in[2] = { PointBlock(&header, m_blockSize), PointBlock(&header, m_blockSize) };
+    WaveformBatch batches[2];
+    PointBlock out[2] = { PointBlock(&m_writer.getHeader()), PointBlock(&m_writer.getHeader()) };
+
+    Reader& reader = m_reader;
+    const uint32_t blockSize = m_blockSize;
+    auto read = [&reader, blockSize](PointBlock* block, WaveformBatch* batch)
+    {
+        if (!reader.readNextBlock(*block, blockSize))
+            return false;
+        if (!reader.readWaveforms(*block, *batch))
+            throw libhsl_error("cannot read the waveform data of the points");
+        return true;
+    };
+    Writer& writer = m_writer;
+    auto write = [&writer](PointBlock const* block)
+    {
+        if (!writer.writeBlock(*block))
+            throw libhsl_error("cannot write the points extracted from waveforms");
+    };
+
+    uint64_t written = 0;
+    size_t current = 0;
+    size_t output = 0;
+    std::future<void> writing;
+    std::future<bool> reading = std::async(std::launch::async, read, &in[0], &batches[0]);
+    while (reading.get())
+    {
+        PointBlock const& block = in[current];
+        WaveformBatch const& batch = batches[current];
+        current ^= 1;
+        reading = std::async(std::launch::async, read, &in[current], &batches[current]);
+
+        m_decomposer.decompose(block, batch, m_returns);
+        extract(block, m_returns, out[output]);
+        written += out[output].size();
+
+        if (writing.valid())
+            writing.get();
+        writing = std::async(std::launch::async, write, &out[output]);
+        output ^= 1;
+    }
+    if (writing.valid())
+        writing.get();
+
+    return written;
+}
+
+}
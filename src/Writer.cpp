@@ -35,6 +35,9 @@
 #include <cstdlib> // std::size_t
 #include <cassert>
 #include <stddef.h>
+#include <cstring>
+#include <limits>
+#include <algorithm>
 
 #ifdef WIN32
 #include <windows.h>
@@ -42,17 +45,21 @@
 #else
 #include <unistd.h>
 #endif
+#include "detail/private_utility.hpp"
 
 
 namespace hsl 
 {
 
 
-Writer::Writer() : FileIO(), _pointCount(0)
+Writer::Writer() : FileIO(), _pointCount(0), _totalPointCount(0), _waveformOffset(0), _chunkSize(0), _defaultZoneMapFields(true),
+    _chunkTableFailed(false)
 {
 }
 
-Writer::Writer(std::string filename, const Header &header) : FileIO(filename), _pointCount(0)
+Writer::Writer(std::string filename, const Header &header) : FileIO(filename), _pointCount(0), _totalPointCount(0),
+    _waveformOffset(0), _chunkSize(0), _defaultZoneMapFields(true),
+    _chunkTableFailed(false)
 {
     setHeader(header);
 	if (header.hasWaveformData())
@@ -68,9 +75,18 @@ bool Writer::open()
 	if (_fp == nullptr)
 		return false;
 
+	// a chunk table inherited from a source header does not describe this file
+	_header->setChunkTableOffset(0);
+	_zoneMap.clear();
+	_chunkTableFailed = false;
+
 	if (!writeHeader())
 		return false;
 
+	// internal waveform records are packed one after another behind the
+	// space reserved for the point records
+	_waveformOffset = _header->getDataOffset() + _totalPointCount * _header->getDataRecordLength();
+
 	// extend file to guarantee we have enough space to store points 
 	// so that waveform data can be written simultaneously.
 	if (getHeader().hasWaveformData() && getHeader().isInternalWaveformData())
@@ -92,7 +108,14 @@ bool Writer::open()
 
 void Writer::close()
 {
+    if (_fp == nullptr)
+        return;
+
+    if (_chunkSize > 0)
+        _chunkTableFailed = !writeChunkTable();
+    updatePointCount(_pointCount);
     fclose(_fp);
+    _fp = nullptr;
 }
 
 void Writer::updatePointCount(uint64_t count)
@@ -125,16 +148,26 @@ bool Writer::writePoint(Point & point)
 		if (point.hasWaveformData())
 		{
 			std::vector<uint8_t> const& waveformData = point.getWaveformData();
-			offset = _header->getDataOffset() + _totalPointCount * _header->getDataRecordLength();
+			offset = _waveformOffset;
 			size = waveformData.size();
-			point.setWaveformDataAddress(offset, size);
+			_waveformOffset += size;
 		}
+		// a point without waveform must not keep the address it had in its source file
+		point.setWaveformDataAddress(offset, size);
 	}
 
 	std::vector<uint8_t> const& data = point.getData();
 	fwrite(&data.front(), _header->getDataRecordLength(), 1, _fp);
 	_pointCount++;
 
+	if (_chunkSize > 0)
+	{
+		if (_zoneMap.getChunkSize() == 0)
+			_zoneMap.create(*_header, _chunkSize,
+				_defaultZoneMapFields ? ZoneMap::getDefaultFields(_header->getSchema()) : _zoneMapFields);
+		_zoneMap.add(&data.front());
+	}
+
 	if (getHeader().hasWaveformData())
 	{
 		if (point.hasWaveformData())
@@ -143,10 +176,11 @@ bool Writer::writePoint(Point & point)
 			if (getHeader().isInternalWaveformData())
 			{
 				// write waveform data to the file
-				long pre = ftell(_fp);
-				fseek(_fp, offset, SEEK_SET);
-				fwrite(&waveformData.front(), size, 1, _fp);
-				fseek(_fp, pre, SEEK_SET);    // back to previous position     
+				uint64_t pre = detail::tell64(_fp);
+				if (detail::seek64(_fp, offset, SEEK_SET) != 0 ||
+					fwrite(&waveformData.front(), size, 1, _fp) != 1 ||
+					detail::seek64(_fp, pre, SEEK_SET) != 0)    // back to previous position     
+					return false;
 			}
 			else
 			{
@@ -159,6 +193,59 @@ bool Writer::writePoint(Point & point)
 	return true;
 }
 
+void Writer::setChunkSize(uint32_t count)
+{
+    if (_pointCount > 0)
+        throw std::runtime_error("chunk size must be set before the first point is written");
+
+    _chunkSize = count;
+}
+
+void Writer::setZoneMapFields(ZoneMapFieldArray const& fields)
+{
+    if (_pointCount > 0)
+        throw std::runtime_error("zone map fields must be set before the first point is written");
+
+    _zoneMapFields = fields;
+    _defaultZoneMapFields = false;
+}
+
+bool Writer::writeChunkTable()
+{
+    if (_zoneMap.getChunkCount() == 0)
+        return true;
+
+    // append behind everything, including the space reserved for points
+    // and any waveform data
+    if (detail::seek64(_fp, 0, SEEK_END) != 0)
+        return false;
+    uint64_t pos = detail::tell64(_fp);
+
+    if (!_zoneMap.write(_fp))
+        return false;
+
+    _header->setChunkTableOffset(pos);
+    return detail::seek64(_fp, offsetof(FileHeader, chunkTableOffset), SEEK_SET) == 0 &&
+        fwrite(&pos, sizeof(pos), 1, _fp) == 1;
+}
+
+bool Writer::writeBlock(PointBlock const& block)
+{
+    if (block.empty())
+        return true;
+    if (block.getRecordLength() != _header->getDataRecordLength())
+        throw libhsl_error("block record length does not match the writer header");
+
+    Point point(_header.get());
+    for (size_t i = 0; i < block.size(); ++i)
+    {
+        block.getPoint(i, point);
+        if (!writePoint(point))
+            return false;
+    }
+    return true;
+}
+
 bool Writer::writePoint(const Point & point)
 {
 	Point pt = point;
@@ -176,7 +263,7 @@ Writer::~Writer()
     // care if we weren't able to write it.
     try
     {
-        updatePointCount(_pointCount);
+        close();
         
     } catch (std::runtime_error const&)
     {
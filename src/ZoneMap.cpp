@@ -0,0 +1,282 @@
+/*************************************************************************************
+ * 
+ * 
+ * Copyright (c) 2021, Zhengjun Liu <zjliu@casm.ac.cn>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ ************************************************************************************/
+
+#include "ZoneMap.h"
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include "Header.h"
+#include "Schema.h"
+
+namespace hsl
+{
+
+ZoneMap::ZoneMap() : _header(0), _chunkSize(0)
+{
+    clear();
+}
+
+void ZoneMap::clear()
+{
+    _header = 0;
+    _chunkSize = 0;
+    _chunks.clear();
+    _fields.clear();
+    _accessors.clear();
+    _ranges.clear();
+    for (int d = 0; d < 3; ++d)
+    {
+        _scale[d] = 1.0;
+        _offset[d] = 0.0;
+    }
+}
+
+void ZoneMap::setCoordinateTransform(Header const& header)
+{
+    _header = &header;
+    _scale[0] = header.getScaleX();
+    _scale[1] = header.getScaleY();
+    _scale[2] = header.getScaleZ();
+    _offset[0] = header.getOffsetX();
+    _offset[1] = header.getOffsetY();
+    _offset[2] = header.getOffsetZ();
+}
+
+void ZoneMap::create(Header const& header, uint32_t chunkSize, ZoneMapFieldArray const& fields)
+{
+    clear();
+    setCoordinateTransform(header);
+    _chunkSize = chunkSize;
+
+    // keep the fields that can be decoded
+    for (ZoneMapFieldArray::const_iterator f = fields.begin(); f != fields.end(); ++f)
+    {
+        FieldAccessor accessor;
+        if (accessor.bind(header.getSchema(), f->first, f->second))
+        {
+            _fields.push_back(*f);
+            _accessors.push_back(accessor);
+        }
+    }
+}
+
+ZoneMapFieldArray ZoneMap::getDefaultFields(Schema const& schema)
+{
+    ZoneMapFieldArray fields;
+    if (schema.getFieldCountById(FI_GNSSTime) > 0)
+        fields.push_back(ZoneMapField(FI_GNSSTime, 0));
+    if (schema.getFieldCountById(FI_Classification) > 0)
+        fields.push_back(ZoneMapField(FI_Classification, 0));
+    for (size_t n = 0; n < schema.getBandCount(); ++n)
+        fields.push_back(ZoneMapField(FI_BandValue, n));
+    return fields;
+}
+
+void ZoneMap::add(const uint8_t* record)
+{
+    int32_t x, y, z;
+    std::memcpy(&x, record, sizeof(int32_t));
+    std::memcpy(&y, record + 4, sizeof(int32_t));
+    std::memcpy(&z, record + 8, sizeof(int32_t));
+
+    const size_t fieldCount = _fields.size();
+    if (_chunks.empty() || _chunks.back().pointCount == _chunkSize)
+    {
+        ChunkBounds chunk;
+        chunk.firstPoint = _chunks.empty() ? 0 : _chunks.back().firstPoint + _chunks.back().pointCount;
+        chunk.pointCount = 0;
+        chunk.minX = chunk.minY = chunk.minZ = (std::numeric_limits<int32_t>::max)();
+        chunk.maxX = chunk.maxY = chunk.maxZ = (std::numeric_limits<int32_t>::min)();
+        _chunks.push_back(chunk);
+
+        for (size_t f = 0; f < fieldCount; ++f)
+        {
+            _ranges.push_back(std::numeric_limits<double>::infinity());
+            _ranges.push_back(-std::numeric_limits<double>::infinity());
+        }
+    }
+
+    ChunkBounds& c = _chunks.back();
+    c.pointCount++;
+    c.minX = (std::min)(c.minX, x);
+    c.minY = (std::min)(c.minY, y);
+    c.minZ = (std::min)(c.minZ, z);
+    c.maxX = (std::max)(c.maxX, x);
+    c.maxY = (std::max)(c.maxY, y);
+    c.maxZ = (std::max)(c.maxZ, z);
+
+    double* range = &_ranges[(_chunks.size() - 1) * fieldCount * 2];
+    for (size_t f = 0; f < fieldCount; ++f, range += 2)
+    {
+        double v = _accessors[f].getValue(record);
+        range[0] = (std::min)(range[0], v);
+        range[1] = (std::max)(range[1], v);
+    }
+}
+
+bool ZoneMap::write(std::FILE* fp) const
+{
+    ChunkTableHeader table;
+    std::memset(&table, 0, sizeof(table));
+    std::memcpy(table.signature, "HSCT", 4);
+    table.majorVersion = 1;
+    table.minorVersion = 1;
+    table.chunkSize = _chunkSize;
+    table.chunkCount = static_cast<uint32_t>(_chunks.size());
+
+    if (fwrite(&table, sizeof(table), 1, fp) != 1 ||
+        (!_chunks.empty() && fwrite(&_chunks.front(), sizeof(ChunkBounds), _chunks.size(), fp) != _chunks.size()))
+        return false;
+
+    ZoneMapHeader zones;
+    std::memcpy(zones.signature, "HSZM", 4);
+    zones.fieldCount = static_cast<uint32_t>(_fields.size());
+    if (fwrite(&zones, sizeof(zones), 1, fp) != 1)
+        return false;
+
+    for (ZoneMapFieldArray::const_iterator f = _fields.begin(); f != _fields.end(); ++f)
+    {
+        ZoneMapFieldRecord record;
+        record.fieldId = static_cast<uint16_t>(f->first);
+        record.reserved = 0;
+        record.index = static_cast<uint32_t>(f->second);
+        if (fwrite(&record, sizeof(record), 1, fp) != 1)
+            return false;
+    }
+
+    return _ranges.empty() || fwrite(&_ranges.front(), sizeof(double), _ranges.size(), fp) == _ranges.size();
+}
+
+bool ZoneMap::read(std::FILE* fp, Header const& header)
+{
+    clear();
+
+    ChunkTableHeader table;
+    if (fread(&table, sizeof(table), 1, fp) != 1 || std::memcmp(table.signature, "HSCT", 4) != 0 ||
+        table.majorVersion != 1 || table.chunkSize == 0)
+        return false;
+
+    // the chunks must cover the points of header exactly
+    const uint64_t points = header.getPointRecordsCount();
+    if (table.chunkCount != (points + table.chunkSize - 1) / table.chunkSize)
+        return false;
+
+    ChunkBoundsArray chunks(table.chunkCount);
+    if (table.chunkCount > 0 && fread(&chunks.front(), sizeof(ChunkBounds), table.chunkCount, fp) != table.chunkCount)
+        return false;
+
+    // findChunk relies on chunk i starting at point i * chunkSize
+    for (size_t i = 0; i < chunks.size(); ++i)
+    {
+        const uint64_t first = static_cast<uint64_t>(i) * table.chunkSize;
+        if (chunks[i].firstPoint != first ||
+            chunks[i].pointCount != (std::min)(static_cast<uint64_t>(table.chunkSize), points - first))
+            return false;
+    }
+
+    setCoordinateTransform(header);
+    _chunkSize = table.chunkSize;
+    _chunks.swap(chunks);
+
+    // tables from before version 1.1 end here
+    ZoneMapHeader zones;
+    if (table.minorVersion < 1 || fread(&zones, sizeof(zones), 1, fp) != 1 ||
+        std::memcmp(zones.signature, "HSZM", 4) != 0)
+        return true;
+
+    // each summarized field is a field of the schema
+    Schema const& schema = header.getSchema();
+    if (zones.fieldCount > schema.getFieldCount())
+        return false;
+
+    ZoneMapFieldArray fields;
+    for (uint32_t i = 0; i < zones.fieldCount; ++i)
+    {
+        ZoneMapFieldRecord record;
+        if (fread(&record, sizeof(record), 1, fp) != 1)
+            return true;
+        FieldId id = static_cast<FieldId>(record.fieldId);
+        if (record.index >= schema.getFieldCountById(id))
+            return false;
+        fields.push_back(ZoneMapField(id, record.index));
+    }
+
+    std::vector<double> ranges(_chunks.size() * fields.size() * 2);
+    if (!ranges.empty() && fread(&ranges.front(), sizeof(double), ranges.size(), fp) != ranges.size())
+        return true;
+
+    _fields.swap(fields);
+    _ranges.swap(ranges);
+    return true;
+}
+
+size_t ZoneMap::findChunk(uint64_t n) const
+{
+    if (_chunkSize == 0)
+        return _chunks.size();
+
+    // chunks are regular, only the last one may be shorter
+    size_t chunk = static_cast<size_t>(n / _chunkSize);
+    if (chunk >= _chunks.size() || n >= _chunks[chunk].firstPoint + _chunks[chunk].pointCount)
+        return _chunks.size();
+    return chunk;
+}
+
+bool ZoneMap::getRange(size_t chunk, FieldId id, size_t n, double& minimum, double& maximum) const
+{
+    if (chunk >= _chunks.size())
+        return false;
+
+    if ((id == FI_X || id == FI_Y || id == FI_Z) && n == 0)
+    {
+        ChunkBounds const& c = _chunks[chunk];
+        int d = id == FI_X ? 0 : (id == FI_Y ? 1 : 2);
+        const int32_t lo[3] = { c.minX, c.minY, c.minZ };
+        const int32_t hi[3] = { c.maxX, c.maxY, c.maxZ };
+        double a = lo[d] * _scale[d] + _offset[d];
+        double b = hi[d] * _scale[d] + _offset[d];
+        minimum = (std::min)(a, b);
+        maximum = (std::max)(a, b);
+        return true;
+    }
+
+    for (size_t f = 0; f < _fields.size(); ++f)
+    {
+        if (_fields[f].first == id && _fields[f].second == n)
+        {
+            const double* range = &_ranges[(chunk * _fields.size() + f) * 2];
+            minimum = range[0];
+            maximum = range[1];
+            return true;
+        }
+    }
+    return false;
+}
+
+}
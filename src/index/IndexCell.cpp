@@ -0,0 +1,217 @@
+/*************************************************************************************
+ * 
+ * 
+ * Copyright (c) 2021, Zhengjun Liu <zjliu@casm.ac.cn>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ ************************************************************************************/
+
+#include "index/IndexCell.h"
+#include <cmath>
+#include <limits>
+
+namespace hsl { namespace detail {
+
+IndexCell::IndexCell() : 
+	m_FileOffset(0), 
+	m_NumPoints(0), 
+	m_MinZ((std::numeric_limits<ElevExtrema>::max)()), 
+	m_MaxZ((std::numeric_limits<ElevExtrema>::min)())
+{
+} // IndexCell::IndexCell
+
+void IndexCell::SetFileOffset(TempFileOffsetType fos)
+{
+	m_FileOffset = fos;
+} // IndexCell::SetFileOffset
+
+void IndexCell::SetNumPoints(uint32_t nmp)
+{
+	m_NumPoints = nmp;
+} // IndexCell::SetNumPoints
+
+TempFileOffsetType IndexCell::GetFileOffset(void) const
+{
+	return (m_FileOffset);
+} // IndexCell::GetFileOffset
+
+uint32_t IndexCell::GetNumRecords(void) const
+{
+	return static_cast<uint32_t>(m_PtRecords.size());
+} // IndexCell::GetNumRecords
+
+uint32_t IndexCell::GetNumPoints(void) const
+{
+	return (m_NumPoints);
+} // IndexCell::GetNumPoints
+
+uint32_t IndexCell::GetNumSubCellRecords(void) const
+{
+	return static_cast<uint32_t>(m_SubCellRecords.size());
+} // IndexCell::GetNumSubCellRecords
+
+uint32_t IndexCell::GetNumZCellRecords(void) const
+{
+	return static_cast<uint32_t>(m_ZCellRecords.size());
+} // IndexCell::GetNumZCellRecords
+
+bool IndexCell::RoomToAdd(uint32_t a)
+{
+	IndexCellData::iterator MapIt = m_PtRecords.find(a);
+	return (MapIt == m_PtRecords.end() || MapIt->second < (std::numeric_limits<ConsecPtAccumulator>::max)());
+} // IndexCell::RoomToAdd
+
+void IndexCell::AddPointRecord(uint32_t a)
+{
+	m_PtRecords[a] = 1;
+	++m_NumPoints;
+} // IndexCell::AddPointRecord
+
+void IndexCell::AddPointRecord(uint32_t a, ConsecPtAccumulator b)
+{
+	m_PtRecords[a] = b;
+	m_NumPoints += b;
+} // IndexCell::AddPointRecord
+
+bool IndexCell::IncrementPointRecord(uint32_t a)
+{
+	IndexCellData::iterator MapIt = m_PtRecords.find(a);
+	if (MapIt != m_PtRecords.end() && MapIt->second < (std::numeric_limits<ConsecPtAccumulator>::max)())
+	{
+		++MapIt->second;
+		++m_NumPoints;
+		return true;
+	} // if
+	return false;
+} // IndexCell::IncrementPointRecord
+
+void IndexCell::RemoveMainRecords(void)
+{
+	m_PtRecords.clear();
+} // IndexCell::RemoveMainRecords
+
+void IndexCell::RemoveAllRecords(void)
+{
+	m_PtRecords.clear();
+	m_ZCellRecords.clear();
+	m_SubCellRecords.clear();
+} // IndexCell::RemoveAllRecords
+
+void IndexCell::UpdateZBounds(double TestZ)
+{
+	if (TestZ > (std::numeric_limits<ElevExtrema>::max)())
+		m_MaxZ = (std::numeric_limits<ElevExtrema>::max)();
+	else if (TestZ < (std::numeric_limits<ElevExtrema>::min)())
+		m_MinZ = (std::numeric_limits<ElevExtrema>::min)();
+	else
+	{
+		if (TestZ > m_MaxZ)
+			m_MaxZ = static_cast<ElevExtrema>(ceil(TestZ));
+		if (TestZ < m_MinZ)
+			m_MinZ = static_cast<ElevExtrema>(floor(TestZ));
+	} // else
+} // IndexCell::UpdateZBounds
+
+ElevRange IndexCell::GetZRange(void) const
+{
+	return (m_MaxZ > m_MinZ ? static_cast<ElevRange>(m_MaxZ - m_MinZ): 0);
+} // IndexCell::GetZRange
+
+void IndexCell::AddZCell(uint32_t a, uint32_t b)
+{
+	m_ZCellRecords[a][b] = 1;
+} // IndexCell::AddZCell
+
+bool IndexCell::IncrementZCell(uint32_t a, uint32_t b)
+{
+	IndexSubCellData::iterator OuterIt = m_ZCellRecords.find(a);
+	if (OuterIt != m_ZCellRecords.end())
+	{
+		IndexCellData::iterator InnerIt = OuterIt->second.find(b);
+		if (InnerIt != OuterIt->second.end() && InnerIt->second < (std::numeric_limits<ConsecPtAccumulator>::max)())
+		{
+			++InnerIt->second;
+			return true;
+		} // if
+	} // if
+	return false;
+} // IndexCell::IncrementZCell
+
+void IndexCell::AddSubCell(uint32_t a, uint32_t b)
+{
+	m_SubCellRecords[a][b] = 1;
+} // IndexCell::AddSubCell
+
+bool IndexCell::IncrementSubCell(uint32_t a, uint32_t b)
+{
+	IndexSubCellData::iterator OuterIt = m_SubCellRecords.find(a);
+	if (OuterIt != m_SubCellRecords.end())
+	{
+		IndexCellData::iterator InnerIt = OuterIt->second.find(b);
+		if (InnerIt != OuterIt->second.end() && InnerIt->second < (std::numeric_limits<ConsecPtAccumulator>::max)())
+		{
+			++InnerIt->second;
+			return true;
+		} // if
+	} // if
+	return false;
+} // IndexCell::IncrementSubCell
+
+ConsecPtAccumulator IndexCell::GetPointRecordCount(uint32_t a)
+{
+	IndexCellData::iterator MapIt = m_PtRecords.find(a);
+	return (MapIt != m_PtRecords.end() ? MapIt->second: 0);
+} // IndexCell::GetPointRecordCount
+
+const IndexCellData::iterator IndexCell::GetFirstRecord(void)
+{
+	return (m_PtRecords.begin());
+} // IndexCell::GetFirstRecord
+
+const IndexCellData::iterator IndexCell::GetEnd(void)
+{
+	return (m_PtRecords.end());
+} // IndexCell::GetEnd
+
+const IndexSubCellData::iterator IndexCell::GetFirstSubCellRecord(void)
+{
+	return (m_SubCellRecords.begin());
+} // IndexCell::GetFirstSubCellRecord
+
+const IndexSubCellData::iterator IndexCell::GetEndSubCell(void)
+{
+	return (m_SubCellRecords.end());
+} // IndexCell::GetEndSubCell
+
+const IndexSubCellData::iterator IndexCell::GetFirstZCellRecord(void)
+{
+	return (m_ZCellRecords.begin());
+} // IndexCell::GetFirstZCellRecord
+
+const IndexSubCellData::iterator IndexCell::GetEndZCell(void)
+{
+	return (m_ZCellRecords.end());
+} // IndexCell::GetEndZCell
+
+}} // namespace hsl::detail
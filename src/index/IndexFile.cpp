@@ -0,0 +1,199 @@
+/*************************************************************************************
+ * 
+ * 
+ * Copyright (c) 2021, Zhengjun Liu <zjliu@casm.ac.cn>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ ************************************************************************************/
+
+#include "index/IndexFile.h"
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+namespace hsl { namespace detail {
+
+IndexFile::IndexFile() : m_base(0), m_size(0), m_header(0), m_cells(0), m_ranges(0)
+#ifdef _WIN32
+	, m_fileHandle(INVALID_HANDLE_VALUE), m_mapHandle(0)
+#else
+	, m_fd(-1)
+#endif
+{
+} // IndexFile::IndexFile
+
+IndexFile::~IndexFile()
+{
+	Close();
+} // IndexFile::~IndexFile
+
+bool IndexFile::Open(std::string const& filename)
+{
+	Close();
+
+#ifdef _WIN32
+	m_fileHandle = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 
+		FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, NULL);
+	if (m_fileHandle == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER fileSize;
+	if (! GetFileSizeEx(m_fileHandle, &fileSize) || fileSize.QuadPart < (LONGLONG)sizeof(IndexFileHeader))
+	{
+		Close();
+		return false;
+	} // if
+	m_size = fileSize.QuadPart;
+	m_mapHandle = CreateFileMappingA(m_fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (! m_mapHandle)
+	{
+		Close();
+		return false;
+	} // if
+	m_base = static_cast<const uint8_t *>(MapViewOfFile(m_mapHandle, FILE_MAP_READ, 0, 0, 0));
+	if (! m_base)
+	{
+		Close();
+		return false;
+	} // if
+#else
+	m_fd = open(filename.c_str(), O_RDONLY);
+	if (m_fd < 0)
+		return false;
+	struct stat st;
+	if (fstat(m_fd, &st) != 0 || st.st_size < (off_t)sizeof(IndexFileHeader))
+	{
+		Close();
+		return false;
+	} // if
+	m_size = st.st_size;
+	void *addr = mmap(0, m_size, PROT_READ, MAP_SHARED, m_fd, 0);
+	if (addr == MAP_FAILED)
+	{
+		Close();
+		return false;
+	} // if
+	m_base = static_cast<const uint8_t *>(addr);
+#endif
+
+	m_header = reinterpret_cast<IndexFileHeader const *>(m_base);
+	if (! Verify())
+	{
+		Close();
+		return false;
+	} // if
+	m_cells = reinterpret_cast<IndexFileCell const *>(m_base + m_header->cellTableOffset);
+	m_ranges = reinterpret_cast<IndexFileRange const *>(m_base + m_header->rangeTableOffset);
+	return true;
+} // IndexFile::Open
+
+void IndexFile::Close(void)
+{
+#ifdef _WIN32
+	if (m_base)
+		UnmapViewOfFile(m_base);
+	if (m_mapHandle)
+		CloseHandle(m_mapHandle);
+	if (m_fileHandle != INVALID_HANDLE_VALUE)
+		CloseHandle(m_fileHandle);
+	m_mapHandle = 0;
+	m_fileHandle = INVALID_HANDLE_VALUE;
+#else
+	if (m_base)
+		munmap(const_cast<uint8_t *>(m_base), m_size);
+	if (m_fd >= 0)
+		close(m_fd);
+	m_fd = -1;
+#endif
+	m_base = 0;
+	m_size = 0;
+	m_header = 0;
+	m_cells = 0;
+	m_ranges = 0;
+} // IndexFile::Close
+
+bool IndexFile::Verify(void) const
+{
+	if (memcmp(m_header->signature, LIBHSL_INDEXFILE_SIGNATURE, sizeof(m_header->signature)) != 0)
+		return false;
+	if (m_header->versionMajor != LIBHSL_INDEXFILE_VERSIONMAJOR)
+		return false;
+	if (m_header->cellsX == 0 || m_header->cellsY == 0)
+		return false;
+	uint64_t cellTableSize = (uint64_t)m_header->cellsX * m_header->cellsY * sizeof(IndexFileCell);
+	uint64_t rangeTableSize = (uint64_t)m_header->rangeCount * sizeof(IndexFileRange);
+	if (m_header->cellTableOffset < sizeof(IndexFileHeader) || m_header->cellTableOffset + cellTableSize > m_size)
+		return false;
+	if (m_header->rangeTableOffset < m_header->cellTableOffset + cellTableSize || 
+		m_header->rangeTableOffset + rangeTableSize > m_size)
+		return false;
+
+	// every cell must refer to ranges inside the range table
+	IndexFileCell const* cells = reinterpret_cast<IndexFileCell const *>(m_base + m_header->cellTableOffset);
+	uint64_t cellCount = (uint64_t)m_header->cellsX * m_header->cellsY;
+	for (uint64_t i = 0; i < cellCount; ++i)
+	{
+		if ((uint64_t)cells[i].firstRange + cells[i].rangeCount > m_header->rangeCount)
+			return false;
+	} // for
+	return true;
+} // IndexFile::Verify
+
+bool IndexFile::Write(std::string const& filename, IndexFileHeader& header, 
+	std::vector<IndexFileCell> const& cells, std::vector<IndexFileRange> const& ranges)
+{
+	if (cells.size() != (size_t)header.cellsX * header.cellsY)
+		return false;
+
+	memcpy(header.signature, LIBHSL_INDEXFILE_SIGNATURE, sizeof(header.signature));
+	header.versionMajor = LIBHSL_INDEXFILE_VERSIONMAJOR;
+	header.versionMinor = LIBHSL_INDEXFILE_VERSIONMINOR;
+	header.reserved = 0;
+	header.rangeCount = static_cast<uint32_t>(ranges.size());
+	header.cellTableOffset = sizeof(IndexFileHeader);
+	header.rangeTableOffset = header.cellTableOffset + cells.size() * sizeof(IndexFileCell);
+
+	FILE *fp = fopen(filename.c_str(), "wb");
+	if (! fp)
+		return false;
+	bool Success = (fwrite(&header, sizeof(IndexFileHeader), 1, fp) == 1);
+	if (Success && ! cells.empty())
+		Success = (fwrite(&cells[0], sizeof(IndexFileCell), cells.size(), fp) == cells.size());
+	if (Success && ! ranges.empty())
+		Success = (fwrite(&ranges[0], sizeof(IndexFileRange), ranges.size(), fp) == ranges.size());
+	if (fclose(fp) != 0)
+		Success = false;
+	if (! Success)
+		remove(filename.c_str());
+	return Success;
+} // IndexFile::Write
+
+}} // namespace hsl::detail
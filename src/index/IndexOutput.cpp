@@ -0,0 +1,65 @@
+/*************************************************************************************
+ * 
+ * 
+ * Copyright (c) 2021, Zhengjun Liu <zjliu@casm.ac.cn>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ ************************************************************************************/
+
+#include "index/IndexOutput.h"
+
+namespace hsl { namespace detail {
+
+// HSP files have no variable length records in which the cell records of an embedded index could be
+// stored, so the cell-by-cell output of Index::BuildIndex is refused here. Indexes are kept in a
+// standalone memory-mapped .hsx file instead, see IndexData::SetReadOrBuildMappedValues.
+
+IndexOutput::IndexOutput(hsl::Index *indexsource) : 
+	m_index(indexsource), 
+	m_FirstCellLocation(0), 
+	m_LastCellLocation(0), 
+	m_DataRecordSize(0), 
+	m_TempWritePos(0), 
+	m_SomeDataReadyToWrite(false)
+{
+} // IndexOutput::IndexOutput
+
+bool IndexOutput::InitiateOutput(void)
+{
+	if (m_index->GetDebugOutputLevel())
+		fprintf(m_index->GetDebugger(), "Embedded indexes are not supported by HSP files, use a standalone .hsx index.\n");
+	return false;
+} // IndexOutput::InitiateOutput
+
+bool IndexOutput::OutputCell(hsl::detail::IndexCell *, uint32_t, uint32_t)
+{
+	return false;
+} // IndexOutput::OutputCell
+
+bool IndexOutput::FinalizeOutput(void)
+{
+	return false;
+} // IndexOutput::FinalizeOutput
+
+}} // namespace hsl::detail
@@ -0,0 +1,124 @@
+/*************************************************************************************
+ * 
+ * 
+ * Copyright (c) 2021, Zhengjun Liu <zjliu@casm.ac.cn>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ ************************************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "hsl.h"
+
+namespace hsl { namespace test {
+
+/// A file in the working directory of the test, removed before use and
+/// again when the test is done with it.
+class TempFile
+{
+public:
+    explicit TempFile(std::string const& name) : _name(name) { std::remove(_name.c_str()); }
+    ~TempFile() { std::remove(_name.c_str()); }
+
+    std::string const& name() const { return _name; }
+
+private:
+    std::string _name;
+
+    TempFile(TempFile const& other);
+    TempFile& operator=(TempFile const& rhs);
+};
+
+/// Reproducible pseudo-random numbers, the same on every platform.
+class Random
+{
+public:
+    explicit Random(uint32_t seed) : _state(seed) {}
+
+    uint32_t next()
+    {
+        _state = _state * 1664525u + 1013904223u;
+        return _state >> 8;
+    }
+
+    /// A multiple of 0.01 in [0, range).
+    double grid(uint32_t range) { return (next() % (range * 100)) / 100.0; }
+
+private:
+    uint32_t _state;
+};
+
+/// Writes count points of format 4 to name, with a chunk table of
+/// chunkSize points unless 0. X and Y are scattered over [0, 100), Z rises
+/// by one every 1000 points, the classification cycles through 0..4 every
+/// 1000 points and the GNSS time is the point number.
+inline void writePoints(std::string const& name, uint32_t count, uint32_t chunkSize, uint32_t seed = 1)
+{
+    Header header;
+    header.setDataFormat(PF_PointFormat4);
+    header.setScale(0.01, 0.01, 0.01);
+    header.setOffset(0, 0, 0);
+    header.setMin(0, 0, 0);
+    header.setMax(100, 100, count / 1000 + 1);
+
+    Writer writer(name, header);
+    if (chunkSize > 0)
+        writer.setChunkSize(chunkSize);
+    if (!writer.open())
+        throw std::runtime_error("cannot create " + name);
+
+    Random random(seed);
+    Point point(&writer.getHeader());
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        point.setCoordinates(random.grid(100), random.grid(100), i / 1000 + random.grid(1) / 2);
+
+        VariantArray classification;
+        classification.push_back(Variant(static_cast<uint8_t>((i / 1000) % 5)));
+        point.setValuesById(FI_Classification, classification);
+        VariantArray time;
+        time.push_back(Variant(static_cast<double>(i)));
+        point.setValuesById(FI_GNSSTime, time);
+
+        if (!writer.writePoint(point))
+            throw std::runtime_error("cannot write " + name);
+    }
+    writer.close();
+}
+
+/// All point records of a file, read with a single readPointRange.
+inline void readAll(Reader& reader, PointBlock& block)
+{
+    block.clear();
+    uint32_t count = static_cast<uint32_t>(reader.getHeader().getPointRecordsCount());
+    if (!reader.readPointRange(0, count, block))
+        throw std::runtime_error("cannot read the points of " + reader.getFilename());
+}
+
+}}
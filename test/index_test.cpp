@@ -0,0 +1,217 @@
+/*************************************************************************************
+ * 
+ * 
+ * Copyright (c) 2021, Zhengjun Liu <zjliu@casm.ac.cn>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ ************************************************************************************/
+
+#include <boost/test/unit_test.hpp>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "hsl.h"
+#include "index/IndexFile.h"
+#include "common.hpp"
+
+using namespace hsl;
+using namespace hsl::test;
+using hsl::detail::IndexFile;
+using hsl::detail::IndexFileCell;
+using hsl::detail::IndexFileHeader;
+using hsl::detail::IndexFileRange;
+
+namespace
+{
+
+// A 3 by 2 cell table, each cell holding one or two ranges.
+void makeIndex(IndexFileHeader& header, std::vector<IndexFileCell>& cells, std::vector<IndexFileRange>& ranges)
+{
+    std::memset(&header, 0, sizeof(header));
+    header.pointRecordsCount = 90;
+    header.cellsX = 3;
+    header.cellsY = 2;
+    header.minX = 0; header.minY = 0; header.minZ = -1;
+    header.maxX = 30; header.maxY = 20; header.maxZ = 1;
+    header.cellSizeX = 10;
+    header.cellSizeY = 10;
+
+    uint32_t point = 0;
+    for (uint32_t c = 0; c < header.cellsX * header.cellsY; ++c)
+    {
+        IndexFileCell cell;
+        std::memset(&cell, 0, sizeof(cell));
+        cell.firstRange = static_cast<uint32_t>(ranges.size());
+        cell.rangeCount = 1 + c % 2;
+        cell.minZ = -0.5 + c;
+        cell.maxZ = 0.5 + c;
+        for (uint32_t r = 0; r < cell.rangeCount; ++r)
+        {
+            IndexFileRange range;
+            range.firstPoint = point;
+            range.count = 5 + r;
+            point += range.count + 2;
+            cell.numPoints += range.count;
+            ranges.push_back(range);
+        }
+        cells.push_back(cell);
+    }
+    header.rangeCount = static_cast<uint32_t>(ranges.size());
+}
+
+// Points of reader inside bounds, by BoundsFilter on each decoded point.
+std::vector<uint32_t> bruteForce(Reader& reader, Bounds<double> const& bounds)
+{
+    PointBlock block(&reader.getHeader());
+    readAll(reader, block);
+    BoundsFilter filter(bounds);
+    Point point(&reader.getHeader());
+    std::vector<uint32_t> ids;
+    for (size_t i = 0; i < block.size(); ++i)
+    {
+        block.getPoint(i, point);
+        if (filter.filter(point))
+            ids.push_back(block.getId(i));
+    }
+    return ids;
+}
+
+std::vector<uint32_t> query(Reader& reader, Index& index, Bounds<double> const& bounds)
+{
+    IndexedReader indexed(reader, index, bounds, 500);
+    PointBlock block(&reader.getHeader());
+    std::vector<uint32_t> ids;
+    while (indexed.readNextBlock(block))
+    {
+        BOOST_CHECK(block.size() <= 500);
+        ids.insert(ids.end(), block.getIds().begin(), block.getIds().end());
+    }
+    return ids;
+}
+
+}
+
+BOOST_AUTO_TEST_SUITE(spatial_index)
+
+BOOST_AUTO_TEST_CASE(index_file_round_trip)
+{
+    TempFile file("index_round_trip.hsx");
+    IndexFileHeader header;
+    std::vector<IndexFileCell> cells;
+    std::vector<IndexFileRange> ranges;
+    makeIndex(header, cells, ranges);
+    BOOST_REQUIRE(IndexFile::Write(file.name(), header, cells, ranges));
+
+    IndexFile index;
+    BOOST_REQUIRE(index.Open(file.name()));
+    IndexFileHeader const& read = index.GetHeader();
+    BOOST_CHECK_EQUAL(std::string(read.signature, 3), std::string(LIBHSL_INDEXFILE_SIGNATURE));
+    BOOST_CHECK_EQUAL(read.pointRecordsCount, header.pointRecordsCount);
+    BOOST_CHECK_EQUAL(read.rangeCount, ranges.size());
+    BOOST_REQUIRE_EQUAL(index.GetCellsX(), 3u);
+    BOOST_REQUIRE_EQUAL(index.GetCellsY(), 2u);
+
+    for (uint32_t x = 0; x < 3; ++x)
+    {
+        for (uint32_t y = 0; y < 2; ++y)
+        {
+            IndexFileCell const& expected = cells[x * 2 + y];
+            IndexFileCell const& cell = index.GetCell(x, y);
+            BOOST_CHECK_EQUAL(cell.firstRange, expected.firstRange);
+            BOOST_CHECK_EQUAL(cell.rangeCount, expected.rangeCount);
+            BOOST_CHECK_EQUAL(cell.numPoints, expected.numPoints);
+            BOOST_CHECK_CLOSE(cell.maxZ, expected.maxZ, 1e-9);
+
+            IndexFileRange const* range = index.GetFirstRange(cell);
+            BOOST_REQUIRE_EQUAL(index.GetEndRange(cell) - range, static_cast<ptrdiff_t>(expected.rangeCount));
+            for (uint32_t r = 0; r < expected.rangeCount; ++r)
+            {
+                BOOST_CHECK_EQUAL(range[r].firstPoint, ranges[expected.firstRange + r].firstPoint);
+                BOOST_CHECK_EQUAL(range[r].count, ranges[expected.firstRange + r].count);
+            }
+        }
+    }
+    index.Close();
+    BOOST_CHECK(!index.IsOpen());
+}
+
+BOOST_AUTO_TEST_CASE(index_file_with_bad_cell_is_rejected)
+{
+    TempFile file("index_bad_cell.hsx");
+    IndexFileHeader header;
+    std::vector<IndexFileCell> cells;
+    std::vector<IndexFileRange> ranges;
+    makeIndex(header, cells, ranges);
+
+    // the last cell reaches past the end of the range table
+    cells.back().rangeCount += 1;
+    BOOST_REQUIRE(IndexFile::Write(file.name(), header, cells, ranges));
+
+    IndexFile index;
+    BOOST_CHECK(!index.Open(file.name()));
+    BOOST_CHECK(!index.IsOpen());
+}
+
+BOOST_AUTO_TEST_CASE(indexed_reader_matches_brute_force)
+{
+    TempFile points("index_points.hsp");
+    TempFile file("index_points.hsx");
+    writePoints(points.name(), 20000, 0);
+
+    Reader reader(points.name());
+    BOOST_REQUIRE(reader.open());
+
+    std::vector<Bounds<double> > windows;
+    windows.push_back(Bounds<double>(10, 10, 0, 20, 20, 25));
+    windows.push_back(Bounds<double>(35.5, 0, 50, 100));
+    windows.push_back(Bounds<double>(0, 0, 3, 100, 100, 3));     // flat Z: not filtered
+    windows.push_back(Bounds<double>(-50, -50, -10, -1, -1, 0));   // outside the data
+
+    {
+        IndexData data;
+        BOOST_REQUIRE(data.SetReadOrBuildMappedValues(&reader, file.name().c_str()));
+        Index index(data);
+        BOOST_REQUIRE(index.IndexReady());
+
+        for (size_t w = 0; w < windows.size(); ++w)
+        {
+            std::vector<uint32_t> expected = bruteForce(reader, windows[w]);
+            std::vector<uint32_t> found = query(reader, index, windows[w]);
+            BOOST_CHECK_EQUAL_COLLECTIONS(found.begin(), found.end(), expected.begin(), expected.end());
+        }
+    }
+
+    // the index file written above is mapped again rather than rebuilt
+    IndexData data;
+    BOOST_REQUIRE(data.SetReadMappedValues(&reader, file.name().c_str()));
+    Index index(data);
+    BOOST_REQUIRE(index.IndexReady());
+    BOOST_CHECK(index.IsMapped());
+    std::vector<uint32_t> expected = bruteForce(reader, windows[0]);
+    std::vector<uint32_t> found = query(reader, index, windows[0]);
+    BOOST_CHECK_EQUAL_COLLECTIONS(found.begin(), found.end(), expected.begin(), expected.end());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,177 @@
+/*************************************************************************************
+ * 
+ * 
+ * Copyright (c) 2021, Zhengjun Liu <zjliu@casm.ac.cn>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ ************************************************************************************/
+
+#include <boost/test/unit_test.hpp>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "hsl.h"
+#include "common.hpp"
+
+using namespace hsl;
+using namespace hsl::test;
+
+namespace
+{
+
+const uint32_t kPoints = 20000;
+
+bool inside(Point const& point, Bounds<double> const& bounds)
+{
+    return point.getX() >= bounds.minx() && point.getX() <= bounds.maxx() &&
+           point.getY() >= bounds.miny() && point.getY() <= bounds.maxy();
+}
+
+// Input file, sorted output and octree of a small build.
+struct OctreeFiles
+{
+    TempFile input;
+    TempFile output;
+    TempFile octree;
+    TempFile temp;
+
+    OctreeFiles(std::string const& name)
+        : input(name + ".hsp"), output(name + "_lod.hsp"), octree(name + "_lod.hso"), temp(name + ".tmp")
+    {
+        writePoints(input.name(), kPoints, 0);
+
+        OctreeBuilder builder;
+        builder.setGridBits(4);
+        builder.setMaxMemoryUsage(100000);
+        builder.setChunkSize(1000);
+        builder.setTempFileName(temp.name());
+        BOOST_REQUIRE(builder.build(input.name(), output.name(), octree.name()));
+    }
+};
+
+}
+
+BOOST_AUTO_TEST_SUITE(octree)
+
+BOOST_AUTO_TEST_CASE(nodes_cover_every_point_once)
+{
+    OctreeFiles files("octree_nodes");
+
+    Octree tree;
+    BOOST_REQUIRE(tree.open(files.octree.name()));
+    BOOST_CHECK_EQUAL(tree.getFileHeader().pointRecordsCount, kPoints);
+
+    Reader reader(files.output.name());
+    BOOST_REQUIRE(reader.open());
+    BOOST_CHECK_EQUAL(reader.getHeader().getPointRecordsCount(), kPoints);
+    BOOST_CHECK_EQUAL(reader.getChunkSize(), 1000u);
+
+    // nodes are stored by depth, each taking the records after the previous one
+    uint64_t next = 0;
+    uint32_t depth = 0;
+    PointBlock block(&reader.getHeader());
+    Point point(&reader.getHeader());
+    std::vector<OctreeNode> const& nodes = tree.getNodes();
+    for (size_t n = 0; n < nodes.size(); ++n)
+    {
+        OctreeNode const& node = nodes[n];
+        BOOST_CHECK(node.depth >= depth);
+        BOOST_CHECK(node.depth <= tree.getMaxDepth());
+        BOOST_CHECK_EQUAL(node.firstPoint, next);
+        depth = node.depth;
+        next += node.pointCount;
+
+        block.clear();
+        BOOST_REQUIRE(Octree::readNode(reader, node, block));
+        BOOST_REQUIRE_EQUAL(block.size(), node.pointCount);
+        Bounds<double> bounds(node.bounds.minx() - 1e-9, node.bounds.miny() - 1e-9,
+                              node.bounds.maxx() + 1e-9, node.bounds.maxy() + 1e-9);
+        for (size_t i = 0; i < block.size(); ++i)
+        {
+            block.getPoint(i, point);
+            BOOST_CHECK(inside(point, bounds));
+        }
+    }
+    BOOST_CHECK_EQUAL(next, kPoints);
+}
+
+BOOST_AUTO_TEST_CASE(full_depth_query_matches_brute_force)
+{
+    OctreeFiles files("octree_query");
+
+    Octree tree;
+    BOOST_REQUIRE(tree.open(files.octree.name()));
+    Reader reader(files.output.name());
+    BOOST_REQUIRE(reader.open());
+
+    Bounds<double> window(10, 10, 20, 20);
+    std::vector<OctreeNode> nodes = tree.query(window, tree.getMaxDepth());
+    PointBlock block(&reader.getHeader());
+    Point point(&reader.getHeader());
+    size_t found = 0;
+    for (size_t n = 0; n < nodes.size(); ++n)
+    {
+        block.clear();
+        BOOST_REQUIRE(Octree::readNode(reader, nodes[n], block));
+        for (size_t i = 0; i < block.size(); ++i)
+        {
+            block.getPoint(i, point);
+            found += inside(point, window) ? 1 : 0;
+        }
+    }
+
+    Reader input(files.input.name());
+    BOOST_REQUIRE(input.open());
+    size_t expected = 0;
+    while (input.readNextPoint())
+        expected += inside(input.getPoint(), window) ? 1 : 0;
+
+    BOOST_CHECK(expected > 0);
+    BOOST_CHECK_EQUAL(found, expected);
+
+    // shallower queries return fewer nodes, never more
+    size_t previous = 0;
+    for (uint32_t d = 0; d <= tree.getMaxDepth(); ++d)
+    {
+        size_t count = tree.query(window, d).size();
+        BOOST_CHECK(count >= previous);
+        previous = count;
+    }
+}
+
+BOOST_AUTO_TEST_CASE(bad_signature_is_rejected)
+{
+    OctreeFiles files("octree_signature");
+
+    std::FILE* fp = std::fopen(files.octree.name().c_str(), "r+b");
+    BOOST_REQUIRE(fp != 0);
+    BOOST_REQUIRE(std::fwrite("XXXX", 1, 4, fp) == 4);
+    std::fclose(fp);
+
+    Octree tree;
+    BOOST_CHECK(!tree.open(files.octree.name()));
+    BOOST_CHECK(!tree.isOpen());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
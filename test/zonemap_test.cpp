@@ -0,0 +1,325 @@
+/*************************************************************************************
+ * 
+ * 
+ * Copyright (c) 2021, Zhengjun Liu <zjliu@casm.ac.cn>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ ************************************************************************************/
+
+#include <boost/test/unit_test.hpp>
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "hsl.h"
+#include "common.hpp"
+
+using namespace hsl;
+using namespace hsl::test;
+
+namespace
+{
+
+const uint32_t kPoints = 20500;
+const uint32_t kChunkSize = 1000;
+
+// Number of points that pass filter, tested one decoded point at a time.
+size_t countPassing(Reader& reader, FilterPtr filter)
+{
+    PointBlock block(&reader.getHeader());
+    readAll(reader, block);
+    Point point(&reader.getHeader());
+    size_t count = 0;
+    for (size_t i = 0; i < block.size(); ++i)
+    {
+        block.getPoint(i, point);
+        count += filter->filter(point) ? 1 : 0;
+    }
+    return count;
+}
+
+// Overwrites size bytes at offset of an existing file.
+void patch(std::string const& name, uint64_t offset, void const* data, size_t size)
+{
+    std::FILE* fp = std::fopen(name.c_str(), "r+b");
+    BOOST_REQUIRE(fp != 0);
+    BOOST_REQUIRE(std::fseek(fp, static_cast<long>(offset), SEEK_SET) == 0);
+    BOOST_REQUIRE(std::fwrite(data, 1, size, fp) == size);
+    std::fclose(fp);
+}
+
+void checkAgreement(Reader& reader, FilterPtr filter)
+{
+    size_t expected = countPassing(reader, filter);
+    std::vector<FilterPtr> filters(1, filter);
+
+    reader.reset();
+    reader.setFilters(filters);
+    size_t points = 0;
+    while (reader.readNextPoint())
+        ++points;
+
+    reader.reset();
+    reader.setFilters(filters);
+    PointBlock block(&reader.getHeader());
+    size_t blocks = 0;
+    while (reader.readNextBlock(block, 700))
+        blocks += block.size();
+
+    reader.setFilters(std::vector<FilterPtr>());
+    BOOST_CHECK_EQUAL(points, expected);
+    BOOST_CHECK_EQUAL(blocks, expected);
+}
+
+// Every chunk that filter claims to skip really has no passing point, and
+// at least one chunk is skipped.
+void checkSkipping(Reader& reader, FilterPtr filter)
+{
+    ZoneMap const& zones = reader.getZoneMap();
+    PointBlock block(&reader.getHeader());
+    readAll(reader, block);
+    Point point(&reader.getHeader());
+
+    size_t skipped = 0;
+    for (size_t chunk = 0; chunk < zones.getChunkCount(); ++chunk)
+    {
+        if (!filter->canSkip(zones, chunk))
+            continue;
+        ++skipped;
+        ChunkBounds const& bounds = zones.getChunkBounds()[chunk];
+        for (uint64_t i = bounds.firstPoint; i < bounds.firstPoint + bounds.pointCount; ++i)
+        {
+            block.getPoint(static_cast<size_t>(i), point);
+            BOOST_CHECK(!filter->filter(point));
+        }
+    }
+    BOOST_CHECK(skipped > 0);
+}
+
+}
+
+BOOST_AUTO_TEST_SUITE(zonemap)
+
+BOOST_AUTO_TEST_CASE(chunk_table_round_trip)
+{
+    TempFile file("zonemap_round_trip.hsp");
+    writePoints(file.name(), kPoints, kChunkSize);
+
+    Reader reader(file.name());
+    BOOST_REQUIRE(reader.open());
+    BOOST_CHECK(!reader.hasChunkTableError());
+    BOOST_CHECK_EQUAL(reader.getChunkSize(), kChunkSize);
+
+    ZoneMap const& zones = reader.getZoneMap();
+    BOOST_REQUIRE_EQUAL(zones.getChunkCount(), (kPoints + kChunkSize - 1) / kChunkSize);
+
+    PointBlock block(&reader.getHeader());
+    readAll(reader, block);
+    Point point(&reader.getHeader());
+
+    for (size_t chunk = 0; chunk < zones.getChunkCount(); ++chunk)
+    {
+        ChunkBounds const& bounds = zones.getChunkBounds()[chunk];
+        size_t first = chunk * kChunkSize;
+        size_t last = std::min<size_t>(first + kChunkSize, kPoints);
+        BOOST_CHECK_EQUAL(bounds.firstPoint, first);
+        BOOST_CHECK_EQUAL(bounds.pointCount, last - first);
+
+        int32_t minX = block.getRawX(first), maxX = minX;
+        int32_t minZ = block.getRawZ(first), maxZ = minZ;
+        double minTime = first, maxTime = last - 1;
+        for (size_t i = first; i < last; ++i)
+        {
+            minX = std::min(minX, block.getRawX(i));
+            maxX = std::max(maxX, block.getRawX(i));
+            minZ = std::min(minZ, block.getRawZ(i));
+            maxZ = std::max(maxZ, block.getRawZ(i));
+        }
+        BOOST_CHECK_EQUAL(bounds.minX, minX);
+        BOOST_CHECK_EQUAL(bounds.maxX, maxX);
+        BOOST_CHECK_EQUAL(bounds.minZ, minZ);
+        BOOST_CHECK_EQUAL(bounds.maxZ, maxZ);
+
+        double minimum = 0, maximum = 0;
+        BOOST_REQUIRE(zones.getRange(chunk, FI_GNSSTime, 0, minimum, maximum));
+        BOOST_CHECK_CLOSE(minimum + 1, minTime + 1, 1e-9);
+        BOOST_CHECK_CLOSE(maximum + 1, maxTime + 1, 1e-9);
+
+        BOOST_REQUIRE(zones.getRange(chunk, FI_Classification, 0, minimum, maximum));
+        BOOST_CHECK_CLOSE(minimum + 1, (chunk % 5) + 1.0, 1e-9);
+        BOOST_CHECK_CLOSE(maximum + 1, (chunk % 5) + 1.0, 1e-9);
+
+        BOOST_CHECK_EQUAL(zones.findChunk(first), chunk);
+        BOOST_CHECK_EQUAL(zones.findChunk(last - 1), chunk);
+    }
+    BOOST_CHECK_EQUAL(zones.findChunk(kPoints), zones.getChunkCount());
+}
+
+BOOST_AUTO_TEST_CASE(file_without_chunk_table)
+{
+    TempFile file("zonemap_none.hsp");
+    writePoints(file.name(), 3000, 0);
+
+    Reader reader(file.name());
+    BOOST_REQUIRE(reader.open());
+    BOOST_CHECK(!reader.hasChunkTableError());
+    BOOST_CHECK_EQUAL(reader.getZoneMap().getChunkCount(), 0u);
+
+    FilterPtr filter(new ContinuousValueFilter<double>(FI_GNSSTime, std::string(">=1500")));
+    checkAgreement(reader, filter);
+}
+
+BOOST_AUTO_TEST_CASE(inconsistent_chunk_table_is_ignored)
+{
+    TempFile file("zonemap_tampered.hsp");
+    writePoints(file.name(), kPoints, kChunkSize);
+
+    uint64_t offset = 0;
+    {
+        Reader reader(file.name());
+        BOOST_REQUIRE(reader.open());
+        offset = reader.getHeader().getChunkTableOffset();
+        BOOST_REQUIRE(offset > 0);
+    }
+
+    // the third chunk claims to start one point late
+    uint64_t firstPoint = 2 * kChunkSize + 1;
+    patch(file.name(), offset + sizeof(ChunkTableHeader) + 2 * sizeof(ChunkBounds), &firstPoint, sizeof(firstPoint));
+    {
+        Reader reader(file.name());
+        BOOST_REQUIRE(reader.open());
+        BOOST_CHECK(reader.hasChunkTableError());
+        BOOST_CHECK_EQUAL(reader.getZoneMap().getChunkCount(), 0u);
+
+        size_t count = 0;
+        while (reader.readNextPoint())
+            ++count;
+        BOOST_CHECK_EQUAL(count, kPoints);
+    }
+
+    // one chunk too few for the points of the file
+    firstPoint = 2 * kChunkSize;
+    patch(file.name(), offset + sizeof(ChunkTableHeader) + 2 * sizeof(ChunkBounds), &firstPoint, sizeof(firstPoint));
+    uint32_t chunkCount = (kPoints + kChunkSize - 1) / kChunkSize - 1;
+    patch(file.name(), offset + offsetof(ChunkTableHeader, chunkCount), &chunkCount, sizeof(chunkCount));
+    {
+        Reader reader(file.name());
+        BOOST_REQUIRE(reader.open());
+        BOOST_CHECK(reader.hasChunkTableError());
+        BOOST_CHECK_EQUAL(reader.getZoneMap().getChunkCount(), 0u);
+
+        FilterPtr filter(new ContinuousValueFilter<double>(FI_GNSSTime, std::string(">=12345.5")));
+        checkAgreement(reader, filter);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(point_and_block_reads_agree)
+{
+    TempFile file("zonemap_filters.hsp");
+    writePoints(file.name(), kPoints, kChunkSize);
+
+    Reader reader(file.name());
+    BOOST_REQUIRE(reader.open());
+
+    checkAgreement(reader, FilterPtr(new BoundsFilter(0, 0, 5.2, 200, 200, 7.1)));
+
+    std::vector<Classification> classes(1, Classification(3));
+    FilterPtr classification(new ClassificationFilter(classes));
+    checkAgreement(reader, classification);
+    classification->SetType(FilterInterface::eExclusion);
+    checkAgreement(reader, classification);
+
+    checkAgreement(reader, FilterPtr(new ContinuousValueFilter<double>(FI_GNSSTime, std::string(">=12345.5"))));
+    FilterPtr time(new ContinuousValueFilter<double>(FI_GNSSTime, std::string("<3000")));
+    time->SetType(FilterInterface::eExclusion);
+    checkAgreement(reader, time);
+
+    checkAgreement(reader, FilterPtr(new ExpressionFilter("time >= 4000 and time < 4100 or z > 19.3")));
+    checkAgreement(reader, FilterPtr(new ExpressionFilter("classification in (1,4) and not (x*2 - 3 > 150)")));
+    FilterPtr expression(new ExpressionFilter("time / 1000 < 7"));
+    expression->SetType(FilterInterface::eExclusion);
+    checkAgreement(reader, expression);
+}
+
+BOOST_AUTO_TEST_CASE(skipped_chunks_have_no_match)
+{
+    TempFile file("zonemap_skip.hsp");
+    writePoints(file.name(), kPoints, kChunkSize);
+
+    Reader reader(file.name());
+    BOOST_REQUIRE(reader.open());
+
+    checkSkipping(reader, FilterPtr(new BoundsFilter(0, 0, 5.2, 200, 200, 7.1)));
+
+    std::vector<Classification> classes(1, Classification(3));
+    checkSkipping(reader, FilterPtr(new ClassificationFilter(classes)));
+
+    checkSkipping(reader, FilterPtr(new ContinuousValueFilter<double>(FI_GNSSTime, std::string(">=12345.5"))));
+    checkSkipping(reader, FilterPtr(new ExpressionFilter("time >= 4000 and time < 4100 or z > 19.3")));
+
+    FilterPtr expression(new ExpressionFilter("time / 1000 < 7"));
+    expression->SetType(FilterInterface::eExclusion);
+    checkSkipping(reader, expression);
+}
+
+BOOST_AUTO_TEST_CASE(batch_filter_matches_point_filter)
+{
+    TempFile file("zonemap_batch.hsp");
+    writePoints(file.name(), 5000, kChunkSize);
+
+    Reader reader(file.name());
+    BOOST_REQUIRE(reader.open());
+    PointBlock block(&reader.getHeader());
+    readAll(reader, block);
+    Point point(&reader.getHeader());
+
+    std::vector<FilterPtr> filters;
+    filters.push_back(FilterPtr(new BoundsFilter(20, 10, 0, 70, 60, 3.5)));
+    filters.push_back(FilterPtr(new ContinuousValueFilter<double>(FI_GNSSTime, std::string("<2500"))));
+    filters.push_back(FilterPtr(new ExpressionFilter("x + y > 100 and classification != 2")));
+
+    for (size_t f = 0; f < filters.size(); ++f)
+    {
+        Bitmask mask(block.size());
+        filters[f]->filter(block, mask);
+        for (size_t i = 0; i < block.size(); ++i)
+        {
+            block.getPoint(i, point);
+            BOOST_CHECK_EQUAL(mask.test(i), filters[f]->filter(point));
+        }
+    }
+
+    FilterChain chain;
+    chain.setFilters(filters);
+    Bitmask mask(block.size());
+    chain.filter(block, mask);
+    for (size_t i = 0; i < block.size(); ++i)
+    {
+        block.getPoint(i, point);
+        BOOST_CHECK_EQUAL(mask.test(i), chain.filter(point));
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()